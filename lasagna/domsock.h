@@ -1,6 +1,6 @@
 /* domsock.h
 ** domsock: interface to unix/local domain sockets
-** wcm, 2008.01.04 - 2010.12.30
+** wcm, 2008.01.04 - 2011.04.05
 ** ===
 */
 #ifndef DOMSOCK_H
@@ -11,7 +11,8 @@
 
 /*
 ** domsock: unix/local domain socket interface module
-** (supporting SOCK_STREAM (TCP) byte stream connections only)
+** (supporting SOCK_STREAM (TCP) byte stream connections,
+** and SOCK_SEQPACKET message connections with the *seq() variants)
 */
 
 /* domsock_create()
@@ -59,6 +60,24 @@ extern
 int domsock_accept(int s);
 
 
+/* domsock_acceptnb()
+**   accept incoming connection on domsock socket s
+**   as domsock_accept(), with the connected socket returned
+**   non-blocking and close-on-exec
+**
+**   return:
+**     >=0 : success, file descriptor for connected socket
+**      -1 : error, errno set
+**           EAGAIN/EWOULDBLOCK if s is non-blocking and no connection pending
+**
+**   notes:
+**     uses accept4() where available (single system call)
+**     intended for servers accepting connections in a batch until EAGAIN
+*/
+extern
+int domsock_acceptnb(int s);
+
+
 /* domsock_close()
 **   close() domsock socket s and unlink() its path address
 **   
@@ -87,5 +106,40 @@ extern
 int domsock_connect(const char *path);
 
 
+/* domsock_createseq()
+**   as domsock_create(), for a SOCK_SEQPACKET socket:
+**   a connection preserving message boundaries, each message delivered
+**   whole by one read/recv()
+**
+**   return:
+**     >=0 : success, file descriptor of socket
+**      -1 : error, errno set
+**           (EPROTONOSUPPORT/ESOCKTNOSUPPORT where the platform has no
+**           SOCK_SEQPACKET in the local domain)
+**
+**   notes:
+**     intended for "server"
+**     accept connections with domsock_accept(), domsock_acceptnb()
+*/
+extern
+int domsock_createseq(const char *path, mode_t mode);
+
+
+/* domsock_connectseq()
+**   as domsock_connect(), to a listening SOCK_SEQPACKET domsock at path
+**
+**   return:
+**     >=0 : success, file descriptor of connected socket
+**      -1 : error, errno set
+**           (ECONNREFUSED/EPROTOTYPE if path is not a listening
+**           SOCK_SEQPACKET socket)
+**
+**   notes:
+**     intended for "client"
+*/
+extern
+int domsock_connectseq(const char *path);
+
+
 #endif /* DOMSOCK_H */
 /* eof: domsock.h */
@@ -0,0 +1,59 @@
+/* domsock_acceptnb.c
+** domsock: unix/local domain sockets
+** wcm, 2011.03.30 - 2011.03.30
+** ===
+*/
+
+/* accept4() is a linux/glibc extension: */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE 1
+#endif
+
+/* libc: */
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* lasagna: */
+#include "fd.h"
+
+/* domsock: */
+#include "domsock.h"
+
+int
+domsock_acceptnb(int s)
+{
+  struct sockaddr_un  connaddr;
+  socklen_t           connlen;
+  int                 fd;
+
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+  connlen = sizeof(connaddr); 
+  fd = accept4(s, (struct sockaddr *)&connaddr, &connlen,
+               SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if((fd != -1) || (errno != ENOSYS)){
+      return fd;
+  }
+  /* else fallthrough: accept4() not supported by running kernel */
+#endif
+
+  connlen = sizeof(connaddr); 
+  fd = accept(s, (struct sockaddr *)&connaddr, &connlen);
+  if(fd == -1){
+      return -1;
+  }
+  if((fd_nonblock(fd) == -1) || (fd_cloexec(fd) == -1)){
+      int  terrno = errno;
+      close(fd);
+      errno = terrno;
+      return -1;
+  }
+
+  return fd;
+}
+
+/* eof: domsock_acceptnb.c */
@@ -0,0 +1,54 @@
+/* domsock_connectseq.c
+** domsock: unix/local domain sockets
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+/* libc: */
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* lasagna: */
+#include "buf.h"
+#include "cstr.h"
+
+/* domsock: */
+#include "domsock.h"
+
+int
+domsock_connectseq(const char *path)
+{
+  struct sockaddr_un  sockaddr;
+  int                 s;
+  int                 terrno;
+
+  if(sizeof(sockaddr.sun_path) < (cstr_len(path) + 1)){
+      errno = ENAMETOOLONG;
+      return -1;
+  }
+
+  if((s = socket(AF_LOCAL, SOCK_SEQPACKET, 0)) == -1){
+      return -1;
+  }
+
+  buf_zero(&sockaddr, sizeof (sockaddr));
+  sockaddr.sun_family = AF_LOCAL;
+  cstr_copy(sockaddr.sun_path, path);
+
+  if(connect(s, (const struct sockaddr *)&sockaddr, sizeof(sockaddr)) == -1){
+      terrno = errno;
+      close(s);
+      errno = terrno;
+      return -1;
+  }
+
+  /* success: */
+  return s;
+}
+
+/* eof: domsock_connectseq.c */
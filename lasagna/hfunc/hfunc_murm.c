@@ -72,8 +72,10 @@ hfunc_murm(const uchar_t *key, size_t klen)
   switch(klen){
   case 3:
       h ^= key[2] << 16;
+      /* fallthrough */
   case 2:
       h ^= key[1] << 8;
+      /* fallthrough */
   case 1:
       h ^= key[0];
       h *= m;
@@ -0,0 +1,7 @@
+/* outvec_STDOUT.h
+** automatically generated by mk_outvec (outvec/mk_outvec.c) 
+*/
+
+#define _VEC_STDOUT_SIZE 256
+
+/* eof: outvec_STDOUT.h */
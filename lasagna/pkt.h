@@ -129,6 +129,20 @@ extern ssize_t pkt_read(int fd, pkt_t K, size_t offset);
 */
 extern ssize_t pkt_write(int fd, const pkt_t K, size_t offset);
 
+/* pkt_ioqget():
+**   get next pkt K from an input ioq (see "ioq.h")
+**   for reading a stream of pkts with buffered read()
+**
+**   return
+**    >0 : no error, pkt_len(K)
+**     0 : eof (before start of pkt)
+**    -1 : error, errno set
+**         read() error
+**         EPROTO if eof within pkt
+*/
+struct ioq;
+extern ssize_t pkt_ioqget(struct ioq *ioq, pkt_t K);
+
 
 /* C programming comments
 **
@@ -0,0 +1,76 @@
+/* pkt_ioqget.c
+** pkt: tiny packet protocol
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "uchar.h"
+#include "ioq.h"
+#include "pkt.h"
+
+static ssize_t ioq_getall(ioq_t *ioq, uchar_t *data, size_t len);
+
+/* ioq_getall()
+**   ioq_get() len bytes into data
+**   return
+**     len : no error
+**     0   : eof before any byte read
+**    -1   : error, errno set (EPROTO on eof after some bytes read)
+*/
+static
+ssize_t
+ioq_getall(ioq_t *ioq, uchar_t *data, size_t len)
+{
+    size_t   n = 0;
+    ssize_t  r;
+
+    while(n < len){
+        r = ioq_get(ioq, &data[n], len - n);
+        if(r == -1){
+            return -1;
+        }
+        if(r == 0){
+            if(n == 0) return 0;
+            errno = EPROTO;
+            return -1;
+        }
+        n += r;
+    }
+
+    return (ssize_t)n;
+}
+
+
+/* pkt_ioqget():
+**   get next pkt K from input ioq
+**   for reading a stream of pkts with buffered read()
+*/
+ssize_t
+pkt_ioqget(ioq_t *ioq, pkt_t K)
+{
+    ssize_t  r;
+
+    r = ioq_getall(ioq, K, PKT_HEADER);
+    if(r <= 0){
+        return r;
+    }
+
+    if(pkt_dlen(K) > 0){
+        r = ioq_getall(ioq, pkt_data(K), pkt_dlen(K));
+        if(r == 0){
+            errno = EPROTO;
+            return -1;
+        }
+        if(r == -1){
+            return -1;
+        }
+    }
+
+    return (ssize_t)pkt_len(K);
+}
+
+
+/* eof: pkt_ioqget.c */
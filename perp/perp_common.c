@@ -0,0 +1,38 @@
+/* perp_common.c
+** perp: persistent process supervision
+** perp_common: subroutines common to perp clients
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+#include <stddef.h>
+
+/* lasanga: */
+#include "cstr.h"
+
+/* perp: */
+#include "perp_common.h"
+
+
+/* perp_svname_ok()
+**   check if name argument may be given to perpd as a service name
+**   (basename in base directory), or as a pattern of names
+*/
+int
+perp_svname_ok(const char *name)
+{
+  if((name[0] == '\0') || (name[0] == '.')){
+      return 0;
+  }
+  if(name[cstr_pos(name, '/')] != '\0'){
+      return 0;
+  }
+  if(cstr_len(name) > PERPD_NAMEMAX){
+      return 0;
+  }
+
+  return 1;
+}
+
+
+/* eof: perp_common.c */
@@ -1,6 +1,6 @@
 /* perp_common.h
 ** common defines for perp apps
-** wcm, 2008.01.23 - 2011.03.11
+** wcm, 2008.01.23 - 2011.04.05
 ** ===
 */
 #ifndef PERP_COMMON_H
@@ -36,6 +36,37 @@
 */
 #define PERPD_SOCKET   "perpd.sock"
 
+/* perpd socket for protocol version 3 messages (perp-2.05)
+**   (relative to PERP_CONTROL; SOCK_SEQPACKET, see PROTO_V2.txt):
+*/
+#define PERPD_SEQSOCKET  "perpd.seq"
+
+/* perpd status file, mapped by clients (perp-2.05)
+**   (relative to PERP_CONTROL; best with PERP_CONTROL on tmpfs):
+*/
+#define PERPD_STATFILE  "perpd.status"
+
+/* perpd journal ring of service transitions (perp-2.05)
+**   (relative to PERP_CONTROL):
+*/
+#define PERPD_JOURNAL  "perpd.journal"
+
+/* maximum length of a service name (basename of service directory)
+**   (a name must fit with status in a protocol packet):
+*/
+#define PERPD_NAMEMAX  128
+
+/* protocol version 3 message (perp-2.05):
+**   header of PERPD_MSGHEADER bytes:
+**     [0]      protocol 3
+**     [1]      type
+**     [2..5]   tag of request (returned in each message of its reply)
+**     [6..9]   length of payload (portable "little-endian")
+**   followed by payload of at most PERPD_MSGMAX bytes
+*/
+#define PERPD_MSGHEADER  10
+#define PERPD_MSGMAX  (64 * 1024)
+
 
 /* perp svdef (service definition) flags: */
 #define SVDEF_FLAG_ACTIVE  0x01
@@ -44,6 +75,8 @@
 #define SVDEF_FLAG_CYCLE   0x08
 #define SVDEF_FLAG_DOWN    0x10
 #define SVDEF_FLAG_ONCE    0x20
+#define SVDEF_FLAG_QUEUED    0x40
+#define SVDEF_FLAG_STARTING  0x80
 
 /* perp subsv (subservice) flags: */
 #define SUBSV_FLAG_ISLOG     0x01
@@ -52,6 +85,19 @@
 #define SUBSV_FLAG_ISPAUSED  0x08
 #define SUBSV_FLAG_WANTDOWN  0x10
 #define SUBSV_FLAG_FAILING   0x20
+#define SUBSV_FLAG_DELAYED   0x40
+#define SUBSV_FLAG_QUARANTINE  0x80
+
+/* perp readiness flags of main (status byte 29, perp-2.05): */
+#define READY_FLAG_NOTIFY  0x01
+#define READY_FLAG_READY   0x02
+
+/* perp health check flags (status byte 90, perp-2.05): */
+#define CHECK_FLAG_ENABLED  0x01
+#define CHECK_FLAG_RUNNING  0x02
+#define CHECK_FLAG_RESULT   0x04
+#define CHECK_FLAG_FAILED   0x08
+#define CHECK_FLAG_TIMEOUT  0x10
 
 /* perp command flags (second byte of command packet): */
 #define SVCMD_FLAG_LOG     0x01
@@ -70,6 +116,11 @@
 #define  die(e) \
     _exit((e))
 
+/*
+** subroutines common to perp clients (defined in perp_common.c):
+*/
+extern int perp_svname_ok(const char *name);
+
 
 #endif /* PERP_COMMON_H */
 /* eof (perp_common.h) */
@@ -0,0 +1,67 @@
+/* perp_journal.h
+** perp: persistent process supervision
+** perp_journal: layout of journal ring of service transitions by perpd
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+#ifndef PERP_JOURNAL_H
+#define PERP_JOURNAL_H  1
+
+/* perp: */
+#include "perp_common.h"
+
+
+/* layout of the journal file (see PROTO_V2.txt):
+**
+**   header of JOURNAL_HEADER bytes:
+**     [0..7]    magic JOURNAL_MAGIC
+**     [8..11]   record size (portable "little-endian", as pid below)
+**     [12..15]  number of records in ring
+**     [16..23]  head: seq of next record (native byte order)
+**     [24..27]  pid of perpd
+**
+**   followed by the ring of JOURNAL_RECORD bytes per record, the record
+**   of seq (from 1) in slot (seq - 1) % nrecs:
+**     [0..7]    seq of record (native byte order), 0 while written
+**     [8..19]   tain timestamp of transition
+**     [20]      event code, as in 'V' event (or JOURNAL_CONTROL)
+**     [21]      which subservice (0: main, 1: log)
+**     [22]      subservice flags
+**     [23]      service flags
+**     [24..27]  pid of subservice
+**     [28..31]  termination status (or command and command flags)
+**     [32..47]  dev/ino of service definition directory
+**     [48..175] name of service (nul-padded to JOURNAL_NAMEMAX)
+**     [176..255] reserved (zero)
+*/
+#define JOURNAL_MAGIC    "perpjrnl"
+#define JOURNAL_HEADER   64
+#define JOURNAL_RECORD   256
+#define JOURNAL_NAMEMAX  PERPD_NAMEMAX
+
+/* header offsets: */
+#define JOURNAL_RECSIZE  8
+#define JOURNAL_NRECS    12
+#define JOURNAL_HEAD     16
+#define JOURNAL_PID      24
+
+/* record offsets: */
+#define JOURNAL_SEQ      0
+#define JOURNAL_STAMP    8
+#define JOURNAL_EVENT    20
+#define JOURNAL_WHICH    21
+#define JOURNAL_SUBSV    22
+#define JOURNAL_SVDEF    23
+#define JOURNAL_SVPID    24
+#define JOURNAL_ARG      28
+#define JOURNAL_DEVINO   32
+#define JOURNAL_NAME     48
+
+/* event code of a control command received (journal only),
+** with command in byte [28], command flags in byte [29]:
+*/
+#define JOURNAL_CONTROL  'K'
+
+
+#endif /* PERP_JOURNAL_H */
+/* eof: perp_journal.h */
@@ -0,0 +1,206 @@
+/* perp_statfile.c
+** perp: persistent process supervision
+** perp_statfile: client access to status file published by perpd
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* lasanga: */
+#include "buf.h"
+#include "cstr.h"
+#include "pidlock.h"
+#include "tain.h"
+#include "uchar.h"
+#include "upak.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perp_statfile.h"
+
+
+/* notes:
+**
+**   each record is written by perpd under a seqlock: the seq counter is
+**   odd while the record is written, and advanced on completion
+**
+**   a client copies the record between two reads of an even seq, and
+**   retries the copy if the seq has moved meanwhile; no lock is taken,
+**   and no system call is made, for a record not being written
+**
+**   the status file is created anew on each startup of perpd, and is
+**   grown but never truncated while perpd is running
+*/
+
+/* attempts to copy a record before giving up: */
+#define STATFILE_TRIES  1000
+
+
+/* statfile_open()
+**   map status file of perpd running on basedir, read-only
+*/
+int
+statfile_open(struct statfile *sf, const char *basedir)
+{
+  char         pathbuf[256];
+  struct stat  st;
+  uchar_t     *map;
+  size_t       size;
+  pid_t        pid;
+  int          fd, e;
+
+  sf->map = NULL;
+  sf->size = 0;
+  sf->nslots = 0;
+
+  if(cstr_vlen(basedir, "/", PERP_CONTROL, "/", PERPD_STATFILE) >= sizeof pathbuf){
+      errno = ENAMETOOLONG;
+      return -1;
+  }
+
+  /* perpd running on basedir? */
+  cstr_vcopy(pathbuf, basedir, "/", PERP_CONTROL, "/", PERPD_PIDLOCK);
+  if((pid = pidlock_check(pathbuf)) <= 0){
+      if(pid == 0) errno = ESRCH;
+      return -1;
+  }
+
+  cstr_vcopy(pathbuf, basedir, "/", PERP_CONTROL, "/", PERPD_STATFILE);
+  if((fd = open(pathbuf, O_RDONLY | O_CLOEXEC)) == -1){
+      return -1;
+  }
+  if(fstat(fd, &st) == -1){
+      e = errno; close(fd); errno = e;
+      return -1;
+  }
+  size = (size_t)st.st_size;
+  if(size < STATFILE_HEADER){
+      close(fd);
+      errno = EPROTO;
+      return -1;
+  }
+  map = (uchar_t *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  e = errno;
+  close(fd);
+  if(map == (uchar_t *)MAP_FAILED){
+      errno = e;
+      return -1;
+  }
+
+  /* header check, and file published by the perpd holding the lock: */
+  if((buf_cmp(map, STATFILE_MAGIC, 8) != 0)
+     || (upak32_unpack(&map[8]) != STATFILE_RECORD)
+     || ((pid_t)upak32_unpack(&map[16]) != pid)){
+      munmap(map, size);
+      errno = ESTALE;
+      return -1;
+  }
+
+  sf->map = map;
+  sf->size = size;
+  sf->nslots = (size - STATFILE_HEADER) / STATFILE_RECORD;
+
+  return 0;
+}
+
+
+/* statfile_read()
+**   copy record in slot into rec
+*/
+int
+statfile_read(const struct statfile *sf, size_t slot,
+              struct statrec *rec, const tain_t *now)
+{
+  const uchar_t           *r;
+  const volatile uint32_t *seqp;
+  uchar_t                  copy[STATFILE_RECORD];
+  uint32_t                 seq;
+  uint64_t                 age, delay;
+  size_t                   nstatus, nname;
+  tain_t                   diff;
+  int                      tries, i;
+
+  if(slot >= sf->nslots){
+      return 0;
+  }
+  r = sf->map + STATFILE_HEADER + (slot * STATFILE_RECORD);
+  seqp = (const volatile uint32_t *)&r[STATFILE_SEQ];
+
+  for(tries = 0; ; ++tries){
+      if(tries == STATFILE_TRIES){
+          errno = EAGAIN;
+          return -1;
+      }
+      seq = *seqp;
+      if(seq & 1){
+          /* record being written: */
+          sched_yield();
+          continue;
+      }
+      __sync_synchronize();
+      buf_copy(copy, r, STATFILE_RECORD);
+      __sync_synchronize();
+      if(*seqp == seq) break;
+  }
+
+  if(!copy[STATFILE_INUSE]){
+      return 0;
+  }
+  nstatus = copy[STATFILE_NSTATUS];
+  nname = copy[STATFILE_NNAME];
+  if((nstatus > STATFILE_STATUS) || (nname > STATFILE_NAMEMAX)){
+      errno = EPROTO;
+      return -1;
+  }
+
+  rec->dev = upak64_unpack(&copy[STATFILE_DEVINO]);
+  rec->ino = upak64_unpack(&copy[STATFILE_DEVINO + 8]);
+  tain_unpack(&rec->stamp, &copy[STATFILE_STAMP]);
+  buf_copy(rec->status, &copy[STATFILE_STATUSAT], nstatus);
+  rec->nstatus = nstatus;
+  buf_copy(rec->name, &copy[STATFILE_NAMEAT], nname);
+  rec->name[nname] = '\0';
+
+  /* delays of main/log at [66..69], [70..73] are msecs from stamp: */
+  if((nstatus >= 74) && tain_less(&rec->stamp, now)){
+      tain_minus(&diff, now, &rec->stamp);
+      age = tain_to_msecs(&diff);
+      for(i = 66; i <= 70; i += 4){
+          delay = upak32_unpack(&rec->status[i]);
+          delay = (delay > age) ? (delay - age) : 0;
+          upak32_pack(&rec->status[i], (uint32_t)delay);
+      }
+  }
+
+  return 1;
+}
+
+
+/* statfile_close()
+**   unmap status file
+*/
+void
+statfile_close(struct statfile *sf)
+{
+  if(sf->map != NULL){
+      munmap(sf->map, sf->size);
+  }
+  sf->map = NULL;
+  sf->size = 0;
+  sf->nslots = 0;
+
+  return;
+}
+
+
+/* eof: perp_statfile.c */
@@ -0,0 +1,103 @@
+/* perp_statfile.h
+** perp: persistent process supervision
+** perp_statfile: shared-memory status file published by perpd
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+#ifndef PERP_STATFILE_H
+#define PERP_STATFILE_H  1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* lasagna: */
+#include "tain.h"
+#include "uchar.h"
+
+/* perp: */
+#include "perp_common.h"
+
+
+/* layout of the status file (see PROTO_V2.txt):
+**
+**   header of STATFILE_HEADER bytes:
+**     [0..7]    magic STATFILE_MAGIC
+**     [8..11]   record size (portable "little-endian", as all but seq below)
+**     [12..15]  number of record slots
+**     [16..19]  pid of perpd
+**     [20..31]  tain timestamp of perpd startup
+**
+**   followed by a record of STATFILE_RECORD bytes per slot:
+**     [0..3]    seq: seqlock counter (native byte order), odd while written
+**     [4]       set if the slot is in use by a service
+**     [5]       length of status
+**     [6]       length of name
+**     [8..19]   tain timestamp of record update
+**     [20..35]  dev/ino of service definition directory
+**     [36..127] status, as in 'S' reply to 'Q' query
+**     [128..]   name of service
+*/
+#define STATFILE_MAGIC    "perpstat"
+#define STATFILE_HEADER   64
+#define STATFILE_RECORD   256
+#define STATFILE_STATUS   92
+#define STATFILE_NAMEMAX  PERPD_NAMEMAX
+
+/* record offsets: */
+#define STATFILE_SEQ      0
+#define STATFILE_INUSE    4
+#define STATFILE_NSTATUS  5
+#define STATFILE_NNAME    6
+#define STATFILE_STAMP    8
+#define STATFILE_DEVINO   20
+#define STATFILE_STATUSAT 36
+#define STATFILE_NAMEAT   128
+
+
+/* statfile object, status file mapped by a client: */
+struct statfile {
+  uchar_t  *map;
+  size_t    size;
+  /* record slots in mapping: */
+  size_t    nslots;
+};
+
+/* statrec object, consistent copy of a record in use: */
+struct statrec {
+  uint64_t  dev;
+  uint64_t  ino;
+  tain_t    stamp;
+  uchar_t   status[STATFILE_STATUS];
+  size_t    nstatus;
+  char      name[STATFILE_NAMEMAX + 1];
+};
+
+
+/* statfile_open()
+**   map status file of perpd running on basedir, read-only
+**   return:
+**     0: success
+**    -1: status file not available (perpd not running, or not
+**        publishing status file), errno set
+*/
+extern int statfile_open(struct statfile *sf, const char *basedir);
+
+/* statfile_read()
+**   copy record in slot into rec, retrying while the record is written
+**   delays in status are adjusted for the age of the record against now
+**   return:
+**     1: record in use, copied into rec
+**     0: slot not in use
+**    -1: no consistent copy (record busy), errno set
+*/
+extern int statfile_read(const struct statfile *sf, size_t slot,
+                         struct statrec *rec, const tain_t *now);
+
+/* statfile_close()
+**   unmap status file
+*/
+extern void statfile_close(struct statfile *sf);
+
+
+#endif /* PERP_STATFILE_H */
+/* eof: perp_statfile.h */
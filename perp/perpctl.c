@@ -3,7 +3,7 @@
 ** perp 2.0: single process scanner/supervisor/controller
 ** perpctl: perpd administrative control interface
 ** (ipc client control to perpd server)
-** wcm, 2008.01.23 - 2011.01.28
+** wcm, 2008.01.23 - 2011.04.05
 ** ===
 */
 
@@ -17,11 +17,13 @@
 #include <signal.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 /* lasanga: */
 #include "buf.h"
 #include "cstr.h"
 #include "domsock.h"
+#include "ioq.h"
 #include "nextopt.h"
 #include "nfmt.h"
 #include "pidlock.h"
@@ -51,8 +53,23 @@ static const char  *basedir = NULL;
 /* error counter: */
 static int  errs = 0;
 
+/* request of protocol 3, pipelined by do_control3(): */
+struct msgreq {
+  uchar_t     *msg;    /* message, header and payload */
+  size_t       len;    /* bytes in msg[] */
+  const char  *svdir;  /* argument of 'C' request, NULL for 'B' request */
+};
+
 /* functions in scope: */
 static void do_sticky(int flag_sticky, char *argv[]);
+static int do_request(int fd_conn, pkt_t pkt, const char *svdir);
+static void do_bulkresult(const uchar_t *rec);
+static int do_bulksend(int fd_conn, ioq_t *in, pkt_t pkt, int first);
+static int do_bulk(int fd_conn, uchar_t cmd[], char *argv[]);
+static int msg_connect(void);
+static void msg_init(uchar_t *msg, uchar_t type, uint32_t tag, size_t len);
+static size_t msg_recv(int fd_conn, uchar_t *msg, size_t max, uint32_t tag);
+static void do_control3(int fd_conn, uchar_t cmd[], char *argv[]);
 static void do_control(uchar_t cmd[], char *argv[]);
 
 
@@ -140,8 +157,468 @@ do_sticky(int flag_sticky, char *argv[])
 }
 
 
+/* do_request()
+**   write request in pkt, read reply into pkt
+**   return:
+**     -1: failure (reported)
+**    >=0: error code in 'E' reply (0: success)
+*/
+static
+int
+do_request(int fd_conn, pkt_t pkt, const char *svdir)
+{
+  if(pkt_write(fd_conn, pkt, 0) == -1){
+      ++errs;
+      eputs_syserr("error: ", svdir, ": error writing request");
+      return -1;
+  }
+
+  if(pkt_read(fd_conn, pkt, 0) == -1){
+      ++errs;
+      eputs_syserr("error: ", svdir, ": error reading response");
+      return -1;
+  }
+
+  if(pkt[0] != 2){
+      ++errs;
+      eputs("error: ", svdir, ": unknown packet protocol in reply");
+      return -1;
+  }
+  if(pkt[1] != 'E'){
+      ++errs;
+      eputs("error: ", svdir, ": unknown packet type in reply");
+      return -1;
+  }
+
+  return (int)upak32_unpack(&pkt[3]);
+}
+
+
+/* do_bulkresult()
+**   report result in 'K' record rec for one service (or unmatched name)
+*/
+static
+void
+do_bulkresult(const uchar_t *rec)
+{
+  const uchar_t  *data = pkt_data(rec);
+  char            name[PERPD_NAMEMAX + 1];
+  size_t          n;
+  int             e;
+
+  n = pkt_dlen(rec) - 20;
+  if(n > PERPD_NAMEMAX) n = PERPD_NAMEMAX;
+  buf_copy(name, &data[20], n);
+  name[n] = '\0';
+  e = (int)upak32_unpack(&data[16]);
+  if(e == 0){
+      report(name, ": ok");
+  }else if(e == ENOENT){
+      ++errs;
+      if(name[cstr_pos(name, '*')] || name[cstr_pos(name, '?')]){
+          eputs("error: ", name, ": no active service matched");
+      }else{
+          eputs("error: ", name, ": service not activated");
+      }
+  }else{
+      ++errs;
+      errno = e;
+      eputs_syserr("error: ", name, ": error reported in reply");
+  }
+
+  return;
+}
+
+
+/* do_bulksend()
+**   write 'B' request in pkt, read stream of 'K' records in reply from
+**   in, reporting the result for each
+**   return:
+**     0: success (any errors reported)
+**    -1: perpd without 'B' request (EPROTO on first request)
+*/
+static
+int
+do_bulksend(int fd_conn, ioq_t *in, pkt_t pkt, int first)
+{
+  uchar_t  *data;
+  ssize_t   r;
+  int       e;
+
+  if(pkt_write(fd_conn, pkt, 0) == -1){
+      fatal_syserr("failure writing request");
+  }
+
+  for(;;){
+      if((r = pkt_ioqget(in, pkt)) <= 0){
+          if(r == 0) errno = EPROTO;
+          fatal_syserr("failure reading response");
+      }
+      if(pkt[0] != 2){
+          fatal(111, "unknown packet protocol in reply");
+      }
+      data = pkt_data(pkt);
+      if(pkt[1] == 'E'){
+          e = (int)upak32_unpack(data);
+          if(e == 0){
+              break;
+          }
+          if(first && (e == EPROTO)){
+              return -1;
+          }
+          errno = e;
+          fatal_syserr("error reported in reply");
+      }
+      if((pkt[1] != 'K') || (pkt_dlen(pkt) < 21)){
+          fatal(111, "unknown packet type in reply");
+      }
+      do_bulkresult(pkt);
+  }
+
+  return 0;
+}
+
+
+/* do_bulk()
+**   send cmd to the services named in argv (names or patterns, as may
+**   be given to perpd), in 'B' requests of as many names as fit a packet
+**   arguments not given as names are left to do_control()
+**   return:
+**     0: success (any errors reported)
+**    -1: perpd without 'B' request (earlier than perp-2.05)
+*/
+static
+int
+do_bulk(int fd_conn, uchar_t cmd[], char *argv[])
+{
+  pkt_t     pkt;
+  uchar_t   ibuf[4096];
+  ioq_t     in = ioq_INIT(fd_conn, ibuf, sizeof ibuf, &read);
+  uchar_t  *data = pkt_data(pkt);
+  size_t    len = 2;
+  size_t    n;
+  int       first = 1;
+
+  data[0] = cmd[0];
+  data[1] = cmd[1];
+  for(; *argv != NULL; ++argv){
+      if(!perp_svname_ok(*argv)){
+          continue;
+      }
+      n = cstr_len(*argv) + 1;
+      if(len + n > PKT_PAYLOAD){
+          /* packet full: */
+          pkt_init(pkt, 2, 'B', len);
+          if(do_bulksend(fd_conn, &in, pkt, first) == -1){
+              return -1;
+          }
+          first = 0;
+          data[0] = cmd[0];
+          data[1] = cmd[1];
+          len = 2;
+      }
+      buf_copy(&data[len], *argv, n);
+      len += n;
+  }
+  if(len > 2){
+      pkt_init(pkt, 2, 'B', len);
+      if(do_bulksend(fd_conn, &in, pkt, first) == -1){
+          return -1;
+      }
+  }
+
+  return 0;
+}
+
+
+/* msg_connect()
+**   connect to perpd socket for protocol 3
+**   return:
+**    >=0: connected socket
+**     -1: no socket for protocol 3, fall back to protocol 2
+**         (perpd earlier than perp-2.05, or platform without
+**         SOCK_SEQPACKET; a perpd not running is then reported in turn)
+*/
+static
+int
+msg_connect(void)
+{
+  char     pathbuf[256];
+  size_t   n;
+  int      fd_conn;
+
+  n = cstr_vlen(basedir, "/", PERP_CONTROL, "/", PERPD_SEQSOCKET);
+  if(!(n < sizeof pathbuf)){
+      return -1;
+  }
+  cstr_vcopy(pathbuf, basedir, "/", PERP_CONTROL, "/", PERPD_SEQSOCKET);
+  fd_conn = domsock_connectseq(pathbuf);
+  if(fd_conn == -1){
+      switch(errno){
+      case ENOENT:
+      case ECONNREFUSED:
+      case EPROTOTYPE:
+      case EPROTONOSUPPORT:
+      case ESOCKTNOSUPPORT:
+          return -1;
+      }
+      fatal_syserr("failure connecting to perpd control socket ", pathbuf);
+  }
+
+  return fd_conn;
+}
+
+
+/* msg_init()
+**   pack header of protocol 3 message of type, tag, payload len
+*/
+static
+void
+msg_init(uchar_t *msg, uchar_t type, uint32_t tag, size_t len)
+{
+  msg[0] = 3;
+  msg[1] = type;
+  upak32_pack(&msg[2], tag);
+  upak32_pack(&msg[6], (uint32_t)len);
+
+  return;
+}
+
+
+/* msg_recv()
+**   receive protocol 3 message of reply to request of tag into msg,
+**   of up to max bytes of payload
+**   return:
+**     length of payload, records of protocol 2 packets (checked whole)
+*/
+static
+size_t
+msg_recv(int fd_conn, uchar_t *msg, size_t max, uint32_t tag)
+{
+  struct iovec   iov;
+  struct msghdr  mh;
+  ssize_t        r;
+  size_t         len, n;
+
+  iov.iov_base = msg;
+  iov.iov_len = PERPD_MSGHEADER + max;
+  buf_zero(&mh, sizeof mh);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+
+  do{
+      r = recvmsg(fd_conn, &mh, 0);
+  }while((r == -1) && (errno == EINTR));
+  if(r <= 0){
+      if(r == 0) errno = EPROTO;
+      fatal_syserr("failure reading response");
+  }
+  len = (size_t)r;
+  if((mh.msg_flags & MSG_TRUNC) || (len < PERPD_MSGHEADER) || (msg[0] != 3)
+     || (upak32_unpack(&msg[6]) != (uint32_t)(len - PERPD_MSGHEADER))){
+      fatal(111, "unknown message protocol in reply");
+  }
+  if(upak32_unpack(&msg[2]) != tag){
+      fatal(111, "reply out of order for request");
+  }
+  len -= PERPD_MSGHEADER;
+
+  /* records: */
+  for(n = 0; n < len; n += pkt_len(&msg[PERPD_MSGHEADER + n])){
+      if(((len - n) < PKT_HEADER)
+         || ((len - n) < pkt_len(&msg[PERPD_MSGHEADER + n]))
+         || (msg[PERPD_MSGHEADER + n] != 2)){
+          fatal(111, "unknown packet protocol in reply");
+      }
+  }
+
+  return len;
+}
+
+
+/* do_control3()
+**   send cmd to list of services given in argv, over protocol 3:
+**     names in as few 'B' requests as fit the maximum payload of perpd,
+**     then a 'C' request by dev/ino for each other argument
+**   requests are pipelined: sent ahead of the replies, with no more
+**   than PERPCTL_AHEAD requests (and PERPD_MSGMAX bytes) outstanding
+**   notes:
+**     the socket queues only a few messages for the receiver (10 by
+**     default on linux, net.unix.max_dgram_qlen): perpd, with its reply
+**     not taken, stops reading requests, and perpctl must not then be
+**     left blocked on sending a request before reading the replies
+*/
+#define PERPCTL_AHEAD  8
+static
+void
+do_control3(int fd_conn, uchar_t cmd[], char *argv[])
+{
+  struct msgreq  *reqv;
+  uchar_t         msg[PERPD_MSGHEADER + PKT_PAYLOAD];
+  uchar_t        *rbuf;
+  uchar_t        *rec;
+  size_t          msgmax, nreq, nsent, ndone, ahead;
+  size_t          len, n, i;
+  char          **argp;
+  int             e;
+
+  /* hello, for maximum payload: */
+  msg_init(msg, 'H', 0, 0);
+  if(send(fd_conn, msg, PERPD_MSGHEADER, 0) == -1){
+      fatal_syserr("failure writing request");
+  }
+  len = msg_recv(fd_conn, msg, PKT_PAYLOAD, 0);
+  if((len < PKT_HEADER + 5) || (msg[PERPD_MSGHEADER + 1] != 'H')){
+      fatal(111, "unknown packet type in reply");
+  }
+  msgmax = (size_t)upak32_unpack(&msg[PERPD_MSGHEADER + PKT_HEADER + 1]);
+  if(msgmax > PERPD_MSGMAX) msgmax = PERPD_MSGMAX;
+  if(msgmax < (2 + PERPD_NAMEMAX + 1)){
+      fatal(111, "unknown packet type in reply");
+  }
+
+  /* at most one request for each argument: */
+  for(n = 0; argv[n] != NULL; ++n) ;
+  reqv = (struct msgreq *)malloc((n + 1) * sizeof(struct msgreq));
+  rbuf = (uchar_t *)malloc(PERPD_MSGHEADER + PERPD_MSGMAX);
+  if((reqv == NULL) || (rbuf == NULL)){
+      fatal_syserr("failure allocating requests");
+  }
+  nreq = 0;
+
+  /* names in bulk: */
+  len = 0;
+  for(argp = argv; *argp != NULL; ++argp){
+      if(!perp_svname_ok(*argp)){
+          continue;
+      }
+      n = cstr_len(*argp) + 1;
+      if((len > 0) && ((len + n) > msgmax)){
+          /* message full: */
+          msg_init(reqv[nreq].msg, 'B', (uint32_t)(nreq + 1), len);
+          reqv[nreq].len = PERPD_MSGHEADER + len;
+          ++nreq;
+          len = 0;
+      }
+      if(len == 0){
+          reqv[nreq].msg = (uchar_t *)malloc(PERPD_MSGHEADER + msgmax);
+          if(reqv[nreq].msg == NULL){
+              fatal_syserr("failure allocating requests");
+          }
+          reqv[nreq].svdir = NULL;
+          reqv[nreq].msg[PERPD_MSGHEADER] = cmd[0];
+          reqv[nreq].msg[PERPD_MSGHEADER + 1] = cmd[1];
+          len = 2;
+      }
+      buf_copy(&reqv[nreq].msg[PERPD_MSGHEADER + len], *argp, n);
+      len += n;
+  }
+  if(len > 0){
+      msg_init(reqv[nreq].msg, 'B', (uint32_t)(nreq + 1), len);
+      reqv[nreq].len = PERPD_MSGHEADER + len;
+      ++nreq;
+  }
+
+  /* other arguments by dev/ino: */
+  for(argp = argv; *argp != NULL; ++argp){
+      struct stat  st;
+
+      if(perp_svname_ok(*argp)){
+          continue;
+      }
+      if(stat(*argp, &st) == -1){
+          ++errs;
+          eputs("error: ", *argp, ": service directory not found");
+          continue;
+      }
+      if(! S_ISDIR(st.st_mode)){
+          ++errs;
+          eputs("error: ", *argp, ": not a directory");
+          continue;
+      }
+      if(!(S_ISVTX & st.st_mode)){
+          ++errs;
+          eputs("error: ", *argp, ": service directory not activated");
+          continue;
+      }
+      reqv[nreq].msg = (uchar_t *)malloc(PERPD_MSGHEADER + 18);
+      if(reqv[nreq].msg == NULL){
+          fatal_syserr("failure allocating requests");
+      }
+      msg_init(reqv[nreq].msg, 'C', (uint32_t)(nreq + 1), 18);
+      upak_pack(&reqv[nreq].msg[PERPD_MSGHEADER], "LLbb",
+                (uint64_t)st.st_dev, (uint64_t)st.st_ino, cmd[0], cmd[1]);
+      reqv[nreq].len = PERPD_MSGHEADER + 18;
+      reqv[nreq].svdir = *argp;
+      ++nreq;
+  }
+
+  /* pipeline: */
+  nsent = ndone = 0;
+  ahead = 0;
+  while(ndone < nreq){
+      while((nsent < nreq)
+            && ((nsent == ndone)
+                || (((nsent - ndone) < PERPCTL_AHEAD)
+                    && ((ahead + reqv[nsent].len) <= PERPD_MSGMAX)))){
+          if(send(fd_conn, reqv[nsent].msg, reqv[nsent].len, 0) == -1){
+              fatal_syserr("failure writing request");
+          }
+          ahead += reqv[nsent].len;
+          ++nsent;
+      }
+
+      /* reply to request ndone, to the terminal 'E' record: */
+      e = -1;
+      while(e == -1){
+          len = msg_recv(fd_conn, rbuf, PERPD_MSGMAX, (uint32_t)(ndone + 1));
+          for(i = 0; i < len; i += pkt_len(rec)){
+              rec = &rbuf[PERPD_MSGHEADER + i];
+              if(e != -1){
+                  fatal(111, "unknown packet type in reply");
+              }
+              if((pkt_type(rec) == 'E') && (pkt_dlen(rec) == 4)){
+                  e = (int)upak32_unpack(pkt_data(rec));
+              }else if((reqv[ndone].svdir == NULL)
+                       && (pkt_type(rec) == 'K') && (pkt_dlen(rec) >= 21)){
+                  do_bulkresult(rec);
+              }else{
+                  fatal(111, "unknown packet type in reply");
+              }
+          }
+      }
+      if(reqv[ndone].svdir == NULL){
+          if(e != 0){
+              errno = e;
+              fatal_syserr("error reported in reply");
+          }
+      }else if(e != 0){
+          ++errs;
+          errno = e;
+          eputs_syserr("error: ", reqv[ndone].svdir, ": error reported in reply");
+      }else{
+          report(reqv[ndone].svdir, ": ok");
+      }
+
+      ahead -= reqv[ndone].len;
+      free(reqv[ndone].msg);
+      ++ndone;
+  }
+
+  free(rbuf);
+  free(reqv);
+
+  return;
+}
+
+
 /* do_control()
 **   send cmd to list of services given in argv
+**   services are addressed by name where possible, in bulk, else by
+**   dev/ino (a perpd earlier than perp-2.05 knows dev/ino only, and
+**   is sent each name in a request of its own)
+**   protocol 3 is used where perpd has its socket (see do_control3()),
+**   else protocol 2
 */
 void
 do_control(uchar_t cmd[], char *argv[]){
@@ -149,8 +626,17 @@ do_control(uchar_t cmd[], char *argv[]){
   size_t   n;
   int      fd_conn;
   int      e;
+  int      use_names = 1;
+  int      use_bulk = 1;
+
+  /* protocol 3, where perpd has it: */
+  if((fd_conn = msg_connect()) != -1){
+      do_control3(fd_conn, cmd, argv);
+      close(fd_conn);
+      return;
+  }
 
-  /* connect to control socket: */
+  /* else connect to control socket of protocol 2: */
   n = cstr_vlen(basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
   if(!(n < sizeof pathbuf)){
       errno = ENAMETOOLONG;
@@ -167,11 +653,54 @@ do_control(uchar_t cmd[], char *argv[]){
       }
   }
 
-  /* loop through service directory arguments and send control packet: */
+  /* names in bulk: */
+  if(do_bulk(fd_conn, cmd, argv) == -1){
+      use_bulk = 0;
+  }
+
+  /* loop through remaining service directory arguments and send control packet: */
   for(; *argv != NULL; ++argv){
       pkt_t        pkt = pkt_INIT(2, 'C', 18);
       struct stat  st;
 
+      if(use_bulk && perp_svname_ok(*argv)){
+          /* done in bulk: */
+          continue;
+      }
+
+      if(use_names && perp_svname_ok(*argv)){
+          uchar_t  *data = pkt_data(pkt);
+
+          /* control packet for this name: */
+          n = cstr_len(*argv);
+          data[0] = cmd[0];
+          data[1] = cmd[1];
+          buf_copy(&data[2], *argv, n);
+          pkt_init(pkt, 2, 'c', 2 + n);
+
+          e = do_request(fd_conn, pkt, *argv);
+          if(e == 0){
+              report(*argv, ": ok");
+              continue;
+          }
+          if(e == ENOENT){
+              ++errs;
+              eputs("error: ", *argv, ": service not activated");
+              continue;
+          }
+          if(e != EPROTO){
+              if(e > 0){
+                  ++errs;
+                  errno = e;
+                  eputs_syserr("error: ", *argv, ": error reported in reply");
+              }
+              continue;
+          }
+          /* else EPROTO, perpd without named requests: */
+          use_names = 0;
+          pkt_init(pkt, 2, 'C', 18);
+      }
+
       if(stat(*argv, &st) == -1){
           ++errs;
           eputs("error: ", *argv, ": service directory not found");
@@ -194,30 +723,10 @@ do_control(uchar_t cmd[], char *argv[]){
       upak_pack(pkt_data(pkt), "LLbb",
                 (uint64_t)st.st_dev, (uint64_t)st.st_ino, cmd[0], cmd[1]);
 
-      if(pkt_write(fd_conn, pkt, 0) == -1){
-          ++errs;
-          eputs_syserr("error: ", *argv, ": error writing request");
+      e = do_request(fd_conn, pkt, *argv);
+      if(e == -1){
           continue;
       }
-
-      if(pkt_read(fd_conn, pkt, 0) == -1){
-          ++errs;
-          eputs_syserr("error: ", *argv, ": error reading response");
-          continue;
-      }
-
-      if(pkt[0] != 2){
-          ++errs;
-          eputs("error: ", *argv, ": unknown packet protocol in reply");
-          continue;
-      }
-      if(pkt[1] != 'E'){
-          ++errs;
-          eputs("error: ", *argv, ": unknown packet type in reply");
-          continue;
-      }
-
-      e = (int)upak32_unpack(&pkt[3]);
       if(e != 0){
           ++errs;
           errno = e;
@@ -1,7 +1,7 @@
 /* perpd.c
 ** perp: persistent process supervision
 ** perpd 2.0: single process scanner/supervisor/controller
-** wcm, 2010.12.28 - 2011.02.17
+** wcm, 2010.12.28 - 2011.04.05
 ** ===
 */
 
@@ -15,8 +15,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -31,7 +31,6 @@
 #include "nuscan.h"
 #include "pidlock.h"
 #include "pkt.h"
-#include "pollio.h"
 #include "sig.h"
 #include "sigset.h"
 #include "sysstr.h"
@@ -42,19 +41,29 @@
 #include "perp_common.h"
 #include "perpd.h"
 
+#ifdef PERPD_SIGNALFD
+#  include <sys/signalfd.h>
+#endif
+#ifdef PERPD_INOTIFY
+#  include <sys/inotify.h>
+#endif
+
 /* brief pause on exceptional error (billionths of second): */
 #define EPAUSE  555444321UL
 
 /* logging variables in perpd scope: */
 const char  *progname = NULL;
-const char   prog_usage[] = "[-hV] [-a secs] [-g gid] [basedir]";
+const char   prog_usage[] = "[-hV] [-a secs] [-c connmax] [-g gid] [-j startmax] [-k secs] [-r records] [basedir ...]";
 const char  *my_pidstr = NULL;
 
 /* other variables available in perpd scope: */
-/* base directory: */
-const char  *basedir = NULL;
+/* base directories: */
+struct perpd_base  *bases = NULL;
+size_t              nbases = 0;
 /* sigset blocking: */
 sigset_t  poll_sigset;
+/* index of running service processes by pid: */
+struct pidtab  pidtab;
 /* status variables for perpd: */
 pid_t     my_pid;
 tain_t    my_when;
@@ -64,23 +73,28 @@ tain_t    my_when;
 */
 /* options/args: */
 static uint32_t  arg_autoscan = 0;
+static uint32_t  arg_connmax = PERPD_CONNMAX;
+static uint32_t  arg_startmax = 0;
+static uint32_t  arg_deadline = 0;
+static uint32_t  arg_journal = PERPD_JOURNAL_RECS;
 static gid_t     arg_gid = (gid_t)-1;
 /* signal flags: */
 static int  flag_chld = 0;
 static int  flag_hup = 0;
 static int  flag_term = 0;
+static int  flag_reexec = 0;
 /* exceptional failure on fork(): */
 static int  flag_failing = 0;
 /* perpd termination in progress: */
 static int  flag_terminating = 0;
-/* file descriptors: selfpipe, pidlock, listening socket: */
+/* file descriptors: selfpipe, signalfd, inotify: */
 static int  selfpipe[2];
-static int  fd_pidlock = -1;
-static int  fd_listen = -1;
-/* service definitions vector: */
-static struct svdef  svdefs[PERP_MAX];
-/* services currently active (in svdefs[]): */
-static int  nservices = 0;
+static int  fd_signal = -1;
+static int  fd_inotify = -1;
+/* arguments of perpd, for re-exec: */
+static char  **my_argv = NULL;
+/* shutdown deadline (with option -k): */
+static struct perpd_timer  deadline;
 
 /*
 ** declarations in file scope:
@@ -88,22 +102,57 @@ static int  nservices = 0;
 
 /* selfpipe: */
 static void selfpipe_ping(void);
+/* signal flags: */
+static void sig_flag(int sig);
 /* signal handler: */
 static void sig_trap(int sig);
+/* signalfd: */
+static void perpd_sigfd_init(void);
+static void perpd_sigfd_read(void);
 
-/* startup/initialize control directory: */
-static void perpd_control_init(void);
-
-/* scanner on basedir ("/etc/perp"): */
-static void perpd_scan(void);
-/* scanner helper function: */
-static const struct stat * perpd_svdir_stat(const char *dirname);
+/* raise descriptor limit for client connections: */
+static void perpd_nofile_init(void);
 
-/* cull deactivated services: */
-static void perpd_cull(void);
-
-/* waitpid() and process terminated children: */
+/* setup base directories from arguments: */
+static void perpd_bases_init(char *argv[]);
+/* startup/initialize control directory: */
+static void perpd_control_init(struct perpd_base *base);
+static void perpd_control_seq(struct perpd_base *base);
+/* total of active services in all base directories: */
+static size_t perpd_nservices(void);
+
+/* scanner on base directory ("/etc/perp"): */
+static void perpd_scan(struct perpd_base *base);
+/* scanner helper functions: */
+static const struct stat * perpd_svdir_stat(struct perpd_base *base,
+                                           const char *dirname, int type);
+static void perpd_scan_keep(struct svdef *svdef, const char *svdir);
+static struct svdef * perpd_scan_new(struct perpd_base *base, const char *svdir,
+                                     const struct stat *st);
+static int perpd_scan_drop(struct svdef *svdef);
+/* incremental scanner, on changes watched with inotify: */
+#ifdef PERPD_INOTIFY
+static void perpd_scan_name(struct perpd_base *base, const char *name, int gone);
+static struct perpd_base * inotify_base(int wd);
+static struct svdef * inotify_svdef(int wd);
+#endif
+static void perpd_inotify_init(void);
+static void perpd_inotify_base(struct perpd_base *base);
+static void perpd_inotify_watch(struct svdef *svdef);
+static void perpd_inotify_unwatch(struct svdef *svdef);
+static void perpd_inotify_read(void);
+static uint32_t perpd_autoscan_secs(void);
+
+/* cull deactivated service: */
+static void perpd_cull(struct svdef *svdef);
+
+/* shutdown deadline timer callback: */
+static void perpd_deadline(struct perpd_timer *timer);
+
+/* process terminated children: */
+static int perpd_reap(struct pident *pident, int wstat, const struct rusage *ru);
 static void perpd_waitup(void);
+static void perpd_waitpidfd(struct pident *pident);
 
 /* poll()-based event loop: */
 static void perpd_mainloop(void);
@@ -127,16 +176,20 @@ selfpipe_ping(void)
   return;
 }
 
-/* signal handler: */
+/* sig_flag():
+**   set signal flags for sig
+**   from sig_trap() or perpd_sigfd_read()
+*/
 static
 void
-sig_trap(int sig)
+sig_flag(int sig)
 {
     switch(sig){
     case SIGCHLD: ++flag_chld; break;
     case SIGHUP:  ++flag_hup;  break;
     case SIGINT:  /* fallthrough: */
     case SIGTERM: ++flag_term; break;
+    case SIGUSR2: ++flag_reexec; break;
     default:      break;
     }
 
@@ -144,13 +197,78 @@ sig_trap(int sig)
     if(flag_terminating){
         flag_term = 0;
         flag_hup = 0;
+        flag_reexec = 0;
     }
 
+    return;
+}
+
+/* signal handler: */
+static
+void
+sig_trap(int sig)
+{
+    sig_flag(sig);
     selfpipe_ping();
     return;
 }
 
 
+/* perpd_sigfd_init()
+**   setup signalfd for signals handled by perpd (linux)
+**   signals then remain blocked, and are read by perpd_sigfd_read()
+**   on failure fd_signal is left -1: signals are caught by sig_trap()
+*/
+static
+void
+perpd_sigfd_init(void)
+{
+#ifdef PERPD_SIGNALFD
+  sigset_t  set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigaddset(&set, SIGHUP);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGPIPE);
+  sigaddset(&set, SIGUSR2);
+  fd_signal = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+  if(fd_signal == -1){
+      log_debug("signalfd() not available, using selfpipe");
+  }
+#endif
+
+  return;
+}
+
+
+/* perpd_sigfd_read()
+**   read pending signals from signalfd and set signal flags
+*/
+static
+void
+perpd_sigfd_read(void)
+{
+#ifdef PERPD_SIGNALFD
+  struct signalfd_siginfo  si;
+  ssize_t                  r;
+
+  for(;;){
+      do{
+          r = read(fd_signal, &si, sizeof si);
+      }while((r == -1) && (errno == EINTR));
+      if(r != (ssize_t)(sizeof si)){
+          break;
+      }
+      sig_flag((int)si.ssi_signo);
+  }
+#endif
+
+  return;
+}
+
+
 /* perpd_trigger_scan()
 **   uses selfpipe_ping() to trigger rescan from mainloop
 **   think: "fake_hup"
@@ -185,44 +303,173 @@ perpd_trigger_fail(void)
 
 
 /* perpd_lookup():
-**   scan svdefs[] for dev, ino
+**   find svdef in svtab of base for dev, ino
 **   return:
 **     NULL: not found
 **     non-null: found, pointer to svdef
 */
 struct svdef *
-perpd_lookup(dev_t dev, ino_t ino)
+perpd_lookup(struct perpd_base *base, dev_t dev, ino_t ino)
 {
-  int  i;
-  for(i = 0; i < nservices; ++i){
-      if((svdefs[i].ino == ino) && (svdefs[i].dev == dev)){
-          /* found: */
-          return &svdefs[i];
+  return perpd_svtab_lookup(&base->svtab, dev, ino);
+}
+
+
+/* perpd_lookupname():
+**   find svdef in svtab of base for name
+**   return:
+**     NULL: not found
+**     non-null: found, pointer to svdef
+*/
+struct svdef *
+perpd_lookupname(struct perpd_base *base, const char *name)
+{
+  return perpd_svtab_lookupname(&base->svtab, name);
+}
+
+
+/* perpd_rename():
+**   set name of svdef in svtab of its base
+*/
+void
+perpd_rename(struct svdef *svdef, const char *name)
+{
+  perpd_svtab_rename(&svdef->base->svtab, svdef, name);
+  perpd_statfile_mark(svdef);
+}
+
+
+/* perpd_nservices():
+**   total of active services in all base directories
+*/
+static
+size_t
+perpd_nservices(void)
+{
+  size_t  n = 0;
+  size_t  b;
+
+  for(b = 0; b < nbases; ++b){
+      n += bases[b].svtab.n;
+  }
+
+  return n;
+}
+
+
+/* perpd_nofile_init()
+**   raise soft limit on open descriptors (to hard limit, as needed)
+**   for arg_connmax client connections, plus room for services
+**   warn on failure
+*/
+static
+void
+perpd_nofile_init(void)
+{
+  struct rlimit  rl;
+  rlim_t         want = (rlim_t)arg_connmax + (nbases * PERPD_SVTAB_INIT);
+
+  if(getrlimit(RLIMIT_NOFILE, &rl) == -1){
+      warn_syserr("failure getrlimit() on RLIMIT_NOFILE");
+      return;
+  }
+  if((rl.rlim_cur == RLIM_INFINITY) || (rl.rlim_cur >= want)){
+      return;
+  }
+
+  if((rl.rlim_max != RLIM_INFINITY) && (rl.rlim_max < want)){
+      log_warning("descriptor limit too low for requested client connections");
+      want = rl.rlim_max;
+  }
+  rl.rlim_cur = want;
+  if(setrlimit(RLIMIT_NOFILE, &rl) == -1){
+      warn_syserr("failure setrlimit() on RLIMIT_NOFILE");
+  }
+
+  return;
+}
+
+
+/* perpd_bases_init()
+**   setup bases[] from the base directory arguments
+**   (default from PERP_BASE, else PERP_BASE_DEFAULT)
+**   abort on fail
+*/
+static
+void
+perpd_bases_init(char *argv[])
+{
+  static char        *argv_default[2] = {NULL, NULL};
+  struct perpd_base  *base;
+  struct stat         st;
+  dev_t              *devs;
+  ino_t              *inos;
+  size_t              i, j, n;
+
+  if(argv[0] == NULL){
+      argv_default[0] = getenv("PERP_BASE");
+      if((argv_default[0] == NULL) || (argv_default[0][0] == '\0'))
+          argv_default[0] = PERP_BASE_DEFAULT;
+      argv = argv_default;
+  }
+  for(n = 0; argv[n] != NULL; ++n){/*empty*/;}
+
+  bases = (struct perpd_base *)calloc(n, sizeof(struct perpd_base));
+  devs = (dev_t *)malloc(n * sizeof(dev_t));
+  inos = (ino_t *)malloc(n * sizeof(ino_t));
+  if((bases == NULL) || (devs == NULL) || (inos == NULL)){
+      errno = ENOMEM;
+      fatal_syserr("failure allocating base directories");
+  }
+
+  for(i = 0; i < n; ++i){
+      base = &bases[i];
+      base->path = argv[i];
+      if(base->path[0] != '/'){
+          fatal_usage("base directory not defined as absolute path: ", base->path);
+      }
+      if((base->fd_dir = open(base->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1){
+          fatal_syserr("failure open() on base directory ", base->path);
       }
+      if(fstat(base->fd_dir, &st) == -1){
+          fatal_syserr("failure fstat() on base directory ", base->path);
+      }
+      for(j = 0; j < i; ++j){
+          if((devs[j] == st.st_dev) && (inos[j] == st.st_ino)){
+              fatal_usage("base directory given more than once: ", base->path);
+          }
+      }
+      devs[i] = st.st_dev;
+      inos[i] = st.st_ino;
+      base->fd_pidlock = -1;
+      base->fd_listen = -1;
+      base->fd_seq = -1;
+      base->statfile.fd = -1;
   }
+  nbases = n;
 
-  /* not found: */
-  return NULL;
+  free(devs);
+  free(inos);
+
+  return;
 }
 
 
 /* perpd_control_init()
-**   setup/initialize perp control directory
+**   setup/initialize perp control directory of base
 **   abort on fail
 **
 **   notes:
-**     cwd is basedir on entry/exit
+**     cwd is base directory on exit
 */
 static
 void
-perpd_control_init(void)
+perpd_control_init(struct perpd_base *base)
 {
-  int  fdbase;  
   int  fd = -1;
 
-  /* setup for return to base directory: */
-  if((fdbase = open(".", O_RDONLY)) == -1){
-      fatal_syserr("failure open() on base directory");
+  if(fchdir(base->fd_dir) == -1){
+      fatal_syserr("failure fchdir() to base directory ", base->path);
   }
 
   /* setup umask for intentional mode on file creation: */
@@ -239,184 +486,358 @@ perpd_control_init(void)
               mkdir(pathbuf, 0700); /* ignore failure */
           } else {
               errno = ENAMETOOLONG;
-              fatal_syserr("failure readlink() on base control directory");
+              fatal_syserr("failure readlink() on control directory in ", base->path);
           }
       }
       /* ignoring other errors */
   }
 
   if(chdir(PERP_CONTROL) != 0){
-      fatal_syserr("failure chdir() to ", PERP_CONTROL);
+      fatal_syserr("failure chdir() to ", PERP_CONTROL, " in ", base->path);
+  }
+
+  /* pidlock and sockets held over re-exec: */
+  if(base->fd_listen != -1){
+      if(fchdir(base->fd_dir) == -1){
+          fatal_syserr("failure fchdir() to base directory ", base->path);
+      }
+      return;
   }
 
   /* initialize pidlock (for single server instance): */
   fd = pidlock_set(PERPD_PIDLOCK, my_pid, PIDLOCK_NOW);
   if(fd == -1){
-      fatal_syserr("failure on lock file ", PERPD_PIDLOCK);
+      fatal_syserr("failure on lock file ", PERPD_PIDLOCK, " in ", base->path);
   }
   fd_cloexec(fd);
-  fd_pidlock = fd;
+  base->fd_pidlock = fd;
 
   /* create listening socket and bind: */
   fd = domsock_create(PERPD_SOCKET, 0700);
   if(fd == -1){
-      fatal_syserr("failure bind() on socket ", PERPD_SOCKET);
+      fatal_syserr("failure bind() on socket ", PERPD_SOCKET, " in ", base->path);
   }
   if(arg_gid != (gid_t)-1){
       /* open socket to members of group: */
       if(chown(PERPD_SOCKET, (uid_t)-1, arg_gid) == -1){
-          fatal_syserr("failure chown() on socket ", PERPD_SOCKET);
+          fatal_syserr("failure chown() on socket ", PERPD_SOCKET, " in ", base->path);
       }
       if(chmod(PERPD_SOCKET, 0770) == -1){
-          fatal_syserr("failure chmod() on socket ", PERPD_SOCKET);
+          fatal_syserr("failure chmod() on socket ", PERPD_SOCKET, " in ", base->path);
       }
   }
-  if(domsock_listen(fd, PERPD_CONNMAX) == -1){
-      fatal_syserr("failure listen() on socket ", PERPD_SOCKET); 
+  if(domsock_listen(fd, (int)arg_connmax) == -1){
+      fatal_syserr("failure listen() on socket ", PERPD_SOCKET, " in ", base->path);
   }
   if(fd_nonblock(fd) == -1){
-      fatal_syserr("failure fcntl() non-blocking on socket ", PERPD_SOCKET);
+      fatal_syserr("failure fcntl() non-blocking on socket ", PERPD_SOCKET, " in ", base->path);
   }
   fd_cloexec(fd);
-  fd_listen = fd;
+  base->fd_listen = fd;
 
-  /* restore cwd: */
-  if(fchdir(fdbase) == -1){
-      fatal_syserr("failure fchdir() to base directory");
+  /* socket for protocol 3: */
+  perpd_control_seq(base);
+
+  /* return to base directory: */
+  if(fchdir(base->fd_dir) == -1){
+      fatal_syserr("failure fchdir() to base directory ", base->path);
   }
-  close(fdbase);
+
+  return;
+}
+
+
+/* perpd_control_seq()
+**   create listening socket for protocol 3 messages in control directory
+**   of base (cwd)
+**   a platform without SOCK_SEQPACKET in the local domain is not fatal:
+**   perpd continues on PERPD_SOCKET alone, and clients fall back to
+**   protocol 2 (for which any stale socket file is removed)
+*/
+static
+void
+perpd_control_seq(struct perpd_base *base)
+{
+  int  fd;
+
+  fd = domsock_createseq(PERPD_SEQSOCKET, 0700);
+  if(fd == -1){
+      if((errno == EPROTONOSUPPORT) || (errno == ESOCKTNOSUPPORT)
+         || (errno == EPROTOTYPE)){
+          log_warning("socket type not supported for ", PERPD_SEQSOCKET,
+                      " in ", base->path, ", serving protocol 2 only");
+          unlink(PERPD_SEQSOCKET);
+          return;
+      }
+      fatal_syserr("failure bind() on socket ", PERPD_SEQSOCKET, " in ", base->path);
+  }
+  if(arg_gid != (gid_t)-1){
+      if(chown(PERPD_SEQSOCKET, (uid_t)-1, arg_gid) == -1){
+          fatal_syserr("failure chown() on socket ", PERPD_SEQSOCKET, " in ", base->path);
+      }
+      if(chmod(PERPD_SEQSOCKET, 0770) == -1){
+          fatal_syserr("failure chmod() on socket ", PERPD_SEQSOCKET, " in ", base->path);
+      }
+  }
+  if(domsock_listen(fd, (int)arg_connmax) == -1){
+      fatal_syserr("failure listen() on socket ", PERPD_SEQSOCKET, " in ", base->path);
+  }
+  if(fd_nonblock(fd) == -1){
+      fatal_syserr("failure fcntl() non-blocking on socket ", PERPD_SEQSOCKET, " in ", base->path);
+  }
+  fd_cloexec(fd);
+  base->fd_seq = fd;
 
   return;
 }
 
 
 /* perpd_cull()
-**   scan svdefs[] and cull any deactivated services
+**   remove deactivated svdef from svtab of its base
+**   caller has checked perpd_svdef_cullok()
+**
+**   side effects:
+**     the last svdef in svtab.svdefs[] is moved into the slot of svdef
+**     (and marked for its new record in the status file)
 */
 static
 void
-perpd_cull(void)
+perpd_cull(struct svdef *svdef)
 {
-  int  i = 0;
-
-  while(i < nservices){
-      if(perpd_svdef_cullok(&svdefs[i])){
-          log_info("deactivating service ", svdefs[i].name);
-          perpd_svdef_close(&svdefs[i]);
-          --nservices;
-          svdefs[i] = svdefs[nservices];
-          continue;
+  struct svtab  *svtab = &svdef->base->svtab;
+  size_t         slot = svdef->slot;
+
+  log_info("deactivating service ", svdef->name);
+  perpd_conn_notify(svdef, SUBSV_MAIN, PERPD_EVENT_CULL, 0);
+  perpd_startq_drop(svdef);
+  perpd_inotify_unwatch(svdef);
+  perpd_svdef_close(svdef);
+  perpd_svtab_drop(svtab, svdef);
+  if(slot < svtab->n){
+      perpd_statfile_mark(svtab->svdefs[slot]);
+  }
+
+  return;
+}
+
+
+/* perpd_deadline()
+**   timer callback: shutdown deadline reached
+**   SIGKILL to all service processes still running, and again each
+**   second until termination complete (bounding any "reset")
+*/
+static
+void
+perpd_deadline(struct perpd_timer *timer)
+{
+  struct svtab  *svtab;
+  struct svdef  *svdef;
+  tain_t         now, when;
+  char           nbuf[NFMT_SIZE];
+  size_t         n = perpd_nservices();
+  size_t         b, j;
+
+  log_warning("shutdown deadline reached, killing ",
+              nfmt_uint32(nbuf, (uint32_t)n), " remaining ",
+              (n == 1) ? "service" : "services");
+  for(b = 0; b < nbases; ++b){
+      svtab = &bases[b].svtab;
+      for(j = 0; j < svtab->n; ++j){
+          svdef = svtab->svdefs[j];
+          /* (process group as for stop timeout, or any "down" with -g:) */
+          perpd_svdef_kill(svdef, SUBSV_MAIN,
+                           svdef->svpair[SUBSV_MAIN].killpg || svdef->killpg);
+          if(svdef->bitflags & SVDEF_FLAG_HASLOG){
+              perpd_svdef_kill(svdef, SUBSV_LOG,
+                               svdef->svpair[SUBSV_LOG].killpg || svdef->killpg);
+          }
       }
-      ++i;
+  }
+
+  tain_now(&now);
+  tain_LOAD(&when, 1, 0);
+  tain_plus(&when, &now, &when);
+  if(perpd_timer_set(timer, &when, &perpd_deadline, NULL) == -1){
+      warn_syserr("failure setting shutdown deadline");
   }
 
   return;
 }
 
 
-/* perpd_waitup()
-**   waitpid on sigchld
-**   called by perpd_mainloop()
+/* perpd_reap()
+**   process service process of pident terminated with wstat,
+**   with resource usage ru
+**   called by perpd_waitup(), perpd_waitpidfd()
 **   if service is set for cull and reaches cull state:
 **     - harvest services at cull state
 **
+**   return:
+**     1: service is complete and wants reactivation (trigger scan)
+**     0: otherwise
+**
 **   side effects:
-**     any cull harvest will decrement nservices, reorder svdefs[]
+**     any cull harvest will remove the svdef from svtab
+*/
+static
+int
+perpd_reap(struct pident *pident, int wstat, const struct rusage *ru)
+{
+  struct svdef   *svdef = pident->svdef;
+  int             which = pident->which;
+  struct subsv   *subsv;
+  int             got_cycle = 0;
+
+  /* health check: */
+  if(which == SUBSV_CHECK){
+      perpd_svdef_checkdone(svdef, wstat);
+      /* cull now if deactivated: */
+      if(perpd_svdef_cullok(svdef)){
+          got_cycle = (svdef->bitflags & SVDEF_FLAG_CYCLE) ? 1 : 0;
+          perpd_cull(svdef);
+      }
+      return got_cycle;
+  }
+
+  subsv = &svdef->svpair[which];
+
+  perpd_conn_notify(svdef, which, PERPD_EVENT_EXIT, wstat);
+  perpd_svdef_tally(svdef, which, wstat, ru);
+  if((which == SUBSV_MAIN) && !(subsv->bitflags & SUBSV_FLAG_ISRESET)){
+      /* no longer starting from start queue, nor ready: */
+      perpd_startq_done(svdef);
+      perpd_svdef_notifyclose(svdef);
+  }
+  perpd_pidtab_del(&pidtab, pident);
+  subsv->pid = 0;
+  subsv->wstat = wstat;
+  /* if terminating from running "once", set want down: */
+  if(subsv->bitflags & SUBSV_FLAG_ISONCE){
+      subsv->bitflags |= SUBSV_FLAG_WANTDOWN;
+  }
+
+  /* check for reset/restart: */
+  if(!(subsv->bitflags & SUBSV_FLAG_ISRESET)){
+      /* subsv exited from start, always run reset: */
+      log_debug("service ", svdef->name, " (",
+                (which == SUBSV_MAIN) ? "main)" : "log)",
+                " terminated");
+      perpd_svdef_run(svdef, which, SVRUN_RESET);
+      return 0;
+  }
+  /* else subsv exited from reset; restart if not wantdown: */
+  if(!(subsv->bitflags & SUBSV_FLAG_WANTDOWN)){
+      log_debug("restarting service ", svdef->name, " (",
+                (which == SUBSV_MAIN) ? "main)" : "log)");
+      perpd_svdef_run(svdef, which, SVRUN_START);
+      return 0;
+  }
+  /* else subsv wantsdown, and is down: */
+  perpd_timer_cancel(&subsv->stop);
+  /* initiate log termination too? */
+  if((which == SUBSV_MAIN) && (svdef->bitflags & SVDEF_FLAG_HASLOG)){
+      subsv = &svdef->svpair[SUBSV_LOG];
+      if((subsv->bitflags & SUBSV_FLAG_WANTDOWN) && (subsv->pid > 0)){
+          if(!(subsv->bitflags & SUBSV_FLAG_ISRESET)){
+              /* shutdown logger if not already running reset: */
+              close(svdef->logpipe[1]);
+              close(svdef->logpipe[0]);
+              svdef->logpipe[0] = svdef->logpipe[1] = -1;
+              perpd_pidtab_kill(&subsv->pident, SIGTERM);
+          }
+          /* make sure not paused (even if running reset): */
+          perpd_pidtab_kill(&subsv->pident, SIGCONT);
+          subsv->bitflags &= ~SUBSV_FLAG_ISPAUSED;
+          perpd_svdef_stop(svdef, SUBSV_LOG, 0);
+          return 0;
+      }
+  }
+
+  /*
+  **  else:
+  **    - subsv exited from reset
+  **    - wants down
+  **    - and svdef is all done
+  **
+  **  check if service wants reactivation:
+  */ 
+  if(svdef->bitflags & SVDEF_FLAG_CYCLE){
+      log_debug("setting up reactivation following deactivation for ", svdef->name);
+      ++got_cycle;
+  }
+  /* cull now if deactivated: */
+  if(perpd_svdef_cullok(svdef)){
+      perpd_cull(svdef);
+  }
+
+  return got_cycle;
+}
+
+
+/* perpd_waitup()
+**   wait4(-1) on sigchld
+**   called by perpd_mainloop()
+**   (with pidfds, needed only for processes without pidfd)
 */
 static
 void
 perpd_waitup(void)
 {
-  struct subsv  *subsv;
-  pid_t          pid;
-  int            wstat;
-  int            which;
-  int            got_cull = 0;
-  int            got_cycle = 0;
-  int            i;
+  struct pident  *pident;
+  struct rusage   ru;
+  pid_t           pid;
+  int             wstat;
+  int             got_cycle = 0;
 
-  while((pid = waitpid(-1, &wstat, WNOHANG)) > 0){
+  while((pid = wait4(-1, &wstat, WNOHANG, &ru)) > 0){
       /* find dead child: */
-      which = -1;
-      for(i = 0; i < nservices; ++i){
-          if(pid == svdefs[i].svpair[SUBSV_MAIN].pid){
-              which = SUBSV_MAIN;
-              break;
-          }else if(pid == svdefs[i].svpair[SUBSV_LOG].pid){
-              which = SUBSV_LOG;
-              break;
-          }
-      }
-      if(which == -1){
+      if((pident = perpd_pidtab_lookup(&pidtab, pid)) == NULL){
           log_debug("not my child");
           continue;
       }
+      got_cycle |= perpd_reap(pident, wstat, &ru);
+  }
 
-      subsv = &svdefs[i].svpair[which];
-      subsv->pid = 0;
-      subsv->wstat = wstat;
-      /* if terminating from running "once", set want down: */
-      if(subsv->bitflags & SUBSV_FLAG_ISONCE){
-          subsv->bitflags |= SUBSV_FLAG_WANTDOWN;
-      }
+  if(got_cycle){
+      /* trigger a perpd_scan() to reactivate this service: */
+      log_debug("triggering a perpd_scan() for service reactivation");
+      perpd_trigger_scan();
+  }
 
-      /* check for reset/restart: */
-      if(!(subsv->bitflags & SUBSV_FLAG_ISRESET)){
-          /* subsv exited from start, always run reset: */
-          log_debug("service ", svdefs[i].name, " (",
-                    (which == SUBSV_MAIN) ? "main)" : "log)",
-                    " terminated");
-          perpd_svdef_run(&svdefs[i], which, SVRUN_RESET);
-          continue;
-      }
-      /* else subsv exited from reset; restart if not wantdown: */
-      if(!(subsv->bitflags & SUBSV_FLAG_WANTDOWN)){
-          log_debug("restarting service ", svdefs[i].name, " (",
-                    (which == SUBSV_MAIN) ? "main)" : "log)");
-          perpd_svdef_run(&svdefs[i], which, SVRUN_START);
-          continue;
-      }
-      /* else subsv wantsdown; initiate log termination too? */
-      if((which == SUBSV_MAIN) && (svdefs[i].bitflags & SVDEF_FLAG_HASLOG)){
-          subsv = &svdefs[i].svpair[SUBSV_LOG];
-          if((subsv->bitflags & SUBSV_FLAG_WANTDOWN) && (subsv->pid > 0)){
-              if(!(subsv->bitflags & SUBSV_FLAG_ISRESET)){
-                  /* shutdown logger if not already running reset: */
-                  close(svdefs[i].logpipe[1]);
-                  close(svdefs[i].logpipe[0]);
-                  kill(subsv->pid, SIGTERM);
-              }
-              /* make sure not paused (even if running reset): */
-              kill(subsv->pid, SIGCONT);
-              subsv->bitflags &= ~SUBSV_FLAG_ISPAUSED;
-              continue;
-          }
-      }
+  return;
+}
 
-      /*
-      **  else:
-      **    - subsv exited from reset
-      **    - wants down
-      **    - and svdef is all done
-      **
-      **  check if set for culling:
-      */
-      if(perpd_svdef_cullok(&svdefs[i])){
-          ++got_cull;
-      }
-      /* check if service wants reactivation: */ 
-      if(svdefs[i].bitflags & SVDEF_FLAG_CYCLE){
-          log_debug("setting up reactivation following deactivation for ", svdefs[i].name);
-          ++got_cycle;
-      }
+
+/* perpd_waitpidfd()
+**   wait4() on process of pident, reported terminated by its pidfd
+**   called by perpd_mainloop()
+*/
+static
+void
+perpd_waitpidfd(struct pident *pident)
+{
+  struct rusage  ru;
+  pid_t          pid;
+  int            wstat;
+
+  /* already reaped by perpd_waitup()? */
+  if(pident->pidfd == -1){
+      return;
   }
 
-  /* cull any deactivated services: */
-  if(got_cull){
-      perpd_cull();
+  do{
+      pid = wait4(pident->pid, &wstat, WNOHANG, &ru);
+  }while((pid == -1) && (errno == EINTR));
+
+  if(pid != pident->pid){
+      /* pidfd ready, but process not waitable: */
+      if(pid == -1){
+          warn_syserr("failure wait4() for service ", pident->svdef->name);
+      }
+      return;
   }
 
-  if(got_cycle){
+  if(perpd_reap(pident, wstat, &ru)){
       /* trigger a perpd_scan() to reactivate this service: */
       log_debug("triggering a perpd_scan() for service reactivation");
       perpd_trigger_scan();
@@ -428,7 +849,10 @@ perpd_waitup(void)
 
 
 /* perpd_svdir_stat()
-**   stat dirname for valid service directory: name, isdir, and sticky
+**   stat dirname in base directory for valid service directory: name,
+**   isdir, and sticky
+**   an entry of type (as read by perpd_dir_next()) other than a directory
+**   or a symlink is refused without a stat
 **   called by perpd_scan()
 **
 **   returns:
@@ -442,22 +866,32 @@ perpd_waitup(void)
 **
 **   note:
 **     errno is *not* left set on stat() failure
+**     an entry gone since it was read is passed over quietly (but not a
+**     dangling symlink)
 */
 static
 const struct stat *
-perpd_svdir_stat(const char *dirname)
+perpd_svdir_stat(struct perpd_base *base, const char *dirname, int type)
 {
   /* note: maintaining persistent stat object! */
   static struct stat  st;
 
-  /* ignore if leading '.': */
-  if(dirname[0] == '.'){
+  /* ignore if leading '.', or not a possible directory: */
+  if((dirname[0] == '.') || !PERPD_DT_MAYDIR(type)){
+      return NULL;
+  }
+
+  /* ignore if name too long for a service name: */
+  if(cstr_len(dirname) > PERPD_NAMEMAX){
+      log_warning("ignoring service directory with name too long: ", dirname);
       return NULL;
   }
 
-  /* get the stat: */
-  if(stat(dirname, &st) == -1){
-      warn_syserr("failure stat() on ", dirname);
+  /* get the stat (following a symlink): */
+  if(fstatat(base->fd_dir, dirname, &st, 0) == -1){
+      if((errno != ENOENT) || PERPD_DT_ISLNK(type)){
+          warn_syserr("failure stat() on ", dirname);
+      }
       /* clear errno: */
       errno = 0;
       return NULL;
@@ -473,14 +907,110 @@ perpd_svdir_stat(const char *dirname)
 }
 
 
+/* perpd_scan_keep()
+**   service svdef found again at svdir in its base directory
+*/
+static
+void
+perpd_scan_keep(struct svdef *svdef, const char *svdir)
+{
+  /* keeper, reflag service as active: */
+  perpd_svdef_keep(svdef, svdir);
+  if(svdef->bitflags & SVDEF_FLAG_CULL){
+      /* deactivation in progress but not yet complete:
+      **   - because something is still running
+      **   - set FLAG_CYCLE to reactivate
+      **   - perpd_waitup() will trigger rescan when ready to reactivate
+      */
+      log_debug("setting reactivation flag for ", svdir);
+      svdef->bitflags |= SVDEF_FLAG_CYCLE;
+      perpd_statfile_mark(svdef);
+  }
+
+  return;
+}
+
+
+/* perpd_scan_new()
+**   activate new service found at svdir (with stat st) in base directory
+**   return:
+**     svdef of service activated
+**     NULL: failure (activation to be retried on a rescan)
+*/
+static
+struct svdef *
+perpd_scan_new(struct perpd_base *base, const char *svdir, const struct stat *st)
+{
+  struct svdef  *svdef;
+
+  if((svdef = perpd_svtab_new(&base->svtab)) == NULL){
+      warn_syserr("unable to activate new service ", svdir);
+      return NULL;
+  }
+  /* activate and first start: */
+  if(perpd_svdef_activate(svdef, base, svdir, st) == -1){
+      log_warning("unable to activate new service ", svdir);
+      free(svdef);
+      return NULL;
+  }
+
+  /* service activation successful: */
+  svdef->bitflags |= SVDEF_FLAG_ACTIVE;
+  perpd_svtab_add(&base->svtab, svdef);
+  perpd_inotify_watch(svdef);
+  log_info("activated new service: ", svdir);
+
+  return svdef;
+}
+
+
+/* perpd_scan_drop()
+**   service svdef no longer found in its base directory:
+**   initiate its cull, or harvest it when cullable
+**   return:
+**     1: svdef culled (its slot in svtab refilled from end of svtab)
+**     0: svdef remains, deactivation in progress
+*/
+static
+int
+perpd_scan_drop(struct svdef *svdef)
+{
+  svdef->bitflags &= ~SVDEF_FLAG_ACTIVE;
+
+  if(!(svdef->bitflags & SVDEF_FLAG_CULL)){
+      /* initiate cull of service: */
+      if(perpd_svdef_wantcull(svdef) == 1){
+          /* this service is already in cull state, harvest now: */
+          perpd_cull(svdef);
+          return 1;
+      }
+  }else{
+      /* unset any FLAG_CYCLE: */
+      if(svdef->bitflags & SVDEF_FLAG_CYCLE){
+          svdef->bitflags &= ~SVDEF_FLAG_CYCLE;
+          perpd_statfile_mark(svdef);
+      }
+      /* check if cullable: */
+      if(perpd_svdef_cullok(svdef)){
+          /* this service is in cull state, harvest now: */
+          perpd_cull(svdef);
+          return 1;
+      }
+  }
+
+  return 0;
+}
+
+
 /* perpd_scan()
-**   scan the perp base directory
+**   scan the perp base directory of base
 **   activate new definitions
 **   deactivate ("cull") deleted definitions
 **
 **   side effects:
-**     activated services: svdefs[] and nservices
-**     harvested for cull: likewise
+**     cwd is base directory
+**     activated services: added to svtab of base
+**     harvested for cull: removed from svtab of base
 **     got_fail activation failure:
 **       - unexpected pipe()/open() failures in perpd_svdef_activate()
 **       - pause and setup rescan with perpd_trigger_scan()
@@ -489,20 +1019,32 @@ perpd_svdir_stat(const char *dirname)
 */
 static
 void
-perpd_scan(void)
+perpd_scan(struct perpd_base *base)
 {
-  DIR                *dir;
-  struct dirent      *d;
+  /* (shared by all bases, scanned one at a time): */
+  static uint64_t     scanbuf[PERPD_SCANBUF / sizeof(uint64_t)];
+  struct svtab       *svtab = &base->svtab;
+  struct perpd_dir    dir;
   const char         *svdir;
   const struct stat  *st;
   struct svdef       *svdef;
   tain_t              epause = tain_INIT(0, EPAUSE);
   int                 got_fail = 0;
-  int                 got_cull = 0;
-  int                 i, terrno;
+  size_t              i;
+  int                 type;
+  int                 terrno;
 
-  if((dir = opendir(".")) == NULL){
-      warn_syserr("failure opendir() for service scan");
+  /* (a full scan settles any changes watched with inotify:) */
+  base->rescan = 0;
+  base->nlinks = 0;
+  perpd_inotify_base(base);
+
+  if(fchdir(base->fd_dir) == -1){
+      warn_syserr("failure fchdir() to base directory ", base->path);
+      return;
+  }
+  if(perpd_dir_open(&dir, base->fd_dir, (uchar_t *)scanbuf, sizeof scanbuf) == -1){
+      warn_syserr("failure opendir() for service scan in ", base->path);
       return;
   }
 
@@ -510,8 +1052,8 @@ perpd_scan(void)
   ** unflag as active all existing services
   ** (active services will be reflagged during scan)
   */
-  for(i = 0; i < nservices; ++i){
-      svdefs[i].bitflags &= ~SVDEF_FLAG_ACTIVE;
+  for(i = 0; i < svtab->n; ++i){
+      svtab->svdefs[i]->bitflags &= ~SVDEF_FLAG_ACTIVE;
   }
 
   /* reset errno before scanning: */
@@ -520,56 +1062,36 @@ perpd_scan(void)
   for(;;){
 
       /* loop terminal (end of directory): */
-      if((d = readdir(dir)) == NULL){
+      if((svdir = perpd_dir_next(&dir, &type)) == NULL){
           break;
       }
 
-      svdir = d->d_name;
-      if((st = perpd_svdir_stat(svdir)) == NULL){
-          /* ignore this dirent: */
+      if((st = perpd_svdir_stat(base, svdir, type)) == NULL){
+          /* ignore this dirent (its target unwatched if a symlink): */
+          if(PERPD_DT_ISLNK(type) && (svdir[0] != '.')) ++base->nlinks;
           continue;
       }
 
       /* otherwise, scan existing services for this dev/ino: */
-      svdef = perpd_lookup(st->st_dev, st->st_ino);
+      svdef = perpd_lookup(base, st->st_dev, st->st_ino);
       if(svdef != NULL){
-          /* keeper, reflag service as active: */
-          perpd_svdef_keep(svdef, svdir);
-          if(svdef->bitflags & SVDEF_FLAG_CULL){
-              /* deactivation in progress but not yet complete:
-              **   - because something is still running
-              **   - set FLAG_CYCLE to reactivate
-              **   - perpd_waitup() will trigger rescan when ready to reactivate
-              */
-              log_debug("setting reactivation flag for ", svdir);
-              svdef->bitflags |= SVDEF_FLAG_CYCLE;
+          perpd_scan_keep(svdef, svdir);
+      }else{
+          /* else, activate new service: */
+          /* explicitly shield errno from perpd_scan_new(): */
+          terrno = errno;
+          svdef = perpd_scan_new(base, svdir, st);
+          if(svdef == NULL){
+              ++got_fail;
           }
-          continue;
-      }
-      /* else, activate new service: */
-      if(!(nservices < PERP_MAX)){
-          log_warning("unable to activate new service ", svdir, ": too many services");
-          ++got_fail;
-          continue;
+          errno = terrno;
       }
-      /* activate and first start: */
-      /* explicitly shield errno from perpd_svdef_activate(): */
-      terrno = errno;
-      if(perpd_svdef_activate(&svdefs[nservices], svdir, st) == -1){
-          log_warning("unable to activate new service ", svdir);
-          ++got_fail;
-      } else {
-          /* service activation successful: */
-          svdefs[nservices].bitflags |= SVDEF_FLAG_ACTIVE;
-          ++nservices;
-          log_info("activated new service: ", svdir);
+      if(PERPD_DT_ISLNK(type) && ((svdef == NULL) || (svdef->wd == 0))){
+          ++base->nlinks;
       }
-      errno = terrno;
   }
 
-  terrno = errno;
-  closedir(dir);
-  errno = terrno;
+  perpd_dir_close(&dir);
 
   /* note:
   **   want to assess errno only from readdir()
@@ -578,7 +1100,7 @@ perpd_scan(void)
   */
 
   if(errno){
-      warn_syserr("failure readdir() while scanning base directory");
+      warn_syserr("failure readdir() while scanning base directory ", base->path);
       log_warning("pausing on base directory scanning failure...");
       tain_pause(&epause, NULL);
       /* trigger rescan: */
@@ -588,29 +1110,14 @@ perpd_scan(void)
   }
 
   /* initiate/check cull on any services not flagged active: */
-  for(i = 0; i < nservices; ++i){
-      if(!(svdefs[i].bitflags & SVDEF_FLAG_ACTIVE)){
-          if(!(svdefs[i].bitflags & SVDEF_FLAG_CULL)){
-              /* initiate cull of service: */
-              if(perpd_svdef_wantcull(&svdefs[i]) == 1){
-                  /* this service is already in cull state: */
-                  ++got_cull;
-              }
-          }else{
-              /* unset any FLAG_CYCLE: */
-              svdefs[i].bitflags &= ~SVDEF_FLAG_CYCLE;
-              /* check if cullable: */
-              if(perpd_svdef_cullok(&svdefs[i])){
-                  /* this service is in cull state: */
-                  ++got_cull;
-              }
-          }
+  i = 0;
+  while(i < svtab->n){
+      svdef = svtab->svdefs[i];
+      if(!(svdef->bitflags & SVDEF_FLAG_ACTIVE) && perpd_scan_drop(svdef)){
+          /* (svdefs[i] now refilled from end of svtab) */
+          continue;
       }
-  }
-
-  /* harvest any services ready for cull (from perpd_svdef_wantcull() above): */
-  if(got_cull){
-      perpd_cull();
+      ++i;
   }
 
   /* too many services or activation failures in perpd_svdef_activate(): */
@@ -625,19 +1132,345 @@ perpd_scan(void)
 }
 
 
+#ifdef PERPD_INOTIFY
+/* perpd_scan_name()
+**   incremental scan of directory name changed in base directory
+**   (gone if known to be removed, without a stat):
+**     a service known by name no longer at name is dropped
+**     a service directory at name is kept, or activated as new
+**   renames and entries other than directories (as symlinks) are left to
+**   a full scan, as a service may be found again under another name
+*/
+static
+void
+perpd_scan_name(struct perpd_base *base, const char *name, int gone)
+{
+  const struct stat  *st = NULL;
+  struct svdef       *svdef = NULL;
+  struct svdef       *old;
+
+  if(!gone){
+      st = perpd_svdir_stat(base, name, DT_DIR);
+  }
+  if(st != NULL){
+      svdef = perpd_lookup(base, st->st_dev, st->st_ino);
+  }
+
+  old = perpd_lookupname(base, name);
+  if((old != NULL) && (old != svdef)){
+      perpd_scan_drop(old);
+  }
+
+  if(st == NULL){
+      return;
+  }
+  if(svdef != NULL){
+      perpd_scan_keep(svdef, name);
+      return;
+  }
+  if(perpd_scan_new(base, name, st) == NULL){
+      /* retry on a full scan: */
+      perpd_trigger_scan();
+  }
+
+  return;
+}
+#endif
+
+
+/* perpd_inotify_init()
+**   with autoscan on linux, setup inotify watches on each base directory,
+**   and on the directory of each service already active (as on re-exec)
+**   on failure fd_inotify is left -1: changes are found by full scans only
+*/
+static
+void
+perpd_inotify_init(void)
+{
+#ifdef PERPD_INOTIFY
+  struct svtab  *svtab;
+  size_t         b, j;
+
+  if(arg_autoscan == 0){
+      return;
+  }
+  fd_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(fd_inotify == -1){
+      warn_syserr("failure inotify_init(), base directories scanned in full only");
+      return;
+  }
+  for(b = 0; b < nbases; ++b){
+      perpd_inotify_base(&bases[b]);
+      svtab = &bases[b].svtab;
+      for(j = 0; j < svtab->n; ++j){
+          perpd_inotify_watch(svtab->svdefs[j]);
+      }
+  }
+#endif
+
+  return;
+}
+
+
+/* perpd_inotify_base()
+**   setup inotify watch on base directory, if not yet watched:
+**   for entries created, deleted, renamed, or changed in attributes (as
+**   the sticky bit), and for the base directory itself moved or removed
+*/
+static
+void
+perpd_inotify_base(struct perpd_base *base)
+{
+#ifdef PERPD_INOTIFY
+  if((fd_inotify == -1) || (base->wd > 0)){
+      return;
+  }
+  base->wd = inotify_add_watch(fd_inotify, base->path,
+                               IN_CREATE | IN_DELETE | IN_ATTRIB
+                               | IN_MOVED_FROM | IN_MOVED_TO
+                               | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+  if(base->wd == -1){
+      warn_syserr("failure inotify_add_watch() on base directory ", base->path);
+      base->wd = 0;
+  }
+#else
+  (void)base;
+#endif
+
+  return;
+}
+
+
+/* perpd_inotify_watch()
+**   setup inotify watch on service directory of svdef, when reached by
+**   symlink from the base directory: for a change in attributes (as the
+**   sticky bit) or removal of the directory, which is not seen by the
+**   watch on the base directory
+**   a service without a watch (as beyond the limit of watches) is left to
+**   full scans
+*/
+static
+void
+perpd_inotify_watch(struct svdef *svdef)
+{
+#ifdef PERPD_INOTIFY
+  static int    warned = 0;
+  struct stat   st;
+  char          path[4096];
+  const char   *basepath = svdef->base->path;
+
+  svdef->wd = 0;
+  if(fd_inotify == -1){
+      return;
+  }
+  if((fstatat(svdef->base->fd_dir, svdef->name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+     || !S_ISLNK(st.st_mode)){
+      return;
+  }
+  if((cstr_len(basepath) + 1 + cstr_len(svdef->name)) >= sizeof path){
+      return;
+  }
+  cstr_vcopy(path, basepath, "/", svdef->name);
+  svdef->wd = inotify_add_watch(fd_inotify, path,
+                                IN_ATTRIB | IN_DELETE_SELF | IN_ONLYDIR);
+  if(svdef->wd == -1){
+      if(!warned){
+          warn_syserr("failure inotify_add_watch() on service ", svdef->name,
+                      ", services without watch scanned in full only");
+          warned = 1;
+      }
+      svdef->wd = 0;
+  }
+#else
+  svdef->wd = 0;
+#endif
+
+  return;
+}
+
+
+/* perpd_inotify_unwatch()
+**   remove inotify watch on service directory of svdef (as on cull)
+*/
+static
+void
+perpd_inotify_unwatch(struct svdef *svdef)
+{
+#ifdef PERPD_INOTIFY
+  if((fd_inotify != -1) && (svdef->wd > 0)){
+      inotify_rm_watch(fd_inotify, svdef->wd);
+  }
+#endif
+  svdef->wd = 0;
+
+  return;
+}
+
+
+#ifdef PERPD_INOTIFY
+/* inotify_base()
+**   base directory of inotify watch wd (or NULL)
+*/
+static
+struct perpd_base *
+inotify_base(int wd)
+{
+  size_t  b;
+
+  for(b = 0; b < nbases; ++b){
+      if(bases[b].wd == wd){
+          return &bases[b];
+      }
+  }
+
+  return NULL;
+}
+
+
+/* inotify_svdef()
+**   service of inotify watch wd (or NULL)
+*/
+static
+struct svdef *
+inotify_svdef(int wd)
+{
+  struct svtab  *svtab;
+  size_t         b, j;
+
+  for(b = 0; b < nbases; ++b){
+      svtab = &bases[b].svtab;
+      for(j = 0; j < svtab->n; ++j){
+          if(svtab->svdefs[j]->wd == wd){
+              return svtab->svdefs[j];
+          }
+      }
+  }
+
+  return NULL;
+}
+#endif
+
+
+/* perpd_inotify_read()
+**   read events from inotify, until EAGAIN, and rescan changes:
+**     each batch of events is taken in two passes: the first marks for a
+**     full scan any base with a rename, an entry other than a directory,
+**     a change on a service reached by symlink, or itself moved or removed
+**     (or all bases on queue overflow), and forgets watches removed; the
+**     second rescans by name the changes in bases not marked
+**   marked bases are then scanned in full
+*/
+static
+void
+perpd_inotify_read(void)
+{
+#ifdef PERPD_INOTIFY
+  static uint64_t              ibuf[4096 / sizeof(uint64_t)];
+  const struct inotify_event  *ev;
+  const uchar_t               *p, *end;
+  struct perpd_base           *base;
+  struct svdef                *svdef;
+  ssize_t                      r;
+  size_t                       b;
+  int                          pass;
+
+  for(;;){
+      do{
+          r = read(fd_inotify, ibuf, sizeof ibuf);
+      }while((r == -1) && (errno == EINTR));
+      if(r <= 0){
+          break;
+      }
+      if(flag_terminating){
+          continue;
+      }
+      end = (const uchar_t *)ibuf + r;
+
+      for(pass = 1; pass <= 2; ++pass){
+          for(p = (const uchar_t *)ibuf; p < end; p += sizeof *ev + ev->len){
+              ev = (const struct inotify_event *)p;
+              if(ev->mask & IN_Q_OVERFLOW){
+                  for(b = 0; b < nbases; ++b) bases[b].rescan = 1;
+                  continue;
+              }
+              if((base = inotify_base(ev->wd)) != NULL){
+                  if(pass == 1){
+                      if((ev->mask & (IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF
+                                      | IN_MOVE_SELF | IN_IGNORED))
+                         || ((ev->len > 0) && !(ev->mask & IN_ISDIR))){
+                          base->rescan = 1;
+                      }
+                      if(ev->mask & IN_IGNORED){
+                          log_warning("lost inotify watch on base directory ", base->path);
+                          base->wd = 0;
+                      }
+                  }else if(!base->rescan && (ev->len > 0)){
+                      perpd_scan_name(base, ev->name, (ev->mask & IN_DELETE) ? 1 : 0);
+                  }
+                  continue;
+              }
+              if((pass == 1) && ((svdef = inotify_svdef(ev->wd)) != NULL)){
+                  svdef->base->rescan = 1;
+                  if(ev->mask & IN_IGNORED){
+                      svdef->wd = 0;
+                  }
+              }
+          }
+      }
+  }
+
+  for(b = 0; b < nbases; ++b){
+      if(bases[b].rescan){
+          log_debug("full scan on inotify event in ", bases[b].path);
+          perpd_scan(&bases[b]);
+      }
+  }
+#endif
+
+  return;
+}
+
+
+/* perpd_autoscan_secs()
+**   interval of autoscan:
+**   as set with option -a, or at least PERPD_SAFESCAN while all base
+**   directories are watched with inotify, without any symlinked entry
+**   unwatched (full scans a safety net only)
+*/
+static
+uint32_t
+perpd_autoscan_secs(void)
+{
+  size_t  b;
+
+  if((fd_inotify == -1) || (arg_autoscan >= PERPD_SAFESCAN)){
+      return arg_autoscan;
+  }
+  for(b = 0; b < nbases; ++b){
+      if((bases[b].wd <= 0) || (bases[b].nlinks > 0)){
+          return arg_autoscan;
+      }
+  }
+
+  return PERPD_SAFESCAN;
+}
+
+
 /* perpd_mainloop()
 **
 ** The perpd event loop is conceptually simple -- though long-winded
 ** in its full elaboration.
 ** 
-** It is based on using poll() to multiplex a set of (non-blocking)
-** i/o events.
+** It is based on using perpd_ev (epoll, or poll() as fallback) to
+** multiplex a set of (non-blocking) i/o events.
 ** 
 ** The events are of three types:
 ** 
-**   * signal interrupts (arriving via selfpipe)
+**   * signal interrupts (arriving via signalfd, or selfpipe)
+**   * termination of service processes (arriving via pidfd, if supported)
 **   * read/write events for connected clients
-**   * new client connections on control socket
+**   * new client connections on the control socket of each base directory
+**   * changes in base directories (arriving via inotify, with autoscan)
 ** 
 ** The connections are set non-blocking to be sure the perpd server
 ** can never be "hung" by a non-responsive or malicious client.  This
@@ -648,55 +1481,105 @@ perpd_scan(void)
 ** position within the buffer.  The control packet protocol is defined
 ** in such a way to allow a completeness check after each read/write.
 ** 
-** Additionally, timestamps are applied to each client connection, so that
-** stale connections may be closed and culled prior to each new poll().
+** Client connections are registered edge-triggered where supported,
+** and perpd_conn_event() drives each ready client until EAGAIN.  New
+** connections are accepted in a batch until EAGAIN on each wakeup.
 **
-** This version of the function initializes the pollv[] vector to consider
-** only currently active connections on each poll().  The alternative is
-** to poll() on a pollv[] vector that includes all possible PERPD_CONNMAX
-** clients, whether active or inactive.
+** Additionally, timestamps are applied to each client connection, so that
+** stale connections may be closed and culled prior to each new wait.
+** Events queued for subscribed clients by perpd_conn_notify() during an
+** iteration are written out together by perpd_conn_flush() before the
+** next wait, as are the records in the status file of services changed
+** during the iteration, by perpd_statfile_flush().
+** Delayed service starts (the respawn governor) are held on the timer
+** queue of perpd_timer, and run when due after each wait.
+** Stop timeouts of services, and the shutdown deadline, are also held
+** on the timer queue, escalating to SIGKILL when due.
+** Readiness notifications from services (on a socketpair handed to
+** "start" of main) are read after each wait, ahead of reaping.
+** Newly activated services are started from the start queue of
+** perpd_startq after each scan, in order, to the limit of services
+** starting at once.
+** The wait timeout is set to the earliest of the next autoscan, the
+** next stale connection deadline, and the next timer.
+** With more than one base directory, each is scanned in turn, and the
+** clients of each are served from its own services; the loop, timers,
+** start queue and client connection pool are shared.
 */
 static
 void
 perpd_mainloop(void)
 {
-  struct perpd_conn  clients[PERPD_CONNMAX];
-  struct pollfd      pollv[PERPD_CONNMAX + 2];
-  tain_t             now;
+  struct perpd_evh   ev_selfpipe, ev_signal, ev_inotify;
+  struct perpd_evh  *readyv[PERPD_EVMAX];
+  struct perpd_evh  *evh;
+  struct perpd_base *base;
+  struct svtab      *svtab;
+  tain_t             now, diff;
+  tain_t             autoscan = tain_INIT(0, 0);
+  tain_t             when_scan = tain_INIT(0, 0);
+  uint32_t           scansecs = 0;
   tain_t             epause = tain_INIT(0, EPAUSE);
-  int                poll_max;
-  int                poll_interval, poll_remain;
-  int                connfd;
-  int                nconns = 0;
-  int                last_nconns = -1;
-  int                last_nservices = -1;
+  int                msecs, m;
+  int                got_listen, got_inotify;
+  size_t             nconns, nservices;
+  size_t             last_nconns = (size_t)-1;
+  size_t             last_nservices = (size_t)-1;
   int                nready;
   char               c, nbuf[NFMT_SIZE];
   int                i;
+  size_t             b, j;
 
-  /* fill pollv[] poll vector: */
-  /* selfpipe: */
-  pollv[0].fd = selfpipe[0];
-  pollv[0].events = POLLIN;
-  /* listening socket: */
-  pollv[1].fd = fd_listen;
-  pollv[1].events = POLLIN;
-
-  /* initialize clients[]: */
-  for(i = 0; i < PERPD_CONNMAX; ++i){
-      perpd_conn_reset(&clients[i]);
+  /* register selfpipe, signalfd and listening sockets: */
+  if(perpd_ev_add(&ev_selfpipe, selfpipe[0], PERPD_EV_IN,
+                  PERPD_EVK_MAIN, NULL) == -1){
+      fatal_syserr("failure registering selfpipe with event backend");
+  }
+  if((fd_signal != -1) &&
+     (perpd_ev_add(&ev_signal, fd_signal, PERPD_EV_IN,
+                   PERPD_EVK_MAIN, NULL) == -1)){
+      fatal_syserr("failure registering signalfd with event backend");
+  }
+  perpd_inotify_init();
+  if((fd_inotify != -1) &&
+     (perpd_ev_add(&ev_inotify, fd_inotify, PERPD_EV_IN,
+                   PERPD_EVK_MAIN, NULL) == -1)){
+      fatal_syserr("failure registering inotify with event backend");
+  }
+  for(b = 0; b < nbases; ++b){
+      base = &bases[b];
+      if(perpd_ev_add(&base->evh, base->fd_listen, PERPD_EV_IN,
+                      PERPD_EVK_MAIN, base) == -1){
+          fatal_syserr("failure registering socket with event backend for ", base->path);
+      }
+      if((base->fd_seq != -1) &&
+         (perpd_ev_add(&base->evh_seq, base->fd_seq, PERPD_EV_IN,
+                       PERPD_EVK_MAIN, base) == -1)){
+          fatal_syserr("failure registering socket with event backend for ", base->path);
+      }
   }
 
-  poll_max = ((int)arg_autoscan) ? ((int)arg_autoscan * 1000) : -1;
-  poll_interval = poll_max;
-  poll_remain = 0;
+  /* schedule first autoscan: */
+  if(arg_autoscan > 0){
+      tain_now(&now);
+      scansecs = perpd_autoscan_secs();
+      tain_LOAD(&autoscan, scansecs, 0);
+      tain_plus(&when_scan, &now, &autoscan);
+  }
 
   /* setup initial scan: */
   perpd_trigger_scan();
 
-  /* main poll loop: */
+  /* main event loop: */
   for(;;){
 
+      /* write out events to subscribers, and status file: */
+      perpd_conn_flush();
+      for(b = 0; b < nbases; ++b){
+          perpd_statfile_flush(&bases[b]);
+      }
+      nservices = perpd_nservices();
+
       /* loop terminal: */
       if(flag_terminating && (nservices == 0)){
           log_info("termination complete");
@@ -710,6 +1593,7 @@ perpd_mainloop(void)
                    (nservices == 1) ? "service" : "services");
           last_nservices = nservices;
       }
+      nconns = perpd_conn_count();
       if(last_nconns != nconns){
           log_info("monitoring ",
                    nfmt_uint32(nbuf, (uint32_t)nconns), " client ",
@@ -718,118 +1602,185 @@ perpd_mainloop(void)
       }
 
       /*
-      ** initializations for each poll:
+      ** initializations for each wait:
       */
 
-      /* close stale connections: */
+      /* close stale connections, timeout for next stale: */
       tain_now(&now);
-      for(i = 0; i < nconns; ++i){
-          if(clients[i].connfd != -1){
-              perpd_conn_checkstale(&clients[i], &now);
-          }
-      }
+      msecs = perpd_conn_checkstale(&now);
 
-      /* cull closed connections: */
-      i = 0;
-      while(i < nconns){
-          if(clients[i].connfd == -1){
-              --nconns;
-              clients[i] = clients[nconns];
-              continue;
-          }
-          ++i;
+      /* timeout for next timer: */
+      m = perpd_timer_msecs(&now);
+      if((m != -1) && ((msecs == -1) || (m < msecs))){
+          msecs = m;
       }
 
-      /* setup pollv[]: */       
-      for(i = 0; i < nconns; ++i){
-          pollv[2 + i].fd = clients[i].connfd;
-          switch(clients[i].state){
-          case PERPD_CONN_READING: pollv[2 + i].events = POLLIN; break;
-          case PERPD_CONN_WRITING: pollv[2 + i].events = POLLOUT; break;
-          default: pollv[2 + i].events = 0;
-          }
-      }
-
-      /* set poll_interval for autoscan: */
+      /* timeout for autoscan: */
       if(arg_autoscan > 0){
-          poll_interval = (poll_remain < 100) ? poll_max : poll_remain;
+          m = 0;
+          if(tain_less(&now, &when_scan)){
+              tain_minus(&diff, &when_scan, &now);
+              m = (int)tain_to_msecs(&diff) + 1;
+          }
+          if((msecs == -1) || (m < msecs)){
+              msecs = m;
+          }
       }
 
       /*
-      ** poll:
+      ** wait:
       */
 
-      /* poll() while signals unblocked: */
-      sigset_unblock(&poll_sigset);
-      {
-          /* listening socket is closed during shutdown: */
-          nfds_t  nfds = flag_terminating ? 1 : nconns + 2;
-          do{
-              nready = pollio(pollv, nfds, poll_interval, &poll_remain);
-          }while((nready == -1) && (errno == EINTR));
-      }
-      sigset_block(&poll_sigset);
+      /* wait while signals unblocked (signalfd: signals remain blocked): */
+      if(fd_signal == -1) sigset_unblock(&poll_sigset);
+      do{
+          nready = perpd_ev_wait(readyv, PERPD_EVMAX, msecs);
+      }while((nready == -1) && (errno == EINTR));
+      if(fd_signal == -1) sigset_block(&poll_sigset);
 
       /*
-      ** process poll events:
+      ** process events:
       */
 
-      /* poll error? */
+      /* wait error? */
       if(nready == -1){
-          warn_syserr("failure poll() in main loop");
+          warn_syserr("failure waiting for events in main loop");
           continue;
       }
 
-      /* check selfpipe: */
-      if(pollv[0].revents & POLLIN){
-          --nready;
-          while(read(selfpipe[0], &c, 1) == 1){/*empty*/;}
+      /* check selfpipe, signalfd, inotify and listening sockets: */
+      got_listen = got_inotify = 0;
+      for(i = 0; i < nready; ++i){
+          if(readyv[i] == &ev_selfpipe){
+              while(read(selfpipe[0], &c, 1) == 1){/*empty*/;}
+          }else if(readyv[i] == &ev_signal){
+              perpd_sigfd_read();
+          }else if(readyv[i] == &ev_inotify){
+              ++got_inotify;
+          }else if((readyv[i]->kind == PERPD_EVK_MAIN) && (readyv[i]->obj != NULL)){
+              ++got_listen;
+          }
+      }
+
+      /* readiness notifications
+      ** (before any reap closes the notification channel):
+      */
+      for(i = 0; i < nready; ++i){
+          if(readyv[i]->kind == PERPD_EVK_NOTIFY){
+              perpd_svdef_notify((struct svdef *)readyv[i]->obj);
+          }
+      }
+
+      /* tend to dead children reported by pidfd
+      ** (before any wait4(-1), and before any other event may cull
+      ** the svdef of a pident in readyv[]):
+      */
+      for(i = 0; i < nready; ++i){
+          if(readyv[i]->kind == PERPD_EVK_PROC){
+              perpd_waitpidfd((struct pident *)readyv[i]->obj);
+          }
       }
 
       /* term: */
       if(flag_term){
           log_info("initiating termination...");
-          int got_cull = 0;
           /* setup global flags for termination in progress
-          ** (disables any further setting of flag_term, flag_hup): */
+          ** (disables any further setting of flag_term, flag_hup,
+          ** flag_reexec): */
           flag_terminating = 1;
           flag_term = 0;
           flag_hup = 0;
+          flag_reexec = 0;
           /* disable further scanning: */
           arg_autoscan = 0;
-          poll_max = -1;
-          poll_interval = poll_max;
-          /* close listening socket: */
-          close(fd_listen);
-          /* dump pending client connections: */
-          for(i = 0; i < nconns; ++i){
-              close(clients[i].connfd);
+          /* close listening sockets: */
+          for(b = 0; b < nbases; ++b){
+              perpd_ev_del(&bases[b].evh);
+              close(bases[b].fd_listen);
+              bases[b].fd_listen = -1;
+              if(bases[b].fd_seq != -1){
+                  perpd_ev_del(&bases[b].evh_seq);
+                  close(bases[b].fd_seq);
+                  bases[b].fd_seq = -1;
+              }
           }
-          nconns = 0;
+          got_listen = 0;
+          /* dump pending client connections: */
+          perpd_conn_closeall();
           /* initiate shutdown on all services: */
-          for(i = 0; i < nservices; ++i){
-              if(perpd_svdef_wantcull(&svdefs[i]) == 1){
-                  ++got_cull;
+          for(b = 0; b < nbases; ++b){
+              svtab = &bases[b].svtab;
+              j = 0;
+              while(j < svtab->n){
+                  struct svdef  *svdef = svtab->svdefs[j];
+                  if(perpd_svdef_wantcull(svdef) == 1){
+                      /* already down, harvest now (refills svdefs[j]): */
+                      perpd_cull(svdef);
+                      continue;
+                  }
+                  ++j;
               }
           }
-          if(got_cull){
-              perpd_cull();
+          /* shutdown deadline: */
+          if((arg_deadline > 0) && (perpd_nservices() > 0)){
+              tain_now(&now);
+              tain_LOAD(&diff, arg_deadline, 0);
+              tain_plus(&diff, &now, &diff);
+              if(perpd_timer_set(&deadline, &diff, &perpd_deadline, NULL) == -1){
+                  warn_syserr("failure setting shutdown deadline");
+              }
           }
       }
 
       /* tend to dead children! */
       if(flag_chld){
           flag_chld = 0;
-          perpd_waitup();
+          /* with pidfds, only for processes without pidfd: */
+          if(!pidtab.use_pidfd || (pidtab.nopidfd > 0)){
+              perpd_waitup();
+          }
+      }
+
+      /* delayed starts, stop timeouts now due: */
+      tain_now(&now);
+      perpd_timer_run(&now);
+
+      /* re-exec (returns only on failure): */
+      /* (never once termination in progress, listeners closed:) */
+      if(flag_reexec && !flag_terminating){
+          flag_reexec = 0;
+          perpd_reexec(my_argv);
+      }
+
+      /* incremental scan of changes watched with inotify: */
+      if(got_inotify){
+          perpd_inotify_read();
+          /* sooner autoscan if now left with entries unwatched: */
+          if((arg_autoscan > 0) && (perpd_autoscan_secs() < scansecs)){
+              tain_now(&now);
+              scansecs = perpd_autoscan_secs();
+              tain_LOAD(&autoscan, scansecs, 0);
+              tain_plus(&when_scan, &now, &autoscan);
+          }
       }
 
-      /* scan: */
-      if(flag_hup || ((arg_autoscan > 0) && (poll_remain < 100))){
+      /* full scan: */
+      if(flag_hup || ((arg_autoscan > 0) && !tain_less(&now, &when_scan))){
           flag_hup = 0;
-          perpd_scan();
-          poll_interval = poll_max;
+          for(b = 0; b < nbases; ++b){
+              perpd_scan(&bases[b]);
+          }
+          if(arg_autoscan > 0){
+              tain_now(&now);
+              scansecs = perpd_autoscan_secs();
+              tain_LOAD(&autoscan, scansecs, 0);
+              tain_plus(&when_scan, &now, &autoscan);
+          }
       }
 
+      /* first starts of newly activated services: */
+      perpd_startq_run();
+
       /* exceptional failure in progress:
       **   fork() failure during a perp_svdef_run() call
       **   seek and retry failing svdefs with perpd_svdef_checkfail():
@@ -843,79 +1794,43 @@ perpd_mainloop(void)
           }
           /* else: */
           flag_failing = 0;
-          for(i = 0; i < nservices; ++i){
-              perpd_svdef_checkfail(&svdefs[i]);
+          for(b = 0; b < nbases; ++b){
+              svtab = &bases[b].svtab;
+              for(j = 0; j < svtab->n; ++j){
+                  perpd_svdef_checkfail(svtab->svdefs[j]);
+              }
           }
           if(flag_failing){
               /* still failing! */
               /* note: implies perpd_trigger_fail() will trigger another loop */
               log_warning("pausing on persistent fork() failure...");
               tain_pause(&epause, NULL);
-              /* XXX, ignore clients while failing: */
-              continue;
+              /* (clients still served: readiness is edge-triggered) */
           }
       }
 
-      /* short-circuit if only selfpipe: */
-      if(nready == 0) continue;
-
       /*
       ** check client sockets:
       */
 
-      for(i = 0; i < nconns; ++i){
-          if((connfd = clients[i].connfd) == -1){
-              continue;
+      for(i = 0; i < nready; ++i){
+          evh = readyv[i];
+          if(evh->kind == PERPD_EVK_CONN){
+              perpd_conn_event((struct perpd_conn *)evh->obj, evh->revents);
           }
-          if(nready == 0) break;
-          if(pollv[2 + i].revents & (POLLERR | POLLHUP | POLLNVAL)){
-              --nready;
-              if(pollv[2 + i].revents & (POLLERR | POLLNVAL)){
-                  log_warning("error on client socket");
+      }
+
+      /* check new client connections: */
+      if(got_listen){
+          for(i = 0; i < nready; ++i){
+              evh = readyv[i];
+              if((evh->kind == PERPD_EVK_MAIN) && (evh->obj != NULL)){
+                  perpd_conn_accept((struct perpd_base *)evh->obj, evh->fd);
               }
-              perpd_conn_close(&clients[i]);
-              continue;
-          }else if(pollv[2 + i].revents & POLLIN){
-              --nready;
-              perpd_conn_read(&clients[i]);
-              continue;
-          }else if(pollv[2 + i].revents & POLLOUT){
-              --nready;
-              perpd_conn_write(&clients[i]);
-              continue;
-          }else{
-              /* XXX, what else? */
-          }
-      }/*end check clients*/
-
-      /* short circuit if no more poll events: */
-      if(nready == 0) continue;
-
-      /* check new client connection: */
-      if(pollv[1].revents & POLLIN){
-          --nready;
-          connfd = domsock_accept(fd_listen);
-          if(connfd == -1){
-              warn_syserr("failure accept() on new client connection");
-          }else if(fd_nonblock(connfd) == -1){
-              warn_syserr("failure fd_nonblock() on new client connection");
-              close(connfd);
-          }else if(nconns == PERPD_CONNMAX){
-              log_warning("too many client connections");
-              close(connfd);
-          }else{
-              log_debug("starting new client connection...");
-              perpd_conn_start(&clients[nconns], connfd);
-              ++nconns;
           }
-      }/*end check connections*/
-
-      if(nready != 0){
-          /* shouldn't happen: */
-          log_debug("uh oh, unhandled poll() events!");
       }
 
-  }/* end for(;;) main poll loop */
+  }/* end for(;;) main event loop */
 
   return;
 }
@@ -924,13 +1839,19 @@ perpd_mainloop(void)
 int
 main(int argc, char *argv[])
 {
-  nextopt_t      nopt = nextopt_INIT(argc, argv, ":hVa:g:");
-  char           opt;
-  uint32_t       u;
-  static char    pidbuf[NFMT_SIZE];
-  const char    *z;
-  struct group  *grent = NULL;
-  int            fd;
+  nextopt_t           nopt = nextopt_INIT(argc, argv, ":hVa:c:g:j:k:r:");
+  char                opt;
+  uint32_t            u;
+  static char         pidbuf[NFMT_SIZE];
+  const char         *z;
+  struct group       *grent = NULL;
+  struct perpd_base  *base;
+  size_t              b;
+  int                 fd;
+  int                 reexec;
+
+  /* arguments kept for re-exec: */
+  my_argv = argv;
 
   /* obtain stringified pid (for logging): */
   my_pid = getpid();
@@ -949,6 +1870,34 @@ main(int argc, char *argv[])
          }
          arg_autoscan = u;
          break;
+     case 'c':
+         z = nuscan_uint32(&u, nopt.opt_arg);
+         if((*z != '\0') || (u == 0)){
+             fatal_usage("bad argument found for option -", optc, ": ", nopt.opt_arg);
+         }
+         arg_connmax = u;
+         break;
+     case 'j':
+         z = nuscan_uint32(&u, nopt.opt_arg);
+         if(*z != '\0'){
+             fatal_usage("non-numeric argument found for option -", optc, ": ", nopt.opt_arg);
+         }
+         arg_startmax = u;
+         break;
+     case 'k':
+         z = nuscan_uint32(&u, nopt.opt_arg);
+         if(*z != '\0'){
+             fatal_usage("non-numeric argument found for option -", optc, ": ", nopt.opt_arg);
+         }
+         arg_deadline = u;
+         break;
+     case 'r':
+         z = nuscan_uint32(&u, nopt.opt_arg);
+         if((*z != '\0') || (u > PERPD_JOURNAL_MAX)){
+             fatal_usage("bad argument found for option -", optc, ": ", nopt.opt_arg);
+         }
+         arg_journal = u;
+         break;
      case 'g':
          if((nopt.opt_arg[0] > '0') && (nopt.opt_arg[0] < '9')){
          /* gid numeric: */
@@ -994,18 +1943,8 @@ main(int argc, char *argv[])
   argc -= nopt.arg_ndx;
   argv += nopt.arg_ndx;
 
-  /* global base directory ("/etc/perp"): */
-  basedir = argv[0];
-  if(!basedir)
-      basedir = getenv("PERP_BASE");
-  if(!basedir || (basedir[0] == '\0'))
-      basedir = PERP_BASE_DEFAULT;
-  if(basedir[0] != '/'){
-      fatal_usage("base directory not defined as absolute path: ", basedir);
-  }
-  if(chdir(basedir) != 0){
-      fatal_syserr("failure chdir() to base directory ", basedir);
-  }
+  /* base directories ("/etc/perp"): */
+  perpd_bases_init(argv);
 
   /* block signals: */
   sigset_fill(&poll_sigset);
@@ -1017,6 +1956,7 @@ main(int argc, char *argv[])
   sig_catch(SIGINT,  &sig_trap);
   sig_catch(SIGTERM, &sig_trap);
   sig_catch(SIGPIPE, &sig_trap);
+  sig_catch(SIGUSR2, &sig_trap);
 
   /* redirect stdin: */
   if((fd = open("/dev/null", O_RDWR)) == -1){
@@ -1031,17 +1971,89 @@ main(int argc, char *argv[])
   fd_cloexec(selfpipe[0]); fd_nonblock(selfpipe[0]);
   fd_cloexec(selfpipe[1]); fd_nonblock(selfpipe[1]);
 
-  /* initialize control directory (pidlock, socket, etc): */
-  perpd_control_init();
+  /* room for client connections in descriptor limit: */
+  perpd_nofile_init();
+
+  /* signals from signalfd, where supported: */
+  perpd_sigfd_init();
+
+  /* initialize event backend and client connection pool: */
+  if(perpd_ev_init((size_t)arg_connmax + (nbases * PERPD_SVTAB_INIT)) == -1){
+      fatal_syserr("failure initializing event backend");
+  }
+  if(perpd_conn_init((size_t)arg_connmax) == -1){
+      fatal_syserr("failure allocating client connections");
+  }
+
+  /* state of previous perpd on re-exec (with pidlocks, sockets): */
+  reexec = perpd_reexec_load(&my_when);
+  if(reexec == -1){
+      fatal_syserr("failure loading state on re-exec");
+  }
+
+  /* initialize each base directory:
+  **   control directory (pidlock, socket, etc), service table,
+  **   runscript environment
+  */
+  for(b = 0; b < nbases; ++b){
+      base = &bases[b];
+      perpd_control_init(base);
+      if(perpd_svtab_init(&base->svtab) == -1){
+          fatal_syserr("failure allocating service table");
+      }
+      if(perpd_svdef_env(base) == -1){
+          fatal_syserr("failure allocating runscript environment");
+      }
+  }
+
+  if(perpd_pidtab_init(&pidtab) == -1){
+      fatal_syserr("failure allocating pid index");
+  }
+  if(perpd_timer_init(nbases * PERPD_SVTAB_INIT) == -1){
+      fatal_syserr("failure allocating timer queue");
+  }
+  perpd_startq_init(arg_startmax);
+
+  perpd_svdef_init();
+
+  /* adopt services of previous perpd on re-exec: */
+  if(reexec){
+      if(perpd_reexec_restore() == -1){
+          fatal_syserr("failure restoring state on re-exec");
+      }
+      /* reap any exits missed across exec: */
+      ++flag_chld;
+  }
 
   /*
   ** no fatals beyond this point!
   */
 
-  /* timestamp startup: */
-  tain_now(&my_when);
+  /* timestamp startup (kept from first startup over re-exec): */
+  if(!reexec){
+      tain_now(&my_when);
+  }
 
-  log_info("starting on ", basedir, " ...");
+  for(b = 0; b < nbases; ++b){
+      base = &bases[b];
+      if(fchdir(base->fd_dir) == -1){
+          warn_syserr("failure fchdir() to base directory ", base->path);
+          continue;
+      }
+      /* status file in control directory (warn on failure): */
+      if(perpd_statfile_init(base, arg_gid) == -1){
+          warn_syserr("failure creating status file ", PERPD_STATFILE, " in ", base->path);
+      }
+      /* journal ring in control directory (warn on failure): */
+      if(perpd_journal_init(base, arg_journal, arg_gid) == -1){
+          warn_syserr("failure opening journal ", PERPD_JOURNAL, " in ", base->path);
+      }
+      if(reexec){
+          log_info("resuming on ", base->path, " after re-exec ...");
+      }else{
+          log_info("starting on ", base->path, " ...");
+      }
+  }
   perpd_mainloop();
 
   die(0);
@@ -2,7 +2,7 @@
 ** perp: perpsistent process supervision
 ** perpd 2.0: single process scanner/supervisor/controller
 ** perpd.h: header file for perpd
-** wcm, 2011.01.12 - 2011.03.21
+** wcm, 2011.01.12 - 2011.04.05
 ** ===
 */
 #ifndef PERPD_H
@@ -13,10 +13,12 @@
 
 /* unix: */
 #include <unistd.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 
 /* lasanga: */
 #include "outvec.h"
@@ -31,19 +33,48 @@
 
 /* map to source:
 ** 
-** the perpd application is partitioned into 3 source files:
+** the perpd application is partitioned into 11 source files:
 **
 **   [] perpd.c:
-**      main() entry, option processing, initialization, signal handling,
-**      main event loop, definition directory scanning, and capturing
-**      terminated child processes
+**      main() entry, option processing, initialization of each base
+**      directory, signal handling, main event loop, definition directory
+**      scanning, and capturing terminated child processes
+** 
+**   [] perpd_svtab.c:
+**      table of active service definitions, lookup indexes by dev/ino
+**      and by name, lookup index of service processes by pid
 ** 
 **   [] perpd_svdef.c:
 **      service activation, service initialization, service start/reset exec(),
-**      service deactivation ("cull")
+**      health checks, service deactivation ("cull")
 ** 
 **   [] perpd_conn.c:
 **      client connection routines, packet/protocol processing
+** 
+**   [] perpd_ev.c:
+**      i/o event backend for the main loop (epoll, with poll() fallback)
+**
+**   [] perpd_timer.c:
+**      timer queue for the main loop (delayed service starts, stop
+**      timeouts)
+**
+**   [] perpd_startq.c:
+**      start queue for newly activated services (ordering, start limit)
+**
+**   [] perpd_statfile.c:
+**      status file of services in the control directory, for clients
+**      reading status without a request to perpd
+**
+**   [] perpd_journal.c:
+**      journal ring of service transitions in the control directory
+**
+**   [] perpd_reexec.c:
+**      live re-exec of perpd, state passed to the new perpd, which adopts
+**      the running services
+**
+**   [] perpd_dir.c:
+**      reading directory entries from a descriptor (getdents64 on linux),
+**      for scanning base directories and service definition directories
 */ 
 
 
@@ -51,14 +82,166 @@
 ** configurable defines (perpd-specific):
 */
 
-/* maximum number of services per perpd instance: */
-#ifndef PERP_MAX
-#define PERP_MAX  200
+/* initial slots for services per perpd instance (grown as needed): */
+#ifndef PERPD_SVTAB_INIT
+#define PERPD_SVTAB_INIT  64
 #endif
 
-/* maximum number of conncurrent perpd client connections: */
+/* default maximum number of concurrent perpd client connections
+** (runtime setting with option -c):
+*/
 #ifndef PERPD_CONNMAX
-#define PERPD_CONNMAX  20
+#define PERPD_CONNMAX  256
+#endif
+
+/* maximum ready events processed per wakeup of the main loop: */
+#ifndef PERPD_EVMAX
+#define PERPD_EVMAX  64
+#endif
+
+/* linux: signals from signalfd, service processes tracked by pidfd
+** (each with fallback at runtime to selfpipe and SIGCHLD/waitpid()):
+*/
+#if defined(__linux__) && !defined(PERPD_NO_SIGNALFD)
+#  define PERPD_SIGNALFD  1
+#endif
+#if defined(__linux__) && !defined(PERPD_NO_PIDFD)
+#  define PERPD_PIDFD  1
+#endif
+
+/* linux: runscripts spawned with clone(CLONE_VM | CLONE_VFORK),
+** on a static stack of PERPD_CLONE_STACK bytes:
+*/
+#if defined(__linux__) && !defined(PERPD_NO_CLONE)
+#  define PERPD_CLONE  1
+#endif
+#ifndef PERPD_CLONE_STACK
+#define PERPD_CLONE_STACK  (32 * 1024)
+#endif
+
+/* linux: state passed on re-exec in a memfd
+** (with fallback at runtime to an unlinked file in the control directory):
+*/
+#if defined(__linux__) && !defined(PERPD_NO_MEMFD)
+#  define PERPD_MEMFD  1
+#endif
+/* linux: directories read with getdents64()
+** (else readdir() on a duplicate descriptor):
+*/
+#if defined(__linux__) && !defined(PERPD_NO_GETDENTS)
+#  define PERPD_GETDENTS  1
+#endif
+/* linux: with autoscan (option -a), base directories (and service
+** directories reached by symlink) watched with inotify, changes rescanned
+** by name as they occur (with fallback at runtime to full scans on the
+** autoscan interval):
+*/
+#if defined(__linux__) && !defined(PERPD_NO_INOTIFY)
+#  define PERPD_INOTIFY  1
+#endif
+/* minimum autoscan interval while base directories are watched, full
+** scans then a safety net only (in seconds):
+*/
+#ifndef PERPD_SAFESCAN
+#define PERPD_SAFESCAN  300
+#endif
+
+/* buffer for entries of base directory read at each scan (in bytes): */
+#ifndef PERPD_SCANBUF
+#define PERPD_SCANBUF  (32 * 1024)
+#endif
+
+/* environment variable naming the state descriptor on re-exec: */
+#define PERPD_REEXEC_ENV  "PERPD_REEXEC"
+
+/* default minimum runtime of a service before restart without delay
+** (respawn governor, in seconds; per service with file "param.respawn"):
+*/
+#ifndef PERPD_RESPAWN
+#define PERPD_RESPAWN  1
+#endif
+/* maximum for "param.respawn" setting (in seconds): */
+#ifndef PERPD_RESPAWN_MAX
+#define PERPD_RESPAWN_MAX  3600
+#endif
+
+/* crash-loop detection:
+**   a service terminated from "start" after running less than PERPD_RUNOK
+**   seconds is counted as a fast failure; on repeated fast failures the
+**   respawn delay is doubled (with jitter) to PERPD_BACKOFF_MAX seconds,
+**   and the service is quarantined after PERPD_QUARANTINE consecutive
+**   fast failures (per service with file "param.quarantine", 0 disables)
+*/
+#ifndef PERPD_RUNOK
+#define PERPD_RUNOK  10
+#endif
+#ifndef PERPD_BACKOFF_MAX
+#define PERPD_BACKOFF_MAX  60
+#endif
+#ifndef PERPD_QUARANTINE
+#define PERPD_QUARANTINE  10
+#endif
+
+/* start queue:
+**   a service started from the start queue is counted against the limit
+**   of services starting at once (perpd option -j) until its main service
+**   has run PERPD_SETTLE seconds
+*/
+#ifndef PERPD_SETTLE
+#define PERPD_SETTLE  1
+#endif
+/* a service with readiness notification (file "param.notify") is counted
+** as starting until ready, to a maximum of PERPD_SETTLE_READY seconds:
+*/
+#ifndef PERPD_SETTLE_READY
+#define PERPD_SETTLE_READY  60
+#endif
+
+/* stop timeout:
+**   a service signaled to stop (by "down" control, or on deactivation)
+**   and still running after the stop timeout is sent SIGKILL;
+**   default stop timeout in seconds, 0 for none (per service with file
+**   "param.stop")
+*/
+#ifndef PERPD_STOP
+#define PERPD_STOP  0
+#endif
+/* maximum for "param.stop" setting (in seconds): */
+#ifndef PERPD_STOP_MAX
+#define PERPD_STOP_MAX  3600
+#endif
+
+/* health checks:
+**   a service with an executable "rc.check" is checked every PERPD_CHECK
+**   seconds while its main service is up (per service with file
+**   "param.check"), the first check at a random offset into the interval;
+**   a check running over PERPD_CHECK_TIMEOUT seconds is killed and failed
+**   ("param.checktimeout"); main is restarted after PERPD_CHECK_FAILS
+**   consecutive failures ("param.checkfails", 0 never restarts)
+*/
+#ifndef PERPD_CHECK
+#define PERPD_CHECK  30
+#endif
+#ifndef PERPD_CHECK_TIMEOUT
+#define PERPD_CHECK_TIMEOUT  10
+#endif
+#ifndef PERPD_CHECK_FAILS
+#define PERPD_CHECK_FAILS  3
+#endif
+/* maximum for "param.check" and "param.checktimeout" (in seconds): */
+#ifndef PERPD_CHECK_MAX
+#define PERPD_CHECK_MAX  86400
+#endif
+
+/* default records in journal ring of service transitions
+** (runtime setting with option -r, 0 for no journal):
+*/
+#ifndef PERPD_JOURNAL_RECS
+#define PERPD_JOURNAL_RECS  4096
+#endif
+/* maximum for option -r: */
+#ifndef PERPD_JOURNAL_MAX
+#define PERPD_JOURNAL_MAX  (1024 * 1024)
 #endif
 
 /* timeout for perpd client connection (in seconds): */
@@ -66,6 +249,24 @@
 #define PERPD_CONNSECS  8
 #endif
 
+/* event queue per subscribed client connection (in bytes);
+** a subscriber falling this far behind is disconnected:
+*/
+#ifndef PERPD_SUBQ
+#define PERPD_SUBQ  (32 * 1024)
+#endif
+
+/* input and output rings per client connection of protocol 2 (in bytes,
+** powers of 2); the input ring holds at least one packet, the output ring
+** at least one reply packet:
+*/
+#ifndef PERPD_CONN_IRING
+#define PERPD_CONN_IRING  1024
+#endif
+#ifndef PERPD_CONN_ORING
+#define PERPD_CONN_ORING  4096
+#endif
+
 /*
 ** access environment:
 */
@@ -78,13 +279,17 @@ extern char **environ;
 /* sigset blocking: */
 extern sigset_t  poll_sigset;
 
+/* index of running service processes by pid: */
+extern struct pidtab  pidtab;
+
 /* stderr/logging variables: */
 extern const char  *progname;
 extern const char   prog_usage[];
 extern const char  *my_pidstr;
 
-/* base directory (default will be "/etc/perp"): */
-extern const char  *basedir;
+/* base directories (default will be "/etc/perp"), in order given: */
+extern struct perpd_base  *bases;
+extern size_t              nbases;
 
 /* status variables: */
 extern pid_t   my_pid;
@@ -98,10 +303,80 @@ extern void perpd_trigger_fail(void);
 extern void perpd_trigger_scan(void);
 
 /* perpd_lookup()
-**   find a svdef by its dev/ino
+**   find a svdef of base by its dev/ino
+**   defined in perpd.c:
+*/
+extern struct svdef * perpd_lookup(struct perpd_base *base, dev_t dev, ino_t ino);
+
+/* perpd_lookupname()
+**   find a svdef of base by its name
 **   defined in perpd.c:
 */
-extern struct svdef * perpd_lookup(dev_t dev, ino_t ino);
+extern struct svdef * perpd_lookupname(struct perpd_base *base, const char *name);
+
+/* perpd_rename()
+**   set the name of a svdef, updating the name index of its base
+**   defined in perpd.c:
+*/
+extern void perpd_rename(struct svdef *svdef, const char *name);
+
+
+/*
+** perpd_ev declarations:
+*/
+
+/* event interest/readiness bits: */
+#define PERPD_EV_IN    0x01
+#define PERPD_EV_OUT   0x02
+/* readiness only, error/hangup on descriptor: */
+#define PERPD_EV_ERR   0x04
+/* interest only, edge-triggered where supported: */
+#define PERPD_EV_EDGE  0x08
+
+/* kind of object owning an event handle: */
+#define PERPD_EVK_MAIN  0   /* selfpipe, signalfd, listening socket */
+#define PERPD_EVK_CONN  1   /* struct perpd_conn */
+#define PERPD_EVK_PROC  2   /* struct pident (pidfd of service process) */
+#define PERPD_EVK_NOTIFY  3 /* struct svdef (readiness notification) */
+
+/* perpd_evh object, event handle for a registered descriptor: */
+struct perpd_evh {
+  int      fd;
+  int      events;   /* current interest */
+  int      revents;  /* readiness from perpd_ev_wait() */
+  int      kind;     /* PERPD_EVK_* */
+  size_t   slot;     /* position in pollv[] (poll backend) */
+  void    *obj;      /* owner of the handle */
+};
+
+/* perpd_ev subroutines (defined in perpd_ev.c): */
+extern int perpd_ev_init(size_t hint);
+extern const char * perpd_ev_backend(void);
+extern int perpd_ev_add(struct perpd_evh *evh, int fd, int events, int kind, void *obj);
+extern int perpd_ev_mod(struct perpd_evh *evh, int events);
+extern void perpd_ev_del(struct perpd_evh *evh);
+extern int perpd_ev_wait(struct perpd_evh **readyv, int max, int msecs);
+
+
+/*
+** perpd_timer declarations:
+*/
+
+/* perpd_timer object, entry in timer queue: */
+struct perpd_timer {
+  tain_t   when;     /* expiration */
+  size_t   slot;     /* position in queue + 1, 0 if not armed */
+  void   (*fn)(struct perpd_timer *timer);
+  void    *obj;      /* owner of the timer */
+};
+
+/* perpd_timer subroutines (defined in perpd_timer.c): */
+extern int perpd_timer_init(size_t hint);
+extern int perpd_timer_set(struct perpd_timer *timer, const tain_t *when,
+                           void (*fn)(struct perpd_timer *), void *obj);
+extern void perpd_timer_cancel(struct perpd_timer *timer);
+extern int perpd_timer_msecs(const tain_t *now);
+extern void perpd_timer_run(const tain_t *now);
 
 
 /*
@@ -112,9 +387,85 @@ extern struct svdef * perpd_lookup(dev_t dev, ino_t ino);
 /* "which" subservice: */
 #define SUBSV_MAIN  0
 #define SUBSV_LOG   1
+/* (pid index only: health check of service) */
+#define SUBSV_CHECK 2
 /* runscript "target": */
 #define SVRUN_START 0
 #define SVRUN_RESET 1
+#define SVRUN_CHECK 2
+
+/* pident object, entry for a running process in the pid index: */
+struct pident {
+  pid_t           pid;
+  /* service and "which" subservice running as pid: */
+  struct svdef   *svdef;
+  int             which;
+  /* next pident in pid index chain: */
+  struct pident  *next;
+  /* pidfd for pid (or -1), registered with perpd_ev: */
+  int             pidfd;
+  struct perpd_evh  evh;
+};
+
+/* runtime metrics histograms:
+**   PERPD_TALLY_BINS bins by decade of msecs, the first bin for durations
+**   to 10 msecs, the last for durations over 10^7 msecs (about 2.8 hours)
+*/
+#define PERPD_TALLY_BINS  8
+
+/* tally object, runtime metrics of a subsv since activation: */
+struct tally {
+  /* "start" runscripts spawned: */
+  uint32_t  starts;
+  /* terminations from "start": all, with non-zero exit, by signal: */
+  uint32_t  exits;
+  uint32_t  exits_error;
+  uint32_t  exits_signal;
+  /* total msecs from start to exit, and from reset to exit: */
+  uint64_t  life_msecs;
+  uint64_t  reset_msecs;
+  /* histograms of start-to-exit lifetime, and of reset duration: */
+  uint32_t  life[PERPD_TALLY_BINS];
+  uint32_t  reset[PERPD_TALLY_BINS];
+  /* resource usage of all start/reset processes, from wait4(): */
+  uint64_t  utime_usecs;
+  uint64_t  stime_usecs;
+  uint64_t  maxrss;          /* max of any process, kbytes */
+  uint64_t  majflt;
+  uint64_t  nvcsw;
+  uint64_t  nivcsw;
+};
+
+/* svcheck object, health check of a service: */
+struct svcheck {
+  /* interval, timeout (seconds, interval 0: no check), failures to restart: */
+  uint32_t  secs;
+  uint32_t  timeout;
+  uint32_t  fails;
+  /* process id of running check (or 0), entry in pid index while running: */
+  pid_t     pid;
+  struct pident  pident;
+  /* start of running/last check, and next check due: */
+  tain_t    when;
+  tain_t    next;
+  /* next check, or timeout of running check (set if killed on timeout): */
+  struct perpd_timer  timer;
+  int       killed;
+  /* latency of last check (msecs): */
+  uint32_t  msecs;
+  /* bitset flags (definitions in perp_common.h as described below): */
+  uchar_t   bitflags;
+/*
+**   #define CHECK_FLAG_ENABLED  0x01
+**   #define CHECK_FLAG_RUNNING  0x02
+** set once a check completes since start of main, with result of last:
+**   #define CHECK_FLAG_RESULT   0x04
+**   #define CHECK_FLAG_FAILED   0x08
+**   #define CHECK_FLAG_TIMEOUT  0x10
+*/
+  /* consecutive failures (to 255): */
+  uchar_t   nfail;
+};
 
 /* subsv object (one of a service pair): */
 struct subsv {
@@ -132,29 +483,53 @@ struct subsv {
 **   #define SUBSV_FLAG_WANTDOWN  0x10
 ** set if fork() fails in perpd_svrun():
 **   #define SUBSV_FLAG_FAILING   0x20
+** set while start is held by the respawn governor:
+**   #define SUBSV_FLAG_DELAYED   0x40
+** set when restarts stopped by crash-loop detection:
+**   #define SUBSV_FLAG_QUARANTINE  0x80
 */
   /* timestamps: */
   tain_t  when;
   tain_t  when_ok;
   /* waitpid() status at termination: */
   int     wstat;
+  /* consecutive fast failures (crash-loop detection): */
+  uint32_t  nfail;
+  /* entry in pid index while running: */
+  struct pident  pident;
+  /* delayed start by respawn governor: */
+  struct perpd_timer  timer;
+  /* stop timeout, and SIGKILL on timeout to process group if set: */
+  struct perpd_timer  stop;
+  int                 killpg;
+  /* runtime metrics: */
+  struct tally  tally;
 };
 
+/* base directory of a svdef (perpd_base declarations below): */
+struct perpd_base;
+
 /* svdef object, perp service definition: */
 struct svdef {
+  /* base directory of the service: */
+  struct perpd_base  *base;
   /* device/inode of the service definition directory: */
   dev_t    dev;
   ino_t    ino;
   /* using fchdir() into svdir: */
   int      fd_dir;
-  /* name (to 31 characters) of service: */
+  /* inotify watch on svdir reached by symlink (0: none): */
+  int      wd;
+  /* name (to PERPD_NAMEMAX characters) of service: */
   /* notes:
   **   - basename of service directory, nul-terminated
-  **   - the actual name may be truncated to fit this buffer
-  **   - name is informational only, used for message/logging
+  **   - a service directory with a longer name is not activated
+  **   - name is a unique key for an active service, in the name index
+  **     (though a service in deactivation may share the name of its
+  **     replacement)
   **   - the unique identifier for the service is dev/ino pair
   */
-  char     name[31 + 1];
+  char     name[PERPD_NAMEMAX + 1];
   /* timestamp at activation: */
   tain_t   when;
   /* bitset flags (definitions in perp_common.h as described below): */
@@ -171,48 +546,348 @@ struct svdef {
 ** set for flag files found at startup:
 **   #define SVDEF_FLAG_DOWN    0x10
 **   #define SVDEF_FLAG_ONCE    0x20
+** set while waiting in start queue, and while starting from queue:
+**   #define SVDEF_FLAG_QUEUED    0x40
+**   #define SVDEF_FLAG_STARTING  0x80
 */
   /* pipe() between MAIN --> LOG: */
   int      logpipe[2];
+  /* respawn governor, minimum runtime before restart (seconds): */
+  uint32_t  respawn;
+  /* fast failures before quarantine (0: never): */
+  uint32_t  quarantine;
+  /* stop timeout (seconds, 0: none): */
+  uint32_t  stop;
+  /* SIGKILL to process group on stop timeout (file "flag.killpg"): */
+  int       killpg;
+  /* descriptor for readiness notification in main (0: none): */
+  int       notify;
   /* main/log service pair: */
   struct subsv  svpair[2];
+  /* position in svtab->svdefs[]: */
+  size_t   slot;
+  /* next svdef in dev/ino index chain: */
+  struct svdef  *hnext;
+  /* next svdef in name index chain: */
+  struct svdef  *nnext;
+  /* names of services to start first (from file "param.after"),
+  ** each nul-terminated, ending with an empty name (or NULL):
+  */
+  char    *after;
+  /* next svdef in start queue: */
+  struct svdef  *qnext;
+  /* end of starting from start queue: */
+  struct perpd_timer  settle;
+  /* readiness notification of main:
+  **   perpd end of the socketpair while main runs "start" (or -1),
+  **   and timestamp of readiness (zero while not ready)
+  */
+  int                 notifyfd;
+  struct perpd_evh    notifyevh;
+  tain_t              when_ready;
+  /* health check (file "rc.check"): */
+  struct svcheck      check;
+  /* set while record in status file is out of date: */
+  int                 statdirty;
 };
 
 /* perpd_svdef subroutines (defined in perpd_svdef.c): */
+extern void perpd_svdef_init(void);
+extern int perpd_svdef_env(struct perpd_base *base);
 extern void perpd_svdef_clear(struct svdef *svdef);
 extern void perpd_svdef_close(struct svdef *svdef);
-extern int perpd_svdef_activate(struct svdef *svdef, const char *svdir, const struct stat *st);
+extern int perpd_svdef_activate(struct svdef *svdef, struct perpd_base *base,
+                                const char *svdir, const struct stat *st);
 extern void perpd_svdef_keep(struct svdef *svdef, const char *svdir);
 extern void perpd_svdef_checkfail(struct svdef *svdef);
 extern int perpd_svdef_wantcull(struct svdef *svdef);
 extern int perpd_svdef_cullok(struct svdef *svdef);
 extern int perpd_svdef_run(struct svdef *svdef, int which, int what);
+extern void perpd_svdef_startup(struct svdef *svdef);
+extern void perpd_svdef_undelay(struct svdef *svdef, int which);
+extern void perpd_svdef_release(struct svdef *svdef, int which);
+extern void perpd_svdef_stop(struct svdef *svdef, int which, int is_killpg);
+extern void perpd_svdef_kill(struct svdef *svdef, int which, int is_killpg);
+extern void perpd_svdef_notify(struct svdef *svdef);
+extern void perpd_svdef_notifyclose(struct svdef *svdef);
+extern void perpd_svdef_checkdone(struct svdef *svdef, int wstat);
+extern void perpd_svdef_adopt(struct svdef *svdef);
+extern void perpd_svdef_tally(struct svdef *svdef, int which, int wstat,
+                              const struct rusage *ru);
+
+
+/*
+** perpd_svtab declarations:
+*/
+
+/* svtab object, table of active service definitions: */
+struct svtab {
+  /* vector of pointers to active svdefs: */
+  struct svdef  **svdefs;
+  /* number of svdefs in use: */
+  size_t          n;
+  /* number of svdefs allocated: */
+  size_t          slots;
+  /* dev/ino and name indexes, hsize chains each (hsize a power of 2): */
+  struct svdef  **hdevino;
+  struct svdef  **hname;
+  size_t          hsize;
+};
+
+/* perpd_svtab subroutines (defined in perpd_svtab.c): */
+extern int perpd_svtab_init(struct svtab *svtab);
+extern struct svdef * perpd_svtab_new(struct svtab *svtab);
+extern void perpd_svtab_add(struct svtab *svtab, struct svdef *svdef);
+extern void perpd_svtab_drop(struct svtab *svtab, struct svdef *svdef);
+extern struct svdef * perpd_svtab_lookup(struct svtab *svtab, dev_t dev, ino_t ino);
+extern void perpd_svtab_rename(struct svtab *svtab, struct svdef *svdef, const char *name);
+extern struct svdef * perpd_svtab_lookupname(struct svtab *svtab, const char *name);
+
+/* pidtab object, index of running processes by pid: */
+struct pidtab {
+  /* hsize chains (hsize a power of 2): */
+  struct pident  **hpid;
+  size_t           hsize;
+  /* number of pidents in index: */
+  size_t           n;
+  /* set if pidfds supported by the running kernel: */
+  int              use_pidfd;
+  /* number of pidents in index without pidfd: */
+  size_t           nopidfd;
+};
+
+/* perpd_pidtab subroutines (defined in perpd_svtab.c): */
+extern int perpd_pidtab_init(struct pidtab *ptab);
+extern void perpd_pidtab_add(struct pidtab *ptab, struct pident *pident,
+                             pid_t pid, struct svdef *svdef, int which);
+extern void perpd_pidtab_del(struct pidtab *ptab, struct pident *pident);
+extern struct pident * perpd_pidtab_lookup(struct pidtab *ptab, pid_t pid);
+extern int perpd_pidtab_kill(struct pident *pident, int sig);
+
+
+/*
+** perpd_startq declarations:
+*/
+
+/* perpd_startq subroutines (defined in perpd_startq.c): */
+extern void perpd_startq_init(uint32_t max);
+extern void perpd_startq_add(struct svdef *svdef);
+extern void perpd_startq_drop(struct svdef *svdef);
+extern void perpd_startq_done(struct svdef *svdef);
+extern void perpd_startq_run(void);
+extern void perpd_startq_adopt(struct svdef *svdef);
 
 
 /*
 ** perpd_conn declarations:
 */
 
+/* length of status payload in 'S' reply: */
+#define PERPD_STATUS  92
+/* maximum length of a status record in 'L' listing reply
+** (pkt header, dev/ino, status length, status, name):
+*/
+#define PERPD_LISTREC  (3 + 16 + 1 + PERPD_STATUS + PERPD_NAMEMAX)
+
+/* length of rusage data in 'U' record (main and log): */
+#define PERPD_RUSAGE  (2 * 48)
+/* length of a 'U' record following an 'R' record in 'L' listing reply
+** (pkt header, dev/ino, rusage length, rusage):
+*/
+#define PERPD_RUSAGEREC  (3 + 16 + 1 + PERPD_RUSAGE)
+
+/* length of metrics data in 'N' record: */
+#define PERPD_METRICS  (32 + (8 * PERPD_TALLY_BINS))
+/* maximum length of metrics records for a service in 'M' reply
+** (main and log, each pkt header, dev/ino, which, metrics length,
+** metrics, name):
+*/
+#define PERPD_METRICREC  (2 * (3 + 16 + 2 + PERPD_METRICS + PERPD_NAMEMAX))
+
+/* maximum length of a control result record in 'B' bulk control reply
+** (pkt header, dev/ino, errno, name):
+*/
+#define PERPD_BULKREC  (3 + 16 + 4 + PERPD_NAMEMAX)
+
+/* event codes in 'V' event reply to a subscriber: */
+#define PERPD_EVENT_ACTIVATE    'A'  /* service activated */
+#define PERPD_EVENT_CULL        'C'  /* service deactivated */
+#define PERPD_EVENT_START       's'  /* "start" spawned */
+#define PERPD_EVENT_RESET       'r'  /* "reset" spawned */
+#define PERPD_EVENT_EXIT        'x'  /* service process terminated */
+#define PERPD_EVENT_DELAY       'w'  /* start held by respawn governor */
+#define PERPD_EVENT_QUARANTINE  'q'  /* service quarantined */
+#define PERPD_EVENT_PAUSE       'p'  /* paused by control */
+#define PERPD_EVENT_CONTINUE    'c'  /* continued by control */
+#define PERPD_EVENT_DOWN        'd'  /* wants down by control */
+#define PERPD_EVENT_UP          'u'  /* wants up by control */
+#define PERPD_EVENT_KILL        'k'  /* killed on stop timeout */
+#define PERPD_EVENT_READY       'y'  /* main reported ready */
+#define PERPD_EVENT_CHECK       'h'  /* health check failed */
+
 /* perpd_conn object: ipc client connection: */
 struct perpd_conn {
   int      connfd;  /* read/write socket for this client */
-  tain_t   stamp;   /* tainstamp at connect */
+  tain_t   stamp;   /* tainstamp at connect/start of request */
   uchar_t  state;   /* current state of connection, defined below: */ 
 #define PERPD_CONN_CLOSED   0
 #define PERPD_CONN_READING  1
 #define PERPD_CONN_WRITING  2
+#define PERPD_CONN_SUBSCRIBED  3
+  uchar_t  proto;   /* 2: packets on PERPD_SOCKET, 3: messages on PERPD_SEQSOCKET */
   pkt_t    pkt;
   size_t   n;       /* current bytes read into pkt[] */
   size_t   w;       /* current bytes written out of pkt[] */
+  uchar_t *obuf;    /* reply stream larger than pkt (or NULL) */
+  size_t   olen;    /* bytes in obuf[] (written out counted by w) */
+  uchar_t  type;    /* type of current request */
+  uint32_t tag;     /* tag of current request (protocol 3) */
+  uchar_t *req;     /* payload of current request (in pkt[] or message) */
+  size_t   reqlen;  /* bytes of payload in req[] */
+  uchar_t  iring[PERPD_CONN_IRING];  /* protocol 2: requests read ahead */
+  size_t   ihead;   /* iring[] read position (free running) */
+  size_t   itail;   /* iring[] write position (free running) */
+  uchar_t  oring[PERPD_CONN_ORING];  /* protocol 2: replies queued */
+  size_t   ohead;   /* oring[] read position (free running) */
+  size_t   otail;   /* oring[] write position (free running) */
+  int      eof;     /* protocol 2: client closed its end for writing */
+  struct perpd_base  *base;  /* base directory accepting this client */
+  uchar_t *subv;    /* subscriber: packed dev/ino filter (or NULL for all) */
+  size_t   nsub;    /* subscriber: number of dev/ino in subv[] */
+  int      dropped; /* subscriber: event queue overflowed */
+  struct perpd_evh    evh;    /* registration with perpd_ev */
+  struct perpd_conn  *prev;   /* open connections, oldest stamp first; */
+  struct perpd_conn  *next;   /* or subscribers; or free list if closed */
 }; 
 
 /* perpd_conn subroutines (defined in perpd_conn.c): */
-extern void perpd_conn_reset(struct perpd_conn *client);
-extern void perpd_conn_close(struct perpd_conn *client);
-extern void perpd_conn_start(struct perpd_conn *client, int connfd);
-extern void perpd_conn_checkstale(struct perpd_conn *client, struct tain *now);
-extern void perpd_conn_read(struct perpd_conn *client);
-extern void perpd_conn_write(struct perpd_conn *client);
+extern int perpd_conn_init(size_t connmax);
+extern size_t perpd_conn_count(void);
+extern void perpd_conn_accept(struct perpd_base *base, int fd_listen);
+extern void perpd_conn_event(struct perpd_conn *client, int revents);
+extern int perpd_conn_checkstale(const struct tain *now);
+extern void perpd_conn_closeall(void);
+extern void perpd_conn_notify(struct svdef *svdef, int which,
+                              uchar_t event, int wstat);
+extern void perpd_conn_flush(void);
+extern void perpd_conn_status(uchar_t *buf, const struct svdef *svdef,
+                              const tain_t *now);
+
+
+/*
+** perpd_statfile declarations:
+*/
+
+/* perpd_statfile object, status file of a base directory: */
+struct perpd_statfile {
+  int       fd;      /* status file (or -1) */
+  uchar_t  *map;     /* mapping of status file (or NULL) */
+  size_t    nslots;  /* records in file */
+  size_t    nused;   /* records written at last flush */
+  size_t    ndirty;  /* svdefs marked since last flush */
+};
+
+/* perpd_statfile subroutines (defined in perpd_statfile.c): */
+extern int perpd_statfile_init(struct perpd_base *base, gid_t gid);
+extern void perpd_statfile_mark(struct svdef *svdef);
+extern void perpd_statfile_flush(struct perpd_base *base);
+extern void perpd_statfile_pid(struct perpd_base *base, pid_t pid);
+
+
+/*
+** perpd_journal declarations:
+*/
+
+/* perpd_journal object, journal ring of a base directory: */
+struct perpd_journal {
+  uchar_t  *map;     /* mapping of journal (or NULL) */
+  size_t    nrecs;   /* records in ring */
+};
+
+/* perpd_journal subroutines (defined in perpd_journal.c): */
+extern int perpd_journal_init(struct perpd_base *base, uint32_t nrecs, gid_t gid);
+extern void perpd_journal_put(const struct svdef *svdef, int which,
+                              uchar_t event, uint32_t arg);
+
+
+/*
+** perpd_base declarations:
+*/
+
+/* perpd_base object, a base directory supervised by perpd:
+**   each with its own control directory (lock, socket, status file,
+**   journal) and service namespace, sharing the main loop, pid index,
+**   timers, start queue and client connections of the one perpd
+*/
+struct perpd_base {
+  /* absolute path of base directory: */
+  const char   *path;
+  /* using fchdir() into base directory: */
+  int           fd_dir;
+  /* lock on PERP_CONTROL/PIDLOCK, listening socket PERP_CONTROL/PERPD_SOCKET: */
+  int           fd_pidlock;
+  int           fd_listen;
+  struct perpd_evh  evh;
+  /* listening socket PERP_CONTROL/PERPD_SEQSOCKET (or -1): */
+  int           fd_seq;
+  struct perpd_evh  evh_seq;
+  /* table of active services: */
+  struct svtab  svtab;
+  /* environment for runscripts (PERP_BASE set to path): */
+  char        **envp;
+  /* status file, journal: */
+  struct perpd_statfile  statfile;
+  struct perpd_journal   journal;
+  /* inotify watch on base directory (0: none), full scan wanted: */
+  int           wd;
+  int           rescan;
+  /* symlinked entries without watch at last scan (left to full scans): */
+  size_t        nlinks;
+};
+
+
+/*
+** perpd_dir declarations:
+*/
+
+/* perpd_dir object, reader of entries of a directory descriptor:
+**   buf supplied by caller, aligned for uint64_t
+*/
+struct perpd_dir {
+  int       fd;     /* directory (not closed by perpd_dir_close()) */
+  uchar_t  *buf;    /* entries read */
+  size_t    size;   /* size of buf */
+  size_t    len;    /* bytes of entries in buf */
+  size_t    pos;    /* next entry in buf */
+#ifndef PERPD_GETDENTS
+  DIR      *dir;    /* readdir() on duplicate of fd */
+#endif
+};
+
+/* entry of type t may be a directory (or a symlink to one), to stat: */
+#ifdef DT_UNKNOWN
+#  define PERPD_DT_MAYDIR(t) \
+     (((t) == DT_DIR) || ((t) == DT_LNK) || ((t) == DT_UNKNOWN))
+#  define PERPD_DT_ISLNK(t)  ((t) == DT_LNK)
+#else
+#  define PERPD_DT_MAYDIR(t)  1
+#  define PERPD_DT_ISLNK(t)   0
+#endif
+
+/* perpd_dir subroutines (defined in perpd_dir.c): */
+extern int perpd_dir_open(struct perpd_dir *dir, int fd, uchar_t *buf, size_t size);
+extern const char * perpd_dir_next(struct perpd_dir *dir, int *type);
+extern void perpd_dir_close(struct perpd_dir *dir);
+
+
+/*
+** perpd_reexec declarations:
+*/
+
+/* perpd_reexec subroutines (defined in perpd_reexec.c): */
+extern void perpd_reexec(char *argv[]);
+extern int perpd_reexec_load(tain_t *when);
+extern int perpd_reexec_restore(void);
 
 
 /*
@@ -2,12 +2,13 @@
 ** perp: persistent process supervision
 ** perpd 2.0:  single process scanner/supervisor/controller
 ** perpd_conn:  ipc routines for perpd
-** wcm, 2010.12.28 - 2011.03.18
+** wcm, 2010.12.28 - 2011.04.05
 ** ===
 */
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 /* unix: */
 #include <unistd.h>
@@ -16,6 +17,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 /* lasanga: */
 #include "buf.h"
@@ -31,38 +33,122 @@
 
 /* perp: */
 #include "perp_common.h"
+#include "perp_journal.h"
 #include "perpd.h"
 
 
-static int perpd_pkt_check(uchar_t *pkt, size_t n);
-
+static int do_signal(struct subsv *subsv, pid_t pid, int sig);
 static void do_kill(struct svdef *svdef, int which, int sig, int is_killpg);
 static int do_control(struct svdef *svdef, int which, uchar_t cmd, int is_killpg);
+static int do_command(struct svdef *svdef, uchar_t cmd, uchar_t flags);
+static int request_name(char *name, const uchar_t *data, size_t len);
+static uint32_t status_delay(const struct subsv *subsv, const tain_t *now);
+static uchar_t status_nfail(const struct subsv *subsv);
+static uchar_t * status_record(uchar_t *rec, dev_t dev, ino_t ino,
+                               const struct svdef *svdef, const tain_t *now);
+static void rusage_pack(uchar_t *buf, const struct tally *tally);
+static uchar_t * list_record(uchar_t *rec, dev_t dev, ino_t ino,
+                             const struct svdef *svdef, const tain_t *now);
+static void metrics_pack(uchar_t *buf, const struct tally *tally);
+static uchar_t * metrics_record(uchar_t *rec, dev_t dev, ino_t ino,
+                                const struct svdef *svdef, const tain_t *now);
 
 static void perpd_conn_exec(struct perpd_conn *client);
 static void perpd_conn_exec_control(struct perpd_conn *client);
+static void perpd_conn_exec_namedcontrol(struct perpd_conn *client);
+static void perpd_conn_exec_svdef(struct perpd_conn *client, struct svdef *svdef,
+                                  uchar_t cmd, uchar_t flags);
+static void perpd_conn_exec_bulkcontrol(struct perpd_conn *client);
+static uchar_t * bulk_record(uchar_t *rec, dev_t dev, ino_t ino, int err,
+                             const char *name);
 static void perpd_conn_exec_query(struct perpd_conn *client);
+static void perpd_conn_exec_namedquery(struct perpd_conn *client);
+static void perpd_conn_exec_list(struct perpd_conn *client);
+static void perpd_conn_exec_metrics(struct perpd_conn *client);
+static void perpd_conn_exec_stream(struct perpd_conn *client, size_t recmax,
+                                   uchar_t * (*record)(uchar_t *, dev_t, ino_t,
+                                                       const struct svdef *,
+                                                       const tain_t *));
+static void perpd_conn_exec_subscribe(struct perpd_conn *client);
 static void perpd_conn_exec_pidyank(struct perpd_conn *client);
+static void perpd_conn_exec_hello(struct perpd_conn *client);
 static void perpd_conn_exec_reply(struct perpd_conn *client, int err);
 
+static void conn_link(struct perpd_conn *client);
+static void conn_unlink(struct perpd_conn *client);
+static void conn_start(struct perpd_conn *client);
+static void conn_close(struct perpd_conn *client);
+static void ring_put(uchar_t *ring, size_t size, size_t pos,
+                     const uchar_t *src, size_t len);
+static void ring_get(uchar_t *dst, const uchar_t *ring, size_t size,
+                     size_t pos, size_t len);
+static int conn_ready(const struct perpd_conn *client);
+static int conn_pending(const struct perpd_conn *client);
+static int conn_fill(struct perpd_conn *client);
+static void conn_parse(struct perpd_conn *client);
+static int conn_flush(struct perpd_conn *client);
+static void conn_io(struct perpd_conn *client);
+static int conn_readmsg(struct perpd_conn *client);
+static int conn_write(struct perpd_conn *client);
+static int conn_writebuf(struct perpd_conn *client);
+static int conn_sendmsg(struct perpd_conn *client, const uchar_t *buf, size_t len);
+static void sub_link(struct perpd_conn *client);
+static void sub_unlink(struct perpd_conn *client);
+static int sub_wants(const struct perpd_conn *client, const uchar_t *devino);
+static void sub_put(struct perpd_conn *client, const uchar_t *rec, size_t len);
+static void sub_drain(struct perpd_conn *client);
+static int sub_io(struct perpd_conn *client);
+
+
+/* client connection pool:
+**   conn_pool[] is allocated once in perpd_conn_init() for connmax clients
+**   closed clients are kept on the conn_free list (linked through next)
+**   open clients are kept on the conn_head list ordered by stamp, oldest
+**   first, so that stale connections are found at the head of the list
+**   subscribed clients are moved to the sub_head list, and are exempt
+**   from the stale connection timeout
+*/
+static struct perpd_conn  *conn_pool = NULL;
+static size_t              conn_n = 0;
+static struct perpd_conn  *conn_free = NULL;
+static struct perpd_conn  *conn_head = NULL;
+static struct perpd_conn  *conn_tail = NULL;
+static struct perpd_conn  *sub_head = NULL;
+
+/* pipelining on protocol 2 connections:
+**   each wakeup of a client reads as much as its input ring will take,
+**   executes every complete request found in the ring (each copied out to
+**   client->pkt), and queues the replies in the output ring, to be flushed
+**   together with a single writev()
+**   execution stops short while the output ring has no room for another
+**   reply packet, or after a reply stream in client->obuf (L/M/B, and the
+**   event queue of a subscriber), which follows the output ring in the
+**   writev(); the remaining requests are taken up once the output drains
+**   the client is not read from while output is pending: a client not
+**   reading its replies is held up by its own socket buffer
+*/
+
+/* message buffer for protocol 3 requests:
+**   each message is received whole by one recvmsg(), and executed before
+**   the next is received, so one buffer serves all clients
+*/
+static uchar_t  *msgbuf = NULL;
 
 
-/* perpd_pkt_check()
-**   inspect first n bytes of pkt read from a client
-**   return:
-**     1: read complete/ok
-**     0: read incomplete
+
+/* do_signal()
+**   kill() pid (negative for process group) of subsv with sig
+**   signal to the process itself is delivered by its pidfd if supported
 */
 static
 int
-perpd_pkt_check(pkt_t pkt, size_t n)
+do_signal(struct subsv *subsv, pid_t pid, int sig)
 {
-  /* need at least PKT_HEADER bytes to check pkt_len() bytes: */
-  if((n < PKT_HEADER) || (n < pkt_len(pkt)))
-      return 0;
+  if(pid < 0){
+      return kill(pid, sig);
+  }
 
-  /* else: assume read complete: */
-  return 1;
+  return perpd_pidtab_kill(&subsv->pident, sig);
 }
 
 
@@ -90,7 +176,7 @@ do_kill(struct svdef *svdef, int which, int sig, int is_killpg)
 
   /* deliver signal if not running reset: */
   if(!(subsv->bitflags & SUBSV_FLAG_ISRESET)){
-      if(kill(pid, sig) == -1){
+      if(do_signal(subsv, pid, sig) == -1){
           warn_syserr("failure kill() on ", sysstr_signal(sig),
                       " to service ", svdef->name, " (",
                       (which == SUBSV_MAIN) ? "main)" : "log)");
@@ -105,7 +191,7 @@ do_kill(struct svdef *svdef, int which, int sig, int is_killpg)
       log_warning("sending signal ", sysstr_signal(sig),
                  " to resetting service ", svdef->name, " (",
                  (which == SUBSV_MAIN) ? "main)" : "log)");
-      if(kill(pid, sig) == -1){
+      if(do_signal(subsv, pid, sig) == -1){
           warn_syserr("failure kill() on ", sysstr_signal(sig),
                       " to service ", svdef->name, " (",
                       (which == SUBSV_MAIN) ? "main)" : "log)");
@@ -157,14 +243,20 @@ do_control(struct svdef *svdef, int which, uchar_t cmd, int is_killpg)
       do_kill(svdef, which, SIGALRM, is_killpg);
       break;
   case 'c': /* continue */
-      subsv->bitflags &= ~SUBSV_FLAG_ISPAUSED;
+      if(subsv->bitflags & SUBSV_FLAG_ISPAUSED){
+          subsv->bitflags &= ~SUBSV_FLAG_ISPAUSED;
+          perpd_conn_notify(svdef, which, PERPD_EVENT_CONTINUE, 0);
+      }
       do_kill(svdef, which, SIGCONT, is_killpg);
       break;
   case 'd': /* faux "down" */
       subsv->bitflags |= SUBSV_FLAG_WANTDOWN;
+      perpd_svdef_undelay(svdef, which);
+      perpd_conn_notify(svdef, which, PERPD_EVENT_DOWN, 0);
       if(subsv->pid > 0){
           do_control(svdef, which, 't', is_killpg);
           do_control(svdef, which, 'c', is_killpg);
+          perpd_svdef_stop(svdef, which, is_killpg);
       }
       break;
   case 'h': /* hup */
@@ -179,6 +271,10 @@ do_control(struct svdef *svdef, int which, uchar_t cmd, int is_killpg)
   case 'o': /* faux "once" */
       subsv->bitflags |= SUBSV_FLAG_ISONCE;
       subsv->bitflags &= ~SUBSV_FLAG_WANTDOWN;
+      /* no stop timeout of any earlier "down": */
+      perpd_timer_cancel(&subsv->stop);
+      perpd_svdef_release(svdef, which);
+      perpd_conn_notify(svdef, which, PERPD_EVENT_UP, 0);
       /* bring it up if it is down: */
       if(subsv->pid == 0){
           perpd_svdef_run(svdef, which, SVRUN_START);
@@ -189,6 +285,7 @@ do_control(struct svdef *svdef, int which, uchar_t cmd, int is_killpg)
       if((subsv->pid > 0) && !(subsv->bitflags & SUBSV_FLAG_ISRESET)){
           subsv->bitflags |= SUBSV_FLAG_ISPAUSED;
           do_kill(svdef, which, SIGSTOP, is_killpg);
+          perpd_conn_notify(svdef, which, PERPD_EVENT_PAUSE, 0);
       }
       break;
   case 'q': /* quit */
@@ -200,6 +297,10 @@ do_control(struct svdef *svdef, int which, uchar_t cmd, int is_killpg)
   case 'u': /* faux "up" */
       subsv->bitflags &= ~SUBSV_FLAG_ISONCE;
       subsv->bitflags &= ~SUBSV_FLAG_WANTDOWN;
+      /* no stop timeout of any earlier "down": */
+      perpd_timer_cancel(&subsv->stop);
+      perpd_svdef_release(svdef, which);
+      perpd_conn_notify(svdef, which, PERPD_EVENT_UP, 0);
       /* bring it up if it is down: */
       if(subsv->pid == 0){
           perpd_svdef_run(svdef, which, SVRUN_START);
@@ -225,9 +326,75 @@ do_control(struct svdef *svdef, int which, uchar_t cmd, int is_killpg)
 }
 
 
+/* do_command()
+**   execute control cmd with flags on svdef
+**   return:
+**     0: success
+**    >0: error code for reply
+*/
+static
+int
+do_command(struct svdef *svdef, uchar_t cmd, uchar_t flags)
+{
+  int   is_killpg = 0;
+  int   which = SUBSV_MAIN;
+
+  /* drop control on deactivating service: */
+  if(svdef->bitflags & SVDEF_FLAG_CULL){
+      /* XXX, select other return value? */
+      return EBUSY;
+  }
+
+  /* command destined for log control: */
+  if(flags & SVCMD_FLAG_LOG){
+      which = SUBSV_LOG;
+  }
+
+  /* command destined for killpg(): */
+  if(flags & SVCMD_FLAG_KILLPG){
+      ++is_killpg;
+  }
+  perpd_journal_put(svdef, which, JOURNAL_CONTROL, (uint32_t)cmd | ((uint32_t)flags << 8));
+  if(do_control(svdef, which, cmd, is_killpg) != 0){
+      return EPROTO;
+  }
+
+  return 0;
+}
+
+
+/* request_name()
+**   copy service name of len bytes in request data into name
+**   return:
+**     0: success, name nul-terminated
+**    -1: not a valid service name
+*/
+static
+int
+request_name(char *name, const uchar_t *data, size_t len)
+{
+  size_t  i;
+
+  if((len == 0) || (len > PERPD_NAMEMAX)){
+      return -1;
+  }
+  for(i = 0; i < len; ++i){
+      if((data[i] == '\0') || (data[i] == '/')){
+          return -1;
+      }
+      name[i] = (char)data[i];
+  }
+  name[len] = '\0';
+
+  return 0;
+}
+
+
 /* perpd_conn_exec()
-**   pkt read is complete:
-**     process control packet and execute
+**   request read is complete:
+**     process control packet (protocol 2, copied out of the input ring by
+**     conn_parse()), or payload of message (protocol 3, set by
+**     conn_readmsg()), and execute
 **     put reply packet in client buffer
 **     set client state to PERPD_CONN_WRITING
 */
@@ -236,31 +403,85 @@ void
 perpd_conn_exec(struct perpd_conn *client)
 {
   size_t    n = client->n;
+  size_t    len;
 
-  if((n < PKT_HEADER) ||
-     (pkt_proto(client->pkt) != 2) ||
-     (pkt_len(client->pkt) != n)){
-      perpd_conn_exec_reply(client, EPROTO);
+  if(client->proto == 2){
+      if((n < PKT_HEADER) ||
+         (pkt_proto(client->pkt) != 2) ||
+         (pkt_len(client->pkt) != n)){
+          perpd_conn_exec_reply(client, EPROTO);
+          return;
+      }
+      client->type = pkt_type(client->pkt);
+      client->req = pkt_data(client->pkt);
+      client->reqlen = pkt_dlen(client->pkt);
   }
+  len = client->reqlen;
 
-  /* dispatch to exec handler: */
-  switch(pkt_type(client->pkt)){
+  /* dispatch to exec handler
+  ** (a request of protocol 2 is limited by the packet to PKT_PAYLOAD):
+  */
+  switch(client->type){
   case 'C': /* control request */
       log_debug("got control request");
-      if(n != (size_t)(18 + 3)){
+      if(len != 18){
           perpd_conn_exec_reply(client, EPROTO);
       } else {
           perpd_conn_exec_control(client);
       }
       break;
+  case 'c': /* control request by name */
+      if(len < 2){
+          perpd_conn_exec_reply(client, EPROTO);
+      } else {
+          perpd_conn_exec_namedcontrol(client);
+      }
+      break;
+  case 'B': /* bulk control request */
+      if(len < (2 + 2)){
+          perpd_conn_exec_reply(client, EPROTO);
+      } else {
+          perpd_conn_exec_bulkcontrol(client);
+      }
+      break;
   case 'Q': /* query status */
-      if(n != (size_t)(16 + 3)){
+      if(len != 16){
           log_debug("status query has bad size!");
           perpd_conn_exec_reply(client, EPROTO);
       } else {
           perpd_conn_exec_query(client);
       }
       break;
+  case 'q': /* query status by name */
+      perpd_conn_exec_namedquery(client);
+      break;
+  case 'L': /* list status */
+      if((len % 16) != 0){
+          log_debug("status list request has bad size!");
+          perpd_conn_exec_reply(client, EPROTO);
+      } else {
+          perpd_conn_exec_list(client);
+      }
+      break;
+  case 'M': /* metrics */
+      if((len % 16) != 0){
+          log_debug("metrics request has bad size!");
+          perpd_conn_exec_reply(client, EPROTO);
+      } else {
+          perpd_conn_exec_metrics(client);
+      }
+      break;
+  case 'W': /* subscribe to events */
+      if((len % 16) != 0){
+          log_debug("subscribe request has bad size!");
+          perpd_conn_exec_reply(client, EPROTO);
+      } else {
+          perpd_conn_exec_subscribe(client);
+      }
+      break;
+  case 'H': /* hello */
+      perpd_conn_exec_hello(client);
+      break;
   case 'Y': /* pidyank */
       perpd_conn_exec_pidyank(client);
       break;
@@ -279,71 +500,213 @@ static
 void
 perpd_conn_exec_control(struct perpd_conn *client)
 {
-  uchar_t       *payload = pkt_data(client->pkt);
+  uchar_t       *payload = client->req;
   dev_t          dev;
   ino_t          ino;
-  uchar_t        cmd;
-  uchar_t        flags;
-  int            is_killpg = 0;
-  struct svdef  *svdef;
-  int            which = SUBSV_MAIN;
-  int            err;
 
   dev = (dev_t)upak64_unpack(&payload[0]);
   ino = (dev_t)upak64_unpack(&payload[8]);
-  cmd = payload[16];
-  flags = payload[17];
 
-  svdef = perpd_lookup(dev, ino);
+  perpd_conn_exec_svdef(client, perpd_lookup(client->base, dev, ino), payload[16], payload[17]);
+
+  return;
+}
+
+
+/* perpd_conn_exec_namedcontrol()
+**   process 'c' pkt (command byte + flags byte + name)
+*/
+static
+void
+perpd_conn_exec_namedcontrol(struct perpd_conn *client)
+{
+  uchar_t  *payload = client->req;
+  char      name[PERPD_NAMEMAX + 1];
+
+  if(request_name(name, &payload[2], client->reqlen - 2) == -1){
+      perpd_conn_exec_reply(client, EPROTO);
+      return;
+  }
+
+  perpd_conn_exec_svdef(client, perpd_lookupname(client->base, name), payload[0], payload[1]);
+
+  return;
+}
+
+
+/* perpd_conn_exec_svdef()
+**   execute control cmd with flags on svdef (NULL if not found)
+*/
+static
+void
+perpd_conn_exec_svdef(struct perpd_conn *client, struct svdef *svdef,
+                      uchar_t cmd, uchar_t flags)
+{
   if(svdef == NULL){
       perpd_conn_exec_reply(client, ENOENT);
       return;
   }
 
-  /* drop control on deactivating service: */
-  if(svdef->bitflags & SVDEF_FLAG_CULL){
-      /* XXX, select other return value? */
-      perpd_conn_exec_reply(client, EBUSY);
+  perpd_conn_exec_reply(client, do_command(svdef, cmd, flags));
+
+  return;
+}
+
+
+/* bulk_record()
+**   pack 'K' record of control result err for dev/ino and name at rec
+**   return:
+**     end of record
+*/
+static
+uchar_t *
+bulk_record(uchar_t *rec, dev_t dev, ino_t ino, int err, const char *name)
+{
+  uchar_t  *data = &rec[PKT_HEADER];
+  size_t    namelen = cstr_len(name);
+
+  upak64_pack(&data[0], (uint64_t)dev);
+  upak64_pack(&data[8], (uint64_t)ino);
+  upak32_pack(&data[16], (uint32_t)err);
+  buf_copy(&data[20], name, namelen);
+  pkt_init(rec, 2, 'K', 20 + namelen);
+
+  return rec + PKT_HEADER + 20 + namelen;
+}
+
+
+/* perpd_conn_exec_bulkcontrol()
+**   process 'B' pkt (command byte + flags byte + selectors):
+**     each selector is a service name or pattern (see cstr_match()),
+**     nul-terminated
+**     cmd is executed on each active service matching any selector,
+**     all within this request, in the order of the services in svtab
+**     reply is a stream of 'K' records, one for each service matched,
+**     then one of ENOENT for each selector matching no service,
+**     terminated with an 'E' reply of 0
+*/
+static
+void
+perpd_conn_exec_bulkcontrol(struct perpd_conn *client)
+{
+  uchar_t        *payload = client->req;
+  size_t          len = client->reqlen - 2;
+  struct svtab   *svtab = &client->base->svtab;
+  struct svdef   *svdef;
+  char            name[PERPD_NAMEMAX + 1];
+  const char    **selv;
+  uchar_t        *hit;
+  size_t          nsel = 0;
+  size_t          i, k, start;
+  int             matched;
+  uchar_t        *p;
+
+  /* selectors, each nul-terminated, checked in place: */
+  if(payload[2 + len - 1] != '\0'){
+      perpd_conn_exec_reply(client, EPROTO);
       return;
   }
+  for(i = 0; i < len; ++i){
+      if(payload[2 + i] == '\0') ++nsel;
+  }
+  selv = (const char **)malloc(nsel * (sizeof(char *) + 1));
+  if(selv == NULL){
+      perpd_conn_exec_reply(client, ENOMEM);
+      return;
+  }
+  hit = (uchar_t *)&selv[nsel];
+  for(k = 0, start = 0, i = 0; i < len; ++i){
+      if(payload[2 + i] != '\0') continue;
+      if(request_name(name, &payload[2 + start], i - start) == -1){
+          free(selv);
+          perpd_conn_exec_reply(client, EPROTO);
+          return;
+      }
+      selv[k] = (const char *)&payload[2 + start];
+      hit[k] = 0;
+      ++k;
+      start = i + 1;
+  }
 
-  /* command destined for log control: */
-  if(flags & SVCMD_FLAG_LOG){
-      which = SUBSV_LOG;
+  client->obuf = (uchar_t *)malloc(((svtab->n + nsel) * PERPD_BULKREC) + PKT_HEADER + 4);
+  if(client->obuf == NULL){
+      free(selv);
+      perpd_conn_exec_reply(client, ENOMEM);
+      return;
   }
 
-  /* command destined for killpg(): */
-  if(flags & SVCMD_FLAG_KILLPG){
-      ++is_killpg;
+  p = client->obuf;
+  for(i = 0; i < svtab->n; ++i){
+      svdef = svtab->svdefs[i];
+      matched = 0;
+      for(k = 0; k < nsel; ++k){
+          if(cstr_match(selv[k], svdef->name)){
+              hit[k] = 1;
+              matched = 1;
+          }
+      }
+      if(matched){
+          p = bulk_record(p, svdef->dev, svdef->ino,
+                          do_command(svdef, payload[0], payload[1]), svdef->name);
+      }
+  }
+  for(k = 0; k < nsel; ++k){
+      if(!hit[k]){
+          p = bulk_record(p, 0, 0, ENOENT, selv[k]);
+      }
   }
-  err = do_control(svdef, which, cmd, is_killpg);
-  perpd_conn_exec_reply(client, err ? EPROTO : 0);
+  free(selv);
+
+  /* terminal: */
+  pkt_init(p, 2, 'E', 4);
+  upak32_pack(&p[PKT_HEADER], 0);
+  p += PKT_HEADER + 4;
+
+  client->olen = (size_t)(p - client->obuf);
+  client->w = 0;
+  client->state = PERPD_CONN_WRITING;
 
   return;
 }
 
 
+/* status_delay()
+**   msecs remaining until delayed start of subsv (0 if not delayed)
+*/
 static
-void
-perpd_conn_exec_query(struct perpd_conn *client)
+uint32_t
+status_delay(const struct subsv *subsv, const tain_t *now)
 {
-  uchar_t       *input = pkt_data(client->pkt);
-  dev_t          dev;
-  ino_t          ino;
-  struct svdef  *svdef;
-  uchar_t        buf[PKT_PAYLOAD];
-
-  dev = (dev_t)upak64_unpack(&input[0]);
-  ino = (ino_t)upak64_unpack(&input[8]);
+  tain_t  diff;
 
-  svdef = perpd_lookup(dev, ino);
-  if(svdef == NULL){
-      perpd_conn_exec_reply(client, ENOTDIR);
-      return;
+  if(!(subsv->bitflags & SUBSV_FLAG_DELAYED) ||
+     !tain_less(now, &subsv->timer.when)){
+      return 0;
   }
 
-  /* status payload is 66 bytes: */
-  buf_WIPE(buf, 66);
+  tain_minus(&diff, &subsv->timer.when, now);
+  return (uint32_t)tain_to_msecs(&diff);
+}
+
+
+/* status_nfail()
+**   consecutive fast failures of subsv (to 255)
+*/
+static
+uchar_t
+status_nfail(const struct subsv *subsv)
+{
+  return (subsv->nfail > 255) ? 255 : (uchar_t)subsv->nfail;
+}
+
+
+/* perpd_conn_status()
+**   pack status of svdef into buf (PERPD_STATUS bytes)
+*/
+void
+perpd_conn_status(uchar_t *buf, const struct svdef *svdef, const tain_t *now)
+{
+  buf_WIPE(buf, PERPD_STATUS);
 
   /* perpd: */
   upak32_pack(&buf[0], (uint32_t)my_pid);
@@ -353,48 +716,65 @@ perpd_conn_exec_query(struct perpd_conn *client)
   tain_pack(&buf[16], &svdef->when);
   buf[28] = svdef->bitflags;
   buf[29] = 0;
+  if(svdef->notify > 0){
+      buf[29] |= READY_FLAG_NOTIFY;
+      if(!tain_iszero(&svdef->when_ready)){
+          buf[29] |= READY_FLAG_READY;
+          tain_pack(&buf[74], &svdef->when_ready);
+      }
+  }
+
+  /* health check: */
+  if(svdef->check.bitflags & CHECK_FLAG_ENABLED){
+      upak32_pack(&buf[86], svdef->check.msecs);
+      buf[90] = svdef->check.bitflags;
+      buf[91] = svdef->check.nfail;
+  }
 
   /* main: */
   upak32_pack(&buf[30], (uint32_t)svdef->svpair[SUBSV_MAIN].pid);
   tain_pack(&buf[34], &svdef->svpair[SUBSV_MAIN].when);
   buf[46] = svdef->svpair[SUBSV_MAIN].bitflags;
-  buf[47] = 0;
+  buf[47] = status_nfail(&svdef->svpair[SUBSV_MAIN]);
+  upak32_pack(&buf[66], status_delay(&svdef->svpair[SUBSV_MAIN], now));
 
   /* log: */
   if(svdef->bitflags & SVDEF_FLAG_HASLOG){
       upak32_pack(&buf[48], (uint32_t)svdef->svpair[SUBSV_LOG].pid);
       tain_pack(&buf[52], &svdef->svpair[SUBSV_LOG].when);
       buf[64] = svdef->svpair[SUBSV_LOG].bitflags;
-      buf[65] = 0;
+      buf[65] = status_nfail(&svdef->svpair[SUBSV_LOG]);
+      upak32_pack(&buf[70], status_delay(&svdef->svpair[SUBSV_LOG], now));
   }
 
-  pkt_load(client->pkt, 2, 'S', buf, 66); 
-  client->n = pkt_len(client->pkt);
-  client->w = 0;
-  client->state = PERPD_CONN_WRITING;  
-
   return;
 }
 
 
 static
 void
-perpd_conn_exec_pidyank(struct perpd_conn *client)
+perpd_conn_exec_query(struct perpd_conn *client)
 {
-  /* currently not supported: */
-  perpd_conn_exec_reply(client, ENOTSUP);
-  return;
-}
+  uchar_t       *input = client->req;
+  dev_t          dev;
+  ino_t          ino;
+  struct svdef  *svdef;
+  uchar_t        buf[PKT_PAYLOAD];
+  tain_t         now;
 
+  dev = (dev_t)upak64_unpack(&input[0]);
+  ino = (ino_t)upak64_unpack(&input[8]);
 
-static
-void
-perpd_conn_exec_reply(struct perpd_conn *client, int err)
-{
-  uchar_t   buf[PKT_PAYLOAD];
+  svdef = perpd_lookup(client->base, dev, ino);
+  if(svdef == NULL){
+      perpd_conn_exec_reply(client, ENOTDIR);
+      return;
+  }
 
-  upak32_pack(buf, (uint32_t)err);
-  pkt_load(client->pkt, 2, 'E', buf, sizeof(uint32_t));
+  tain_now(&now);
+  perpd_conn_status(buf, svdef, &now);
+
+  pkt_load(client->pkt, 2, 'S', buf, PERPD_STATUS); 
   client->n = pkt_len(client->pkt);
   client->w = 0;
   client->state = PERPD_CONN_WRITING;  
@@ -403,130 +783,1414 @@ perpd_conn_exec_reply(struct perpd_conn *client, int err)
 }
 
 
-/*
-** perpd scope:
+/* perpd_conn_exec_namedquery()
+**   process 'q' pkt (name):
+**     reply with the 'R' status record of the service
 */
-
+static
 void
-perpd_conn_reset(struct perpd_conn *client)
+perpd_conn_exec_namedquery(struct perpd_conn *client)
 {
-  client->connfd = -1;
-  client->state = PERPD_CONN_CLOSED;
-  client->n = 0;
+  struct svdef  *svdef;
+  char           name[PERPD_NAMEMAX + 1];
+  tain_t         now;
+
+  if(request_name(name, client->req, client->reqlen) == -1){
+      perpd_conn_exec_reply(client, EPROTO);
+      return;
+  }
+
+  svdef = perpd_lookupname(client->base, name);
+  if(svdef == NULL){
+      perpd_conn_exec_reply(client, ENOTDIR);
+      return;
+  }
+
+  tain_now(&now);
+  status_record(client->pkt, svdef->dev, svdef->ino, svdef, &now);
+  client->n = pkt_len(client->pkt);
   client->w = 0;
+  client->state = PERPD_CONN_WRITING;
+
   return;
 }
 
 
-void
-perpd_conn_close(struct perpd_conn *client)
+/* status_record()
+**   pack 'R' record pkt for dev/ino into rec
+**   svdef NULL if dev/ino not found (record is dev/ino only)
+**   return:
+**     pointer to end of record in rec
+*/
+static
+uchar_t *
+status_record(uchar_t *rec, dev_t dev, ino_t ino,
+              const struct svdef *svdef, const tain_t *now)
 {
-  if(client->connfd != -1) close(client->connfd);
-  perpd_conn_reset(client);
-  return;
+  uchar_t  *data = &rec[PKT_HEADER];
+  size_t    len = 16;
+  size_t    namelen;
+
+  upak64_pack(&data[0], (uint64_t)dev);
+  upak64_pack(&data[8], (uint64_t)ino);
+  if(svdef != NULL){
+      namelen = cstr_len(svdef->name);
+      data[16] = PERPD_STATUS;
+      perpd_conn_status(&data[17], svdef, now);
+      buf_copy(&data[17 + PERPD_STATUS], svdef->name, namelen);
+      len = 17 + PERPD_STATUS + namelen;
+  }
+  pkt_init(rec, 2, 'R', len);
+
+  return &rec[PKT_HEADER + len];
 }
 
 
+/* rusage_pack()
+**   pack resource usage of tally into buf (PERPD_RUSAGE / 2 bytes)
+*/
+static
 void
-perpd_conn_start(struct perpd_conn *client, int connfd)
+rusage_pack(uchar_t *buf, const struct tally *tally)
 {
-  client->connfd = connfd;
-  tain_now(&client->stamp);
-  client->state = PERPD_CONN_READING;
-  client->n = 0;
-  client->w = 0;
+  upak64_pack(&buf[0], tally->utime_usecs);
+  upak64_pack(&buf[8], tally->stime_usecs);
+  upak64_pack(&buf[16], tally->maxrss);
+  upak64_pack(&buf[24], tally->majflt);
+  upak64_pack(&buf[32], tally->nvcsw);
+  upak64_pack(&buf[40], tally->nivcsw);
+
   return;
 }
 
 
-void
-perpd_conn_checkstale(struct perpd_conn *client, struct tain *now)
+/* list_record()
+**   pack 'R' record pkt for dev/ino into rec,
+**   followed by 'U' record of resource usage if svdef is found
+**   return:
+**     pointer to end of records in rec
+*/
+static
+uchar_t *
+list_record(uchar_t *rec, dev_t dev, ino_t ino,
+            const struct svdef *svdef, const tain_t *now)
 {
-  tain_t  diff, max_diff = tain_INIT(PERPD_CONNSECS, 0);
+  uchar_t  *data;
 
-  /* assumes clock is strictly monotonic! */
-  if(tain_less(&client->stamp, now)){
-      tain_minus(&diff, now, &client->stamp);
-      if(tain_less(&max_diff, &diff)){
-          /* close stale connection: */
-          log_warning("closing stale client connection");
-          perpd_conn_close(client);
-      }
+  rec = status_record(rec, dev, ino, svdef, now);
+  if(svdef == NULL){
+      return rec;
   }
 
-  return;
+  data = &rec[PKT_HEADER];
+  upak64_pack(&data[0], (uint64_t)dev);
+  upak64_pack(&data[8], (uint64_t)ino);
+  data[16] = PERPD_RUSAGE;
+  rusage_pack(&data[17], &svdef->svpair[SUBSV_MAIN].tally);
+  rusage_pack(&data[17 + (PERPD_RUSAGE / 2)], &svdef->svpair[SUBSV_LOG].tally);
+  pkt_init(rec, 2, 'U', 17 + PERPD_RUSAGE);
+
+  return &rec[PKT_HEADER + 17 + PERPD_RUSAGE];
 }
 
 
+/* metrics_pack()
+**   pack runtime metrics of tally into buf (PERPD_METRICS bytes)
+*/
+static
 void
-perpd_conn_read(struct perpd_conn *client)
+metrics_pack(uchar_t *buf, const struct tally *tally)
 {
-  size_t    n = client->n;
-  ssize_t   r;
-
-  /* pkt_read() from socket, socket is non-blocking: */
-  r = pkt_read(client->connfd, client->pkt, n);
-
-  /* handle errors: */
-  if(r == -1){
-      /* error, close socket, reset client */
-      warn_syserr("error reading client");
-      perpd_conn_close(client);
-      return;
-  }else if(r == 0){
-      /* eof, close socket, reset client */
-      log_debug("client closed connection");
-      perpd_conn_close(client);
-      return;
+  int  i;
+
+  upak32_pack(&buf[0], tally->starts);
+  upak32_pack(&buf[4], tally->exits);
+  upak32_pack(&buf[8], tally->exits_error);
+  upak32_pack(&buf[12], tally->exits_signal);
+  upak64_pack(&buf[16], tally->life_msecs);
+  upak64_pack(&buf[24], tally->reset_msecs);
+  for(i = 0; i < PERPD_TALLY_BINS; ++i){
+      upak32_pack(&buf[32 + (i * 4)], tally->life[i]);
+      upak32_pack(&buf[32 + (PERPD_TALLY_BINS * 4) + (i * 4)], tally->reset[i]);
   }
 
-  /* else: */
-  client->n += r;
-  if(perpd_pkt_check(client->pkt, client->n) == 1){
-      log_debug("perpd_conn_read() complete");
-      /* pkt read is complete:
-      **   process control packet and execute
-      **   put reply packet in client buffer
-      **   set client state to PERPD_CONN_WRITING
-      */
+  return;
+}
+
+
+/* metrics_record()
+**   pack 'N' records for dev/ino into rec, one for main and one for log
+**   svdef NULL if dev/ino not found (one record, dev/ino only)
+**   return:
+**     pointer to end of records in rec
+*/
+static
+uchar_t *
+metrics_record(uchar_t *rec, dev_t dev, ino_t ino,
+               const struct svdef *svdef, const tain_t *now)
+{
+  uchar_t  *data;
+  size_t    len, namelen;
+  int       which;
+
+  (void)now;
+  if(svdef == NULL){
+      data = &rec[PKT_HEADER];
+      upak64_pack(&data[0], (uint64_t)dev);
+      upak64_pack(&data[8], (uint64_t)ino);
+      pkt_init(rec, 2, 'N', 16);
+      return &rec[PKT_HEADER + 16];
+  }
+
+  namelen = cstr_len(svdef->name);
+  for(which = SUBSV_MAIN; which <= SUBSV_LOG; ++which){
+      if((which == SUBSV_LOG) && !(svdef->bitflags & SVDEF_FLAG_HASLOG)){
+          break;
+      }
+      data = &rec[PKT_HEADER];
+      upak64_pack(&data[0], (uint64_t)dev);
+      upak64_pack(&data[8], (uint64_t)ino);
+      data[16] = (uchar_t)which;
+      data[17] = PERPD_METRICS;
+      metrics_pack(&data[18], &svdef->svpair[which].tally);
+      buf_copy(&data[18 + PERPD_METRICS], svdef->name, namelen);
+      len = 18 + PERPD_METRICS + namelen;
+      pkt_init(rec, 2, 'N', len);
+      rec = &rec[PKT_HEADER + len];
+  }
+
+  return rec;
+}
+
+
+/* perpd_conn_exec_list()
+**   process 'L' pkt:
+**     reply with a stream of 'R' records, for each dev/ino in request,
+**     or for all active services if request is empty
+**     each 'R' record of an active service is followed by its 'U' record
+**     stream is terminated with an 'E' reply of 0
+*/
+static
+void
+perpd_conn_exec_list(struct perpd_conn *client)
+{
+  perpd_conn_exec_stream(client, PERPD_LISTREC + PERPD_RUSAGEREC, &list_record);
+  return;
+}
+
+
+/* perpd_conn_exec_metrics()
+**   process 'M' pkt:
+**     as 'L', with a stream of 'N' metrics records for main and log
+*/
+static
+void
+perpd_conn_exec_metrics(struct perpd_conn *client)
+{
+  perpd_conn_exec_stream(client, PERPD_METRICREC, &metrics_record);
+  return;
+}
+
+
+/* perpd_conn_exec_stream()
+**   reply to 'L' or 'M' request of client:
+**     record() packs records of at most recmax bytes for each dev/ino
+**     in request, or for all active services if request is empty
+**     stream is terminated with an 'E' reply of 0
+*/
+static
+void
+perpd_conn_exec_stream(struct perpd_conn *client, size_t recmax,
+                       uchar_t * (*record)(uchar_t *, dev_t, ino_t,
+                                           const struct svdef *,
+                                           const tain_t *))
+{
+  uchar_t        *input = client->req;
+  size_t          nreq = client->reqlen / 16;
+  struct svdef  **svdefs;
+  struct svdef   *svdef;
+  size_t          nsv, nrec, i;
+  uchar_t        *p;
+  tain_t          now;
+  dev_t           dev;
+  ino_t           ino;
+
+  svdefs = client->base->svtab.svdefs;
+  nsv = client->base->svtab.n;
+  nrec = (nreq > 0) ? nreq : nsv;
+
+  client->obuf = (uchar_t *)malloc((nrec * recmax) + PKT_HEADER + 4);
+  if(client->obuf == NULL){
+      perpd_conn_exec_reply(client, ENOMEM);
+      return;
+  }
+
+  tain_now(&now);
+  p = client->obuf;
+  if(nreq > 0){
+      for(i = 0; i < nreq; ++i){
+          dev = (dev_t)upak64_unpack(&input[(i * 16)]);
+          ino = (ino_t)upak64_unpack(&input[(i * 16) + 8]);
+          p = record(p, dev, ino, perpd_lookup(client->base, dev, ino), &now);
+      }
+  }else{
+      for(i = 0; i < nsv; ++i){
+          svdef = svdefs[i];
+          p = record(p, svdef->dev, svdef->ino, svdef, &now);
+      }
+  }
+
+  /* terminal: */
+  pkt_init(p, 2, 'E', 4);
+  upak32_pack(&p[PKT_HEADER], 0);
+  p += PKT_HEADER + 4;
+
+  client->olen = (size_t)(p - client->obuf);
+  client->w = 0;
+  client->state = PERPD_CONN_WRITING;
+
+  return;
+}
+
+
+/* perpd_conn_exec_subscribe()
+**   process 'W' pkt:
+**     reply with an 'E' of 0, and continue the connection as a stream
+**     of 'V' event packets, for each dev/ino in request, or for all
+**     services if request is empty
+**     the subscription lasts until the client closes the connection
+*/
+static
+void
+perpd_conn_exec_subscribe(struct perpd_conn *client)
+{
+  size_t   nreq = client->reqlen / 16;
+
+  client->obuf = (uchar_t *)malloc(PERPD_SUBQ);
+  if(client->obuf == NULL){
+      perpd_conn_exec_reply(client, ENOMEM);
+      return;
+  }
+  if(nreq > 0){
+      client->subv = (uchar_t *)malloc(nreq * 16);
+      if(client->subv == NULL){
+          free(client->obuf);
+          client->obuf = NULL;
+          perpd_conn_exec_reply(client, ENOMEM);
+          return;
+      }
+      buf_copy(client->subv, client->req, nreq * 16);
+  }
+  client->nsub = nreq;
+  client->dropped = 0;
+
+  /* acknowledge, first in event queue: */
+  pkt_init(client->obuf, 2, 'E', 4);
+  upak32_pack(&client->obuf[PKT_HEADER], 0);
+  client->olen = PKT_HEADER + 4;
+  client->w = 0;
+
+  log_debug("client subscribed to events");
+  client->state = PERPD_CONN_SUBSCRIBED;
+  conn_unlink(client);
+  sub_link(client);
+
+  return;
+}
+
+
+static
+void
+perpd_conn_exec_pidyank(struct perpd_conn *client)
+{
+  /* currently not supported: */
+  perpd_conn_exec_reply(client, ENOTSUP);
+  return;
+}
+
+
+/* perpd_conn_exec_hello()
+**   process 'H' pkt (empty):
+**     reply with 'H' record of the highest protocol version of perpd, and
+**     the maximum payload of a request on this connection
+*/
+static
+void
+perpd_conn_exec_hello(struct perpd_conn *client)
+{
+  uchar_t   buf[PKT_PAYLOAD];
+
+  buf[0] = 3;
+  upak32_pack(&buf[1], (client->proto == 3) ? PERPD_MSGMAX : PKT_PAYLOAD);
+  pkt_load(client->pkt, 2, 'H', buf, 5);
+  client->n = pkt_len(client->pkt);
+  client->w = 0;
+  client->state = PERPD_CONN_WRITING;
+
+  return;
+}
+
+
+static
+void
+perpd_conn_exec_reply(struct perpd_conn *client, int err)
+{
+  uchar_t   buf[PKT_PAYLOAD];
+
+  upak32_pack(buf, (uint32_t)err);
+  pkt_load(client->pkt, 2, 'E', buf, sizeof(uint32_t));
+  client->n = pkt_len(client->pkt);
+  client->w = 0;
+  client->state = PERPD_CONN_WRITING;  
+
+  return;
+}
+
+
+/* conn_link()
+**   append client to tail of open connections list
+*/
+static
+void
+conn_link(struct perpd_conn *client)
+{
+  client->next = NULL;
+  client->prev = conn_tail;
+  if(conn_tail != NULL){
+      conn_tail->next = client;
+  }else{
+      conn_head = client;
+  }
+  conn_tail = client;
+
+  return;
+}
+
+
+/* conn_unlink()
+**   remove client from open connections list
+*/
+static
+void
+conn_unlink(struct perpd_conn *client)
+{
+  if(client->prev != NULL){
+      client->prev->next = client->next;
+  }else{
+      conn_head = client->next;
+  }
+  if(client->next != NULL){
+      client->next->prev = client->prev;
+  }else{
+      conn_tail = client->prev;
+  }
+  client->prev = client->next = NULL;
+
+  return;
+}
+
+
+/* conn_start()
+**   (re)start client reading a new request
+**   stamp is renewed, client moves to tail of open connections list
+*/
+static
+void
+conn_start(struct perpd_conn *client)
+{
+  tain_now(&client->stamp);
+  client->state = PERPD_CONN_READING;
+  client->n = 0;
+  client->w = 0;
+  conn_unlink(client);
+  conn_link(client);
+
+  return;
+}
+
+
+/* conn_close()
+**   close client connection and return client to free list
+*/
+static
+void
+conn_close(struct perpd_conn *client)
+{
+  perpd_ev_del(&client->evh);
+  close(client->connfd);
+  if(client->state == PERPD_CONN_SUBSCRIBED){
+      sub_unlink(client);
+  }else{
+      conn_unlink(client);
+  }
+  client->connfd = -1;
+  client->state = PERPD_CONN_CLOSED;
+  client->n = 0;
+  client->w = 0;
+  if(client->obuf != NULL){
+      free(client->obuf);
+      client->obuf = NULL;
+  }
+  if(client->subv != NULL){
+      free(client->subv);
+      client->subv = NULL;
+  }
+  client->olen = 0;
+  client->nsub = 0;
+  client->ihead = client->itail = 0;
+  client->ohead = client->otail = 0;
+  client->eof = 0;
+  client->next = conn_free;
+  conn_free = client;
+  --conn_n;
+
+  return;
+}
+
+
+/* ring_put()
+**   copy len bytes of src into ring of size at free running pos
+*/
+static
+void
+ring_put(uchar_t *ring, size_t size, size_t pos, const uchar_t *src, size_t len)
+{
+  size_t  at = pos & (size - 1);
+  size_t  m = size - at;
+
+  if(m > len) m = len;
+  buf_copy(&ring[at], src, m);
+  buf_copy(ring, &src[m], len - m);
+
+  return;
+}
+
+
+/* ring_get()
+**   copy len bytes out of ring of size at free running pos into dst
+*/
+static
+void
+ring_get(uchar_t *dst, const uchar_t *ring, size_t size, size_t pos, size_t len)
+{
+  size_t  at = pos & (size - 1);
+  size_t  m = size - at;
+
+  if(m > len) m = len;
+  buf_copy(dst, &ring[at], m);
+  buf_copy(&dst[m], ring, len - m);
+
+  return;
+}
+
+
+/* conn_ready()
+**   check for a complete request packet in input ring of client
+**   return:
+**     1: yes
+**     0: no
+*/
+static
+int
+conn_ready(const struct perpd_conn *client)
+{
+  size_t  len = client->itail - client->ihead;
+
+  if(len < PKT_HEADER){
+      return 0;
+  }
+
+  return (len >= (PKT_HEADER + (size_t)client->iring[(client->ihead + 2) & (PERPD_CONN_IRING - 1)]));
+}
+
+
+/* conn_pending()
+**   check for output queued to client, not yet written
+**   return:
+**     1: yes
+**     0: no
+*/
+static
+int
+conn_pending(const struct perpd_conn *client)
+{
+  return ((client->otail != client->ohead) ||
+          ((client->obuf != NULL) && (client->w < client->olen)));
+}
+
+
+/* conn_fill()
+**   read from protocol 2 client into free space of input ring
+**   a read short of the free space drains the socket (stream socket), and
+**   saves the read to EAGAIN
+**   return:
+**     1: input ring filled, more may be waiting
+**     0: socket drained (EAGAIN, or eof set)
+**    -1: client closed
+*/
+static
+int
+conn_fill(struct perpd_conn *client)
+{
+  struct iovec  iov[2];
+  size_t        room = PERPD_CONN_IRING - (client->itail - client->ihead);
+  size_t        at = client->itail & (PERPD_CONN_IRING - 1);
+  int           niov = 1;
+  ssize_t       r;
+
+  if(room == 0){
+      return 1;
+  }
+
+  iov[0].iov_base = &client->iring[at];
+  iov[0].iov_len = PERPD_CONN_IRING - at;
+  if(iov[0].iov_len >= room){
+      iov[0].iov_len = room;
+  }else{
+      iov[1].iov_base = client->iring;
+      iov[1].iov_len = room - iov[0].iov_len;
+      ++niov;
+  }
+
+  do{
+      r = readv(client->connfd, iov, niov);
+  }while((r == -1) && (errno == EINTR));
+
+  if(r == -1){
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+          return 0;
+      }
+      warn_syserr("error reading client");
+      conn_close(client);
+      return -1;
+  }else if(r == 0){
+      /* eof: requests in ring are still served before close: */
+      client->eof = 1;
+      return 0;
+  }
+
+  client->itail += (size_t)r;
+  return ((size_t)r == room) ? 1 : 0;
+}
+
+
+/* conn_parse()
+**   execute complete requests in input ring of protocol 2 client, and
+**   queue replies in output ring (or leave reply stream in client->obuf)
+**   stops on first incomplete request, on a reply stream, or when the
+**   output ring has no room for another reply
+*/
+static
+void
+conn_parse(struct perpd_conn *client)
+{
+  size_t  n;
+
+  while((client->obuf == NULL) && (client->state != PERPD_CONN_SUBSCRIBED)
+        && ((PERPD_CONN_ORING - (client->otail - client->ohead)) >= PKT_SIZE)
+        && conn_ready(client)){
+      conn_start(client);
+      n = PKT_HEADER + (size_t)client->iring[(client->ihead + 2) & (PERPD_CONN_IRING - 1)];
+      ring_get(client->pkt, client->iring, PERPD_CONN_IRING, client->ihead, n);
+      client->ihead += n;
+      client->n = n;
+      log_debug("conn_parse() request complete");
       perpd_conn_exec(client);
-  } else {
-      /* pkt read not yet complete, leave to next poll(): */
-      log_debug("perpd_conn_read() to be continued...");
+      if(client->state == PERPD_CONN_SUBSCRIBED){
+          break;
+      }
+      if(client->obuf == NULL){
+          /* reply packet: */
+          ring_put(client->oring, PERPD_CONN_ORING, client->otail,
+                   client->pkt, pkt_len(client->pkt));
+          client->otail += pkt_len(client->pkt);
+      }
+      client->state = PERPD_CONN_READING;
+  }
+
+  return;
+}
+
+
+/* conn_flush()
+**   write output ring of protocol 2 client, followed by any stream in
+**   client->obuf, with one writev()
+**   a completed stream is freed, or reset for the event queue of a subscriber
+**   a write short of the output fills the socket, and saves the write to
+**   EAGAIN
+**   return:
+**     1: output complete (or none)
+**     0: output incomplete, continue on next event
+**    -1: failure, errno set
+*/
+static
+int
+conn_flush(struct perpd_conn *client)
+{
+  struct iovec  iov[3];
+  size_t        rlen = client->otail - client->ohead;
+  size_t        at = client->ohead & (PERPD_CONN_ORING - 1);
+  size_t        total = 0;
+  size_t        m;
+  int           niov = 0;
+  ssize_t       r;
+
+  if(rlen > 0){
+      m = PERPD_CONN_ORING - at;
+      if(m > rlen) m = rlen;
+      iov[niov].iov_base = &client->oring[at];
+      iov[niov++].iov_len = m;
+      if(m < rlen){
+          iov[niov].iov_base = client->oring;
+          iov[niov++].iov_len = rlen - m;
+      }
+      total = rlen;
+  }
+  if((client->obuf != NULL) && (client->w < client->olen)){
+      iov[niov].iov_base = &client->obuf[client->w];
+      iov[niov++].iov_len = client->olen - client->w;
+      total += client->olen - client->w;
+  }
+  if(niov == 0){
+      return 1;
+  }
+
+  do{
+      r = writev(client->connfd, iov, niov);
+  }while((r == -1) && (errno == EINTR));
+  if(r == -1){
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+          return 0;
+      }
+      return -1;
+  }
+
+  m = ((size_t)r < rlen) ? (size_t)r : rlen;
+  client->ohead += m;
+  client->w += (size_t)r - m;
+  if((size_t)r < total){
+      log_debug("conn_flush() to be continued...");
+      return 0;
+  }
+
+  if(client->obuf != NULL){
+      if(client->state == PERPD_CONN_SUBSCRIBED){
+          /* queue empty: */
+          client->olen = 0;
+          client->w = 0;
+      }else{
+          free(client->obuf);
+          client->obuf = NULL;
+          client->olen = 0;
+          client->w = 0;
+      }
+  }
+
+  log_debug("conn_flush() complete");
+  return 1;
+}
+
+
+/* conn_io()
+**   drive protocol 2 client until its input is drained (or output is
+**   blocked): read into input ring, execute requests, flush replies
+**   input is drained to EAGAIN before waiting on input, as readiness of
+**   the connection is edge-triggered
+*/
+static
+void
+conn_io(struct perpd_conn *client)
+{
+  int  more, r;
+
+  for(;;){
+      more = 0;
+      if(!client->eof){
+          if(conn_pending(client)){
+              /* input not read behind output, read once output is flushed
+              ** (its edge-triggered readiness may be spent already):
+              */
+              more = 1;
+          }else if((more = conn_fill(client)) == -1){
+              return;
+          }
+      }
+      conn_parse(client);
+      r = conn_flush(client);
+      if(r == -1){
+          warn_syserr("error writing to client");
+          conn_close(client);
+          return;
+      }
+      if(client->state == PERPD_CONN_SUBSCRIBED){
+          /* continued by sub_io(): */
+          perpd_ev_mod(&client->evh,
+                       (r == 0) ? (PERPD_EV_IN | PERPD_EV_OUT) : PERPD_EV_IN);
+          return;
+      }
+      if(r == 0){
+          /* waiting on client to take output: */
+          perpd_ev_mod(&client->evh, PERPD_EV_OUT);
+          return;
+      }
+      if(!conn_ready(client)){
+          if(client->eof){
+              log_debug("client closed connection");
+              conn_close(client);
+              return;
+          }
+          if(!more){
+              /* waiting on client for input: */
+              perpd_ev_mod(&client->evh, PERPD_EV_IN);
+              return;
+          }
+      }
+  }
+
+  /* not reached: */
+  return;
+}
+
+
+/* conn_readmsg()
+**   receive request message from protocol 3 client
+**   a message is received whole, or not at all: there is no partial read
+**   to be continued
+**   return:
+**     1: request received and processed, client in writing state
+**     0: nothing received (EAGAIN), continue on next event
+**    -1: client closed
+*/
+static
+int
+conn_readmsg(struct perpd_conn *client)
+{
+  struct iovec   iov;
+  struct msghdr  msg;
+  ssize_t        r;
+  size_t         len;
+
+  iov.iov_base = msgbuf;
+  iov.iov_len = PERPD_MSGHEADER + PERPD_MSGMAX;
+  buf_zero(&msg, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  do{
+      r = recvmsg(client->connfd, &msg, 0);
+  }while((r == -1) && (errno == EINTR));
+
+  if(r == -1){
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+          return 0;
+      }
+      warn_syserr("error reading client");
+      conn_close(client);
+      return -1;
+  }else if(r == 0){
+      log_debug("client closed connection");
+      conn_close(client);
+      return -1;
+  }
+
+  /* else: */
+  len = (size_t)r;
+  client->type = (len > 1) ? msgbuf[1] : 0;
+  client->tag = (len >= 6) ? upak32_unpack(&msgbuf[2]) : 0;
+  if(msg.msg_flags & MSG_TRUNC){
+      log_debug("message exceeds PERPD_MSGMAX");
+      perpd_conn_exec_reply(client, EMSGSIZE);
+      return 1;
+  }
+  if((len < PERPD_MSGHEADER) || (msgbuf[0] != 3) ||
+     (upak32_unpack(&msgbuf[6]) != (uint32_t)(len - PERPD_MSGHEADER))){
+      perpd_conn_exec_reply(client, EPROTO);
+      return 1;
+  }
+
+  log_debug("conn_readmsg() complete");
+  client->req = &msgbuf[PERPD_MSGHEADER];
+  client->reqlen = len - PERPD_MSGHEADER;
+  perpd_conn_exec(client);
+
+  return 1;
+}
+
+
+/* conn_write()
+**   send reply to protocol 3 client
+**   return:
+**     1: write complete, client restarted in reading state
+**     0: write incomplete (EAGAIN), continue on next event
+**    -1: client closed
+*/
+static
+int
+conn_write(struct perpd_conn *client)
+{
+  int   r;
+
+  if(client->obuf != NULL){
+      return conn_writebuf(client);
+  }
+
+  r = conn_sendmsg(client, client->pkt, client->n);
+  if(r == -1){
+      warn_syserr("error writing to client");
+      conn_close(client);
+      return -1;
+  }
+  if(r == 0){
+      log_debug("conn_write() to be continued...");
+      return 0;
+  }
+
+  /* reply complete, resume in read state: */
+  log_debug("conn_write() complete");
+  conn_start(client);
+
+  return 1;
+}
+
+
+/* conn_writebuf()
+**   send reply stream in client->obuf to protocol 3 client
+**   return as conn_write()
+*/
+static
+int
+conn_writebuf(struct perpd_conn *client)
+{
+  int   r;
+
+  r = conn_sendmsg(client, client->obuf, client->olen);
+  if(r == 0){
+      log_debug("conn_writebuf() to be continued...");
+      return 0;
+  }
+  if(r == -1){
+      warn_syserr("error writing to client");
+      conn_close(client);
+      return -1;
+  }
+
+  /* stream complete, resume in read state: */
+  log_debug("conn_writebuf() complete");
+  free(client->obuf);
+  client->obuf = NULL;
+  client->olen = 0;
+  conn_start(client);
+
+  return 1;
+}
+
+
+/* conn_sendmsg()
+**   send reply records buf[client->w .. len) to protocol 3 client:
+**     records are packed whole (each a packet of protocol 2) into
+**     messages of up to PERPD_MSGMAX bytes of payload, each message with
+**     the type and tag of the request
+**     a message is sent whole or not at all, client->w advanced by the
+**     records of each message sent
+**   return:
+**     1: all records sent
+**     0: incomplete (EAGAIN), continue on next event
+**    -1: failure, errno set
+*/
+static
+int
+conn_sendmsg(struct perpd_conn *client, const uchar_t *buf, size_t len)
+{
+  uchar_t        hdr[PERPD_MSGHEADER];
+  struct iovec   iov[2];
+  struct msghdr  msg;
+  size_t         w, m;
+  ssize_t        r;
+
+  while(client->w < len){
+      w = client->w;
+      for(m = 0; (w + m) < len; m += pkt_len(&buf[w + m])){
+          if((m + pkt_len(&buf[w + m])) > PERPD_MSGMAX) break;
+      }
+
+      hdr[0] = 3;
+      hdr[1] = client->type;
+      upak32_pack(&hdr[2], client->tag);
+      upak32_pack(&hdr[6], (uint32_t)m);
+      iov[0].iov_base = hdr;
+      iov[0].iov_len = PERPD_MSGHEADER;
+      iov[1].iov_base = (void *)&buf[w];
+      iov[1].iov_len = m;
+      buf_zero(&msg, sizeof msg);
+      msg.msg_iov = iov;
+      msg.msg_iovlen = 2;
+
+      do{
+          r = sendmsg(client->connfd, &msg, 0);
+      }while((r == -1) && (errno == EINTR));
+      if(r == -1){
+          if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+              return 0;
+          }
+          return -1;
+      }
+      client->w += m;
+  }
+
+  return 1;
+}
+
+
+/* sub_link()
+**   insert client at head of subscribers list
+*/
+static
+void
+sub_link(struct perpd_conn *client)
+{
+  client->prev = NULL;
+  client->next = sub_head;
+  if(sub_head != NULL){
+      sub_head->prev = client;
+  }
+  sub_head = client;
+
+  return;
+}
+
+
+/* sub_unlink()
+**   remove client from subscribers list
+*/
+static
+void
+sub_unlink(struct perpd_conn *client)
+{
+  if(client->prev != NULL){
+      client->prev->next = client->next;
+  }else{
+      sub_head = client->next;
   }
+  if(client->next != NULL){
+      client->next->prev = client->prev;
+  }
+  client->prev = client->next = NULL;
 
   return;
 }
 
 
+/* sub_wants()
+**   check if subscriber wants events for packed dev/ino
+**   return:
+**     1: yes
+**     0: no
+*/
+static
+int
+sub_wants(const struct perpd_conn *client, const uchar_t *devino)
+{
+  size_t  i;
+
+  if(client->nsub == 0){
+      return 1;
+  }
+  for(i = 0; i < client->nsub; ++i){
+      if(buf_cmp(&client->subv[i * 16], devino, 16) == 0){
+          return 1;
+      }
+  }
+
+  return 0;
+}
+
+
+/* sub_put()
+**   append event record of len bytes to subscriber queue
+**   a full queue is written out as far as the socket will take it now;
+**   on overflow the subscriber is marked dropped, to be closed by
+**   perpd_conn_flush() (perpd never waits on a subscriber)
+*/
+static
 void
-perpd_conn_write(struct perpd_conn *client)
+sub_put(struct perpd_conn *client, const uchar_t *rec, size_t len)
 {
-  int       connfd = client->connfd;
-  size_t    n = client->n;  /* total bytes in pkt */
-  size_t    w = client->w;  /* bytes previously written */
-  ssize_t   r;
+  if(client->dropped){
+      return;
+  }
+
+  if((client->olen + len) > PERPD_SUBQ){
+      sub_drain(client);
+      /* reclaim space written out: */
+      if(client->w > 0){
+          buf_copy(client->obuf, &client->obuf[client->w], client->olen - client->w);
+          client->olen -= client->w;
+          client->w = 0;
+      }
+      if((client->olen + len) > PERPD_SUBQ){
+          log_warning("event queue overflow on subscriber connection");
+          client->dropped = 1;
+          return;
+      }
+  }
+
+  buf_copy(&client->obuf[client->olen], rec, len);
+  client->olen += len;
 
-  /* pkt_write() to socket, socket is non-blocking: */
-  r = pkt_write(client->connfd, client->pkt, w);
+  return;
+}
 
+
+/* sub_drain()
+**   write out subscriber queue until empty or EAGAIN
+**   an empty queue is reset; on write error the subscriber is marked dropped
+*/
+static
+void
+sub_drain(struct perpd_conn *client)
+{
+  int  r;
+
+  if(client->proto == 3){
+      r = conn_sendmsg(client, client->obuf, client->olen);
+      if(r == 1){
+          /* queue empty: */
+          client->olen = 0;
+          client->w = 0;
+      }
+  }else{
+      /* (any replies still in output ring go first:) */
+      r = conn_flush(client);
+  }
   if(r == -1){
-      /* error, close socket, reset client */
-      warn_syserr("error writing to client");
-      perpd_conn_close(client);
+      warn_syserr("error writing to subscriber");
+      client->dropped = 1;
+  }
+
+  return;
+}
+
+
+/* sub_io()
+**   service subscriber connection:
+**     discard any input, close on eof or error
+**     write out event queue until empty or EAGAIN
+**   return:
+**     0: subscriber open
+**    -1: subscriber closed
+*/
+static
+int
+sub_io(struct perpd_conn *client)
+{
+  ssize_t  r;
+
+  /* input not expected from subscriber, check for eof: */
+  for(;;){
+      do{
+          r = read(client->connfd, client->pkt, sizeof client->pkt);
+      }while((r == -1) && (errno == EINTR));
+      if(r > 0){
+          continue;
+      }
+      if(r == 0){
+          log_debug("subscriber closed connection");
+          conn_close(client);
+          return -1;
+      }
+      if((errno == EAGAIN) || (errno == EWOULDBLOCK)){
+          break;
+      }
+      warn_syserr("error reading subscriber");
+      conn_close(client);
+      return -1;
+  }
+
+  /* write out queue: */
+  if(!client->dropped){
+      sub_drain(client);
+  }
+  if(client->dropped){
+      log_warning("closing subscriber connection");
+      conn_close(client);
+      return -1;
+  }
+
+  perpd_ev_mod(&client->evh,
+               conn_pending(client) ?
+                   (PERPD_EV_IN | PERPD_EV_OUT) : PERPD_EV_IN);
+
+  return 0;
+}
+
+
+/*
+** perpd scope:
+*/
+
+/* perpd_conn_init()
+**   allocate pool for connmax client connections
+**   return:
+**     0: success
+**    -1: allocation failure
+*/
+int
+perpd_conn_init(size_t connmax)
+{
+  size_t  i;
+
+  conn_pool = (struct perpd_conn *)calloc(connmax, sizeof(struct perpd_conn));
+  msgbuf = (uchar_t *)malloc(PERPD_MSGHEADER + PERPD_MSGMAX);
+  if((conn_pool == NULL) || (msgbuf == NULL)){
+      errno = ENOMEM;
+      return -1;
+  }
+
+  conn_n = 0;
+  conn_head = conn_tail = NULL;
+  conn_free = NULL;
+  i = connmax;
+  while(i > 0){
+      --i;
+      conn_pool[i].connfd = -1;
+      conn_pool[i].state = PERPD_CONN_CLOSED;
+      conn_pool[i].next = conn_free;
+      conn_free = &conn_pool[i];
+  }
+
+  return 0;
+}
+
+
+/* perpd_conn_count()
+**   number of open client connections
+*/
+size_t
+perpd_conn_count(void)
+{
+  return conn_n;
+}
+
+
+/* perpd_conn_accept()
+**   accept all pending connections on listening socket fd_listen of base
+**   (until EAGAIN), each client then served from base, in protocol 3 on
+**   base->fd_seq, else protocol 2
+**   connections beyond the pool are accepted and closed immediately
+*/
+void
+perpd_conn_accept(struct perpd_base *base, int fd_listen)
+{
+  struct perpd_conn  *client;
+  int                 connfd;
+  uint32_t            nrefused = 0;
+  char                nbuf[NFMT_SIZE];
+
+  for(;;){
+      connfd = domsock_acceptnb(fd_listen);
+      if(connfd == -1){
+          if(errno == ECONNABORTED){
+              continue;
+          }
+          if((errno != EAGAIN) && (errno != EWOULDBLOCK)){
+              warn_syserr("failure accept() on new client connection");
+          }
+          break;
+      }
+
+      if(conn_free == NULL){
+          ++nrefused;
+          close(connfd);
+          continue;
+      }
+
+      client = conn_free;
+      if(perpd_ev_add(&client->evh, connfd, PERPD_EV_IN | PERPD_EV_EDGE,
+                      PERPD_EVK_CONN, client) == -1){
+          warn_syserr("failure registering new client connection");
+          close(connfd);
+          continue;
+      }
+      conn_free = client->next;
+      client->connfd = connfd;
+      client->proto = (fd_listen == base->fd_seq) ? 3 : 2;
+      client->base = base;
+      client->prev = client->next = NULL;
+      ++conn_n;
+      log_debug("starting new client connection...");
+      conn_link(client);
+      conn_start(client);
+  }
+
+  if(nrefused > 0){
+      log_warning("too many client connections, refused ",
+                  nfmt_uint32(nbuf, nrefused), " new ",
+                  (nrefused == 1) ? "connection" : "connections");
+  }
+
+  return;
+}
+
+
+/* perpd_conn_event()
+**   drive client i/o on readiness revents until EAGAIN
+**   (required for edge-triggered events)
+*/
+void
+perpd_conn_event(struct perpd_conn *client, int revents)
+{
+  int  r;
+
+  /* client may have been closed since the event was reported: */
+  if(client->connfd == -1){
       return;
   }
 
-  /* else: */
-  w += r;
-  if(w == n){
-      /* packet write complete, resume in read state: */
-      log_debug("perpd_conn_write() complete");
-      perpd_conn_start(client, connfd);
-  } else {
-      /* continue writing on next poll()... */
-      log_debug("perpd_conn_write() to be continued...");
-      client->w = w;
+  /* subscriber: */
+  if(client->state == PERPD_CONN_SUBSCRIBED){
+      sub_io(client);
+      return;
+  }
+
+  /* error/hangup on a client awaiting reply, nothing more to do: */
+  if((revents & PERPD_EV_ERR) &&
+     ((client->state == PERPD_CONN_WRITING) || conn_pending(client))){
+      log_debug("client connection dropped before reply");
+      conn_close(client);
+      return;
+  }
+
+  /* protocol 2, pipelined: */
+  if(client->proto == 2){
+      conn_io(client);
+      return;
+  }
+
+  do{
+      switch(client->state){
+      case PERPD_CONN_READING: r = conn_readmsg(client); break;
+      case PERPD_CONN_WRITING: r = conn_write(client); break;
+      case PERPD_CONN_SUBSCRIBED: r = sub_io(client); break;
+      default: r = -1; break;
+      }
+  }while(r == 1);
+
+  if((r == 0) && (client->state != PERPD_CONN_SUBSCRIBED)){
+      /* waiting on client, set interest for current state: */
+      perpd_ev_mod(&client->evh,
+                   (client->state == PERPD_CONN_WRITING) ?
+                       PERPD_EV_OUT : PERPD_EV_IN);
+  }
+
+  return;
+}
+
+
+/* perpd_conn_checkstale()
+**   close connections older than PERPD_CONNSECS at time now
+**   return:
+**     -1: no open connections
+**    >=0: msecs until the oldest open connection becomes stale
+*/
+int
+perpd_conn_checkstale(const struct tain *now)
+{
+  tain_t  max_diff = tain_INIT(PERPD_CONNSECS, 0);
+  tain_t  deadline, diff;
+
+  while(conn_head != NULL){
+      tain_plus(&deadline, &conn_head->stamp, &max_diff);
+      if(tain_less(now, &deadline)){
+          tain_minus(&diff, &deadline, now);
+          return (int)tain_to_msecs(&diff) + 1;
+      }
+      /* close stale connection: */
+      log_warning("closing stale client connection");
+      conn_close(conn_head);
+  }
+
+  return -1;
+}
+
+
+/* perpd_conn_closeall()
+**   close all open client connections
+**   (subscribers are kept, to follow a shutdown to its end)
+*/
+void
+perpd_conn_closeall(void)
+{
+  while(conn_head != NULL){
+      conn_close(conn_head);
+  }
+
+  return;
+}
+
+
+/* perpd_conn_notify()
+**   queue event for svdef->which to interested subscribers of its base
+**   wstat is the termination status for PERPD_EVENT_EXIT (else 0)
+**   (the queues are written out by perpd_conn_flush())
+**   svdef is marked for update in the status file
+**   the event is appended to the journal
+*/
+void
+perpd_conn_notify(struct svdef *svdef, int which,
+                  uchar_t event, int wstat)
+{
+  struct perpd_conn  *client;
+  pkt_t               rec;
+  uchar_t            *data = &rec[PKT_HEADER];
+  size_t              namelen;
+  tain_t              now;
+
+  /* any event is a change of status, and a transition for the journal: */
+  perpd_statfile_mark(svdef);
+  perpd_journal_put(svdef, which, event, (uint32_t)wstat);
+
+  if(sub_head == NULL){
+      return;
+  }
+
+  namelen = cstr_len(svdef->name);
+  tain_now(&now);
+  buf_WIPE(data, 40);
+  tain_pack(&data[0], &now);
+  data[12] = event;
+  data[13] = (uchar_t)which;
+  data[14] = svdef->svpair[which].bitflags;
+  upak64_pack(&data[16], (uint64_t)svdef->dev);
+  upak64_pack(&data[24], (uint64_t)svdef->ino);
+  upak32_pack(&data[32], (uint32_t)svdef->svpair[which].pid);
+  upak32_pack(&data[36], (uint32_t)wstat);
+  buf_copy(&data[40], svdef->name, namelen);
+  pkt_init(rec, 2, 'V', 40 + namelen);
+
+  for(client = sub_head; client != NULL; client = client->next){
+      if((client->base == svdef->base) && sub_wants(client, &data[16])){
+          sub_put(client, rec, PKT_HEADER + 40 + namelen);
+      }
+  }
+
+  return;
+}
+
+
+/* perpd_conn_flush()
+**   write out event queues of subscribers
+**   called by perpd_mainloop() before each wait
+*/
+void
+perpd_conn_flush(void)
+{
+  struct perpd_conn  *client, *next;
+
+  for(client = sub_head; client != NULL; client = next){
+      next = client->next;
+      if(client->dropped || conn_pending(client)){
+          sub_io(client);
+      }
   }
 
   return;
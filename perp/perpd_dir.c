@@ -0,0 +1,158 @@
+/* perpd_dir.c
+** perp: persistent process supervision
+** perpd 2.0: single process scanner/supervisor/controller
+** perpd_dir: reading directory entries from a descriptor
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* unix: */
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+/* lasanga: */
+#include "uchar.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perpd.h"
+
+
+/* notes:
+**
+**   a directory is read from a descriptor held open by the caller (the
+**   fd_dir of a base directory or of a service), rewound at each
+**   perpd_dir_open(), so that names found are resolved relative to the
+**   same descriptor with fstatat()/openat(), without path lookups from
+**   the cwd
+**
+**   on linux, entries are read directly with getdents64() into the buffer
+**   supplied by the caller, many to a syscall; elsewhere with readdir() on
+**   a duplicate of the descriptor
+**
+**   the type of each entry is given as d_type (DT_UNKNOWN where the
+**   filesystem does not report it), for callers to skip entries that
+**   cannot be of interest without a stat
+*/
+
+#ifdef PERPD_GETDENTS
+/* record returned by getdents64(): */
+struct dirent64_rec {
+  uint64_t        d_ino;
+  int64_t         d_off;
+  unsigned short  d_reclen;
+  unsigned char   d_type;
+  char            d_name[];
+};
+#endif
+
+
+/* perpd_dir_open()
+**   start reading entries of directory fd into buf of size bytes
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+int
+perpd_dir_open(struct perpd_dir *dir, int fd, uchar_t *buf, size_t size)
+{
+  dir->fd = fd;
+  dir->buf = buf;
+  dir->size = size;
+  dir->len = 0;
+  dir->pos = 0;
+
+#ifdef PERPD_GETDENTS
+  if(lseek(fd, 0, SEEK_SET) == -1){
+      return -1;
+  }
+#else
+  if((fd = dup(fd)) == -1){
+      return -1;
+  }
+  if((dir->dir = fdopendir(fd)) == NULL){
+      close(fd);
+      return -1;
+  }
+  rewinddir(dir->dir);
+#endif
+
+  return 0;
+}
+
+
+/* perpd_dir_next()
+**   next entry of dir, its type (or DT_UNKNOWN) in *type
+**   return:
+**     name of entry, until next call
+**     NULL: end of directory (errno untouched), or failure (errno set)
+*/
+const char *
+perpd_dir_next(struct perpd_dir *dir, int *type)
+{
+#ifdef PERPD_GETDENTS
+  struct dirent64_rec  *d;
+  long                  r;
+
+  if(dir->pos >= dir->len){
+      do{
+          r = syscall(SYS_getdents64, dir->fd, dir->buf, dir->size);
+      }while((r == -1) && (errno == EINTR));
+      if(r <= 0){
+          /* end of directory, or failure: */
+          return NULL;
+      }
+      dir->len = (size_t)r;
+      dir->pos = 0;
+  }
+
+  d = (struct dirent64_rec *)&dir->buf[dir->pos];
+  dir->pos += d->d_reclen;
+  *type = d->d_type;
+
+  return d->d_name;
+#else
+  struct dirent  *d;
+
+  if((d = readdir(dir->dir)) == NULL){
+      return NULL;
+  }
+#  ifdef DT_UNKNOWN
+  *type = d->d_type;
+#  else
+  *type = 0;
+#  endif
+
+  return d->d_name;
+#endif
+}
+
+
+/* perpd_dir_close()
+**   end reading entries of dir
+**   (the descriptor given to perpd_dir_open() is left open)
+*/
+void
+perpd_dir_close(struct perpd_dir *dir)
+{
+#ifndef PERPD_GETDENTS
+  int  terrno = errno;
+
+  closedir(dir->dir);
+  errno = terrno;
+#endif
+  dir->len = dir->pos = 0;
+
+  return;
+}
+
+
+/* eof: perpd_dir.c */
@@ -0,0 +1,367 @@
+/* perpd_ev.c
+** perp: persistent process supervision
+** perpd 2.0: single process scanner/supervisor/controller
+** perpd_ev: i/o event backend for perpd main loop (epoll or poll)
+** wcm, 2011.03.30 - 2011.03.30
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+/* epoll backend on linux, unless disabled at compile time: */
+#if defined(__linux__) && !defined(PERPD_NO_EPOLL)
+#  define PERPD_EPOLL  1
+#  include <sys/epoll.h>
+#endif
+
+/* lasanga: */
+#include "pollio.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perpd.h"
+
+
+/* notes:
+**
+**   perpd_ev hides the system event interface behind a handle object,
+**   struct perpd_evh, embedded in the object that owns the descriptor
+**   (eg, a client connection); perpd_ev_wait() returns the ready handles
+**
+**   epoll backend:
+**     - handles registered with PERPD_EV_EDGE are registered once for
+**       both input and output, edge-triggered; perpd_ev_mod() on these
+**       handles then records interest without a system call
+**     - the owner of an edge-triggered handle must drive i/o on the
+**       descriptor until EAGAIN on each readiness
+**     - perpd_ev_del() must be called before close() on the descriptor:
+**       a copy of the descriptor held by a child between fork() and
+**       exec() would otherwise keep the registration alive
+**
+**   poll backend:
+**     - a pollfd vector with one entry per handle, grown as required;
+**       evh->slot is the position of the handle in the vector, and
+**       perpd_ev_del() fills the vacancy from the end of the vector
+**     - level-triggered only; PERPD_EV_EDGE is ignored, so a handle
+**       driven until EAGAIN works the same on either backend
+**
+**   the poll backend is used if compiled without epoll support, or if
+**   epoll_create() fails at runtime
+*/
+
+
+/* poll backend: */
+static struct pollfd     *pollv = NULL;
+static struct perpd_evh **pollevh = NULL;
+static size_t             poll_n = 0;
+static size_t             poll_slots = 0;
+
+#ifdef PERPD_EPOLL
+/* epoll backend (in use if epfd != -1): */
+static int                 epfd = -1;
+static struct epoll_event  epv[PERPD_EVMAX];
+#endif
+
+
+static int poll_grow(size_t want);
+static int poll_wait(struct perpd_evh **readyv, int max, int msecs);
+#ifdef PERPD_EPOLL
+static int epoll_ctlevh(int op, struct perpd_evh *evh);
+static int epoll_waitevh(struct perpd_evh **readyv, int max, int msecs);
+#endif
+
+
+/* poll_grow()
+**   ensure room in pollv[] for want entries
+*/
+static
+int
+poll_grow(size_t want)
+{
+  struct pollfd      *pv;
+  struct perpd_evh  **hv;
+  size_t              slots;
+
+  if(want <= poll_slots){
+      return 0;
+  }
+
+  slots = (poll_slots > 0) ? poll_slots : 16;
+  while(slots < want){
+      slots *= 2;
+  }
+
+  pv = (struct pollfd *)realloc(pollv, slots * sizeof(struct pollfd));
+  if(pv == NULL){
+      errno = ENOMEM;
+      return -1;
+  }
+  pollv = pv;
+
+  hv = (struct perpd_evh **)realloc(pollevh, slots * sizeof(struct perpd_evh *));
+  if(hv == NULL){
+      errno = ENOMEM;
+      return -1;
+  }
+  pollevh = hv;
+  poll_slots = slots;
+
+  return 0;
+}
+
+
+/* poll_wait()
+**   perpd_ev_wait() for poll backend
+*/
+static
+int
+poll_wait(struct perpd_evh **readyv, int max, int msecs)
+{
+  struct perpd_evh  *evh;
+  short              re;
+  int                nready;
+  int                n = 0;
+  size_t             i;
+
+  nready = pollio(pollv, (nfds_t)poll_n, msecs, NULL);
+  if(nready <= 0){
+      return nready;
+  }
+
+  for(i = 0; (i < poll_n) && (nready > 0) && (n < max); ++i){
+      if((re = pollv[i].revents) == 0){
+          continue;
+      }
+      --nready;
+      evh = pollevh[i];
+      evh->revents = 0;
+      if(re & POLLIN) evh->revents |= PERPD_EV_IN;
+      if(re & POLLOUT) evh->revents |= PERPD_EV_OUT;
+      if(re & (POLLERR | POLLHUP | POLLNVAL)) evh->revents |= PERPD_EV_ERR;
+      readyv[n++] = evh;
+  }
+
+  return n;
+}
+
+
+#ifdef PERPD_EPOLL
+
+/* epoll_ctlevh()
+**   epoll_ctl() op on evh
+*/
+static
+int
+epoll_ctlevh(int op, struct perpd_evh *evh)
+{
+  struct epoll_event  ev;
+
+  ev.events = 0;
+  ev.data.ptr = evh;
+  if(evh->events & PERPD_EV_EDGE){
+      ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  }else{
+      if(evh->events & PERPD_EV_IN) ev.events |= EPOLLIN;
+      if(evh->events & PERPD_EV_OUT) ev.events |= EPOLLOUT;
+  }
+
+  return epoll_ctl(epfd, op, evh->fd, &ev);
+}
+
+
+/* epoll_waitevh()
+**   perpd_ev_wait() for epoll backend
+*/
+static
+int
+epoll_waitevh(struct perpd_evh **readyv, int max, int msecs)
+{
+  struct perpd_evh  *evh;
+  uint32_t           re;
+  int                nready;
+  int                i;
+
+  if(max > PERPD_EVMAX){
+      max = PERPD_EVMAX;
+  }
+
+  nready = epoll_wait(epfd, epv, max, msecs);
+  for(i = 0; i < nready; ++i){
+      re = epv[i].events;
+      evh = (struct perpd_evh *)epv[i].data.ptr;
+      evh->revents = 0;
+      if(re & EPOLLIN) evh->revents |= PERPD_EV_IN;
+      if(re & EPOLLOUT) evh->revents |= PERPD_EV_OUT;
+      if(re & (EPOLLERR | EPOLLHUP)) evh->revents |= PERPD_EV_ERR;
+      readyv[i] = evh;
+  }
+
+  return nready;
+}
+
+#endif /* PERPD_EPOLL */
+
+
+/*
+** perpd scope:
+*/
+
+/* perpd_ev_init()
+**   initialize event backend, sized for about hint descriptors
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+int
+perpd_ev_init(size_t hint)
+{
+#ifdef PERPD_EPOLL
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd != -1){
+      return 0;
+  }
+  /* else: fall back to poll() */
+#endif
+
+  return poll_grow(hint);
+}
+
+
+/* perpd_ev_backend()
+**   name of event backend in use (for logging)
+*/
+const char *
+perpd_ev_backend(void)
+{
+#ifdef PERPD_EPOLL
+  if(epfd != -1) return "epoll";
+#endif
+
+  return "poll";
+}
+
+
+/* perpd_ev_add()
+**   register fd with event interest, owned by obj of kind PERPD_EVK_*
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+int
+perpd_ev_add(struct perpd_evh *evh, int fd, int events, int kind, void *obj)
+{
+  evh->fd = fd;
+  evh->events = events;
+  evh->revents = 0;
+  evh->kind = kind;
+  evh->obj = obj;
+
+#ifdef PERPD_EPOLL
+  if(epfd != -1){
+      return epoll_ctlevh(EPOLL_CTL_ADD, evh);
+  }
+#endif
+
+  if(poll_grow(poll_n + 1) == -1){
+      return -1;
+  }
+  evh->slot = poll_n;
+  pollv[poll_n].fd = fd;
+  pollv[poll_n].events = 0;
+  pollv[poll_n].revents = 0;
+  pollevh[poll_n] = evh;
+  ++poll_n;
+
+  return perpd_ev_mod(evh, events);
+}
+
+
+/* perpd_ev_mod()
+**   change event interest for registered evh
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+int
+perpd_ev_mod(struct perpd_evh *evh, int events)
+{
+  struct pollfd  *pfd;
+
+#ifdef PERPD_EPOLL
+  if(epfd != -1){
+      int  was = evh->events;
+      evh->events = events | (was & PERPD_EV_EDGE);
+      if(was & PERPD_EV_EDGE){
+          /* edge-triggered, registered for all events: */
+          return 0;
+      }
+      return (evh->events == was) ? 0 : epoll_ctlevh(EPOLL_CTL_MOD, evh);
+  }
+#endif
+
+  evh->events = events;
+  pfd = &pollv[evh->slot];
+  pfd->events = 0;
+  if(events & PERPD_EV_IN) pfd->events |= POLLIN;
+  if(events & PERPD_EV_OUT) pfd->events |= POLLOUT;
+
+  return 0;
+}
+
+
+/* perpd_ev_del()
+**   deregister evh (call before close() on evh->fd)
+*/
+void
+perpd_ev_del(struct perpd_evh *evh)
+{
+  size_t  last;
+
+#ifdef PERPD_EPOLL
+  if(epfd != -1){
+      epoll_ctlevh(EPOLL_CTL_DEL, evh);
+      return;
+  }
+#endif
+
+  /* fill vacancy from end of pollv[]: */
+  last = --poll_n;
+  if(evh->slot != last){
+      pollv[evh->slot] = pollv[last];
+      pollevh[evh->slot] = pollevh[last];
+      pollevh[evh->slot]->slot = evh->slot;
+  }
+
+  return;
+}
+
+
+/* perpd_ev_wait()
+**   wait up to msecs (-1: indefinitely) for events on registered handles
+**   fill readyv[] with up to max ready handles, evh->revents set
+**   return:
+**     >0: number of ready handles in readyv[]
+**      0: timeout
+**     -1: error, errno set (eg EINTR)
+*/
+int
+perpd_ev_wait(struct perpd_evh **readyv, int max, int msecs)
+{
+#ifdef PERPD_EPOLL
+  if(epfd != -1){
+      return epoll_waitevh(readyv, max, msecs);
+  }
+#endif
+
+  return poll_wait(readyv, max, msecs);
+}
+
+
+/* eof: perpd_ev.c */
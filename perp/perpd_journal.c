@@ -0,0 +1,210 @@
+/* perpd_journal.c
+** perp: persistent process supervision
+** perpd 2.0: single process scanner/supervisor/controller
+** perpd_journal: journal ring of service transitions
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* lasanga: */
+#include "buf.h"
+#include "cstr.h"
+#include "tain.h"
+#include "uchar.h"
+#include "upak.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perp_journal.h"
+#include "perpd.h"
+
+
+/* notes:
+**
+**   each transition of a service (the events of perpd_conn_notify(),
+**   and control commands received) is appended as a record of fixed
+**   size to the journal file in the control directory, a ring of nrecs
+**   records mapped with mmap(); the oldest record is overwritten when
+**   the ring is full (layout in perp_journal.h)
+**
+**   records are left to the kernel to write out, without fsync(): the
+**   journal survives a crash or restart of perpd, not of the system
+**
+**   the journal is kept over a restart of perpd when the ring is of the
+**   same size, else it is unlinked and created anew
+**
+**   each base directory has its own journal (base->journal), of the
+**   services in its svtab
+**
+**   each record is written with its seq cleared, and the seq then set
+**   before the head is advanced, so that a reader following the head
+**   may detect a record overwritten while it is read (see perpjournal.c)
+*/
+
+static uchar_t * journal_reuse(const char *path, size_t size, uint32_t nrecs);
+
+
+/* journal_reuse()
+**   map existing journal at path, if of size with nrecs records
+**   return:
+**     mapping of journal
+**     NULL: no journal to reuse
+*/
+static
+uchar_t *
+journal_reuse(const char *path, size_t size, uint32_t nrecs)
+{
+  struct stat  st;
+  uchar_t     *map;
+  int          fd;
+
+  if((fd = open(path, O_RDWR | O_CLOEXEC)) == -1){
+      return NULL;
+  }
+  if((fstat(fd, &st) == -1) || ((size_t)st.st_size != size)){
+      close(fd);
+      return NULL;
+  }
+  map = (uchar_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == (uchar_t *)MAP_FAILED){
+      return NULL;
+  }
+  if((buf_cmp(map, JOURNAL_MAGIC, 8) != 0)
+     || (upak32_unpack(&map[JOURNAL_RECSIZE]) != JOURNAL_RECORD)
+     || (upak32_unpack(&map[JOURNAL_NRECS]) != nrecs)
+     || (*(volatile uint64_t *)&map[JOURNAL_HEAD] == 0)){
+      munmap(map, size);
+      return NULL;
+  }
+
+  return map;
+}
+
+
+/* perpd_journal_init()
+**   open journal of nrecs records in control directory of base
+**   (0: no journal)
+**   cwd is base directory
+**   return:
+**     0: success
+**    -1: failure, errno set (perpd runs without journal for base)
+*/
+int
+perpd_journal_init(struct perpd_base *base, uint32_t nrecs, gid_t gid)
+{
+  const char  *path = PERP_CONTROL "/" PERPD_JOURNAL;
+  size_t       size = JOURNAL_HEADER + ((size_t)nrecs * JOURNAL_RECORD);
+  uchar_t     *map;
+  int          fd, e;
+
+  base->journal.map = NULL;
+  base->journal.nrecs = 0;
+
+  if(nrecs == 0){
+      return 0;
+  }
+
+  map = journal_reuse(path, size, nrecs);
+  if(map == NULL){
+      /* readers mapping a previous journal keep the old inode: */
+      if((unlink(path) == -1) && (errno != ENOENT)){
+          return -1;
+      }
+      fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+      if(fd == -1){
+          return -1;
+      }
+      if((gid != (gid_t)-1)
+         && ((fchown(fd, (uid_t)-1, gid) == -1) || (fchmod(fd, 0640) == -1))){
+          e = errno; close(fd); errno = e;
+          return -1;
+      }
+      if(ftruncate(fd, (off_t)size) == -1){
+          e = errno; close(fd); errno = e;
+          return -1;
+      }
+      map = (uchar_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      e = errno;
+      close(fd);
+      if(map == (uchar_t *)MAP_FAILED){
+          errno = e;
+          return -1;
+      }
+      buf_copy(&map[0], JOURNAL_MAGIC, 8);
+      upak32_pack(&map[JOURNAL_RECSIZE], JOURNAL_RECORD);
+      upak32_pack(&map[JOURNAL_NRECS], nrecs);
+      *(volatile uint64_t *)&map[JOURNAL_HEAD] = 1;
+  }
+  upak32_pack(&map[JOURNAL_PID], (uint32_t)my_pid);
+
+  base->journal.map = map;
+  base->journal.nrecs = nrecs;
+
+  return 0;
+}
+
+
+/* perpd_journal_put()
+**   append record of event on svdef->which to journal of its base
+**   arg is the termination status of PERPD_EVENT_EXIT/CHECK, or the
+**   command and flags of JOURNAL_CONTROL (else 0)
+*/
+void
+perpd_journal_put(const struct svdef *svdef, int which, uchar_t event, uint32_t arg)
+{
+  struct perpd_journal  *journal = &svdef->base->journal;
+  volatile uint64_t     *headp;
+  volatile uint64_t     *seqp;
+  uint64_t               seq;
+  uchar_t               *r;
+  size_t                 namelen;
+  tain_t                 now;
+
+  if(journal->map == NULL){
+      return;
+  }
+
+  headp = (volatile uint64_t *)&journal->map[JOURNAL_HEAD];
+  seq = *headp;
+  r = journal->map + JOURNAL_HEADER + (((seq - 1) % journal->nrecs) * JOURNAL_RECORD);
+  seqp = (volatile uint64_t *)&r[JOURNAL_SEQ];
+
+  *seqp = 0;
+  __sync_synchronize();
+
+  tain_now(&now);
+  buf_WIPE(&r[JOURNAL_STAMP], JOURNAL_RECORD - JOURNAL_STAMP);
+  tain_pack(&r[JOURNAL_STAMP], &now);
+  r[JOURNAL_EVENT] = event;
+  r[JOURNAL_WHICH] = (uchar_t)which;
+  r[JOURNAL_SUBSV] = svdef->svpair[which].bitflags;
+  r[JOURNAL_SVDEF] = svdef->bitflags;
+  upak32_pack(&r[JOURNAL_SVPID], (uint32_t)svdef->svpair[which].pid);
+  upak32_pack(&r[JOURNAL_ARG], arg);
+  upak64_pack(&r[JOURNAL_DEVINO], (uint64_t)svdef->dev);
+  upak64_pack(&r[JOURNAL_DEVINO + 8], (uint64_t)svdef->ino);
+  /* (svdef->name is at most PERPD_NAMEMAX, JOURNAL_NAMEMAX:) */
+  namelen = cstr_len(svdef->name);
+  buf_copy(&r[JOURNAL_NAME], svdef->name, namelen);
+
+  __sync_synchronize();
+  *seqp = seq;
+  __sync_synchronize();
+  *headp = seq + 1;
+
+  return;
+}
+
+
+/* eof: perpd_journal.c */
@@ -0,0 +1,781 @@
+/* perpd_reexec.c
+** perp: persistent process supervision
+** perpd 2.0: single process scanner/supervisor/controller
+** perpd_reexec: live re-exec of perpd, services kept running
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+/* lasanga: */
+#include "buf.h"
+#include "cstr.h"
+#include "dynbuf.h"
+#include "execvx.h"
+#include "fd.h"
+#include "nfmt.h"
+#include "nuscan.h"
+#include "tain.h"
+#include "uchar.h"
+#include "upak.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perpd.h"
+
+
+/* notes:
+**
+**   on SIGUSR2, perpd_reexec() packs the state of perpd into an
+**   anonymous file (memfd, or an unlinked file in the control directory
+**   of the first base), clears close-on-exec from the descriptors held
+**   across exec (pidlock and listening sockets of each base, and of each
+**   service its directory, logpipe, and readiness notification channel),
+**   and execs argv[0] with the original arguments, the state descriptor
+**   named in PERPD_REEXEC_ENV
+**
+**   exec keeps the pid of perpd: the service processes remain its
+**   children, and the new perpd adopts them with perpd_reexec_load() and
+**   perpd_reexec_restore() at startup; nothing is stopped or started
+**
+**   the state is in a layout of its own (STATE_VERSION), independent of
+**   the struct layout of either binary:
+**
+**     header:
+**       [0..7]    magic STATE_MAGIC
+**       [8..11]   STATE_VERSION
+**       [12..23]  my_when (startup of first perpd)
+**       [24..27]  number of base directories
+**     followed by each base directory in order (see state_base()),
+**     then for each base directory in order, the number of its services
+**     and each service in slot order (see state_svdef());
+**     integers "little-endian" by upak, descriptors and pids as uint32
+**
+**   the new perpd is run with the same arguments, and so on the same
+**   base directories in the same order: a state of other base
+**   directories is refused
+**
+**   client connections are dropped by exec, and subscribers resubscribe;
+**   the status file is withdrawn before exec, and created anew by the
+**   new perpd
+**
+**   on failure before exec (or of exec itself), everything is put back
+**   as it was, and perpd continues; the new perpd exits on failure to
+**   restore the state, leaving the services running unsupervised
+*/
+
+#define STATE_MAGIC    "perpexec"
+#define STATE_VERSION  3
+
+/* state object, packing (or unpacking on load) of state: */
+struct state {
+  /* set when unpacking: */
+  int      load;
+  /* packed state, and position of unpacking: */
+  dynbuf   dyn;
+  size_t   pos;
+  /* set on any failure: */
+  int      err;
+};
+
+/* state loaded at startup: */
+static struct state  loaded = {0, dynbuf_INIT(), 0, 0};
+
+
+static int state_bytes(struct state *st, void *p, size_t len);
+static void state_u8(struct state *st, uchar_t *u);
+static void state_u32(struct state *st, uint32_t *u);
+static void state_u64(struct state *st, uint64_t *u);
+static void state_int(struct state *st, int *i);
+static void state_pid(struct state *st, pid_t *pid);
+static void state_tain(struct state *st, tain_t *t);
+static void state_timer(struct state *st, struct perpd_timer *timer);
+static void state_tally(struct state *st, struct tally *tally);
+static void state_subsv(struct state *st, struct subsv *subsv);
+static void state_svdef(struct state *st, struct svdef *svdef);
+static void state_base(struct state *st, struct perpd_base *base);
+static int state_fd(void);
+static void reexec_inherit(int fd, int inherit);
+static void reexec_fds(int inherit);
+static void reexec_statfiles(pid_t pid);
+
+
+/* state_bytes()
+**   pack len bytes at p into state, or unpack from state into p
+**   return:
+**     0: success
+**    -1: failure (st->err set)
+*/
+static
+int
+state_bytes(struct state *st, void *p, size_t len)
+{
+  if(st->err){
+      return -1;
+  }
+
+  if(st->load){
+      if(len > (dynbuf_LEN(&st->dyn) - st->pos)){
+          st->err = EINVAL;
+          return -1;
+      }
+      buf_copy(p, (uchar_t *)dynbuf_BUF(&st->dyn) + st->pos, len);
+      st->pos += len;
+  }else if(dynbuf_putbuf(&st->dyn, p, len) == -1){
+      st->err = ENOMEM;
+      return -1;
+  }
+
+  return 0;
+}
+
+
+/* state_u8(), state_u32(), state_u64(), state_int(), state_pid(),
+** state_tain():
+**   pack/unpack scalars
+*/
+static
+void
+state_u8(struct state *st, uchar_t *u)
+{
+  state_bytes(st, u, 1);
+  return;
+}
+
+static
+void
+state_u32(struct state *st, uint32_t *u)
+{
+  uchar_t  b[4];
+
+  if(!st->load) upak32_pack(b, *u);
+  if((state_bytes(st, b, sizeof b) == 0) && st->load){
+      *u = upak32_unpack(b);
+  }
+
+  return;
+}
+
+static
+void
+state_u64(struct state *st, uint64_t *u)
+{
+  uchar_t  b[8];
+
+  if(!st->load) upak64_pack(b, *u);
+  if((state_bytes(st, b, sizeof b) == 0) && st->load){
+      *u = upak64_unpack(b);
+  }
+
+  return;
+}
+
+static
+void
+state_int(struct state *st, int *i)
+{
+  uint32_t  u = (uint32_t)*i;
+
+  state_u32(st, &u);
+  if(st->load) *i = (int)(int32_t)u;
+
+  return;
+}
+
+static
+void
+state_pid(struct state *st, pid_t *pid)
+{
+  uint32_t  u = (uint32_t)*pid;
+
+  state_u32(st, &u);
+  if(st->load) *pid = (pid_t)(int32_t)u;
+
+  return;
+}
+
+static
+void
+state_tain(struct state *st, tain_t *t)
+{
+  uchar_t  b[TAIN_PACK_SIZE];
+
+  if(!st->load) tain_pack(b, t);
+  if((state_bytes(st, b, sizeof b) == 0) && st->load){
+      tain_unpack(t, b);
+  }
+
+  return;
+}
+
+
+/* state_timer()
+**   pack/unpack expiration of timer, zero if not armed
+**   (on unpacking, the timer is left for perpd_svdef_adopt() to rearm)
+*/
+static
+void
+state_timer(struct state *st, struct perpd_timer *timer)
+{
+  tain_t  when = tain_INIT(0, 0);
+
+  if(!st->load && (timer->slot > 0)){
+      tain_assign(&when, &timer->when);
+  }
+  state_tain(st, &when);
+  if(st->load){
+      tain_assign(&timer->when, &when);
+  }
+
+  return;
+}
+
+
+/* state_tally()
+**   pack/unpack runtime metrics
+*/
+static
+void
+state_tally(struct state *st, struct tally *tally)
+{
+  int  i;
+
+  state_u32(st, &tally->starts);
+  state_u32(st, &tally->exits);
+  state_u32(st, &tally->exits_error);
+  state_u32(st, &tally->exits_signal);
+  state_u64(st, &tally->life_msecs);
+  state_u64(st, &tally->reset_msecs);
+  for(i = 0; i < PERPD_TALLY_BINS; ++i){
+      state_u32(st, &tally->life[i]);
+      state_u32(st, &tally->reset[i]);
+  }
+  state_u64(st, &tally->utime_usecs);
+  state_u64(st, &tally->stime_usecs);
+  state_u64(st, &tally->maxrss);
+  state_u64(st, &tally->majflt);
+  state_u64(st, &tally->nvcsw);
+  state_u64(st, &tally->nivcsw);
+
+  return;
+}
+
+
+/* state_subsv()
+**   pack/unpack subservice
+*/
+static
+void
+state_subsv(struct state *st, struct subsv *subsv)
+{
+  state_pid(st, &subsv->pid);
+  state_u8(st, &subsv->bitflags);
+  state_tain(st, &subsv->when);
+  state_tain(st, &subsv->when_ok);
+  state_int(st, &subsv->wstat);
+  state_u32(st, &subsv->nfail);
+  state_timer(st, &subsv->timer);
+  state_timer(st, &subsv->stop);
+  state_int(st, &subsv->killpg);
+  state_tally(st, &subsv->tally);
+
+  return;
+}
+
+
+/* state_svdef()
+**   pack/unpack service definition
+**   (on unpacking, svdef is clear and after is allocated)
+*/
+static
+void
+state_svdef(struct state *st, struct svdef *svdef)
+{
+  struct svcheck  *check = &svdef->check;
+  uint64_t         u64;
+  uint32_t         len;
+  const char      *z;
+
+  u64 = (uint64_t)svdef->dev;
+  state_u64(st, &u64);
+  if(st->load) svdef->dev = (dev_t)u64;
+  u64 = (uint64_t)svdef->ino;
+  state_u64(st, &u64);
+  if(st->load) svdef->ino = (ino_t)u64;
+
+  /* name: */
+  len = (uint32_t)cstr_len(svdef->name);
+  state_u32(st, &len);
+  if(st->load && (len > PERPD_NAMEMAX)){
+      st->err = EINVAL;
+      return;
+  }
+  state_bytes(st, svdef->name, (size_t)len);
+  if(st->load) svdef->name[len] = '\0';
+
+  state_tain(st, &svdef->when);
+  state_u8(st, &svdef->bitflags);
+  state_int(st, &svdef->fd_dir);
+  state_int(st, &svdef->logpipe[0]);
+  state_int(st, &svdef->logpipe[1]);
+  state_u32(st, &svdef->respawn);
+  state_u32(st, &svdef->quarantine);
+  state_u32(st, &svdef->stop);
+  state_int(st, &svdef->killpg);
+  state_int(st, &svdef->notify);
+
+  /* names in "param.after", to the terminating empty name: */
+  len = 0;
+  if(!st->load && (svdef->after != NULL)){
+      for(z = svdef->after; *z != '\0'; z += cstr_len(z) + 1){/*empty*/;}
+      len = (uint32_t)(z - svdef->after) + 1;
+  }
+  state_u32(st, &len);
+  if(st->load && !st->err && (len > 0)){
+      if(len > (dynbuf_LEN(&st->dyn) - st->pos)){
+          st->err = EINVAL;
+          return;
+      }
+      if((svdef->after = (char *)malloc(len)) == NULL){
+          st->err = ENOMEM;
+          return;
+      }
+  }
+  if(len > 0){
+      state_bytes(st, svdef->after, (size_t)len);
+      if(st->load && !st->err &&
+         ((svdef->after[len - 1] != '\0') ||
+          ((len > 1) && (svdef->after[len - 2] != '\0')))){
+          st->err = EINVAL;
+      }
+  }
+
+  state_subsv(st, &svdef->svpair[SUBSV_MAIN]);
+  state_subsv(st, &svdef->svpair[SUBSV_LOG]);
+
+  state_timer(st, &svdef->settle);
+  state_int(st, &svdef->notifyfd);
+  state_tain(st, &svdef->when_ready);
+
+  /* health check: */
+  state_u32(st, &check->secs);
+  state_u32(st, &check->timeout);
+  state_u32(st, &check->fails);
+  state_pid(st, &check->pid);
+  state_tain(st, &check->when);
+  state_tain(st, &check->next);
+  state_timer(st, &check->timer);
+  state_int(st, &check->killed);
+  state_u32(st, &check->msecs);
+  state_u8(st, &check->bitflags);
+  state_u8(st, &check->nfail);
+
+  return;
+}
+
+
+/* state_base()
+**   pack path and descriptors of base directory, or unpack and check
+**   against base (as configured in the new perpd)
+*/
+static
+void
+state_base(struct state *st, struct perpd_base *base)
+{
+  uint32_t  len = (uint32_t)cstr_len(base->path);
+  char      path[4096];
+
+  state_u32(st, &len);
+  if(st->load){
+      if(!st->err && (len >= sizeof path)){
+          st->err = EINVAL;
+          return;
+      }
+      state_bytes(st, path, (size_t)len);
+      if(st->err){
+          return;
+      }
+      path[len] = '\0';
+      if(cstr_cmp(path, base->path) != 0){
+          /* state of another base directory: */
+          st->err = EINVAL;
+          return;
+      }
+  }else{
+      state_bytes(st, (void *)base->path, (size_t)len);
+  }
+  state_int(st, &base->fd_pidlock);
+  state_int(st, &base->fd_listen);
+  state_int(st, &base->fd_seq);
+
+  return;
+}
+
+
+/* state_fd()
+**   open anonymous file for state (inherited across exec)
+**   memfd where supported, else an unlinked file in the control directory
+**   of the first base directory
+**   return:
+**     >=0: descriptor
+**      -1: failure, errno set
+*/
+static
+int
+state_fd(void)
+{
+  const char  *path = PERP_CONTROL "/perpd.reexec";
+  int          fd;
+
+#ifdef PERPD_MEMFD
+  fd = (int)syscall(SYS_memfd_create, "perpd.reexec", 0);
+  if((fd != -1) || (errno != ENOSYS)){
+      return fd;
+  }
+#endif
+
+  if(fchdir(bases[0].fd_dir) == -1){
+      return -1;
+  }
+  unlink(path);
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if(fd != -1){
+      unlink(path);
+  }
+
+  return fd;
+}
+
+
+/* reexec_inherit()
+**   clear (inherit set), or set, close-on-exec on fd
+*/
+static
+void
+reexec_inherit(int fd, int inherit)
+{
+  if(fd < 0){
+      return;
+  }
+
+  if(inherit){
+      fcntl(fd, F_SETFD, 0);
+  }else{
+      fd_cloexec(fd);
+  }
+
+  return;
+}
+
+
+/* reexec_fds()
+**   clear (inherit set), or set, close-on-exec on descriptors held
+**   across exec, of all base directories
+*/
+static
+void
+reexec_fds(int inherit)
+{
+  struct perpd_base  *base;
+  struct svdef       *svdef;
+  size_t              b, i;
+
+  for(b = 0; b < nbases; ++b){
+      base = &bases[b];
+      reexec_inherit(base->fd_pidlock, inherit);
+      reexec_inherit(base->fd_listen, inherit);
+      if(base->fd_seq != -1){
+          reexec_inherit(base->fd_seq, inherit);
+      }
+      for(i = 0; i < base->svtab.n; ++i){
+          svdef = base->svtab.svdefs[i];
+          reexec_inherit(svdef->fd_dir, inherit);
+          if(svdef->bitflags & SVDEF_FLAG_HASLOG){
+              reexec_inherit(svdef->logpipe[0], inherit);
+              reexec_inherit(svdef->logpipe[1], inherit);
+          }
+          reexec_inherit(svdef->notifyfd, inherit);
+      }
+  }
+
+  return;
+}
+
+
+/* reexec_statfiles()
+**   set perpd pid in status file of each base directory
+*/
+static
+void
+reexec_statfiles(pid_t pid)
+{
+  size_t  b;
+
+  for(b = 0; b < nbases; ++b){
+      perpd_statfile_pid(&bases[b], pid);
+  }
+
+  return;
+}
+
+
+/* perpd_reexec()
+**   exec argv[0] with argv, passing state of perpd
+**   return:
+**     only on failure (logged), perpd continuing as before
+*/
+void
+perpd_reexec(char *argv[])
+{
+  struct state    st = {0, dynbuf_INIT(), 0, 0};
+  struct svtab   *svtab;
+  size_t          n, b, i, envc;
+  uint32_t        u;
+  char            envbuf[sizeof PERPD_REEXEC_ENV + NFMT_SIZE];
+  char            nbuf[NFMT_SIZE];
+  char          **envp = NULL;
+  const uchar_t  *p;
+  ssize_t         w;
+  int             fd;
+
+  for(n = 0, b = 0; b < nbases; ++b){
+      n += bases[b].svtab.n;
+  }
+  log_info("re-executing ", argv[0], " with ",
+           nfmt_uint32(nbuf, (uint32_t)n), " active ",
+           (n == 1) ? "service" : "services", " ...");
+
+  /* pack: */
+  state_bytes(&st, STATE_MAGIC, 8);
+  u = STATE_VERSION;
+  state_u32(&st, &u);
+  state_tain(&st, &my_when);
+  u = (uint32_t)nbases;
+  state_u32(&st, &u);
+  for(b = 0; b < nbases; ++b){
+      state_base(&st, &bases[b]);
+  }
+  for(b = 0; b < nbases; ++b){
+      svtab = &bases[b].svtab;
+      u = (uint32_t)svtab->n;
+      state_u32(&st, &u);
+      for(i = 0; i < svtab->n; ++i){
+          state_svdef(&st, svtab->svdefs[i]);
+      }
+  }
+  if(st.err){
+      errno = st.err;
+      warn_syserr("failure packing state for re-exec");
+      dynbuf_freebuf(&st.dyn);
+      return;
+  }
+
+  /* write state, to be read from the start: */
+  if((fd = state_fd()) == -1){
+      warn_syserr("failure creating state file for re-exec");
+      dynbuf_freebuf(&st.dyn);
+      return;
+  }
+  p = (const uchar_t *)dynbuf_BUF(&st.dyn);
+  i = dynbuf_LEN(&st.dyn);
+  while(i > 0){
+      w = write(fd, p, i);
+      if(w == -1){
+          if(errno == EINTR) continue;
+          break;
+      }
+      p += w;
+      i -= (size_t)w;
+  }
+  dynbuf_freebuf(&st.dyn);
+  if((i > 0) || (lseek(fd, 0, SEEK_SET) == -1)){
+      warn_syserr("failure writing state file for re-exec");
+      close(fd);
+      return;
+  }
+
+  /* environment, with state descriptor: */
+  for(envc = 0; environ[envc] != NULL; ++envc){/*empty*/;}
+  if((envp = (char **)malloc((envc + 2) * sizeof(char *))) == NULL){
+      errno = ENOMEM;
+      warn_syserr("failure allocating environment for re-exec");
+      close(fd);
+      return;
+  }
+  for(i = 0; i < envc; ++i){
+      envp[i] = environ[i];
+  }
+  cstr_vcopy(envbuf, PERPD_REEXEC_ENV, "=", nfmt_uint32(nbuf, (uint32_t)fd));
+  envp[envc] = envbuf;
+  envp[envc + 1] = NULL;
+
+  /* descriptors across exec, status file withdrawn from clients: */
+  reexec_fds(1);
+  reexec_statfiles(0);
+
+  execvx(argv[0], argv, envp, NULL);
+
+  /* uh oh: */
+  warn_syserr("failure exec() on ", argv[0], " for re-exec");
+  log_warning("continuing without re-exec");
+  reexec_statfiles(my_pid);
+  reexec_fds(0);
+  free(envp);
+  close(fd);
+
+  return;
+}
+
+
+/* perpd_reexec_load()
+**   read any state passed by a previous perpd on re-exec, from the
+**   descriptor named in environment variable PERPD_REEXEC_ENV (which is
+**   removed from the environment)
+**   on load, sets fd_pidlock, fd_listen, fd_seq (close-on-exec) of each
+**   base directory, and when
+**   called at startup, after setup of bases[]
+**   return:
+**     1: state loaded, for perpd_reexec_restore()
+**     0: no state, normal startup
+**    -1: failure, errno set
+*/
+int
+perpd_reexec_load(tain_t *when)
+{
+  struct state  *st = &loaded;
+  const char    *z;
+  const char    *end;
+  uchar_t        magic[8];
+  uchar_t        rbuf[4096];
+  uint32_t       fd, u;
+  ssize_t        r;
+  size_t         b;
+
+  if((z = getenv(PERPD_REEXEC_ENV)) == NULL){
+      return 0;
+  }
+  end = nuscan_uint32(&fd, z);
+  if((end == NULL) || (*end != '\0')){
+      errno = EINVAL;
+      return -1;
+  }
+  unsetenv(PERPD_REEXEC_ENV);
+
+  for(;;){
+      r = read((int)fd, rbuf, sizeof rbuf);
+      if(r == -1){
+          if(errno == EINTR) continue;
+          close((int)fd);
+          return -1;
+      }
+      if(r == 0){
+          break;
+      }
+      if(dynbuf_putbuf(&st->dyn, rbuf, (size_t)r) == -1){
+          close((int)fd);
+          errno = ENOMEM;
+          return -1;
+      }
+  }
+  close((int)fd);
+
+  st->load = 1;
+  st->pos = 0;
+  state_bytes(st, magic, 8);
+  state_u32(st, &u);
+  if(st->err || (buf_cmp(magic, STATE_MAGIC, 8) != 0)
+     || (u != STATE_VERSION)){
+      /* not a state of this version: */
+      errno = EPROTO;
+      return -1;
+  }
+  state_tain(st, when);
+  state_u32(st, &u);
+  if(!st->err && (u != (uint32_t)nbases)){
+      /* state of other base directories: */
+      st->err = EINVAL;
+  }
+  for(b = 0; (b < nbases) && !st->err; ++b){
+      state_base(st, &bases[b]);
+  }
+  if(st->err){
+      errno = st->err;
+      return -1;
+  }
+  for(b = 0; b < nbases; ++b){
+      fd_cloexec(bases[b].fd_pidlock);
+      fd_cloexec(bases[b].fd_listen);
+      if(bases[b].fd_seq != -1){
+          fd_cloexec(bases[b].fd_seq);
+      }
+  }
+
+  return 1;
+}
+
+
+/* perpd_reexec_restore()
+**   adopt services from state loaded by perpd_reexec_load(),
+**   entering each in the svtab of its base directory (in the slot it
+**   held before exec)
+**   called at startup, after initialization of each svtab and pidtab
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+int
+perpd_reexec_restore(void)
+{
+  struct state       *st = &loaded;
+  struct perpd_base  *base;
+  struct svdef       *svdef;
+  uint32_t            n, i;
+  size_t              b;
+
+  for(b = 0; (b < nbases) && !st->err; ++b){
+      base = &bases[b];
+      state_u32(st, &n);
+      for(i = 0; (i < n) && !st->err; ++i){
+          if((svdef = perpd_svtab_new(&base->svtab)) == NULL){
+              st->err = errno;
+              break;
+          }
+          svdef->base = base;
+          state_svdef(st, svdef);
+          if(st->err){
+              if(svdef->after != NULL) free(svdef->after);
+              free(svdef);
+              break;
+          }
+          perpd_svtab_add(&base->svtab, svdef);
+          perpd_svdef_adopt(svdef);
+          perpd_startq_adopt(svdef);
+          perpd_statfile_mark(svdef);
+      }
+  }
+  if(!st->err && (st->pos != dynbuf_LEN(&st->dyn))){
+      st->err = EINVAL;
+  }
+  dynbuf_freebuf(&st->dyn);
+
+  if(st->err){
+      errno = st->err;
+      return -1;
+  }
+
+  return 0;
+}
+
+
+/* eof: perpd_reexec.c */
@@ -0,0 +1,316 @@
+/* perpd_startq.c
+** perp: persistent process supervision
+** perpd 2.0: single process scanner/supervisor/controller
+** perpd_startq: start queue for newly activated services
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* unix: */
+#include <errno.h>
+
+/* lasanga: */
+#include "cstr.h"
+#include "tain.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perpd.h"
+
+
+/* notes:
+**
+**   a newly activated service is not started at once, but appended to
+**   the start queue (flagged SVDEF_FLAG_QUEUED), and started from the
+**   queue by perpd_startq_run() in the main loop
+**
+**   a service started from the queue is counted as "starting" (flagged
+**   SVDEF_FLAG_STARTING) until its main service has run PERPD_SETTLE
+**   seconds, or has terminated; no more than startq_max services are
+**   starting at once (0: no limit)
+**
+**   a service with readiness notification (file "param.notify") is
+**   counted as starting until ready instead, to PERPD_SETTLE_READY
+**   seconds
+**
+**   a service with names in its "param.after" file is held in the queue
+**   while any service of those names is queued or starting; a name not
+**   found among the active services is ignored
+**
+**   the one queue (and the limit startq_max) is shared by the services
+**   of all base directories, the names in "param.after" those of
+**   services in the same base directory
+**
+**   should every service left in the queue be held, with none starting,
+**   the services are held on each other (a dependency cycle), and the
+**   first in the queue is started anyway
+*/
+
+static struct svdef  *startq_head = NULL;
+static struct svdef  *startq_tail = NULL;
+static uint32_t       startq_max = 0;
+static uint32_t       startq_nstarting = 0;
+
+
+static int startq_held(const struct svdef *svdef);
+static void startq_unlink(struct svdef *svdef, struct svdef *prev);
+static int startq_start(struct svdef *svdef);
+static void startq_settle(struct perpd_timer *timer);
+
+
+/* startq_held()
+**   check if svdef is held in queue for any service in svdef->after
+**   return:
+**     1: held
+**     0: ok to start
+*/
+static
+int
+startq_held(const struct svdef *svdef)
+{
+  const char    *name = svdef->after;
+  struct svdef  *dep;
+
+  if(name == NULL){
+      return 0;
+  }
+
+  for(; *name != '\0'; name += cstr_len(name) + 1){
+      dep = perpd_lookupname(svdef->base, name);
+      if((dep != NULL) && (dep != svdef) &&
+         (dep->bitflags & (SVDEF_FLAG_QUEUED | SVDEF_FLAG_STARTING))){
+          return 1;
+      }
+  }
+
+  return 0;
+}
+
+
+/* startq_unlink()
+**   remove svdef from queue, following prev (NULL if svdef is head)
+*/
+static
+void
+startq_unlink(struct svdef *svdef, struct svdef *prev)
+{
+  if(prev == NULL){
+      startq_head = svdef->qnext;
+  }else{
+      prev->qnext = svdef->qnext;
+  }
+  if(startq_tail == svdef){
+      startq_tail = prev;
+  }
+  svdef->qnext = NULL;
+  svdef->bitflags &= ~SVDEF_FLAG_QUEUED;
+  perpd_statfile_mark(svdef);
+
+  return;
+}
+
+
+/* startq_start()
+**   first start of svdef, taken from queue
+**   return:
+**     1: svdef counted as starting
+**     0: otherwise (main not running)
+*/
+static
+int
+startq_start(struct svdef *svdef)
+{
+  tain_t  now, settle;
+
+  log_debug("starting service ", svdef->name, " from start queue");
+  perpd_svdef_startup(svdef);
+
+  if(svdef->svpair[SUBSV_MAIN].pid <= 0){
+      return 0;
+  }
+
+  tain_now(&now);
+  tain_LOAD(&settle, (svdef->notify > 0) ? PERPD_SETTLE_READY : PERPD_SETTLE, 0);
+  tain_plus(&settle, &now, &settle);
+  if(perpd_timer_set(&svdef->settle, &settle, &startq_settle, svdef) == -1){
+      warn_syserr("failure setting start timer for service ", svdef->name);
+      return 0;
+  }
+  svdef->bitflags |= SVDEF_FLAG_STARTING;
+  perpd_statfile_mark(svdef);
+  ++startq_nstarting;
+
+  return 1;
+}
+
+
+/* startq_settle()
+**   timer callback: starting service has settled
+*/
+static
+void
+startq_settle(struct perpd_timer *timer)
+{
+  perpd_startq_done((struct svdef *)timer->obj);
+  return;
+}
+
+
+/*
+** perpd scope:
+*/
+
+/* perpd_startq_init()
+**   initialize start queue, with max services starting at once
+**   (0: no limit)
+*/
+void
+perpd_startq_init(uint32_t max)
+{
+  startq_head = startq_tail = NULL;
+  startq_max = max;
+  startq_nstarting = 0;
+
+  return;
+}
+
+
+/* perpd_startq_add()
+**   append newly activated svdef to start queue
+**   called by perpd_svdef_activate()
+*/
+void
+perpd_startq_add(struct svdef *svdef)
+{
+  svdef->qnext = NULL;
+  if(startq_tail == NULL){
+      startq_head = svdef;
+  }else{
+      startq_tail->qnext = svdef;
+  }
+  startq_tail = svdef;
+  svdef->bitflags |= SVDEF_FLAG_QUEUED;
+  perpd_statfile_mark(svdef);
+
+  return;
+}
+
+
+/* perpd_startq_drop()
+**   remove svdef from start queue, and from count of starting
+**   called on deactivation
+*/
+void
+perpd_startq_drop(struct svdef *svdef)
+{
+  struct svdef  *prev = NULL;
+  struct svdef  *s;
+
+  if(svdef->bitflags & SVDEF_FLAG_QUEUED){
+      for(s = startq_head; s != NULL; prev = s, s = s->qnext){
+          if(s == svdef){
+              startq_unlink(svdef, prev);
+              break;
+          }
+      }
+  }
+  perpd_startq_done(svdef);
+
+  return;
+}
+
+
+/* perpd_startq_done()
+**   svdef no longer counted as starting
+**   called on settle timeout, on readiness, and on termination of main
+**   from start
+*/
+void
+perpd_startq_done(struct svdef *svdef)
+{
+  if(svdef->bitflags & SVDEF_FLAG_STARTING){
+      svdef->bitflags &= ~SVDEF_FLAG_STARTING;
+      perpd_statfile_mark(svdef);
+      --startq_nstarting;
+      perpd_timer_cancel(&svdef->settle);
+  }
+
+  return;
+}
+
+
+/* perpd_startq_run()
+**   start services from queue, in order, to the limit of starting
+**   called by perpd_mainloop()
+*/
+void
+perpd_startq_run(void)
+{
+  struct svdef  *svdef, *prev, *next;
+  int            again;
+
+  do{
+      again = 0;
+      prev = NULL;
+      for(svdef = startq_head; svdef != NULL; svdef = next){
+          next = svdef->qnext;
+          if((startq_max > 0) && (startq_nstarting >= startq_max)){
+              return;
+          }
+          if(startq_held(svdef)){
+              prev = svdef;
+              continue;
+          }
+          startq_unlink(svdef, prev);
+          /* a service not left starting may release others held on it: */
+          if(startq_start(svdef) == 0){
+              again = 1;
+          }
+      }
+
+      if(!again && (startq_nstarting == 0) && (startq_head != NULL)){
+          /* all held on services in queue: */
+          svdef = startq_head;
+          log_warning("dependency cycle in start queue, starting service ",
+                      svdef->name);
+          startq_unlink(svdef, NULL);
+          if(startq_start(svdef) == 0){
+              again = 1;
+          }
+      }
+  }while(again);
+
+  return;
+}
+
+
+/* perpd_startq_adopt()
+**   resume queue state of svdef restored on re-exec:
+**   a queued service is appended to the queue again (in slot order),
+**   a starting service counted as starting until its restored settle
+**   called by perpd_reexec_restore()
+*/
+void
+perpd_startq_adopt(struct svdef *svdef)
+{
+  if(svdef->bitflags & SVDEF_FLAG_QUEUED){
+      perpd_startq_add(svdef);
+  }
+
+  if(svdef->bitflags & SVDEF_FLAG_STARTING){
+      ++startq_nstarting;
+      if(perpd_timer_set(&svdef->settle, &svdef->settle.when,
+                         &startq_settle, svdef) == -1){
+          warn_syserr("failure setting start timer for service ", svdef->name);
+          perpd_startq_done(svdef);
+      }
+  }
+
+  return;
+}
+
+
+/* eof: perpd_startq.c */
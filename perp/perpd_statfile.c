@@ -0,0 +1,296 @@
+/* perpd_statfile.c
+** perp: persistent process supervision
+** perpd 2.0: single process scanner/supervisor/controller
+** perpd_statfile: status file of services, mapped by clients
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* lasanga: */
+#include "buf.h"
+#include "cstr.h"
+#include "tain.h"
+#include "uchar.h"
+#include "upak.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perp_statfile.h"
+#include "perpd.h"
+
+
+/* notes:
+**
+**   the status file in the control directory holds a record of fixed
+**   layout for each active service (as described in perp_statfile.h),
+**   at the position of the service in svtab->svdefs[]
+**
+**   a service with changed status is marked by perpd_statfile_mark(),
+**   and its record rewritten once by perpd_statfile_flush() before the
+**   next wait of the main loop; the record of a slot vacated by cull is
+**   then cleared
+**
+**   each record is written under a seqlock, so that clients may copy
+**   a consistent status without locking and without any request to
+**   perpd (see perp_statfile.c)
+**
+**   each base directory has its own status file (base->statfile), of
+**   the services in its svtab
+**
+**   the file is unlinked and created anew at startup, and grown (never
+**   truncated) as services are activated; a failure on the file is not
+**   fatal to perpd, but withdraws the status file, leaving clients to
+**   query perpd on its socket
+*/
+
+static int statfile_grow(struct perpd_statfile *sf, size_t nslots);
+static void statfile_withdraw(struct perpd_base *base);
+static void statfile_write(struct perpd_statfile *sf, size_t slot,
+                           const struct svdef *svdef, const tain_t *now);
+
+
+/* statfile_grow()
+**   extend status file and mapping to nslots records
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+static
+int
+statfile_grow(struct perpd_statfile *sf, size_t nslots)
+{
+  uchar_t  *map;
+  size_t    size = STATFILE_HEADER + (nslots * STATFILE_RECORD);
+
+  if(ftruncate(sf->fd, (off_t)size) == -1){
+      return -1;
+  }
+  map = (uchar_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        sf->fd, 0);
+  if(map == (uchar_t *)MAP_FAILED){
+      return -1;
+  }
+  if(sf->map != NULL){
+      munmap(sf->map,
+             STATFILE_HEADER + (sf->nslots * STATFILE_RECORD));
+  }
+  sf->map = map;
+  sf->nslots = nslots;
+  upak32_pack(&sf->map[12], (uint32_t)nslots);
+
+  return 0;
+}
+
+
+/* statfile_withdraw()
+**   give up status file of base on failure:
+**   clear the perpd pid in header, refused by clients
+*/
+static
+void
+statfile_withdraw(struct perpd_base *base)
+{
+  struct perpd_statfile  *sf = &base->statfile;
+
+  warn_syserr("failure on status file ", PERPD_STATFILE, " in ", base->path);
+  log_warning("withdrawing status file ", PERPD_STATFILE, " in ", base->path);
+
+  upak32_pack(&sf->map[16], 0);
+  munmap(sf->map, STATFILE_HEADER + (sf->nslots * STATFILE_RECORD));
+  close(sf->fd);
+  sf->map = NULL;
+  sf->fd = -1;
+  sf->nslots = 0;
+
+  return;
+}
+
+
+/* statfile_write()
+**   write record of svdef (or clear record if svdef is NULL) into slot
+*/
+static
+void
+statfile_write(struct perpd_statfile *sf, size_t slot,
+               const struct svdef *svdef, const tain_t *now)
+{
+  uchar_t            *r = sf->map + STATFILE_HEADER + (slot * STATFILE_RECORD);
+  volatile uint32_t  *seqp = (volatile uint32_t *)&r[STATFILE_SEQ];
+  size_t              namelen;
+
+  /* seq odd while writing: */
+  *seqp = *seqp + 1;
+  __sync_synchronize();
+
+  buf_WIPE(&r[STATFILE_INUSE], STATFILE_RECORD - STATFILE_INUSE);
+  if(svdef != NULL){
+      namelen = cstr_len(svdef->name);
+      r[STATFILE_INUSE] = 1;
+      r[STATFILE_NSTATUS] = PERPD_STATUS;
+      r[STATFILE_NNAME] = (uchar_t)namelen;
+      tain_pack(&r[STATFILE_STAMP], now);
+      upak64_pack(&r[STATFILE_DEVINO], (uint64_t)svdef->dev);
+      upak64_pack(&r[STATFILE_DEVINO + 8], (uint64_t)svdef->ino);
+      perpd_conn_status(&r[STATFILE_STATUSAT], svdef, now);
+      buf_copy(&r[STATFILE_NAMEAT], svdef->name, namelen);
+  }
+
+  __sync_synchronize();
+  *seqp = *seqp + 1;
+
+  return;
+}
+
+
+/* perpd_statfile_init()
+**   create status file in control directory of base
+**   cwd is base directory
+**   return:
+**     0: success
+**    -1: failure, errno set (perpd runs without status file for base)
+*/
+int
+perpd_statfile_init(struct perpd_base *base, gid_t gid)
+{
+  struct perpd_statfile  *sf = &base->statfile;
+  const char             *path = PERP_CONTROL "/" PERPD_STATFILE;
+  int                     fd;
+
+  /* (svdefs may be marked already, as on re-exec) */
+  sf->fd = -1;
+  sf->map = NULL;
+  sf->nslots = 0;
+
+  /* clients mapping a previous file keep the old inode: */
+  if((unlink(path) == -1) && (errno != ENOENT)){
+      return -1;
+  }
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if(fd == -1){
+      return -1;
+  }
+  if(gid != (gid_t)-1){
+      /* readable to members of group, as socket: */
+      if((fchown(fd, (uid_t)-1, gid) == -1) || (fchmod(fd, 0640) == -1)){
+          close(fd);
+          return -1;
+      }
+  }
+  sf->fd = fd;
+  if(statfile_grow(sf, PERPD_SVTAB_INIT) == -1){
+      close(fd);
+      sf->fd = -1;
+      return -1;
+  }
+
+  /* header: */
+  buf_copy(&sf->map[0], STATFILE_MAGIC, 8);
+  upak32_pack(&sf->map[8], STATFILE_RECORD);
+  upak32_pack(&sf->map[16], (uint32_t)my_pid);
+  tain_pack(&sf->map[20], &my_when);
+
+  return 0;
+}
+
+
+/* perpd_statfile_mark()
+**   mark svdef for update of its record in status file of its base
+*/
+void
+perpd_statfile_mark(struct svdef *svdef)
+{
+  if(!svdef->statdirty){
+      svdef->statdirty = 1;
+      ++svdef->base->statfile.ndirty;
+  }
+
+  return;
+}
+
+
+/* perpd_statfile_pid()
+**   set perpd pid in header of status file of base
+**   (0 withdraws the file from clients, as before re-exec)
+*/
+void
+perpd_statfile_pid(struct perpd_base *base, pid_t pid)
+{
+  struct perpd_statfile  *sf = &base->statfile;
+
+  if(sf->map != NULL){
+      upak32_pack(&sf->map[16], (uint32_t)pid);
+  }
+
+  return;
+}
+
+
+/* perpd_statfile_flush()
+**   write out records of marked services of base, clear any vacated slots
+**   called by perpd_mainloop() before each wait
+*/
+void
+perpd_statfile_flush(struct perpd_base *base)
+{
+  struct perpd_statfile  *sf = &base->statfile;
+  struct svdef          **svdefs = base->svtab.svdefs;
+  size_t                  n = base->svtab.n;
+  size_t                  i, nslots;
+  tain_t                  now;
+
+  if((sf->ndirty == 0) && (sf->nused <= n)){
+      return;
+  }
+
+  if(sf->map == NULL){
+      /* no status file, just unmark: */
+      for(i = 0; i < n; ++i){
+          svdefs[i]->statdirty = 0;
+      }
+      sf->ndirty = 0;
+      sf->nused = n;
+      return;
+  }
+
+  if(n > sf->nslots){
+      nslots = sf->nslots * 2;
+      while(nslots < n) nslots *= 2;
+      if(statfile_grow(sf, nslots) == -1){
+          statfile_withdraw(base);
+          perpd_statfile_flush(base);
+          return;
+      }
+  }
+
+  tain_now(&now);
+  for(i = 0; (i < n) && (sf->ndirty > 0); ++i){
+      if(svdefs[i]->statdirty){
+          statfile_write(sf, i, svdefs[i], &now);
+          svdefs[i]->statdirty = 0;
+          --sf->ndirty;
+      }
+  }
+  sf->ndirty = 0;
+
+  /* slots vacated by cull: */
+  for(i = n; i < sf->nused; ++i){
+      statfile_write(sf, i, NULL, &now);
+  }
+  sf->nused = n;
+
+  return;
+}
+
+
+/* eof: perpd_statfile.c */
@@ -2,26 +2,39 @@
 ** perp: persistent process supervision
 ** perpd 2.0: single process scanner/supervisor/controller
 ** perpd_svdef: perpd subroutines on service definitions
-** wcm, 2010.12.28 - 2011.02.07
+** wcm, 2010.12.28 - 2011.04.05
 ** ===
 */
 
+/* clone() is a linux/glibc extension: */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE 1
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 /* unix: */
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#  include <sched.h>
+#  include <sys/syscall.h>
+#endif
 
 /* lasanga: */
 #include "buf.h"
 #include "cstr.h"
 #include "fd.h"
-#include "newenv.h"
 #include "nfmt.h"
+#include "nuscan.h"
 #include "sig.h"
 #include "sigset.h"
 #include "sysstr.h"
@@ -33,6 +46,337 @@
 #include "perpd.h"
 
 
+/* svrun object, arguments to svrun_child(): */
+struct svrun {
+  struct svdef  *svdef;
+  int            which;
+  int            target;
+  char         **argv;
+  /* child end of readiness notification socketpair (or -1): */
+  int            notifyfd;
+};
+
+/* svlist object, files found in a service definition directory: */
+struct svlist {
+  int       fd;   /* service definition directory */
+  uint32_t  has;  /* bits of svlist_names[] found */
+};
+
+/* files of a service definition directory inspected at activation
+** (other entries passed over):
+*/
+static const char *svlist_names[] = {
+  "flag.down", "flag.once", "flag.killpg", "rc.log", "rc.check",
+  "param.respawn", "param.quarantine", "param.stop", "param.notify",
+  "param.after", "param.check", "param.checktimeout", "param.checkfails",
+  NULL
+};
+
+static void svlist_init(struct svlist *ls, int fd);
+static int svlist_has(const struct svlist *ls, const char *name);
+static int svlist_stat(const struct svlist *ls, const char *name, struct stat *st);
+static int svlist_open(const struct svlist *ls, const char *name);
+static uint32_t svdef_param(const struct svlist *ls, const char *svdir,
+                            const char *param, uint32_t dflt, uint32_t max);
+static char * svdef_after(const struct svlist *ls, const char *svdir);
+static void svrun_timeout(struct perpd_timer *timer);
+static void svrun_stopdue(struct perpd_timer *timer);
+static uint32_t svrun_jitter(uint32_t range);
+static void svrun_history(struct svdef *svdef, int which, const tain_t *now);
+static int tally_bin(uint64_t msecs);
+static void svrun_fatal(const struct svrun *run, const char *mesg);
+static int svrun_child(void *arg);
+static pid_t svrun_spawn(struct svrun *run);
+static int svrun_notifyopen(struct svdef *svdef);
+static void svcheck_init(struct svdef *svdef, const struct svlist *ls,
+                         const char *svdir);
+static void svcheck_due(struct perpd_timer *timer);
+static int svcheck_spawn(struct svdef *svdef);
+static void svcheck_schedule(struct svdef *svdef);
+
+/* state for svrun_jitter(): */
+static uint32_t  svrun_seed = 1;
+
+#ifdef PERPD_CLONE
+/* stack for svrun_child() under clone(CLONE_VM | CLONE_VFORK): */
+static long  svrun_stack[PERPD_CLONE_STACK / sizeof(long)];
+#endif
+
+
+/* perpd_svdef_init()
+**   setup for runscripts, once at startup
+*/
+void
+perpd_svdef_init(void)
+{
+  tain_t   now;
+
+  /* seed for backoff jitter: */
+  tain_now(&now);
+  svrun_seed ^= (uint32_t)getpid() ^ now.nsec ^ (uint32_t)now.sec;
+  if(svrun_seed == 0) svrun_seed = 1;
+
+  return;
+}
+
+
+/* perpd_svdef_env()
+**   setup environment for runscripts of base, once at startup:
+**   environ, with PERP_BASE set to base->path
+**
+**   return:
+**     0: success
+**    -1: allocation failure, errno set
+*/
+int
+perpd_svdef_env(struct perpd_base *base)
+{
+  char    *perp_base;
+  char   **envp;
+  size_t   n = 0;
+  size_t   i, j;
+
+  perp_base = (char *)malloc(cstr_vlen("PERP_BASE=", base->path) + 1);
+  if(perp_base == NULL){
+      errno = ENOMEM;
+      return -1;
+  }
+  cstr_vcopy(perp_base, "PERP_BASE=", base->path);
+
+  while(environ[n] != NULL) ++n;
+  envp = (char **)malloc((n + 2) * sizeof(char *));
+  if(envp == NULL){
+      free(perp_base);
+      errno = ENOMEM;
+      return -1;
+  }
+
+  for(i = 0, j = 0; i < n; ++i){
+      if(cstr_ncmp(environ[i], "PERP_BASE=", 10) == 0){
+          continue;
+      }
+      envp[j++] = environ[i];
+  }
+  envp[j++] = perp_base;
+  envp[j] = NULL;
+  base->envp = envp;
+
+  return 0;
+}
+
+
+/* svlist_init()
+**   list files of svlist_names[] found in service definition directory fd
+**   by one read of its entries (on failure, all names are taken as found,
+**   each then looked up in turn)
+*/
+static
+void
+svlist_init(struct svlist *ls, int fd)
+{
+  uint64_t           buf[512];
+  struct perpd_dir   dir;
+  const char        *name;
+  int                type, i;
+
+  ls->fd = fd;
+  ls->has = 0;
+  if(perpd_dir_open(&dir, fd, (uchar_t *)buf, sizeof buf) == -1){
+      ls->has = ~(uint32_t)0;
+      return;
+  }
+  errno = 0;
+  while((name = perpd_dir_next(&dir, &type)) != NULL){
+      for(i = 0; svlist_names[i] != NULL; ++i){
+          if(cstr_cmp(name, svlist_names[i]) == 0){
+              ls->has |= ((uint32_t)1 << i);
+              break;
+          }
+      }
+  }
+  if(errno){
+      ls->has = ~(uint32_t)0;
+  }
+  perpd_dir_close(&dir);
+
+  return;
+}
+
+
+/* svlist_has()
+**   check for file name (of svlist_names[]) in ls
+**   return:
+**     1: yes
+**     0: no
+*/
+static
+int
+svlist_has(const struct svlist *ls, const char *name)
+{
+  int  i;
+
+  for(i = 0; svlist_names[i] != NULL; ++i){
+      if(cstr_cmp(name, svlist_names[i]) == 0){
+          return (ls->has & ((uint32_t)1 << i)) ? 1 : 0;
+      }
+  }
+
+  return 1;
+}
+
+
+/* svlist_stat()
+**   fstatat() file name in service definition directory of ls
+**   (a name not listed fails without a syscall)
+**   return as stat()
+*/
+static
+int
+svlist_stat(const struct svlist *ls, const char *name, struct stat *st)
+{
+  if(!svlist_has(ls, name)){
+      errno = ENOENT;
+      return -1;
+  }
+
+  return fstatat(ls->fd, name, st, 0);
+}
+
+
+/* svlist_open()
+**   openat() file name in service definition directory of ls, to read
+**   (a name not listed fails without a syscall)
+**   return as open()
+*/
+static
+int
+svlist_open(const struct svlist *ls, const char *name)
+{
+  if(!svlist_has(ls, name)){
+      errno = ENOENT;
+      return -1;
+  }
+
+  return openat(ls->fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+
+/* svdef_param()
+**   numeric setting for service from file "param.<param>" in svdir
+**   return:
+**     setting from file, to max
+**     dflt if file not found or not numeric
+*/
+static
+uint32_t
+svdef_param(const struct svlist *ls, const char *svdir,
+            const char *param, uint32_t dflt, uint32_t max)
+{
+  char         name[64];
+  char         buf[32];
+  const char  *z;
+  uint32_t     u;
+  ssize_t      r;
+  int          fd;
+
+  cstr_vcopy(name, "param.", param);
+  if((fd = svlist_open(ls, name)) == -1){
+      return dflt;
+  }
+  do{
+      r = read(fd, buf, sizeof buf - 1);
+  }while((r == -1) && (errno == EINTR));
+  close(fd);
+
+  if(r <= 0){
+      log_warning("empty or unreadable param.", param, " for ", svdir);
+      return dflt;
+  }
+  buf[r] = '\0';
+  z = nuscan_uint32(&u, buf);
+  if((z == buf) || ((*z != '\0') && (*z != '\n'))){
+      log_warning("non-numeric param.", param, " for ", svdir);
+      return dflt;
+  }
+
+  return (u > max) ? max : u;
+}
+
+
+/* whitespace separating names in "param.after": */
+#define AFTER_ISSPACE(c) \
+  (((c) == ' ') || ((c) == '\t') || ((c) == '\n') || ((c) == '\r'))
+
+/* svdef_after()
+**   names of services to start before svdir, from file "param.after"
+**   (names separated by whitespace)
+**   return:
+**     list of names, each nul-terminated, ending with an empty name
+**     NULL if file not found or without names
+*/
+static
+char *
+svdef_after(const struct svlist *ls, const char *svdir)
+{
+  char      buf[1024];
+  char     *after;
+  size_t    i, j, k;
+  ssize_t   r;
+  int       fd, bad;
+
+  if((fd = svlist_open(ls, "param.after")) == -1){
+      return NULL;
+  }
+  do{
+      r = read(fd, buf, sizeof buf);
+  }while((r == -1) && (errno == EINTR));
+  close(fd);
+
+  if(r <= 0){
+      log_warning("empty or unreadable param.after for ", svdir);
+      return NULL;
+  }
+  if((size_t)r == sizeof buf){
+      log_warning("param.after too long for ", svdir);
+      return NULL;
+  }
+
+  if((after = (char *)malloc((size_t)r + 2)) == NULL){
+      warn_syserr("failure allocating param.after for ", svdir);
+      return NULL;
+  }
+
+  /* split names into after: */
+  i = j = 0;
+  while(i < (size_t)r){
+      if(AFTER_ISSPACE(buf[i])){
+          ++i;
+          continue;
+      }
+      bad = 0;
+      for(k = i; (k < (size_t)r) && !AFTER_ISSPACE(buf[k]); ++k){
+          if((buf[k] == '/') || (buf[k] == '\0')) bad = 1;
+      }
+      if(bad || ((k - i) > PERPD_NAMEMAX)){
+          log_warning("ignoring bad name in param.after for ", svdir);
+      }else{
+          buf_copy(&after[j], &buf[i], k - i);
+          j += k - i;
+          after[j++] = '\0';
+      }
+      i = k;
+  }
+
+  if(j == 0){
+      free(after);
+      return NULL;
+  }
+  after[j] = '\0';
+
+  return after;
+}
+
+
 /* perpd_svdef_clear()
 **   prepare a clean perpd_svdef object
 */
@@ -45,18 +389,26 @@ perpd_svdef_clear(struct svdef *svdef)
 
 
 /* perpd_svdef_close()
-**   close descriptors in a perpd_svdef object
+**   close descriptors in a perpd_svdef object, cancel stop timeouts
 */
 void
 perpd_svdef_close(struct svdef *svdef)
 {
+  perpd_timer_cancel(&svdef->svpair[SUBSV_MAIN].stop);
+  perpd_timer_cancel(&svdef->svpair[SUBSV_LOG].stop);
+  perpd_svdef_notifyclose(svdef);
+  perpd_timer_cancel(&svdef->check.timer);
   close(svdef->fd_dir);
+  if(svdef->after != NULL){
+      free(svdef->after);
+      svdef->after = NULL;
+  }
   return;
 }
 
 
 /* perpd_svdef_activate()
-**   activate service definition
+**   activate service definition in base
 **   called by perpd_scan()
 **
 **   return:
@@ -66,26 +418,29 @@ perpd_svdef_close(struct svdef *svdef)
 **   notes:
 **     failures include:
 **       - service definition directory name too long
-**         (must me less than, say, 240 characters)
+**         (must be no more than PERPD_NAMEMAX characters)
 **       - open() on service definition directory
 **       - pipe() for logpipe
 **     service is activated only on success
 */
 int
-perpd_svdef_activate(struct svdef *svdef, const char *svdir, const struct stat *st_dir)
+perpd_svdef_activate(struct svdef *svdef, struct perpd_base *base,
+                     const char *svdir, const struct stat *st_dir)
 {
-  struct stat  st;
-  char         path_buf[256];
-  int          fd;
+  struct svlist  ls;
+  struct stat    st;
+  int            fd;
 
   perpd_svdef_clear(svdef);
 
-  if(cstr_len(svdir) > 240){
+  if(cstr_len(svdir) > PERPD_NAMEMAX){
       errno = ENAMETOOLONG;
       warn_syserr("service definition directory name error: ", svdir);
       return -1;
   }
 
+  svdef->base = base;
+  svdef->notifyfd = -1;
   svdef->dev = st_dir->st_dev;
   svdef->ino = st_dir->st_ino;
   cstr_lcpy(svdef->name, svdir, sizeof svdef->name);
@@ -93,27 +448,35 @@ perpd_svdef_activate(struct svdef *svdef, const char *svdir, const struct stat *
   svdef->bitflags |= SVDEF_FLAG_ACTIVE;
 
   /* open an fd to use for fchdir() in perpd_svrun(): */
-  cstr_vcopy(path_buf, "./", svdir);
-  if((fd = open(path_buf, O_RDONLY)) == -1){
+  fd = openat(base->fd_dir, svdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(fd == -1){
       warn_syserr("failure open() on service definition directory ", svdir);
       return -1;
   }
-  fd_cloexec(fd);
   svdef->fd_dir = fd;
 
-  /* inspect service definition directory: */
-  cstr_vcopy(path_buf, "./", svdir, "/flag.down");
-  if(stat(path_buf, &st) != -1){
+  /* inspect service definition directory, files looked up relative to fd: */
+  svlist_init(&ls, fd);
+  if(svlist_stat(&ls, "flag.down", &st) != -1){
       svdef->bitflags |= SVDEF_FLAG_DOWN;
   }
-  cstr_vcopy(path_buf, "./", svdir, "/flag.once");
-  if(stat(path_buf, &st) != -1){
+  if(svlist_stat(&ls, "flag.once", &st) != -1){
       svdef->bitflags |= SVDEF_FLAG_ONCE;
   }
+  if(svlist_stat(&ls, "flag.killpg", &st) != -1){
+      svdef->killpg = 1;
+  }
+  svdef->respawn = svdef_param(&ls, svdir, "respawn", PERPD_RESPAWN, PERPD_RESPAWN_MAX);
+  svdef->quarantine = svdef_param(&ls, svdir, "quarantine", PERPD_QUARANTINE, 255);
+  svdef->stop = svdef_param(&ls, svdir, "stop", PERPD_STOP, PERPD_STOP_MAX);
+  svdef->notify = (int)svdef_param(&ls, svdir, "notify", 0, 1023);
+  if((svdef->notify > 0) && (svdef->notify < 3)){
+      log_warning("ignoring param.notify (descriptor below 3) for ", svdir);
+      svdef->notify = 0;
+  }
 
   /* logging? */
-  cstr_vcopy(path_buf, "./", svdir, "/rc.log");
-  if(stat(path_buf, &st) != -1){
+  if(svlist_stat(&ls, "rc.log", &st) != -1){
       if(st.st_mode & S_IXUSR){
           svdef->bitflags |= SVDEF_FLAG_HASLOG;
           log_debug("rc.log exists and is executable for ", svdir);
@@ -133,34 +496,60 @@ perpd_svdef_activate(struct svdef *svdef, const char *svdir, const struct stat *
       fd_cloexec(svdef->logpipe[1]);
   } 
 
+  /* start ordering: */
+  svdef->after = svdef_after(&ls, svdir);
+
+  /* health check: */
+  svcheck_init(svdef, &ls, svdir);
+
   /*
   ** from here on, the service is considered activated
   */
+  perpd_conn_notify(svdef, SUBSV_MAIN, PERPD_EVENT_ACTIVATE, 0);
 
-  /* first time startup: */
-  /* log: if FLAG_HASLOG, start irrespective of any other svdef->bitflags: */
+  /* setup for first time startup: */
   if(svdef->bitflags & SVDEF_FLAG_HASLOG){
       svdef->svpair[SUBSV_LOG].bitflags |= SUBSV_FLAG_ISLOG;
-      perpd_svdef_run(svdef, SUBSV_LOG, SVRUN_START);
   }
-
-  /* XXX, bail here if log startup fails on fork() ?  */
-
-  /* main: */
   if(!(svdef->bitflags & SVDEF_FLAG_DOWN)){
       /* setup for running once? */
       if(svdef->bitflags & SVDEF_FLAG_ONCE){
           svdef->svpair[SUBSV_MAIN].bitflags |= SUBSV_FLAG_ISONCE;
       }
-      perpd_svdef_run(svdef, SUBSV_MAIN, SVRUN_START);
   } else {
       svdef->svpair[SUBSV_MAIN].bitflags |= SUBSV_FLAG_WANTDOWN;
   }
+
+  /* first time startup from start queue: */
+  perpd_startq_add(svdef);
  
   return 0;
 }
 
 
+/* perpd_svdef_startup()
+**   first time startup of activated service
+**   called by perpd_startq_run()
+*/
+void
+perpd_svdef_startup(struct svdef *svdef)
+{
+  /* log: if FLAG_HASLOG, start irrespective of any other svdef->bitflags: */
+  if(svdef->bitflags & SVDEF_FLAG_HASLOG){
+      perpd_svdef_run(svdef, SUBSV_LOG, SVRUN_START);
+  }
+
+  /* XXX, bail here if log startup fails on fork() ?  */
+
+  /* main (unless flagged down, or set down while in start queue): */
+  if(!(svdef->svpair[SUBSV_MAIN].bitflags & SUBSV_FLAG_WANTDOWN)){
+      perpd_svdef_run(svdef, SUBSV_MAIN, SVRUN_START);
+  }
+
+  return;
+}
+
+
 /* perpd_svdef_keep()
 **   set this svdef as active
 **   called by perpd_scan()
@@ -171,8 +560,10 @@ perpd_svdef_keep(struct svdef *svdef, const char *svdir)
   /* flag active: */
   svdef->bitflags |= SVDEF_FLAG_ACTIVE;
 
-  /* possible name update: */
-  cstr_lcpy(svdef->name, svdir, sizeof svdef->name);
+  /* possible name update (with name index): */
+  if(cstr_cmp(svdef->name, svdir) != 0){
+      perpd_rename(svdef, svdir);
+  }
 
   return;
 }
@@ -232,6 +623,7 @@ perpd_svdef_wantcull(struct svdef *svdef)
   struct subsv  *subsv;
 
   svdef->bitflags |= SVDEF_FLAG_CULL;
+  perpd_statfile_mark(svdef);
 
   /* initiate termination: */
   svdef->svpair[SUBSV_MAIN].bitflags |= SUBSV_FLAG_WANTDOWN;
@@ -239,16 +631,27 @@ perpd_svdef_wantcull(struct svdef *svdef)
       svdef->svpair[SUBSV_LOG].bitflags |= SUBSV_FLAG_WANTDOWN;
   }
 
+  /* drop any delayed start: */
+  perpd_svdef_undelay(svdef, SUBSV_MAIN);
+  perpd_svdef_undelay(svdef, SUBSV_LOG);
+
+  /* drop health checks, kill any check running: */
+  perpd_timer_cancel(&svdef->check.timer);
+  if(svdef->check.pid > 0){
+      kill(0 - svdef->check.pid, SIGKILL);
+  }
+
   /* subsv main: */
   subsv = &svdef->svpair[SUBSV_MAIN];
 
   /* sigterm main (if not running reset) and make sure not paused: */
   if(subsv->pid > 0){
       if(!(subsv->bitflags & SUBSV_FLAG_ISRESET)){
-          kill(subsv->pid, SIGTERM);
+          perpd_pidtab_kill(&subsv->pident, SIGTERM);
       }
       subsv->bitflags &= ~SUBSV_FLAG_ISPAUSED;
-      kill(subsv->pid, SIGCONT);
+      perpd_pidtab_kill(&subsv->pident, SIGCONT);
+      perpd_svdef_stop(svdef, SUBSV_MAIN, 0);
       return 0;
   }
 
@@ -260,10 +663,17 @@ perpd_svdef_wantcull(struct svdef *svdef)
       if(!(subsv->bitflags & SUBSV_FLAG_ISRESET)){
           close(svdef->logpipe[1]);
           close(svdef->logpipe[0]);
-          kill(subsv->pid, SIGTERM);
+          svdef->logpipe[0] = svdef->logpipe[1] = -1;
+          perpd_pidtab_kill(&subsv->pident, SIGTERM);
       }
       subsv->bitflags &= ~SUBSV_FLAG_ISPAUSED;
-      kill(subsv->pid, SIGCONT);
+      perpd_pidtab_kill(&subsv->pident, SIGCONT);
+      perpd_svdef_stop(svdef, SUBSV_LOG, 0);
+      return 0;
+  }
+
+  /* health check killed above, cull on its termination: */
+  if(svdef->check.pid > 0){
       return 0;
   }
 
@@ -319,28 +729,886 @@ perpd_svdef_cullok(struct svdef *svdef)
       return 0;
   }
 
+  /* health check: */
+  if(svdef->check.pid > 0){
+      return 0;
+  }
+
   return 1;
 }
 
 
+/* svrun_fatal()
+**   report failure in child and _exit()
+**   (composed and written directly, as the child may share the memory
+**   of perpd under clone(CLONE_VM))
+*/
+static
+void
+svrun_fatal(const struct svrun *run, const char *mesg)
+{
+  int            e = errno;
+  const char    *v[16];
+  struct iovec   iov[16];
+  int            i, n = 0;
+
+  v[n++] = "error: ";
+  v[n++] = progname;
+  v[n++] = "[";
+  v[n++] = my_pidstr;
+  v[n++] = "]: fatal: (in child for service ";
+  v[n++] = run->svdef->name;
+  v[n++] = "): ";
+  v[n++] = mesg;
+  v[n++] = " for ";
+  v[n++] = run->argv[0];
+  v[n++] = ": ";
+  v[n++] = sysstr_errno_mesg(e);
+  v[n++] = " (";
+  v[n++] = sysstr_errno(e);
+  v[n++] = ")\n";
+  for(i = 0; i < n; ++i){
+      iov[i].iov_base = (void *)v[i];
+      iov[i].iov_len = cstr_len(v[i]);
+  }
+  while((writev(2, iov, n) == -1) && (errno == EINTR)){/*empty*/;}
+
+  _exit(111);
+}
+
+
+/* svrun_child()
+**   in child: setup and exec() runscript for run
+**   no return
+**
+**   notes:
+**     under clone(CLONE_VM | CLONE_VFORK) the child runs in the memory
+**     of perpd (which is suspended until exec()):
+**       - only system calls, nothing allocated or altered in memory
+**         (but errno, restored by svrun_spawn())
+**       - signal dispositions are per-process: sig_uncatch() is safe
+**     child uses (but does not alter) global poll_sigset
+*/
+static
+int
+svrun_child(void *arg)
+{
+  const struct svrun  *run = (const struct svrun *)arg;
+  struct svdef        *svdef = run->svdef;
+  int                  i, n;
+
+  /* clear signal handlers from child process: */
+  sig_uncatch(SIGCHLD);
+  sig_uncatch(SIGHUP);
+  sig_uncatch(SIGINT);
+  sig_uncatch(SIGTERM);
+  sig_uncatch(SIGPIPE);
+  sig_uncatch(SIGUSR2);
+  /* run child in new process group: */
+  setsid();
+  /* cwd for runscripts is svdir: */
+  if(fchdir(svdef->fd_dir) == -1){
+      svrun_fatal(run, "failure fchdir() to service directory");
+  }
+  /* setup logpipe: */
+  if(svdef->bitflags & SVDEF_FLAG_HASLOG){
+      if(run->which == SUBSV_MAIN){
+          /* set stdout to logpipe: */
+          if(dup2(svdef->logpipe[1], 1) != 1){
+              svrun_fatal(run, "failure dup2() on logpipe[1] to logging service");
+          }
+      }
+      if((run->which == SUBSV_LOG) && (run->target == SVRUN_START)){
+          /* set stdin to logpipe:
+          **   (but not if this is a resetting log service)
+          */
+          if(dup2(svdef->logpipe[0], 0) != 0){
+              svrun_fatal(run, "failure dup2() on logpipe[0] for logging service");
+          }
+      }
+  }
+  /* setup readiness notification descriptor: */
+  n = -1;
+  if(run->notifyfd != -1){
+      n = svdef->notify;
+      if(run->notifyfd == n){
+          /* (clear close-on-exec): */
+          if(fcntl(n, F_SETFD, 0) == -1){
+              svrun_fatal(run, "failure fcntl() on readiness notification descriptor");
+          }
+      }else if(dup2(run->notifyfd, n) != n){
+          svrun_fatal(run, "failure dup2() on readiness notification descriptor");
+      }
+  }
+  /* close extraneous descriptors (all others close-on-exec anyway): */
+#ifdef SYS_close_range
+  if(n == -1){
+      i = syscall(SYS_close_range, 3U, ~0U, 0U);
+  }else{
+      i = (n > 3) ? syscall(SYS_close_range, 3U, (unsigned)(n - 1), 0U) : 0;
+      if(i != -1) i = syscall(SYS_close_range, (unsigned)(n + 1), ~0U, 0U);
+  }
+  if(i == -1)
+#endif
+  {
+      for(i = 3; i < 1024; ++i){
+          if(i != n) close(i);
+      }
+  }
+  sigset_unblock(&poll_sigset);
+  /* go forth my child: */
+  execve(run->argv[0], run->argv, svdef->base->envp);
+  /* nuts, exec failed: */
+  svrun_fatal(run, "failure execve()");
+
+  return 111;
+}
+
+
+/* svrun_spawn()
+**   start child process for run
+**   clone(CLONE_VM | CLONE_VFORK) where available: no copy of perpd
+**   address space, perpd resumes on exec() of child
+**   fork() otherwise
+**
+**   notes:
+**     the child shares the errno of perpd (no CLONE_SETTLS), clobbered
+**     by any failure before exec(): errno is restored on return; a child
+**     failing before exec() reports itself on stderr and exits 111 (see
+**     svrun_fatal()), nothing is passed back to perpd
+**
+**   return:
+**     >0: pid of child
+**     -1: failure, errno set
+*/
+static
+pid_t
+svrun_spawn(struct svrun *run)
+{
+  pid_t  pid;
+#ifdef PERPD_CLONE
+  int    terrno = errno;
+
+  pid = clone(&svrun_child, &svrun_stack[sizeof svrun_stack / sizeof(long)],
+              CLONE_VM | CLONE_VFORK | SIGCHLD, run);
+  if(pid != -1){
+      /* errno as before the child ran: */
+      errno = terrno;
+      return pid;
+  }
+  if(errno != ENOSYS){
+      return -1;
+  }
+#endif
+
+  pid = fork();
+  if(pid == 0){
+      svrun_child(run);
+  }
+
+  return pid;
+}
+
+
+/* svrun_notifyopen()
+**   open readiness notification channel for start of main of svdef:
+**   a datagram socketpair, with the perpd end registered with perpd_ev
+**
+**   return:
+**     >=0: child end of socketpair (close-on-exec)
+**      -1: failure, errno set
+*/
+static
+int
+svrun_notifyopen(struct svdef *svdef)
+{
+  int  sv[2];
+
+  if(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == -1){
+      return -1;
+  }
+  fd_cloexec(sv[0]);
+  fd_cloexec(sv[1]);
+  fd_nonblock(sv[0]);
+  if(perpd_ev_add(&svdef->notifyevh, sv[0], PERPD_EV_IN,
+                  PERPD_EVK_NOTIFY, svdef) == -1){
+      close(sv[0]);
+      close(sv[1]);
+      return -1;
+  }
+  svdef->notifyfd = sv[0];
+
+  return sv[1];
+}
+
+
+/* svrun_timeout()
+**   timer callback: delayed start of subsv is due
+*/
+static
+void
+svrun_timeout(struct perpd_timer *timer)
+{
+  struct svdef  *svdef = (struct svdef *)timer->obj;
+  int            which;
+
+  which = (timer == &svdef->svpair[SUBSV_LOG].timer) ? SUBSV_LOG : SUBSV_MAIN;
+  svdef->svpair[which].bitflags &= ~SUBSV_FLAG_DELAYED;
+  if(!(svdef->svpair[which].bitflags & SUBSV_FLAG_WANTDOWN)){
+      perpd_svdef_run(svdef, which, SVRUN_START);
+  }
+
+  return;
+}
+
+
+/* perpd_svdef_undelay()
+**   cancel delayed start of svdef->which, if any
+**   called for "down" control, and on deactivation
+*/
+void
+perpd_svdef_undelay(struct svdef *svdef, int which)
+{
+  struct subsv  *subsv = &svdef->svpair[which];
+
+  if(subsv->bitflags & SUBSV_FLAG_DELAYED){
+      perpd_timer_cancel(&subsv->timer);
+      subsv->bitflags &= ~SUBSV_FLAG_DELAYED;
+  }
+
+  return;
+}
+
+
+/* perpd_svdef_stop()
+**   arm stop timeout of svdef->which, signaled to stop
+**   on timeout, SIGKILL to the process group if is_killpg
+**   (or for file "flag.killpg")
+**   called for "down" control, and on deactivation
+**
+**   notes:
+**     a stop timeout already armed is kept (not postponed)
+**     the timeout is cancelled by perpd_reap() once the subsv is down,
+**     and bounds a "reset" following the termination of "start"
+*/
+void
+perpd_svdef_stop(struct svdef *svdef, int which, int is_killpg)
+{
+  struct subsv  *subsv = &svdef->svpair[which];
+  tain_t         now, when;
+
+  if((svdef->stop == 0) || !(subsv->pid > 0)){
+      return;
+  }
+
+  if(subsv->stop.slot > 0){
+      /* already armed: */
+      subsv->killpg |= is_killpg;
+      return;
+  }
+  subsv->killpg = (is_killpg || svdef->killpg);
+
+  tain_now(&now);
+  tain_LOAD(&when, svdef->stop, 0);
+  tain_plus(&when, &now, &when);
+  if(perpd_timer_set(&subsv->stop, &when, &svrun_stopdue, svdef) == -1){
+      warn_syserr("failure setting stop timeout for service ", svdef->name);
+  }
+
+  return;
+}
+
+
+/* svrun_stopdue()
+**   timer callback: stop timeout of subsv is due
+*/
+static
+void
+svrun_stopdue(struct perpd_timer *timer)
+{
+  struct svdef  *svdef = (struct svdef *)timer->obj;
+  struct subsv  *subsv;
+  int            which;
+
+  which = (timer == &svdef->svpair[SUBSV_LOG].stop) ? SUBSV_LOG : SUBSV_MAIN;
+  subsv = &svdef->svpair[which];
+
+  /* since brought up again, or down: */
+  if(!(subsv->bitflags & SUBSV_FLAG_WANTDOWN) || !(subsv->pid > 0)){
+      return;
+  }
+
+  log_warning("stop timeout on service ", svdef->name, " (",
+              (which == SUBSV_MAIN) ? "main)" : "log)", ", sending SIGKILL");
+  perpd_conn_notify(svdef, which, PERPD_EVENT_KILL, 0);
+  perpd_svdef_kill(svdef, which, subsv->killpg);
+
+  /* rearm, bounding any "reset" to follow: */
+  perpd_svdef_stop(svdef, which, subsv->killpg);
+
+  return;
+}
+
+
+/* perpd_svdef_kill()
+**   SIGKILL to running process of svdef->which,
+**   to its process group if is_killpg
+**   called on stop timeout, and on shutdown deadline
+*/
+void
+perpd_svdef_kill(struct svdef *svdef, int which, int is_killpg)
+{
+  struct subsv  *subsv = &svdef->svpair[which];
+  int            r;
+
+  if(!(subsv->pid > 0)){
+      return;
+  }
+
+  if(is_killpg){
+      r = kill(0 - subsv->pid, SIGKILL);
+  }else{
+      r = perpd_pidtab_kill(&subsv->pident, SIGKILL);
+  }
+  if(r == -1){
+      warn_syserr("failure kill() on SIGKILL to service ", svdef->name, " (",
+                  (which == SUBSV_MAIN) ? "main)" : "log)");
+  }
+
+  return;
+}
+
+
+/* perpd_svdef_notify()
+**   read readiness notification from main of svdef:
+**   a datagram beginning "READY" sets main ready (once for each start)
+**   called by perpd_mainloop() on input from svdef->notifyfd
+*/
+void
+perpd_svdef_notify(struct svdef *svdef)
+{
+  char     buf[64];
+  ssize_t  r;
+
+  for(;;){
+      r = recv(svdef->notifyfd, buf, sizeof buf, 0);
+      if(r == -1){
+          if(errno == EINTR) continue;
+          if((errno != EAGAIN) && (errno != EWOULDBLOCK)){
+              warn_syserr("failure recv() on readiness notification for service ",
+                          svdef->name);
+          }
+          break;
+      }
+      if((r < 5) || (buf_cmp(buf, "READY", 5) != 0)){
+          continue;
+      }
+      if(tain_iszero(&svdef->when_ready)){
+          tain_now(&svdef->when_ready);
+          log_debug("service ", svdef->name, " reported ready");
+          perpd_conn_notify(svdef, SUBSV_MAIN, PERPD_EVENT_READY, 0);
+          /* no longer starting from start queue: */
+          perpd_startq_done(svdef);
+      }
+  }
+
+  return;
+}
+
+
+/* perpd_svdef_notifyclose()
+**   close readiness notification channel of svdef, clear readiness
+**   called on termination of main from start, and by perpd_svdef_close()
+*/
+void
+perpd_svdef_notifyclose(struct svdef *svdef)
+{
+  if(svdef->notifyfd != -1){
+      perpd_ev_del(&svdef->notifyevh);
+      close(svdef->notifyfd);
+      svdef->notifyfd = -1;
+  }
+  tain_LOAD(&svdef->when_ready, 0, 0);
+
+  return;
+}
+
+
+/* svcheck_init()
+**   setup health check of svdef, if executable "rc.check" in svdir,
+**   with the first check at a random offset into the interval
+**   called by perpd_svdef_activate()
+*/
+static
+void
+svcheck_init(struct svdef *svdef, const struct svlist *ls, const char *svdir)
+{
+  struct svcheck  *check = &svdef->check;
+  struct stat      st;
+  tain_t           now, offset;
+
+  if(svlist_stat(ls, "rc.check", &st) == -1){
+      return;
+  }
+  if(!(st.st_mode & S_IXUSR)){
+      log_warning("rc.check exists but is not set executable for ", svdir);
+      return;
+  }
+
+  check->secs = svdef_param(ls, svdir, "check", PERPD_CHECK, PERPD_CHECK_MAX);
+  check->timeout = svdef_param(ls, svdir, "checktimeout", PERPD_CHECK_TIMEOUT, PERPD_CHECK_MAX);
+  check->fails = svdef_param(ls, svdir, "checkfails", PERPD_CHECK_FAILS, 255);
+  if(check->secs == 0){
+      return;
+  }
+  if(check->timeout == 0){
+      check->timeout = 1;
+  }
+  check->bitflags = CHECK_FLAG_ENABLED;
+
+  /* spread checks of services over the interval: */
+  tain_now(&now);
+  tain_load_msecs(&offset, (uint64_t)svrun_jitter(check->secs * 1000));
+  tain_plus(&check->next, &now, &offset);
+  svcheck_schedule(svdef);
+
+  return;
+}
+
+
+/* svcheck_schedule()
+**   set timer for next health check of svdef
+*/
+static
+void
+svcheck_schedule(struct svdef *svdef)
+{
+  struct svcheck  *check = &svdef->check;
+
+  if(perpd_timer_set(&check->timer, &check->next, &svcheck_due, svdef) == -1){
+      warn_syserr("failure setting health check timer for service ", svdef->name);
+  }
+
+  return;
+}
+
+
+/* svcheck_due()
+**   timer callback: health check of svdef is due, or running check has
+**   timed out
+**
+**   notes:
+**     checks are scheduled at fixed intervals from the first
+**     a check is skipped while main is not up (or not yet ready)
+*/
+static
+void
+svcheck_due(struct perpd_timer *timer)
+{
+  struct svdef    *svdef = (struct svdef *)timer->obj;
+  struct svcheck  *check = &svdef->check;
+  struct subsv    *subsv = &svdef->svpair[SUBSV_MAIN];
+  tain_t           now, interval, when;
+
+  tain_now(&now);
+
+  /* running check timed out: */
+  if(check->pid > 0){
+      log_warning("health check timeout on service ", svdef->name,
+                  ", sending SIGKILL");
+      check->killed = 1;
+      if(kill(0 - check->pid, SIGKILL) == -1){
+          warn_syserr("failure kill() on SIGKILL to health check of service ",
+                      svdef->name);
+      }
+      /* next scheduled on termination of check */
+      return;
+  }
+
+  /* next check: */
+  tain_LOAD(&interval, check->secs, 0);
+  tain_plus(&check->next, &check->next, &interval);
+  if(tain_less(&check->next, &now)){
+      tain_plus(&check->next, &now, &interval);
+  }
+
+  /* check only while main is up (and ready): */
+  if(!(subsv->pid > 0) ||
+     (subsv->bitflags & (SUBSV_FLAG_ISRESET | SUBSV_FLAG_WANTDOWN | SUBSV_FLAG_ISPAUSED)) ||
+     ((svdef->notify > 0) && tain_iszero(&svdef->when_ready))){
+      svcheck_schedule(svdef);
+      return;
+  }
+
+  if(svcheck_spawn(svdef) == -1){
+      warn_syserr("failure fork() for health check of service ", svdef->name);
+      svcheck_schedule(svdef);
+      return;
+  }
+
+  /* timeout on running check: */
+  tain_LOAD(&when, check->timeout, 0);
+  tain_plus(&when, &now, &when);
+  if(perpd_timer_set(&check->timer, &when, &svcheck_due, svdef) == -1){
+      warn_syserr("failure setting health check timer for service ", svdef->name);
+  }
+
+  return;
+}
+
+
+/* svcheck_spawn()
+**   run "rc.check" for svdef:
+**     ./rc.check check <svname>
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+static
+int
+svcheck_spawn(struct svdef *svdef)
+{
+  struct svcheck  *check = &svdef->check;
+  char            *prog[4];
+  struct svrun     run;
+  pid_t            pid;
+
+  prog[0] = "./rc.check";
+  prog[1] = "check";
+  prog[2] = svdef->name;
+  prog[3] = NULL;
+
+  run.svdef = svdef;
+  run.which = SUBSV_MAIN;
+  run.target = SVRUN_CHECK;
+  run.argv = prog;
+  run.notifyfd = -1;
+  if((pid = svrun_spawn(&run)) == -1){
+      return -1;
+  }
+
+  check->pid = pid;
+  perpd_pidtab_add(&pidtab, &check->pident, pid, svdef, SUBSV_CHECK);
+  tain_now(&check->when);
+  check->bitflags |= CHECK_FLAG_RUNNING;
+  check->killed = 0;
+  perpd_statfile_mark(svdef);
+
+  return 0;
+}
+
+
+/* perpd_svdef_checkdone()
+**   process health check of svdef terminated with wstat
+**   on failure (non-zero exit, signal, or timeout), restart main after
+**   check->fails consecutive failures
+**   called by perpd_reap()
+*/
+void
+perpd_svdef_checkdone(struct svdef *svdef, int wstat)
+{
+  struct svcheck  *check = &svdef->check;
+  struct subsv    *subsv = &svdef->svpair[SUBSV_MAIN];
+  tain_t           now, diff;
+  char             nbuf[NFMT_SIZE];
+  int              failed;
+
+  perpd_pidtab_del(&pidtab, &check->pident);
+  perpd_timer_cancel(&check->timer);
+  check->pid = 0;
+  check->bitflags &= ~CHECK_FLAG_RUNNING;
+  perpd_statfile_mark(svdef);
+
+  /* killed on deactivation: */
+  if(svdef->bitflags & SVDEF_FLAG_CULL){
+      return;
+  }
+
+  tain_now(&now);
+  tain_minus(&diff, &now, &check->when);
+  check->msecs = (uint32_t)tain_to_msecs(&diff);
+
+  failed = (check->killed || !WIFEXITED(wstat) || (WEXITSTATUS(wstat) != 0));
+  check->bitflags &= ~(CHECK_FLAG_FAILED | CHECK_FLAG_TIMEOUT);
+  check->bitflags |= CHECK_FLAG_RESULT;
+  if(check->killed){
+      check->bitflags |= CHECK_FLAG_TIMEOUT;
+  }
+
+  if(!failed){
+      check->nfail = 0;
+  }else{
+      check->bitflags |= CHECK_FLAG_FAILED;
+      if(check->nfail < 255) ++check->nfail;
+      log_warning("health check failed on service ", svdef->name, " (",
+                  nfmt_uint32(nbuf, check->nfail), " consecutive)");
+      perpd_conn_notify(svdef, SUBSV_MAIN, PERPD_EVENT_CHECK, wstat);
+      /* restart main (if still up and wanting up): */
+      if((check->fails > 0) && (check->nfail >= check->fails) &&
+         (subsv->pid > 0) &&
+         !(subsv->bitflags & (SUBSV_FLAG_ISRESET | SUBSV_FLAG_WANTDOWN))){
+          log_warning("restarting service ", svdef->name,
+                      " on failed health checks");
+          check->nfail = 0;
+          perpd_pidtab_kill(&subsv->pident, SIGTERM);
+          subsv->bitflags &= ~SUBSV_FLAG_ISPAUSED;
+          perpd_pidtab_kill(&subsv->pident, SIGCONT);
+      }
+  }
+
+  /* next check (for a check running past its interval, from now): */
+  if(tain_less(&check->next, &now)){
+      tain_LOAD(&diff, check->secs, 0);
+      tain_plus(&check->next, &now, &diff);
+  }
+  svcheck_schedule(svdef);
+
+  return;
+}
+
+
+/* perpd_svdef_adopt()
+**   resume svdef restored from the state of a previous perpd on re-exec:
+**   descriptors set close-on-exec, running processes entered in pid
+**   index, readiness notification channel registered, and timers
+**   rearmed at the expirations restored (if non-zero)
+**   called by perpd_reexec_restore()
+*/
+void
+perpd_svdef_adopt(struct svdef *svdef)
+{
+  struct svcheck  *check = &svdef->check;
+  struct subsv    *subsv;
+  int              which;
+
+  fd_cloexec(svdef->fd_dir);
+  if(svdef->bitflags & SVDEF_FLAG_HASLOG){
+      if(svdef->logpipe[0] != -1) fd_cloexec(svdef->logpipe[0]);
+      if(svdef->logpipe[1] != -1) fd_cloexec(svdef->logpipe[1]);
+  }
+
+  if(svdef->notifyfd != -1){
+      fd_cloexec(svdef->notifyfd);
+      if(perpd_ev_add(&svdef->notifyevh, svdef->notifyfd, PERPD_EV_IN,
+                      PERPD_EVK_NOTIFY, svdef) == -1){
+          warn_syserr("failure registering readiness notification for service ",
+                      svdef->name);
+          close(svdef->notifyfd);
+          svdef->notifyfd = -1;
+      }
+  }
+
+  for(which = SUBSV_MAIN; which <= SUBSV_LOG; ++which){
+      subsv = &svdef->svpair[which];
+      if(subsv->pid > 0){
+          perpd_pidtab_add(&pidtab, &subsv->pident, subsv->pid, svdef, which);
+      }
+      if(!tain_iszero(&subsv->timer.when) &&
+         (perpd_timer_set(&subsv->timer, &subsv->timer.when, &svrun_timeout, svdef) == -1)){
+          warn_syserr("failure setting respawn governor for service ", svdef->name);
+      }
+      if(!tain_iszero(&subsv->stop.when) &&
+         (perpd_timer_set(&subsv->stop, &subsv->stop.when, &svrun_stopdue, svdef) == -1)){
+          warn_syserr("failure setting stop timeout for service ", svdef->name);
+      }
+      if(subsv->bitflags & SUBSV_FLAG_FAILING){
+          perpd_trigger_fail();
+      }
+  }
+
+  if(check->pid > 0){
+      perpd_pidtab_add(&pidtab, &check->pident, check->pid, svdef, SUBSV_CHECK);
+  }
+  if(!tain_iszero(&check->timer.when) &&
+     (perpd_timer_set(&check->timer, &check->timer.when, &svcheck_due, svdef) == -1)){
+      warn_syserr("failure setting health check timer for service ", svdef->name);
+  }
+
+  return;
+}
+
+
+/* perpd_svdef_release()
+**   release svdef->which from quarantine, if quarantined
+**   called for "up" and "once" controls
+*/
+void
+perpd_svdef_release(struct svdef *svdef, int which)
+{
+  struct subsv  *subsv = &svdef->svpair[which];
+
+  if(subsv->bitflags & SUBSV_FLAG_QUARANTINE){
+      log_info("releasing service ", svdef->name, " (",
+               (which == SUBSV_MAIN) ? "main)" : "log)", " from quarantine");
+      subsv->bitflags &= ~SUBSV_FLAG_QUARANTINE;
+      subsv->nfail = 0;
+      tain_LOAD(&subsv->when_ok, 0, 0);
+  }
+
+  return;
+}
+
+
+/* svrun_jitter()
+**   pseudo-random number in [0, range) (xorshift32)
+*/
+static
+uint32_t
+svrun_jitter(uint32_t range)
+{
+  uint32_t  x = svrun_seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  svrun_seed = x;
+
+  return (range > 0) ? (x % range) : 0;
+}
+
+
+/* svrun_history()
+**   crash-loop detection, on exit of svdef->which from "start":
+**     - count a fast failure if the service ran less than PERPD_RUNOK
+**     - on repeated fast failures, set respawn governor with exponential
+**       backoff plus jitter (to a quarter of the backoff)
+**     - quarantine service after svdef->quarantine fast failures
+*/
+static
+void
+svrun_history(struct svdef *svdef, int which, const tain_t *now)
+{
+  struct subsv  *subsv = &svdef->svpair[which];
+  uint32_t       secs, shift;
+  tain_t         backoff;
+  char           nstr[NFMT_SIZE];
+
+  if(tain_uptime(now, &subsv->when) >= PERPD_RUNOK){
+      subsv->nfail = 0;
+      return;
+  }
+
+  ++subsv->nfail;
+  if(subsv->nfail < 2){
+      /* first fast failure: respawn governor as usual */
+      return;
+  }
+
+  /* backoff = respawn * 2^(nfail - 1), to PERPD_BACKOFF_MAX: */
+  secs = (svdef->respawn > 0) ? svdef->respawn : 1;
+  shift = subsv->nfail - 1;
+  while((shift > 0) && (secs < PERPD_BACKOFF_MAX)){
+      secs <<= 1;
+      --shift;
+  }
+  if(secs > PERPD_BACKOFF_MAX) secs = PERPD_BACKOFF_MAX;
+  tain_load_msecs(&backoff, ((uint64_t)secs * 1000) + svrun_jitter(secs * 250));
+  tain_plus(&subsv->when_ok, now, &backoff);
+
+  if((svdef->quarantine > 0) && (subsv->nfail >= svdef->quarantine)){
+      subsv->bitflags |= SUBSV_FLAG_QUARANTINE;
+      perpd_conn_notify(svdef, which, PERPD_EVENT_QUARANTINE, 0);
+      log_warning("quarantine on service ", svdef->name, " (",
+                  (which == SUBSV_MAIN) ? "main)" : "log)", " after ",
+                  nfmt_uint32(nstr, subsv->nfail), " fast failures");
+  }
+
+  return;
+}
+
+
+/* tally_bin()
+**   histogram bin for duration of msecs
+*/
+static
+int
+tally_bin(uint64_t msecs)
+{
+  uint64_t  bound = 10;
+  int       bin = 0;
+
+  while((bin < (PERPD_TALLY_BINS - 1)) && (msecs > bound)){
+      bound *= 10;
+      ++bin;
+  }
+
+  return bin;
+}
+
+
+/* perpd_svdef_tally()
+**   runtime metrics on termination of svdef->which with wstat
+**   resource usage ru of the terminated process is accumulated
+**   called by perpd_reap(), before the next perpd_svdef_run()
+*/
+void
+perpd_svdef_tally(struct svdef *svdef, int which, int wstat,
+                  const struct rusage *ru)
+{
+  struct subsv  *subsv = &svdef->svpair[which];
+  struct tally  *tally = &subsv->tally;
+  tain_t         now, diff;
+  uint64_t       msecs = 0;
+
+  tally->utime_usecs += ((uint64_t)ru->ru_utime.tv_sec * 1000000) + ru->ru_utime.tv_usec;
+  tally->stime_usecs += ((uint64_t)ru->ru_stime.tv_sec * 1000000) + ru->ru_stime.tv_usec;
+  if((uint64_t)ru->ru_maxrss > tally->maxrss){
+      tally->maxrss = (uint64_t)ru->ru_maxrss;
+  }
+  tally->majflt += (uint64_t)ru->ru_majflt;
+  tally->nvcsw += (uint64_t)ru->ru_nvcsw;
+  tally->nivcsw += (uint64_t)ru->ru_nivcsw;
+
+  tain_now(&now);
+  if(tain_less(&subsv->when, &now)){
+      tain_minus(&diff, &now, &subsv->when);
+      msecs = tain_to_msecs(&diff);
+  }
+
+  if(subsv->bitflags & SUBSV_FLAG_ISRESET){
+      tally->reset_msecs += msecs;
+      ++tally->reset[tally_bin(msecs)];
+      return;
+  }
+
+  /* else terminated from start: */
+  ++tally->exits;
+  if(WIFSIGNALED(wstat)){
+      ++tally->exits_signal;
+  }else if(WIFEXITED(wstat) && (WEXITSTATUS(wstat) != 0)){
+      ++tally->exits_error;
+  }
+  tally->life_msecs += msecs;
+  ++tally->life[tally_bin(msecs)];
+
+  return;
+}
+
+
 /* perpd_svdef_run()
 **   exec() a service:
 **     "which" is SUBSV_MAIN or SUBSV_LOG
 **     "target" is SVRUN_START or SVRUN_RESET
 **
+**   a start within svdef->respawn seconds of the previous start is
+**   held by the respawn governor: the subsv is flagged SUBSV_FLAG_DELAYED,
+**   and the start is made from the timer queue when the delay expires
+**   (the delay is extended by svrun_history() on repeated fast failures)
+**
+**   a start is refused for a subsv in quarantine
+**
 **   side effects:
 **     global flag_failing set on fail of fork()
-**     child uses (but does not alter) global poll_sigset
 */
 int
 perpd_svdef_run(struct svdef *svdef, int which, int target)
 {
   struct subsv  *subsv = &svdef->svpair[which];
   char          *prog[7];
+  struct svrun   run;
   tain_t         now, when_ok;
-  tain_t         towait = tain_INIT(0,0);
+  int            was_failing;
   pid_t          pid;
-  int            i;
 
   /* insanity checks: */
   if((which == SUBSV_LOG) && !(svdef->bitflags & SVDEF_FLAG_HASLOG)){
@@ -353,6 +1621,21 @@ perpd_svdef_run(struct svdef *svdef, int which, int target)
       return 0;
   }
 
+  if(subsv->bitflags & SUBSV_FLAG_DELAYED){
+      log_debug("perpd_svrun() requested for service with start pending");
+      return 0;
+  }
+
+  if((target == SVRUN_START) && (subsv->bitflags & SUBSV_FLAG_QUARANTINE)){
+      log_warning("service ", svdef->name, " (",
+                  (which == SUBSV_MAIN) ? "main)" : "log)",
+                  " in quarantine, not restarted");
+      return 0;
+  }
+
+  /* retry after failure? */
+  was_failing = (subsv->bitflags & SUBSV_FLAG_FAILING) ? 1 : 0;
+
   /* initialize (attempted) target, etc: */
   switch(target){
   case SVRUN_RESET: subsv->bitflags |= SUBSV_FLAG_ISRESET; break;
@@ -390,95 +1673,74 @@ perpd_svdef_run(struct svdef *svdef, int which, int target)
 
   /* timestamps and respawn governor: */
   tain_now(&now);
+  if((target == SVRUN_RESET) && !was_failing &&
+     !(subsv->bitflags & SUBSV_FLAG_WANTDOWN)){
+      /* exited from start: */
+      svrun_history(svdef, which, &now);
+  }
   tain_assign(&when_ok, &subsv->when_ok);
   if((target == SVRUN_START) && tain_less(&now, &when_ok)){
-          log_warning("setting respawn governor on 'start' target of service ", svdef->name,
-                      " for ", prog[0]);
-          tain_minus(&towait, &when_ok, &now);
+      log_warning("setting respawn governor on 'start' target of service ", svdef->name,
+                  " for ", prog[0]);
+      if(perpd_timer_set(&subsv->timer, &when_ok, &svrun_timeout, svdef) != -1){
+          subsv->bitflags |= SUBSV_FLAG_DELAYED;
+          perpd_conn_notify(svdef, which, PERPD_EVENT_DELAY, 0);
+          return 0;
+      }
+      /* else: start now */
+      warn_syserr("failure setting respawn governor for service ", svdef->name);
+  }
+
+  /* readiness notification: */
+  run.notifyfd = -1;
+  if((which == SUBSV_MAIN) && (target == SVRUN_START) && (svdef->notify > 0)){
+      perpd_svdef_notifyclose(svdef);
+      if((run.notifyfd = svrun_notifyopen(svdef)) == -1){
+          warn_syserr("failure setting readiness notification for service ",
+                      svdef->name);
+      }
   }
 
-  /* fork/exec: */
-  if((pid = fork()) == -1){
+  /* spawn: */
+  run.svdef = svdef;
+  run.which = which;
+  run.target = target;
+  run.argv = prog;
+  pid = svrun_spawn(&run);
+  if(run.notifyfd != -1){
+      close(run.notifyfd);
+  }
+  if(pid == -1){
+      if(run.notifyfd != -1){
+          perpd_svdef_notifyclose(svdef);
+      }
       subsv->pid = 0;
       subsv->bitflags |= SUBSV_FLAG_FAILING;
+      perpd_statfile_mark(svdef);
       perpd_trigger_fail();
       warn_syserr("failure fork() for service ", svdef->name);
       return -1;
   }
 
-  /* XXX, TODO:
-  **   if child error before exec(), die() with a distinctive error code
-  */
-
-  /* child: */
-  if(pid == 0){
-      /* run child in new process group: */
-      setsid();
-      /* cwd for runscripts is svdir: */
-      if(fchdir(svdef->fd_dir) == -1){
-          fatal_syserr("(in child for service ", svdef->name,
-                       "): failure fchdir() to service directory");
-      }
-      /* setup logpipe: */
-      if(svdef->bitflags & SVDEF_FLAG_HASLOG){
-          if(which == SUBSV_MAIN){
-              /* set stdout to logpipe: */
-              close(1);
-              if(dup2(svdef->logpipe[1], 1) != 1){
-                  fatal_syserr("(in child for service ", svdef->name,
-                               "): failure dup2() on logpipe[1] to logging service");
-              }
-          }
-          if((which == SUBSV_LOG) && (target == SVRUN_START)){
-              /* set stdin to logpipe:
-              **   (but not if this is a resetting log service)
-              */
-              close(0);
-              if(dup2(svdef->logpipe[0], 0) != 0){
-                  fatal_syserr("(in child for service ", svdef->name,
-                               "): failure dup2() on logpipe[0] for logging service");
-              }
-          }
-          close(svdef->logpipe[0]);
-          close(svdef->logpipe[1]);
-      }
-      /* close extraneous descriptors (shouldn't be any!): */
-      for(i = 3; i < 1024; ++i) close(i);
-      /* set PERP_BASE in the environment: */
-      if(newenv_set("PERP_BASE", basedir) == -1){
-          fatal_syserr("(in child for service ", svdef->name,
-                       "): failure setting PERP_BASE environment for ",
-                       prog[0], " ", prog[1]);
-      }
-      /* respawn governor: */
-      if((target == SVRUN_START) && !(tain_iszero(&towait))){
-          tain_pause(&towait, NULL);
-      }
-      /* clear signal handlers from child process: */
-      sig_uncatch(SIGCHLD);
-      sig_uncatch(SIGHUP);
-      sig_uncatch(SIGINT);
-      sig_uncatch(SIGTERM);
-      sig_uncatch(SIGPIPE);
-      sigset_unblock(&poll_sigset);
-      /* go forth my child: */
-      newenv_run(prog, environ);
-      /* nuts, exec failed: */
-      fatal_syserr("(in child for service ", svdef->name,
-                   "):  failure execve()");
-  }
-
   /* parent: */
   subsv->pid = pid;
+  perpd_pidtab_add(&pidtab, &subsv->pident, pid, svdef, which);
   /* set timestamps and respawn governor: */
   tain_assign(&subsv->when, &now);
   if(target == SVRUN_START){
-      /* when_ok = now + 1sec + wait: */ 
-      tain_LOAD(&when_ok, 1, 0);
+      ++subsv->tally.starts;
+      if(which == SUBSV_MAIN){
+          /* health check results are for the current start: */
+          svdef->check.bitflags &= ~(CHECK_FLAG_RESULT | CHECK_FLAG_FAILED | CHECK_FLAG_TIMEOUT);
+          svdef->check.nfail = 0;
+      }
+      /* when_ok = now + respawn: */ 
+      tain_LOAD(&when_ok, svdef->respawn, 0);
       tain_plus(&when_ok, &now, &when_ok);
-      tain_plus(&when_ok, &when_ok, &towait);
       tain_assign(&subsv->when_ok, &when_ok);
   }
+  perpd_conn_notify(svdef, which,
+                    (target == SVRUN_START) ? PERPD_EVENT_START : PERPD_EVENT_RESET, 0);
 
   return 0;
 }
@@ -0,0 +1,601 @@
+/* perpd_svtab.c
+** perp: persistent process supervision
+** perpd 2.0: single process scanner/supervisor/controller
+** perpd_svtab: growable table of service definitions, with dev/ino index
+**   and name index (and index of service processes by pid)
+** wcm, 2011.03.28 - 2011.04.05
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+/* lasanga: */
+#include "cstr.h"
+#include "hfunc.h"
+#include "uchar.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perpd.h"
+
+/* pidfd system calls (no libc wrappers assumed): */
+#if defined(PERPD_PIDFD) && \
+    (!defined(SYS_pidfd_open) || !defined(SYS_pidfd_send_signal))
+#  undef PERPD_PIDFD
+#endif
+
+
+/* notes:
+**
+**   svtab->svdefs[] is a vector of pointers to individually allocated
+**   svdef objects; a pointer to an svdef remains valid for the life of
+**   the service, irrespective of any reordering of the vector on cull
+**
+**   svdef->slot is the current position of the svdef in svdefs[],
+**   so that deactivation may swap the last svdef into the vacancy
+**   without a search
+**
+**   the dev/ino index is a chained hash, with chains linked through
+**   svdef->hnext, and a power-of-2 number of buckets doubled whenever
+**   the number of services exceeds the number of buckets
+**
+**   the name index is built alongside, with chains linked through
+**   svdef->nnext and the same number of buckets; a service in
+**   deactivation may share its name with a new service activated in
+**   its place, and perpd_svtab_lookupname() then finds the new service
+**
+**   the pid index is built the same way, on pident objects embedded
+**   in each subsv, entered by perpd_svdef_run() on fork() and removed
+**   by perpd_waitup() on reaping the process
+**
+**   where the kernel supports pidfds, each pident also holds a pidfd
+**   registered with perpd_ev, so that process termination is reported
+**   directly to the main loop for the pident, and signals are delivered
+**   with pidfd_send_signal() free of any race with pid reuse; ptab->nopidfd
+**   counts pidents without a pidfd, for which perpd still depends on
+**   SIGCHLD and waitpid(-1)
+*/
+
+
+static size_t devino_hash(dev_t dev, ino_t ino);
+static size_t name_hash(const char *name);
+static void name_link(struct svtab *svtab, struct svdef *svdef);
+static void name_unlink(struct svtab *svtab, struct svdef *svdef);
+static void svtab_rehash(struct svtab *svtab, size_t hsize);
+static size_t pid_hash(pid_t pid);
+static void pidtab_rehash(struct pidtab *ptab, size_t hsize);
+#ifdef PERPD_PIDFD
+static int pidfd_open(pid_t pid);
+#endif
+
+
+/* devino_hash()
+**   hash value for dev/ino (before masking to table size)
+*/
+static
+size_t
+devino_hash(dev_t dev, ino_t ino)
+{
+  uint64_t  d = (uint64_t)dev;
+  uint64_t  i = (uint64_t)ino;
+  uint32_t  h;
+
+  h = (uint32_t)i * HFUNC_PHI32_PRIME;
+  h ^= (uint32_t)(i >> 32);
+  h ^= ((uint32_t)d ^ (uint32_t)(d >> 32)) * HFUNC_FNV32_PRIME;
+
+  return (size_t)hfunc_postmix32(h);
+}
+
+
+/* name_hash()
+**   hash value for service name (before masking to table size)
+*/
+static
+size_t
+name_hash(const char *name)
+{
+  return (size_t)hfunc_fnvm((const uchar_t *)name, cstr_len(name));
+}
+
+
+/* name_link()
+**   enter svdef at head of its chain in name index
+*/
+static
+void
+name_link(struct svtab *svtab, struct svdef *svdef)
+{
+  size_t  h;
+
+  h = name_hash(svdef->name) & (svtab->hsize - 1);
+  svdef->nnext = svtab->hname[h];
+  svtab->hname[h] = svdef;
+
+  return;
+}
+
+
+/* name_unlink()
+**   remove svdef from name index
+*/
+static
+void
+name_unlink(struct svtab *svtab, struct svdef *svdef)
+{
+  struct svdef  **pp;
+  size_t          h;
+
+  h = name_hash(svdef->name) & (svtab->hsize - 1);
+  for(pp = &svtab->hname[h]; *pp != NULL; pp = &(*pp)->nnext){
+      if(*pp == svdef){
+          *pp = svdef->nnext;
+          break;
+      }
+  }
+
+  return;
+}
+
+
+/* svtab_rehash()
+**   rebuild dev/ino and name indexes with hsize buckets (hsize is power of 2)
+**   on allocation failure the existing indexes are retained
+*/
+static
+void
+svtab_rehash(struct svtab *svtab, size_t hsize)
+{
+  struct svdef  **hv, **hn;
+  struct svdef   *svdef;
+  size_t          i, h;
+
+  hv = (struct svdef **)calloc(hsize, sizeof(struct svdef *));
+  hn = (struct svdef **)calloc(hsize, sizeof(struct svdef *));
+  if((hv == NULL) || (hn == NULL)){
+      /* keep running with longer chains: */
+      free(hv);
+      free(hn);
+      return;
+  }
+
+  free(svtab->hdevino);
+  free(svtab->hname);
+  svtab->hdevino = hv;
+  svtab->hname = hn;
+  svtab->hsize = hsize;
+
+  for(i = 0; i < svtab->n; ++i){
+      svdef = svtab->svdefs[i];
+      h = devino_hash(svdef->dev, svdef->ino) & (hsize - 1);
+      svdef->hnext = hv[h];
+      hv[h] = svdef;
+      name_link(svtab, svdef);
+  }
+
+  return;
+}
+
+
+/* perpd_svtab_init()
+**   initialize an empty service table
+**
+**   return:
+**     0: success
+**    -1: allocation failure
+*/
+int
+perpd_svtab_init(struct svtab *svtab)
+{
+  svtab->n = 0;
+  svtab->slots = PERPD_SVTAB_INIT;
+  svtab->hsize = PERPD_SVTAB_INIT;
+
+  svtab->svdefs = (struct svdef **)malloc(svtab->slots * sizeof(struct svdef *));
+  svtab->hdevino = (struct svdef **)calloc(svtab->hsize, sizeof(struct svdef *));
+  svtab->hname = (struct svdef **)calloc(svtab->hsize, sizeof(struct svdef *));
+  if((svtab->svdefs == NULL) || (svtab->hdevino == NULL) || (svtab->hname == NULL)){
+      free(svtab->svdefs);
+      free(svtab->hdevino);
+      free(svtab->hname);
+      errno = ENOMEM;
+      return -1;
+  }
+
+  return 0;
+}
+
+
+/* perpd_svtab_new()
+**   allocate a clean svdef object with room reserved for it in svtab
+**   (the svdef is not entered into svtab until perpd_svtab_add())
+**
+**   return:
+**     non-NULL: success
+**     NULL: allocation failure, errno set
+*/
+struct svdef *
+perpd_svtab_new(struct svtab *svtab)
+{
+  struct svdef  *svdef;
+
+  if(svtab->n == svtab->slots){
+      size_t          slots = svtab->slots * 2;
+      struct svdef  **v;
+      v = (struct svdef **)realloc(svtab->svdefs, slots * sizeof(struct svdef *));
+      if(v == NULL){
+          errno = ENOMEM;
+          return NULL;
+      }
+      svtab->svdefs = v;
+      svtab->slots = slots;
+  }
+
+  svdef = (struct svdef *)malloc(sizeof(struct svdef));
+  if(svdef == NULL){
+      errno = ENOMEM;
+      return NULL;
+  }
+  perpd_svdef_clear(svdef);
+
+  return svdef;
+}
+
+
+/* perpd_svtab_add()
+**   enter svdef (from perpd_svtab_new()) into svtab and indexes
+**   does not fail (space reserved in perpd_svtab_new())
+*/
+void
+perpd_svtab_add(struct svtab *svtab, struct svdef *svdef)
+{
+  size_t  h;
+
+  svdef->slot = svtab->n;
+  svtab->svdefs[svtab->n] = svdef;
+  ++svtab->n;
+
+  h = devino_hash(svdef->dev, svdef->ino) & (svtab->hsize - 1);
+  svdef->hnext = svtab->hdevino[h];
+  svtab->hdevino[h] = svdef;
+  name_link(svtab, svdef);
+
+  /* grow indexes to keep chains short: */
+  if(svtab->n > svtab->hsize){
+      svtab_rehash(svtab, svtab->hsize * 2);
+  }
+
+  return;
+}
+
+
+/* perpd_svtab_drop()
+**   remove svdef from svtab and indexes, and free it
+**   the last svdef in svdefs[] is moved into the vacated slot
+*/
+void
+perpd_svtab_drop(struct svtab *svtab, struct svdef *svdef)
+{
+  struct svdef  **pp;
+  struct svdef   *last;
+  size_t          h;
+
+  /* unlink from index: */
+  h = devino_hash(svdef->dev, svdef->ino) & (svtab->hsize - 1);
+  for(pp = &svtab->hdevino[h]; *pp != NULL; pp = &(*pp)->hnext){
+      if(*pp == svdef){
+          *pp = svdef->hnext;
+          break;
+      }
+  }
+  name_unlink(svtab, svdef);
+
+  /* fill vacancy from end of vector: */
+  --svtab->n;
+  last = svtab->svdefs[svtab->n];
+  svtab->svdefs[svdef->slot] = last;
+  last->slot = svdef->slot;
+
+  free(svdef);
+  return;
+}
+
+
+/* perpd_svtab_lookup()
+**   find svdef in svtab by dev/ino
+**   return:
+**     NULL: not found
+**     non-null: found, pointer to svdef
+*/
+struct svdef *
+perpd_svtab_lookup(struct svtab *svtab, dev_t dev, ino_t ino)
+{
+  struct svdef  *svdef;
+  size_t         h;
+
+  h = devino_hash(dev, ino) & (svtab->hsize - 1);
+  for(svdef = svtab->hdevino[h]; svdef != NULL; svdef = svdef->hnext){
+      if((svdef->ino == ino) && (svdef->dev == dev)){
+          /* found: */
+          return svdef;
+      }
+  }
+
+  /* not found: */
+  return NULL;
+}
+
+
+/* perpd_svtab_rename()
+**   set name of svdef in svtab (name no more than PERPD_NAMEMAX)
+*/
+void
+perpd_svtab_rename(struct svtab *svtab, struct svdef *svdef, const char *name)
+{
+  name_unlink(svtab, svdef);
+  cstr_lcpy(svdef->name, name, sizeof svdef->name);
+  name_link(svtab, svdef);
+
+  return;
+}
+
+
+/* perpd_svtab_lookupname()
+**   find svdef in svtab by name
+**   a service not in deactivation is preferred
+**   return:
+**     NULL: not found
+**     non-null: found, pointer to svdef
+*/
+struct svdef *
+perpd_svtab_lookupname(struct svtab *svtab, const char *name)
+{
+  struct svdef  *svdef;
+  struct svdef  *culling = NULL;
+  size_t         h;
+
+  h = name_hash(name) & (svtab->hsize - 1);
+  for(svdef = svtab->hname[h]; svdef != NULL; svdef = svdef->nnext){
+      if(cstr_cmp(svdef->name, name) == 0){
+          if(!(svdef->bitflags & SVDEF_FLAG_CULL)){
+              /* found: */
+              return svdef;
+          }
+          culling = svdef;
+      }
+  }
+
+  /* not found, or only in deactivation: */
+  return culling;
+}
+
+
+/* pid_hash()
+**   hash value for pid (before masking to table size)
+*/
+static
+size_t
+pid_hash(pid_t pid)
+{
+  return (size_t)hfunc_postmix32((uint32_t)pid * HFUNC_PHI32_PRIME);
+}
+
+
+#ifdef PERPD_PIDFD
+/* pidfd_open()
+**   return pidfd for pid (close-on-exec), or -1 with errno set
+*/
+static
+int
+pidfd_open(pid_t pid)
+{
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+#endif
+
+
+/* pidtab_rehash()
+**   rebuild pid index with hsize buckets (hsize is power of 2)
+**   on allocation failure the existing index is retained
+*/
+static
+void
+pidtab_rehash(struct pidtab *ptab, size_t hsize)
+{
+  struct pident  **hv;
+  struct pident   *pident, *next;
+  size_t           i, h;
+
+  hv = (struct pident **)calloc(hsize, sizeof(struct pident *));
+  if(hv == NULL){
+      /* keep running with longer chains: */
+      return;
+  }
+
+  for(i = 0; i < ptab->hsize; ++i){
+      for(pident = ptab->hpid[i]; pident != NULL; pident = next){
+          next = pident->next;
+          h = pid_hash(pident->pid) & (hsize - 1);
+          pident->next = hv[h];
+          hv[h] = pident;
+      }
+  }
+
+  free(ptab->hpid);
+  ptab->hpid = hv;
+  ptab->hsize = hsize;
+
+  return;
+}
+
+
+/* perpd_pidtab_init()
+**   initialize an empty pid index
+**
+**   return:
+**     0: success
+**    -1: allocation failure
+*/
+int
+perpd_pidtab_init(struct pidtab *ptab)
+{
+  ptab->n = 0;
+  ptab->nopidfd = 0;
+  ptab->use_pidfd = 0;
+#ifdef PERPD_PIDFD
+  {
+      /* probe running kernel for pidfd support: */
+      int  fd = pidfd_open(getpid());
+      if(fd != -1){
+          close(fd);
+          ptab->use_pidfd = 1;
+      }
+  }
+#endif
+  ptab->hsize = PERPD_SVTAB_INIT * 2;
+  ptab->hpid = (struct pident **)calloc(ptab->hsize, sizeof(struct pident *));
+  if(ptab->hpid == NULL){
+      errno = ENOMEM;
+      return -1;
+  }
+
+  return 0;
+}
+
+
+/* perpd_pidtab_add()
+**   enter pident into pid index for pid running "which" of svdef
+**   open and register pidfd for pid, if supported
+**   does not fail (pident without pidfd on pidfd failure)
+*/
+void
+perpd_pidtab_add(struct pidtab *ptab, struct pident *pident,
+                 pid_t pid, struct svdef *svdef, int which)
+{
+  size_t  h;
+
+  pident->pid = pid;
+  pident->svdef = svdef;
+  pident->which = which;
+  pident->pidfd = -1;
+
+#ifdef PERPD_PIDFD
+  if(ptab->use_pidfd){
+      pident->pidfd = pidfd_open(pid);
+      if(pident->pidfd == -1){
+          warn_syserr("failure pidfd_open() for service ", svdef->name);
+      }else if(perpd_ev_add(&pident->evh, pident->pidfd, PERPD_EV_IN,
+                            PERPD_EVK_PROC, pident) == -1){
+          warn_syserr("failure registering pidfd for service ", svdef->name);
+          close(pident->pidfd);
+          pident->pidfd = -1;
+      }
+  }
+#endif
+  if(pident->pidfd == -1){
+      ++ptab->nopidfd;
+  }
+
+  h = pid_hash(pid) & (ptab->hsize - 1);
+  pident->next = ptab->hpid[h];
+  ptab->hpid[h] = pident;
+  ++ptab->n;
+
+  /* grow index to keep chains short: */
+  if(ptab->n > ptab->hsize){
+      pidtab_rehash(ptab, ptab->hsize * 2);
+  }
+
+  return;
+}
+
+
+/* perpd_pidtab_del()
+**   remove pident from pid index, closing any pidfd
+*/
+void
+perpd_pidtab_del(struct pidtab *ptab, struct pident *pident)
+{
+  struct pident  **pp;
+  size_t           h;
+
+  h = pid_hash(pident->pid) & (ptab->hsize - 1);
+  for(pp = &ptab->hpid[h]; *pp != NULL; pp = &(*pp)->next){
+      if(*pp == pident){
+          *pp = pident->next;
+          --ptab->n;
+          break;
+      }
+  }
+  pident->pid = 0;
+  pident->next = NULL;
+
+  if(pident->pidfd != -1){
+      perpd_ev_del(&pident->evh);
+      close(pident->pidfd);
+      pident->pidfd = -1;
+  }else{
+      --ptab->nopidfd;
+  }
+
+  return;
+}
+
+
+/* perpd_pidtab_lookup()
+**   find pident in pid index for pid
+**   return:
+**     NULL: not found
+**     non-null: found, pointer to pident
+*/
+struct pident *
+perpd_pidtab_lookup(struct pidtab *ptab, pid_t pid)
+{
+  struct pident  *pident;
+  size_t          h;
+
+  h = pid_hash(pid) & (ptab->hsize - 1);
+  for(pident = ptab->hpid[h]; pident != NULL; pident = pident->next){
+      if(pident->pid == pid){
+          /* found: */
+          return pident;
+      }
+  }
+
+  /* not found: */
+  return NULL;
+}
+
+
+/* perpd_pidtab_kill()
+**   deliver signal sig to process of pident
+**   using pidfd_send_signal() if pident holds a pidfd, else kill()
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+int
+perpd_pidtab_kill(struct pident *pident, int sig)
+{
+#ifdef PERPD_PIDFD
+  if(pident->pidfd != -1){
+      return (int)syscall(SYS_pidfd_send_signal, pident->pidfd, sig, NULL, 0);
+  }
+#endif
+
+  return kill(pident->pid, sig);
+}
+
+
+/* eof: perpd_svtab.c */
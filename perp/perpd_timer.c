@@ -0,0 +1,267 @@
+/* perpd_timer.c
+** perp: persistent process supervision
+** perpd 2.0: single process scanner/supervisor/controller
+** perpd_timer: timer queue for perpd main loop
+** wcm, 2011.04.02 - 2011.04.02
+** ===
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* unix: */
+#include <errno.h>
+
+/* lasanga: */
+#include "tain.h"
+
+/* perp: */
+#include "perp_common.h"
+#include "perpd.h"
+
+
+/* notes:
+**
+**   the timer queue is a binary min-heap of pointers to struct
+**   perpd_timer, ordered by timer->when
+**
+**   a timer is embedded in the object that owns it (eg, a subsv), and
+**   timer->slot is its position in the heap plus one: a timer cleared
+**   to zero is not armed, and a pending timer may be canceled in place
+**
+**   an expiring timer is removed from the heap before its callback is
+**   run, so that the callback may arm the same timer again
+*/
+
+static struct perpd_timer  **heap = NULL;
+static size_t                heap_n = 0;
+static size_t                heap_slots = 0;
+
+
+static void heap_put(size_t i, struct perpd_timer *timer);
+static void heap_up(size_t i);
+static void heap_down(size_t i);
+static void heap_remove(size_t i);
+
+
+/* heap_put()
+**   set timer at heap position i
+*/
+static
+void
+heap_put(size_t i, struct perpd_timer *timer)
+{
+  heap[i] = timer;
+  timer->slot = i + 1;
+  return;
+}
+
+
+/* heap_up()
+**   sift entry at position i toward root
+*/
+static
+void
+heap_up(size_t i)
+{
+  struct perpd_timer  *timer = heap[i];
+  size_t               parent;
+
+  while(i > 0){
+      parent = (i - 1) / 2;
+      if(!tain_less(&timer->when, &heap[parent]->when)){
+          break;
+      }
+      heap_put(i, heap[parent]);
+      i = parent;
+  }
+  heap_put(i, timer);
+
+  return;
+}
+
+
+/* heap_down()
+**   sift entry at position i toward leaves
+*/
+static
+void
+heap_down(size_t i)
+{
+  struct perpd_timer  *timer = heap[i];
+  size_t               child;
+
+  for(;;){
+      child = (2 * i) + 1;
+      if(child >= heap_n){
+          break;
+      }
+      if(((child + 1) < heap_n) &&
+         tain_less(&heap[child + 1]->when, &heap[child]->when)){
+          ++child;
+      }
+      if(!tain_less(&heap[child]->when, &timer->when)){
+          break;
+      }
+      heap_put(i, heap[child]);
+      i = child;
+  }
+  heap_put(i, timer);
+
+  return;
+}
+
+
+/* heap_remove()
+**   remove entry at position i, refill from end of heap
+*/
+static
+void
+heap_remove(size_t i)
+{
+  struct perpd_timer  *last;
+
+  heap[i]->slot = 0;
+  last = heap[--heap_n];
+  if(i == heap_n){
+      return;
+  }
+
+  heap_put(i, last);
+  if((i > 0) && tain_less(&last->when, &heap[(i - 1) / 2]->when)){
+      heap_up(i);
+  }else{
+      heap_down(i);
+  }
+
+  return;
+}
+
+
+/*
+** perpd scope:
+*/
+
+/* perpd_timer_init()
+**   initialize timer queue, sized for about hint timers
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+int
+perpd_timer_init(size_t hint)
+{
+  heap = (struct perpd_timer **)malloc(hint * sizeof(struct perpd_timer *));
+  if(heap == NULL){
+      errno = ENOMEM;
+      return -1;
+  }
+  heap_slots = hint;
+  heap_n = 0;
+
+  return 0;
+}
+
+
+/* perpd_timer_set()
+**   arm timer to run fn(timer) at when
+**   a timer already pending is rescheduled
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+int
+perpd_timer_set(struct perpd_timer *timer, const tain_t *when,
+                void (*fn)(struct perpd_timer *), void *obj)
+{
+  struct perpd_timer  **h;
+  size_t                slots;
+
+  tain_assign(&timer->when, when);
+  timer->fn = fn;
+  timer->obj = obj;
+
+  if(timer->slot > 0){
+      /* reschedule in place: */
+      heap_up(timer->slot - 1);
+      heap_down(timer->slot - 1);
+      return 0;
+  }
+
+  if(heap_n == heap_slots){
+      slots = (heap_slots > 0) ? (heap_slots * 2) : 16;
+      h = (struct perpd_timer **)realloc(heap, slots * sizeof(struct perpd_timer *));
+      if(h == NULL){
+          errno = ENOMEM;
+          return -1;
+      }
+      heap = h;
+      heap_slots = slots;
+  }
+
+  heap_put(heap_n, timer);
+  ++heap_n;
+  heap_up(heap_n - 1);
+
+  return 0;
+}
+
+
+/* perpd_timer_cancel()
+**   disarm timer if pending
+*/
+void
+perpd_timer_cancel(struct perpd_timer *timer)
+{
+  if(timer->slot > 0){
+      heap_remove(timer->slot - 1);
+  }
+
+  return;
+}
+
+
+/* perpd_timer_msecs()
+**   msecs from now until the next timer expires
+**   return:
+**     >=0: msecs to next timer
+**      -1: no timer pending
+*/
+int
+perpd_timer_msecs(const tain_t *now)
+{
+  tain_t  diff;
+
+  if(heap_n == 0){
+      return -1;
+  }
+  if(!tain_less(now, &heap[0]->when)){
+      return 0;
+  }
+
+  tain_minus(&diff, &heap[0]->when, now);
+  /* round up, so timer will not be found early: */
+  return (int)tain_to_msecs(&diff) + 1;
+}
+
+
+/* perpd_timer_run()
+**   run the callbacks of all timers expired at now
+*/
+void
+perpd_timer_run(const tain_t *now)
+{
+  struct perpd_timer  *timer;
+
+  while((heap_n > 0) && !tain_less(now, &heap[0]->when)){
+      timer = heap[0];
+      heap_remove(0);
+      timer->fn(timer);
+  }
+
+  return;
+}
+
+
+/* eof: perpd_timer.c */
@@ -2,7 +2,7 @@
 ** perp: persistent process supervision
 ** perp 2.0: single process scanner/supervisor/controller
 ** perphup: trigger rescan in perpd
-** wcm, 2009.11.11 - 2011.03.18
+** wcm, 2009.11.11 - 2011.04.05
 ** ===
 */
 
@@ -29,24 +29,28 @@
 
 /* logging variables in scope: */
 static const char *progname = NULL;
-static const char  prog_usage[] = "[-hV] [-q] [-t] [basedir]";
+static const char  prog_usage[] = "[-hV] [-q] [-t | -x] [basedir]";
 
 /* option variables in scope: */
 /* "quiet", !opq_q == verbose, default is verbose: */
 static int opt_q = 0;
 /* send sigterm instead of sighup: */
 static int opt_t = 0;
+/* send sigusr2 (re-exec) instead of sighup: */
+static int opt_x = 0;
 
 int
 main(int argc, char *argv[])
 {
-  nextopt_t    nopt = nextopt_INIT(argc, argv, ":hVqt");
+  nextopt_t    nopt = nextopt_INIT(argc, argv, ":hVqtx");
   char         opt;
   const char  *basedir = NULL;
   char         pathbuf[256];
   size_t       n;
   pid_t        lockpid;
   char         nbuf[NFMT_SIZE];
+  int          sig = SIGHUP;
+  const char  *signame = "SIGHUP";
 
   progname = nextopt_progname(&nopt);
   while((opt = nextopt(&nopt))){
@@ -56,6 +60,7 @@ main(int argc, char *argv[])
       case 'V': version(); die(0); break;
       case 'q': ++opt_q; break;
       case 't': ++opt_t; break;
+      case 'x': ++opt_x; break;
       case ':':
           fatal_usage("missing argument for option -", optc);
           break;
@@ -68,6 +73,10 @@ main(int argc, char *argv[])
       }
   }
 
+  if(opt_t && opt_x){
+      fatal_usage("options -t and -x may not be used together");
+  }
+
   argc -= nopt.arg_ndx;
   argv += nopt.arg_ndx;
 
@@ -101,18 +110,25 @@ main(int argc, char *argv[])
       fatal(111, "perpd not running on ", basedir, ": no lock active on ", pathbuf);
   }
  
-  if(kill(lockpid, opt_t ? SIGTERM : SIGHUP) == -1){
-      fatal_syserr("failure kill() on ", opt_t ? "SIGTERM" : "SIGHUP" , " to perpd pid ",
+  if(opt_t){
+      sig = SIGTERM; signame = "SIGTERM";
+  }else if(opt_x){
+      sig = SIGUSR2; signame = "SIGUSR2";
+  }
+  if(kill(lockpid, sig) == -1){
+      fatal_syserr("failure kill() on ", signame, " to perpd pid ",
                    nfmt_uint32(nbuf, (uint32_t)lockpid),
                    "running on ", basedir);
   }
 
   /* success: */
   if(!opt_q){
-      if(!opt_t){
-          eputs(progname, ": perpd rescan triggered on ", basedir);
-      }else{
+      if(opt_t){
           eputs(progname, ": SIGTERM for perpd on ", basedir);
+      }else if(opt_x){
+          eputs(progname, ": perpd re-exec triggered on ", basedir);
+      }else{
+          eputs(progname, ": perpd rescan triggered on ", basedir);
       }
   }
 
@@ -0,0 +1,472 @@
+/* perpjournal.c
+** perp: persistent process supervision
+** perp 2.0: single process scanner/supervisor/controller
+** perpjournal: decode, filter and follow journal of service transitions
+** (reads journal ring mapped from perpd control directory)
+** wcm, 2011.04.05 - 2011.04.05
+** ===
+*/
+
+/* libc: */
+#include <stdlib.h>
+#include <time.h>
+
+/* unix: */
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/* lasanga: */
+#include "buf.h"
+#include "cstr.h"
+#include "nextopt.h"
+#include "nfmt.h"
+#include "nuscan.h"
+#include "sysstr.h"
+#include "tain.h"
+#include "upak.h"
+#include "uchar.h"
+
+#include "perp_common.h"
+#include "perp_journal.h"
+#include "perp_stderr.h"
+
+/* redefine eputs() for ioq: */
+#ifdef eputs
+#undef eputs
+#endif
+
+/* ioq-based i/o: */
+#include "ioq.h"
+#include "ioq_std.h"
+
+#define eputs(...) \
+  {ioq_flush(ioq1); ioq_vputs(ioq2, __VA_ARGS__, "\n"); ioq_flush(ioq2); }
+
+/* stdout using ioq: */
+#define vputs(...) \
+  ioq_vputs(ioq1, __VA_ARGS__)
+
+#define vputs_flush() \
+  ioq_flush(ioq1)
+
+
+/* logging variables in scope: */
+static const char  *progname = NULL;
+static const char   prog_usage[] = "[-hV] [-b basedir] [-f] [-n num] [sv ...]";
+
+/* interval polling the journal head when following (msecs): */
+#define FOLLOW_MSECS  200
+/* polls between checks for a journal created anew by perpd: */
+#define FOLLOW_RECHECK  5
+
+/* journal object, journal ring mapped read-only: */
+struct journal {
+  uchar_t  *map;
+  size_t    size;
+  uint64_t  nrecs;
+  /* file mapped: */
+  dev_t     dev;
+  ino_t     ino;
+};
+
+static int journal_open(struct journal *J, const char *path);
+static void journal_close(struct journal *J);
+static uint64_t journal_head(const struct journal *J);
+static int journal_read(const struct journal *J, uint64_t seq, uchar_t *rec);
+static int journal_replaced(const struct journal *J, const char *path);
+static const char * event_word(uchar_t event);
+static int want_name(const char *name, char *namev[]);
+static void put_stamp(const uchar_t *buf);
+static void put_wstat(int wstat);
+static void put_record(const uchar_t *rec, const char *name);
+
+
+/* journal_open()
+**   map journal at path
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+static
+int
+journal_open(struct journal *J, const char *path)
+{
+  struct stat  st;
+  uchar_t     *map;
+  int          fd, e;
+
+  if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1){
+      return -1;
+  }
+  if(fstat(fd, &st) == -1){
+      e = errno; close(fd); errno = e;
+      return -1;
+  }
+  if((size_t)st.st_size < JOURNAL_HEADER){
+      close(fd);
+      errno = EPROTO;
+      return -1;
+  }
+  map = (uchar_t *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  e = errno;
+  close(fd);
+  if(map == (uchar_t *)MAP_FAILED){
+      errno = e;
+      return -1;
+  }
+
+  J->map = map;
+  J->size = (size_t)st.st_size;
+  J->nrecs = upak32_unpack(&map[JOURNAL_NRECS]);
+  J->dev = st.st_dev;
+  J->ino = st.st_ino;
+  if((buf_cmp(map, JOURNAL_MAGIC, 8) != 0)
+     || (upak32_unpack(&map[JOURNAL_RECSIZE]) != JOURNAL_RECORD)
+     || (J->nrecs == 0)
+     || (J->size < JOURNAL_HEADER + (J->nrecs * JOURNAL_RECORD))){
+      journal_close(J);
+      errno = EPROTO;
+      return -1;
+  }
+
+  return 0;
+}
+
+
+static
+void
+journal_close(struct journal *J)
+{
+  munmap(J->map, J->size);
+  J->map = NULL;
+  J->size = 0;
+
+  return;
+}
+
+
+/* journal_head()
+**   seq of next record to be written into journal
+*/
+static
+uint64_t
+journal_head(const struct journal *J)
+{
+  uint64_t  head;
+
+  head = *(const volatile uint64_t *)&J->map[JOURNAL_HEAD];
+  __sync_synchronize();
+
+  return head;
+}
+
+
+/* journal_read()
+**   copy record of seq into rec
+**   return:
+**     1: success
+**     0: record of seq overwritten (lost)
+*/
+static
+int
+journal_read(const struct journal *J, uint64_t seq, uchar_t *rec)
+{
+  const uchar_t  *r;
+
+  r = J->map + JOURNAL_HEADER + (((seq - 1) % J->nrecs) * JOURNAL_RECORD);
+  if(*(const volatile uint64_t *)&r[JOURNAL_SEQ] != seq){
+      return 0;
+  }
+  __sync_synchronize();
+  buf_copy(rec, r, JOURNAL_RECORD);
+  __sync_synchronize();
+
+  return (*(const volatile uint64_t *)&r[JOURNAL_SEQ] == seq) ? 1 : 0;
+}
+
+
+/* journal_replaced()
+**   check if journal at path is other than the journal mapped
+**   (created anew by perpd restarted with another size)
+*/
+static
+int
+journal_replaced(const struct journal *J, const char *path)
+{
+  struct stat  st;
+
+  if(stat(path, &st) == -1){
+      return 0;
+  }
+
+  return ((st.st_dev != J->dev) || (st.st_ino != J->ino)) ? 1 : 0;
+}
+
+
+static
+const char *
+event_word(uchar_t event)
+{
+  switch(event){
+  case 'A': return "activate";
+  case 'C': return "deactivate";
+  case 's': return "start";
+  case 'r': return "reset";
+  case 'x': return "exit";
+  case 'w': return "delay";
+  case 'q': return "quarantine";
+  case 'p': return "pause";
+  case 'c': return "continue";
+  case 'd': return "down";
+  case 'u': return "up";
+  case 'k': return "kill";
+  case 'y': return "ready";
+  case 'h': return "checkfail";
+  case JOURNAL_CONTROL: return "control";
+  }
+
+  return "unknown";
+}
+
+
+/* want_name()
+**   check name against filter of names in namev (all if none)
+*/
+static
+int
+want_name(const char *name, char *namev[])
+{
+  if(*namev == NULL){
+      return 1;
+  }
+  for(; *namev != NULL; ++namev){
+      if(cstr_cmp(name, *namev) == 0){
+          return 1;
+      }
+  }
+
+  return 0;
+}
+
+
+/* put_stamp()
+**   output packed tain in buf as utc timestamp (as tinylog)
+*/
+static
+void
+put_stamp(const uchar_t *buf)
+{
+  char        stamp[sizeof "yyyymmddThhmmss.uuuuuu"];
+  char       *s = stamp;
+  tain_t      t;
+  time_t      utc;
+  struct tm  *tm;
+
+  tain_unpack(&t, buf);
+  utc = tain_to_utc(&t);
+  tm = gmtime(&utc);
+
+  nfmt_uint32_pad0_(s, 1900 + tm->tm_year, 4); s += 4;
+  nfmt_uint32_pad0_(s, 1 + tm->tm_mon, 2); s += 2;
+  nfmt_uint32_pad0_(s, tm->tm_mday, 2); s += 2;
+  *s = 'T'; ++s;
+  nfmt_uint32_pad0_(s, tm->tm_hour, 2); s += 2;
+  nfmt_uint32_pad0_(s, tm->tm_min, 2); s += 2;
+  nfmt_uint32_pad0_(s, tm->tm_sec, 2); s += 2;
+  *s = '.'; ++s;
+  nfmt_uint32_pad0_(s, (uint32_t)(t.nsec / 1000), 6); s += 6;
+  *s = '\0';
+
+  vputs(stamp);
+
+  return;
+}
+
+
+static
+void
+put_wstat(int wstat)
+{
+  char  nbuf[NFMT_SIZE];
+
+  if(WIFEXITED(wstat)){
+      vputs(" exitcode ", nfmt_uint32(nbuf, (uint32_t)WEXITSTATUS(wstat)));
+  } else if(WIFSIGNALED(wstat)){
+      vputs(" signal ", sysstr_signal(WTERMSIG(wstat)));
+  }
+
+  return;
+}
+
+
+/* put_record()
+**   output one line for journal record rec of service name
+*/
+static
+void
+put_record(const uchar_t *rec, const char *name)
+{
+  char      nbuf[NFMT_SIZE];
+  uint32_t  pid = upak32_unpack(&rec[JOURNAL_SVPID]);
+  uint32_t  arg = upak32_unpack(&rec[JOURNAL_ARG]);
+  char      cmd[2] = {'\0', '\0'};
+
+  put_stamp(&rec[JOURNAL_STAMP]);
+  vputs(" ", name, (rec[JOURNAL_WHICH] == 1) ? " log " : " main ",
+        event_word(rec[JOURNAL_EVENT]));
+  if(pid != 0){
+      vputs(" pid ", nfmt_uint32(nbuf, pid));
+  }
+
+  switch(rec[JOURNAL_EVENT]){
+  case 'x':
+  case 'h':
+      put_wstat((int)arg);
+      break;
+  case JOURNAL_CONTROL:
+      cmd[0] = (char)(arg & 0xff);
+      vputs(" command ", cmd);
+      if((arg >> 8) & SVCMD_FLAG_KILLPG){
+          vputs(" killpg");
+      }
+      break;
+  }
+  vputs("\n");
+
+  return;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  nextopt_t        nopt = nextopt_INIT(argc, argv, ":hVb:fn:");
+  char             opt;
+  const char      *basedir = NULL;
+  const char      *z;
+  int              opt_f = 0;
+  uint32_t         arg_n = 0;
+  int              got_n = 0;
+  char             pathbuf[256];
+  struct journal   J;
+  uchar_t          rec[JOURNAL_RECORD];
+  char             name[JOURNAL_NAMEMAX + 1];
+  uint64_t         head, next, lost = 0;
+  tain_t           interval = tain_INIT(0, FOLLOW_MSECS * 1000000);
+  int              polls = 0;
+  char             nbuf[NFMT_SIZE];
+
+  progname = nextopt_progname(&nopt);
+  while((opt = nextopt(&nopt))){
+      char optc[2] = {nopt.opt_got, '\0'};
+      switch(opt){
+      case 'h': usage(); die(0); break;
+      case 'V': version(); die(0); break;
+      case 'b': basedir = nopt.opt_arg; break;
+      case 'f': opt_f = 1; break;
+      case 'n':
+          z = nuscan_uint32(&arg_n, nopt.opt_arg);
+          if(*z != '\0'){
+              fatal_usage("non-numeric argument found for option -", optc, " ", nopt.opt_arg);
+          }
+          got_n = 1;
+          break;
+      case ':':
+          fatal_usage("missing argument for option -", optc);
+          break;
+      case '?':
+          if(nopt.opt_got != '?'){
+              fatal_usage("invalid option -", optc);
+          }
+          /* else fallthrough: */
+      default : die_usage(); break;
+      }
+  }
+
+  argc -= nopt.arg_ndx;
+  argv += nopt.arg_ndx;
+
+  if(!basedir)
+      basedir = getenv("PERP_BASE");
+  if(!basedir)
+      basedir = ".";
+
+  if(cstr_vlen(basedir, "/", PERP_CONTROL, "/", PERPD_JOURNAL) >= sizeof pathbuf){
+      errno = ENAMETOOLONG;
+      fatal_syserr("failure locating journal ",
+                   basedir, "/", PERP_CONTROL, "/", PERPD_JOURNAL);
+  }
+  cstr_vcopy(pathbuf, basedir, "/", PERP_CONTROL, "/", PERPD_JOURNAL);
+  if(journal_open(&J, pathbuf) == -1){
+      fatal_syserr("failure opening journal ", pathbuf);
+  }
+
+  /* oldest record in ring, or last arg_n records of the services: */
+  head = journal_head(&J);
+  next = (head > J.nrecs) ? (head - J.nrecs) : 1;
+  if(got_n){
+      uint64_t  seq = head;
+      uint32_t  n = 0;
+      while((seq > next) && (n < arg_n)){
+          --seq;
+          if(journal_read(&J, seq, rec)){
+              buf_copy(name, &rec[JOURNAL_NAME], JOURNAL_NAMEMAX);
+              name[JOURNAL_NAMEMAX] = '\0';
+              if(want_name(name, argv)) ++n;
+          }
+      }
+      next = (n < arg_n) ? next : seq;
+  }
+
+  for(;;){
+      for(; next < head; ++next){
+          if(!journal_read(&J, next, rec)){
+              ++lost;
+              continue;
+          }
+          buf_copy(name, &rec[JOURNAL_NAME], JOURNAL_NAMEMAX);
+          name[JOURNAL_NAMEMAX] = '\0';
+          if(want_name(name, argv)){
+              put_record(rec, name);
+          }
+      }
+      vputs_flush();
+
+      if(lost > 0){
+          eputs(progname, ": warning: ", nfmt_uint64(nbuf, lost),
+                " records overwritten before read");
+          lost = 0;
+      }
+
+      if(!opt_f){
+          break;
+      }
+
+      /* follow: */
+      tain_pause(&interval, NULL);
+      if(++polls == FOLLOW_RECHECK){
+          polls = 0;
+          if(journal_replaced(&J, pathbuf)){
+              journal_close(&J);
+              if(journal_open(&J, pathbuf) == -1){
+                  fatal_syserr("failure opening journal ", pathbuf);
+              }
+              next = 1;
+          }
+      }
+      head = journal_head(&J);
+      if(head - next > J.nrecs){
+          lost += (head - J.nrecs) - next;
+          next = head - J.nrecs;
+      }
+  }
+
+  die(0);
+}
+
+
+/* eof: perpjournal.c */
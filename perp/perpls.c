@@ -3,7 +3,7 @@
 ** perp 2.0: single process scanner/supervisor/controller
 ** perpls: query and list perp services
 ** (ipc client query to perpd server)
-** wcm, 2008.01.23 - 2011.01.27
+** wcm, 2008.01.23 - 2011.04.05
 ** ===
 */
 
@@ -35,6 +35,7 @@
 #include "uchar.h"
 
 #include "perp_common.h"
+#include "perp_statfile.h"
 #include "perp_stderr.h"
 
 /* redefine eputs() for ioq: */
@@ -63,7 +64,7 @@
 
 /* logging variables in scope: */
 static const char  *progname = NULL;
-static const char   prog_usage[] = "[-hV] [-b basedir] [-cGgrt] [sv ...]";
+static const char   prog_usage[] = "[-hV] [-b basedir] [-cGgrtu] [sv ...]";
 
 /* status display panel: */
 #define  PERP_PANEL  "[- --- ---]"
@@ -134,20 +135,37 @@ struct svstat {
 /* 66 bytes in status query reply: */
 #define BINSTAT_SIZE  66
     uchar_t      binstat[BINSTAT_SIZE];
+    int          binstat_ok;
+    dev_t        dev;
+    ino_t        ino;
     pid_t        pid_main;
     uint64_t     uptime_main;
     int          has_log;
     pid_t        pid_log;
     uint64_t     uptime_log;
+    /* resource usage from 'U' record (cpu usecs, maxrss kbytes): */
+    int          usage_ok;
+    uint64_t     cpu_main;
+    uint64_t     rss_main;
+    uint64_t     cpu_log;
+    uint64_t     rss_log;
     int          sys_errno;
     const char  *errmsg;
 }; 
 
 
 
+/* maximum dev/ino per 'L' list request: */
+#define LISTREQ_MAX  15
+
 /* prototypes in scope: */
 static struct svstat * svstat_init(struct svstat *svstat, const char *dir);
+static int svstat_stat(struct svstat *svstat);
 static void svstat_query(int fd_conn, struct svstat *svstat);
+static int svstat_list(int fd_conn, struct svstat **svv, size_t n, int all);
+static size_t svstat_mapped(const struct statfile *sf, struct svstat **svv, size_t n,
+                            const tain_t *now);
+static void svstat_listfail(struct svstat **svv, size_t n, int e, const char *msg);
 static void svstat_unpack(struct svstat *svstat, tain_t *now);
 static void svstat_setcap(struct svstat *svstat);
 static void svstat_free(struct svstat *svstat);
@@ -156,11 +174,13 @@ static void captab_init(const char *db);
 static const char * captab_lookup(const char *db, const char *key, size_t *attr_len);
 
 static const char *name_pad(const char *name, size_t width);
+static const char *cpu_fmt(char *s, uint64_t usecs);
 
 /* qsort comparison functions: */
 typedef int(*cmp_func_t)(const void *, const void *);
 static int cmp_byname(const void *a, const void *b);
 static int cmp_byuptime(const void *a, const void *b);
+static int cmp_bydevino(const void *a, const void *b);
 
 
 /*
@@ -212,7 +232,9 @@ svstat_init(struct svstat *svstat, const char *svdir)
   S->has_log     = 0;
   S->pid_log     = -1;
   S->uptime_log  = 0;
+  S->usage_ok    = 0;
   S->sys_errno   = EOK;
+  S->binstat_ok  = 0;
   return S;
 
 fail:
@@ -223,17 +245,19 @@ fail:
 }
 
 
-/* svstat_query()
-**   query fd_conn socket for status of svstat object sv
+/* svstat_stat()
+**   stat() service directory of svstat object
+**   sets panel[1] to 'E' (error), '-' (not active), or '+' (active)
+**   return:
+**     1: service active, dev/ino set for query
+**     0: otherwise
 */
 static
-void
-svstat_query(int fd_conn, struct svstat *S)
+int
+svstat_stat(struct svstat *S)
 {
   const char  *svdir = S->name;
   struct stat  st;
-  pkt_t        pkt = pkt_INIT(2, 'Q', 16);
-
 
   S->sys_errno = 0;
 
@@ -241,26 +265,42 @@ svstat_query(int fd_conn, struct svstat *S)
       S->panel[1] = 'E';
       S->sys_errno = errno;
       S->errmsg = "failure stat() on service directory";
-      return;
+      return 0;
   }
 
   if(! S_ISDIR(st.st_mode)){
       S->panel[1] = 'E';
       S->sys_errno = ENOTDIR;
       S->errmsg = "not a directory";
-      return;
+      return 0;
   }
 
   if(! (st.st_mode & S_ISVTX)){
       /* sticky bit not set; service not activated: */
       S->panel[1] = '-';
-      return;
+      return 0;
   }
 
   /* service considered "active" if sticky bit set: */
   S->panel[1] = '+';
+  S->dev = st.st_dev;
+  S->ino = st.st_ino;
+
+  return 1;
+}
+
+
+/* svstat_query()
+**   query fd_conn socket for status of (active) svstat object sv
+**   (single 'Q' query, for perpd not supporting 'L')
+*/
+static
+void
+svstat_query(int fd_conn, struct svstat *S)
+{
+  pkt_t        pkt = pkt_INIT(2, 'Q', 16);
 
-  upak_pack(pkt_data(pkt), "LL", (uint64_t)st.st_dev, (uint64_t)st.st_ino);
+  upak_pack(pkt_data(pkt), "LL", (uint64_t)S->dev, (uint64_t)S->ino);
 
   if(pkt_write(fd_conn, pkt, 0) == -1){
       S->panel[1] = 'E';
@@ -301,6 +341,198 @@ svstat_query(int fd_conn, struct svstat *S)
 }
 
 
+/* svstat_listfail()
+**   set error on the n svstat objects in svv still waiting for status
+*/
+static
+void
+svstat_listfail(struct svstat **svv, size_t n, int e, const char *msg)
+{
+  size_t  i;
+
+  for(i = 0; i < n; ++i){
+      if(svv[i]->panel[1] == '+'){
+          svv[i]->panel[1] = 'E';
+          svv[i]->sys_errno = e;
+          svv[i]->errmsg = msg;
+      }
+  }
+
+  return;
+}
+
+
+/* svstat_list()
+**   query fd_conn socket with 'L' for status of n active svstat objects
+**   in svv[] (sorted by dev/ino): all active services in one request if
+**   all is set, else for each dev/ino of svv[] in requests of LISTREQ_MAX
+**
+**   status from each 'R' record in the reply is saved in the svstat
+**   objects matching the dev/ino of the record, as is resource usage
+**   from each 'U' record; an svstat object without status at the end
+**   is set with error
+**
+**   return:
+**     0: success (any error set in svstat objects)
+**    -1: 'L' request not supported by perpd
+*/
+static
+int
+svstat_list(int fd_conn, struct svstat **svv, size_t n, int all)
+{
+  pkt_t           pkt;
+  uchar_t         ibuf[4096];
+  ioq_t           in = ioq_INIT(fd_conn, ibuf, sizeof ibuf, &read);
+  struct svstat   key, *keyp = &key;
+  struct svstat **hit;
+  uchar_t        *data;
+  size_t          next = 0, nreq, k, ns;
+  ssize_t         r;
+  int             first = 1;
+
+  while(all || (next < n)){
+      /* request: */
+      nreq = 0;
+      if(!all){
+          nreq = n - next;
+          if(nreq > LISTREQ_MAX) nreq = LISTREQ_MAX;
+          for(k = 0; k < nreq; ++k){
+              upak_pack(pkt_data(pkt) + (k * 16), "LL",
+                        (uint64_t)svv[next + k]->dev,
+                        (uint64_t)svv[next + k]->ino);
+          }
+          next += nreq;
+      }
+      pkt_init(pkt, 2, 'L', nreq * 16);
+      if(pkt_write(fd_conn, pkt, 0) == -1){
+          svstat_listfail(svv, n, errno, "failure pkt_write() during status query");
+          return 0;
+      }
+
+      /* reply, 'R' records until 'E' terminal: */
+      for(;;){
+          if((r = pkt_ioqget(&in, pkt)) <= 0){
+              svstat_listfail(svv, n, (r == 0) ? EPROTO : errno,
+                              "failure pkt_read() during status query");
+              return 0;
+          }
+          if(pkt[0] != 2){
+              svstat_listfail(svv, n, EPROTO, "unknown packet protocol in status reply");
+              return 0;
+          }
+          if(pkt[1] == 'E'){
+              errno = (int)upak32_unpack(pkt_data(pkt));
+              if(errno == 0) break;
+              if(first && (errno == EPROTO)){
+                  /* perpd without 'L' support: */
+                  return -1;
+              }
+              svstat_listfail(svv, n, errno, "error reported in status reply");
+              return 0;
+          }
+          first = 0;
+          if((pkt[1] != 'R') && (pkt[1] != 'U')){
+              svstat_listfail(svv, n, EPROTO, "unknown packet type in status reply");
+              return 0;
+          }
+          /* record without status: service not found by perpd */
+          data = pkt_data(pkt);
+          if(pkt_dlen(pkt) < 17) continue;
+          ns = data[16];
+          if(pkt[1] == 'U'){
+              /* resource usage of main and log: */
+              if((ns < 96) || (pkt_dlen(pkt) < 17 + ns)) continue;
+          }else{
+              if(ns > BINSTAT_SIZE) ns = BINSTAT_SIZE;
+              if(ns < 66) continue;
+          }
+
+          /* save status in each svstat matching dev/ino: */
+          key.dev = (dev_t)upak64_unpack(&data[0]);
+          key.ino = (ino_t)upak64_unpack(&data[8]);
+          hit = (struct svstat **)bsearch(&keyp, svv, n, sizeof(struct svstat *),
+                                          &cmp_bydevino);
+          if(hit == NULL) continue;
+          while((hit > svv) && (cmp_bydevino(hit - 1, &keyp) == 0)) --hit;
+          while((hit < &svv[n]) && (cmp_bydevino(hit, &keyp) == 0)){
+              if(pkt[1] == 'U'){
+                  (*hit)->cpu_main = upak64_unpack(&data[17]) + upak64_unpack(&data[25]);
+                  (*hit)->rss_main = upak64_unpack(&data[33]);
+                  (*hit)->cpu_log = upak64_unpack(&data[65]) + upak64_unpack(&data[73]);
+                  (*hit)->rss_log = upak64_unpack(&data[81]);
+                  (*hit)->usage_ok = 1;
+              }else{
+                  buf_copy((*hit)->binstat, &data[17], ns);
+                  (*hit)->binstat_ok = 1;
+              }
+              ++hit;
+          }
+      }
+      if(all) break;
+  }
+
+  /* active svstat without status from perpd: */
+  for(k = 0; k < n; ++k){
+      if(!svv[k]->binstat_ok){
+          svv[k]->panel[1] = 'E';
+          svv[k]->sys_errno = ENOTDIR;
+          svv[k]->errmsg = "error reported in status reply";
+      }
+  }
+
+  return 0;
+}
+
+
+/* svstat_mapped()
+**   read status of n active svstat objects in svv[] (sorted by dev/ino)
+**   from the status file of perpd mapped in sf, without a request to perpd
+**
+**   svstat objects left without status (eg, a service activated since the
+**   status file was mapped, or a record busy through each retry) are
+**   moved to the front of svv[], in order, for query on the socket
+**
+**   return: number of svstat objects without status
+*/
+static
+size_t
+svstat_mapped(const struct statfile *sf, struct svstat **svv, size_t n,
+              const tain_t *now)
+{
+  struct statrec   rec;
+  struct svstat    key, *keyp = &key;
+  struct svstat  **hit;
+  size_t           slot, i, k;
+
+  for(slot = 0; slot < sf->nslots; ++slot){
+      if(statfile_read(sf, slot, &rec, now) != 1) continue;
+      if(rec.nstatus < BINSTAT_SIZE) continue;
+
+      /* save status in each svstat matching dev/ino: */
+      key.dev = (dev_t)rec.dev;
+      key.ino = (ino_t)rec.ino;
+      hit = (struct svstat **)bsearch(&keyp, svv, n, sizeof(struct svstat *),
+                                      &cmp_bydevino);
+      if(hit == NULL) continue;
+      while((hit > svv) && (cmp_bydevino(hit - 1, &keyp) == 0)) --hit;
+      while((hit < &svv[n]) && (cmp_bydevino(hit, &keyp) == 0)){
+          buf_copy((*hit)->binstat, rec.status, BINSTAT_SIZE);
+          (*hit)->binstat_ok = 1;
+          ++hit;
+      }
+  }
+
+  /* collect svstat without status: */
+  for(i = 0, k = 0; i < n; ++i){
+      if(!svv[i]->binstat_ok){
+          svv[k++] = svv[i];
+      }
+  }
+
+  return k;
+}
+
+
 /* svstat_unpack()
 **   unpack S->binstat and interpret service status into panel
 **   compute uptimes compared to now
@@ -314,6 +546,7 @@ svstat_unpack(struct svstat *S, tain_t *now)
   tain_t    when;
   uint64_t  uptime;
   int       flags;
+  int       queued;
 
   /* already flagged error/inactive in svstat_query(): */
   if((S->panel[1] == 'E') || (S->panel[1] == '-')) return;
@@ -327,6 +560,8 @@ svstat_unpack(struct svstat *S, tain_t *now)
   }
   /* log? */
   S->has_log = (flags & SVDEF_FLAG_HASLOG) ? 1 : 0;
+  /* waiting in start queue? */
+  queued = (flags & SVDEF_FLAG_QUEUED) ? 1 : 0;
 
   /* main: */
   S->pid_main = pid = upak32_unpack(&buf[30]);
@@ -340,6 +575,18 @@ svstat_unpack(struct svstat *S, tain_t *now)
       ((pid != 0) && (flags & SUBSV_FLAG_WANTDOWN)) ){
       S->panel[3] = '!';
   }
+  if((pid == 0) && (flags & SUBSV_FLAG_DELAYED)){
+      /* start held by respawn governor: */
+      S->panel[5] = 'w';
+  }
+  if((pid == 0) && (flags & SUBSV_FLAG_QUARANTINE)){
+      /* restarts stopped by crash-loop detection: */
+      S->panel[5] = 'q';
+  }
+  if((pid == 0) && queued){
+      /* first start held in start queue: */
+      S->panel[5] = 's';
+  }
   if(pid > 0){
       if(flags & SUBSV_FLAG_ISONCE) S->panel[4] = 'o';
       if(flags & SUBSV_FLAG_ISPAUSED) S->panel[5] = 'p';
@@ -368,6 +615,18 @@ svstat_unpack(struct svstat *S, tain_t *now)
       ((pid != 0) && (flags & SUBSV_FLAG_WANTDOWN)) ){
       S->panel[7] = '!';
   }
+  if((pid == 0) && (flags & SUBSV_FLAG_DELAYED)){
+      /* start held by respawn governor: */
+      S->panel[9] = 'w';
+  }
+  if((pid == 0) && (flags & SUBSV_FLAG_QUARANTINE)){
+      /* restarts stopped by crash-loop detection: */
+      S->panel[9] = 'q';
+  }
+  if((pid == 0) && queued){
+      /* first start held in start queue: */
+      S->panel[9] = 's';
+  }
   if(pid > 0){
       if(flags & SUBSV_FLAG_ISONCE) S->panel[8] = 'o';
       if(flags & SUBSV_FLAG_ISPAUSED) S->panel[9] = 'p';
@@ -611,6 +870,42 @@ cmp_byuptime(const void *a, const void *b)
 }
 
 
+static
+int
+cmp_bydevino(const void *a, const void *b)
+{
+    /* fun with pointers: */
+    struct svstat *sv1 = *(struct svstat **)a;
+    struct svstat *sv2 = *(struct svstat **)b;
+
+    if(sv1->dev != sv2->dev)
+        return (sv1->dev < sv2->dev) ? -1 : 1;
+
+    if(sv1->ino != sv2->ino)
+        return (sv1->ino < sv2->ino) ? -1 : 1;
+
+    return 0;
+}
+
+
+/* cpu_fmt()
+**   format cpu usecs into s as seconds, to 2 decimals
+**   s is at least NFMT_SIZE
+*/
+static
+const char *
+cpu_fmt(char *s, uint64_t usecs)
+{
+    size_t  n;
+
+    n = nfmt_uint64_(s, usecs / 1000000);
+    s[n++] = '.';
+    nfmt_uint32_pad0(&s[n], (uint32_t)((usecs % 1000000) / 10000), 2);
+
+    return (const char *)s;
+}
+
+
 /* name_pad()
 **   right pad "name" with whitespace upto width
 **   note: return is pointer to internal static buffer
@@ -644,11 +939,12 @@ name_pad(const char *name, size_t width)
 int
 main(int argc, char *argv[])
 {
-  nextopt_t        nopt = nextopt_INIT(argc, argv, ":hVb:cGgKrt");
+  nextopt_t        nopt = nextopt_INIT(argc, argv, ":hVb:cGgKrtu");
   char             opt;
   int              opt_G = 0; /* explicit want colorized */
   int              opt_K = 0; /* undocumented show color */
   int              opt_r = 0; /* reverse display order */
+  int              opt_u = 0; /* show resource usage */
   int              use_color = 1;
   const char      *basedir = NULL;
   struct dynstuf  *svstuf = NULL;
@@ -659,6 +955,11 @@ main(int argc, char *argv[])
   size_t           n;
   tain_t           now;
   int              fd_conn;
+  struct svstat  **svv;
+  size_t           nactive;
+  struct statfile  sf;
+  int              need_conn = 1;
+  int              list_all = 0;
   size_t           i, width = 0;
 
   progname = nextopt_progname(&nopt);
@@ -674,6 +975,7 @@ main(int argc, char *argv[])
       case 'K': opt_K = 1; break;
       case 'r': opt_r = 1; break;
       case 't': sort_by = &cmp_byuptime; break;
+      case 'u': opt_u = 1; break;
       case ':':
           fatal_usage("missing argument for option -", optc);
           break;
@@ -795,42 +1097,79 @@ main(int argc, char *argv[])
       /* sort directory list by name: */
       if(sort_by == NULL)
           sort_by = &cmp_byname;
-  }
 
-  /* connect to control socket: */
-  n = cstr_vlen(basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
-  if(!(n < sizeof pathbuf)){
-      errno = ENAMETOOLONG;
-      fatal_syserr("failure locating perpd control socket ",
-                   basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
-  }
-  cstr_vcopy(pathbuf, basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
-  fd_conn = domsock_connect(pathbuf);
-  if(fd_conn == -1){
-      if(errno == ECONNREFUSED){
-          fatal_syserr("perpd not running on control socket ", pathbuf);
-      } else {
-          fatal_syserr("failure connecting to perpd control socket ", pathbuf);
-      }
+      /* query status of all services: */
+      list_all = 1;
   }
 
   /* uptimes compared to now: */
   tain_now(&now);
 
   /* svstat_fill()
-  **   query status from perpd socket for each svstat object
+  **   stat() each svstat object, collect active objects in svv[]
+  **   query status of active objects from perpd socket
   **   scan/update for longest name
   */
+  svv = (struct svstat **)malloc((dynstuf_ITEMS(svstuf) + 1) * sizeof(struct svstat *));
+  if(svv == NULL){
+      fatal(111, "allocation failure");
+  }
+  nactive = 0;
   for(i = 0; i < dynstuf_ITEMS(svstuf); ++i){
       size_t  w;
       svstat = (struct svstat *)dynstuf_get(svstuf, i);
-      svstat_query(fd_conn, svstat);
+      if(svstat_stat(svstat)){
+          svv[nactive++] = svstat;
+      }
       w = cstr_len(svstat->name);
       if(w > width) width = w; 
   }  
+  qsort(svv, nactive, sizeof(struct svstat *), &cmp_bydevino);
+
+  /* status from status file of perpd when published
+  ** (resource usage only by query on the socket):
+  */
+  if(!opt_u && (nactive > 0) && (statfile_open(&sf, basedir) == 0)){
+      n = svstat_mapped(&sf, svv, nactive, &now);
+      statfile_close(&sf);
+      if(n < nactive){
+          /* query only the rest, by dev/ino: */
+          nactive = n;
+          list_all = 0;
+      }
+      need_conn = (nactive > 0);
+  }
+
+  if(need_conn){
+      /* connect to control socket: */
+      n = cstr_vlen(basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
+      if(!(n < sizeof pathbuf)){
+          errno = ENAMETOOLONG;
+          fatal_syserr("failure locating perpd control socket ",
+                       basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
+      }
+      cstr_vcopy(pathbuf, basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
+      fd_conn = domsock_connect(pathbuf);
+      if(fd_conn == -1){
+          if(errno == ECONNREFUSED){
+              fatal_syserr("perpd not running on control socket ", pathbuf);
+          } else {
+              fatal_syserr("failure connecting to perpd control socket ", pathbuf);
+          }
+      }
 
-  /* close fd_conn (ignore error): */
-  close(fd_conn);
+      /* query all active services when listing basedir: */
+      if((nactive > 0) && (svstat_list(fd_conn, svv, nactive, list_all) == -1)){
+          /* perpd without 'L', query each service: */
+          for(i = 0; i < nactive; ++i){
+              svstat_query(fd_conn, svv[i]);
+          }
+      }
+
+      /* close fd_conn (ignore error): */
+      close(fd_conn);
+  }
+  free(svv);
 
   /* apply sort: */
   if(sort_by != NULL){
@@ -849,6 +1188,8 @@ main(int argc, char *argv[])
       char        *attr = NULL;
       char         up_main[NFMT_SIZE], pid_main[NFMT_SIZE];
       char         up_log[NFMT_SIZE], pid_log[NFMT_SIZE];
+      char         cpu_main[NFMT_SIZE], rss_main[NFMT_SIZE];
+      char         cpu_log[NFMT_SIZE], rss_log[NFMT_SIZE];
 
       svstat = dynstuf_get(svstuf, i);
       svstat_unpack(svstat, &now);
@@ -891,6 +1232,18 @@ main(int argc, char *argv[])
                ((panel[8] == '+') || (panel[8] == 'o'))
                    ? nfmt_uint32(pid_log, svstat->pid_log)
                    : "-");
+          if(opt_u && svstat->usage_ok){
+              vputs("  cpu: ",
+                    cpu_fmt(cpu_main, svstat->cpu_main),
+                    "s/",
+                    svstat->has_log ? cpu_fmt(cpu_log, svstat->cpu_log) : "-",
+                    "s",
+                    "  maxrss: ",
+                    nfmt_uint64(rss_main, svstat->rss_main),
+                    "k/",
+                    svstat->has_log ? nfmt_uint64(rss_log, svstat->rss_log) : "-",
+                    "k");
+          }
           break;
       case '-':
           vputs("  (service not activated)");
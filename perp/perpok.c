@@ -3,7 +3,7 @@
 ** perp 2.0: single process scanner/supervisor/controller
 ** perpok: query and return service "ok"
 ** (ipc client query to perpd server)
-** wcm, 2009.11.09 - 2011.01.27
+** wcm, 2009.11.09 - 2011.04.05
 ** ===
 */
 
@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -34,11 +35,12 @@
 #include "uchar.h"
 
 #include "perp_common.h"
+#include "perp_statfile.h"
 #include "perp_stderr.h"
 
 
 static const char *progname = NULL;
-static const char prog_usage[] = "[-hV] [-b basedir] [-u secs] [-v] sv";
+static const char prog_usage[] = "[-hV] [-b basedir] [-r] [-u secs] [-w secs] [-v] sv";
 
 
 #define  report_fail(...) \
@@ -58,27 +60,311 @@ static const char prog_usage[] = "[-hV] [-b basedir] [-u secs] [-v] sv";
   }
 
 
+/* options/args: */
+static int         verbose = 0;
+static int         opt_ready = 0;
+static uint32_t    arg_upsecs = 0;
+static uint32_t    arg_waitsecs = 0;
+static const char *svdir = NULL;
+/* path to perpd control socket: */
+static char        pathbuf[256];
+/* query by name, and dev/ino of service from last query: */
+static int         use_name = 0;
+static uchar_t     devino[16];
+/* status file of perpd (if published): */
+static struct statfile  sf;
+
+
+static int connect_perpd(void);
+static const uchar_t * query_mapped(pkt_t pkt, size_t *len);
+static const uchar_t * query(pkt_t pkt, size_t *len);
+static const char * check(const uchar_t *status, size_t len, const tain_t *now,
+                          uint32_t *due);
+static int subscribe(void);
+
+
+/* connect_perpd()
+**   connect to perpd control socket
+**   return connected socket (no return on failure)
+*/
+static
+int
+connect_perpd(void)
+{
+  int  fd_conn;
+
+  fd_conn = domsock_connect(pathbuf);
+  if(fd_conn == -1){
+      if(errno == ECONNREFUSED){
+          fatal_syserr("perpd not running on control socket ", pathbuf);
+      } else {
+          fatal_syserr("failure connecting to perpd control socket ", pathbuf);
+      }
+  }
+
+  return fd_conn;
+}
+
+
+/* query_mapped()
+**   find status of svdir in status file of perpd, without request to perpd
+**   a service in deactivation is passed over (for its replacement by name)
+**   return:
+**     status copied into pkt, with length of status in len
+**     NULL: not found in status file (for query on the socket)
+*/
+static
+const uchar_t *
+query_mapped(pkt_t pkt, size_t *len)
+{
+  struct statrec  rec;
+  struct stat     st;
+  tain_t          now;
+  size_t          slot;
+
+  if(sf.map == NULL){
+      return NULL;
+  }
+  if(!use_name && (stat(svdir, &st) == -1)){
+      return NULL;
+  }
+
+  tain_now(&now);
+  for(slot = 0; slot < sf.nslots; ++slot){
+      if(statfile_read(&sf, slot, &rec, &now) != 1) continue;
+      if(use_name){
+          if(cstr_cmp(rec.name, svdir) != 0) continue;
+      } else {
+          if((rec.dev != (uint64_t)st.st_dev) || (rec.ino != (uint64_t)st.st_ino)) continue;
+      }
+      if((rec.nstatus < 66) || (rec.status[28] & SVDEF_FLAG_CULL)) continue;
+
+      upak_pack(devino, "LL", rec.dev, rec.ino);
+      buf_copy(pkt_data(pkt), rec.status, rec.nstatus);
+      *len = rec.nstatus;
+      return pkt_data(pkt);
+  }
+
+  return NULL;
+}
+
+
+/* query()
+**   query perpd for status of svdir, reply in pkt
+**   status is taken from the status file of perpd when found there
+**   return:
+**     status in pkt, with length of status in len
+**     (no return on failure, or if service not activated)
+*/
+static
+const uchar_t *
+query(pkt_t pkt, size_t *len)
+{
+  const uchar_t  *status = NULL;
+  struct stat     st;
+  int             fd_conn;
+  int             e;
+
+  if((status = query_mapped(pkt, len)) != NULL){
+      return status;
+  }
+
+  fd_conn = connect_perpd();
+
+  /* status query by name (perp-2.05), replied with status record: */
+  if(use_name){
+      pkt_load(pkt, 2, 'q', (uchar_t *)svdir, cstr_len(svdir));
+
+      if(pkt_write(fd_conn, pkt, 0) == -1){
+          fatal_syserr("failure pkt_write() to perpd control socket");
+      }
+      if(pkt_read(fd_conn, pkt, 0) == -1){
+          fatal_syserr("failure pkt_read() from perpd control socket");
+      }
+      if(pkt[0] != 2){
+          fatal(111, "unknown protocol found in reply from perpd control socket");
+      }
+
+      if((pkt[1] == 'R') && (pkt_dlen(pkt) >= 17) && (pkt[PKT_HEADER + 16] >= 66)){
+          buf_copy(devino, &pkt[PKT_HEADER], 16);
+          *len = pkt[PKT_HEADER + 16];
+          status = &pkt[PKT_HEADER + 17];
+      } else if(pkt[1] == 'E'){
+          e = (int)upak32_unpack(&pkt[3]);
+          if(e == ENOTDIR){
+              report_fail("service ", svdir, " not activated");
+          }
+          if(e != EPROTO){
+              errno = e;
+              fatal_syserr("error reported in reply from perpd control socket");
+          }
+          /* else EPROTO, perpd without named requests: */
+          use_name = 0;
+      } else {
+          fatal(111, "unknown packet reply type from perpd control socket");
+      }
+  }
+
+  /* else status query by dev/ino: */
+  if(status == NULL){
+      if(stat(svdir, &st) == -1){
+          fatal_syserr("failure stat() on service directory ", svdir);
+      }
+
+      if(! S_ISDIR(st.st_mode)){
+          fatal_usage("argument not a directory: ", svdir);
+      }
+
+      if(!(S_ISVTX & st.st_mode)){
+          report_fail("service directory ", svdir, " not activated");
+      }
+
+      /* status query packet: */ 
+      pkt_init(pkt, 2, 'Q', 16);
+      upak_pack(pkt_data(pkt), "LL", (uint64_t)st.st_dev, (uint64_t)st.st_ino);
+      buf_copy(devino, pkt_data(pkt), 16);
+
+      if(pkt_write(fd_conn, pkt, 0) == -1){
+          fatal_syserr("failure pkt_write() to perpd control socket");
+      }
+
+      if(pkt_read(fd_conn, pkt, 0) == -1){
+          fatal_syserr("failure pkt_read() from perpd control socket");
+      }
+
+      if(pkt[0] != 2){
+          fatal(111, "unknown protocol found in reply from perpd control socket");
+      }
+      if(pkt[1] != 'S'){
+          if(pkt[1] == 'E'){
+              errno = (int)upak32_unpack(&pkt[3]);
+              fatal_syserr("error reported in reply from perpd control socket");
+          } else {
+              fatal(111, "unknown packet reply type from perpd control socket");
+          }
+      }
+      *len = pkt_dlen(pkt);
+      status = pkt_data(pkt);
+  }
+
+  /* done with connection: */
+  close(fd_conn);
+
+  return status;
+}
+
+
+/* check()
+**   check status of service at time now for options -r, -u
+**   return:
+**     NULL: service ok
+**     otherwise: reason service not ok
+**   with secs of uptime still to run for -u in due (else 0)
+*/
+static
+const char *
+check(const uchar_t *status, size_t len, const tain_t *now, uint32_t *due)
+{
+  pid_t     pid_main;
+  tain_t    when_main;
+  uint64_t  uptime_main;
+  uchar_t   flags;
+  uchar_t   ready;
+
+  *due = 0;
+
+  if((arg_upsecs == 0) && !opt_ready){
+  /* basic test complete: */
+      return NULL;
+  }
+
+  /* else continue extended testing... */
+
+  pid_main = upak32_unpack(&status[30]);
+  if(!(pid_main > 0)){
+      return "service not running (pid is 0)";
+  }
+
+  flags = status[46];
+  if(flags & SUBSV_FLAG_ISRESET){
+      return "service is resetting";
+  }
+  if(flags & SUBSV_FLAG_WANTDOWN){
+      return "service wants down";
+  }
+
+  /* readiness (perp-2.05), if service with readiness notification: */
+  if(opt_ready){
+      ready = (len >= 92) ? status[29] : 0;
+      if((ready & READY_FLAG_NOTIFY) && !(ready & READY_FLAG_READY)){
+          return "service not ready";
+      }
+  }
+
+  tain_unpack(&when_main, &status[34]);
+  uptime_main = tain_uptime(now, &when_main);
+  if(uptime_main < (uint64_t)arg_upsecs){
+      *due = arg_upsecs - (uint32_t)uptime_main;
+      return "service uptime not met";
+  }
+
+  /* okie dokie! */
+  return NULL;
+}
+
+
+/* subscribe()
+**   subscribe to events of service with devino from last query
+**   return:
+**     >=0: subscribed connection
+**      -1: perpd without subscriptions (before perp-2.05)
+*/
+static
+int
+subscribe(void)
+{
+  pkt_t  pkt;
+  int    fd_sub;
+
+  fd_sub = connect_perpd();
+
+  pkt_load(pkt, 2, 'W', devino, 16);
+  if(pkt_write(fd_sub, pkt, 0) == -1){
+      fatal_syserr("failure pkt_write() to perpd control socket");
+  }
+  if(pkt_read(fd_sub, pkt, 0) == -1){
+      fatal_syserr("failure pkt_read() from perpd control socket");
+  }
+  if((pkt[0] != 2) || (pkt[1] != 'E') || (pkt_dlen(pkt) < 4)){
+      fatal(111, "unknown packet reply type from perpd control socket");
+  }
+  if(upak32_unpack(&pkt[3]) != 0){
+      /* perpd without subscriptions: */
+      close(fd_sub);
+      return -1;
+  }
+
+  return fd_sub;
+}
+
+
 int
 main(int argc, char *argv[])
 {
-  nextopt_t       nopt = nextopt_INIT(argc, argv, ":hVb:u:v");
+  nextopt_t       nopt = nextopt_INIT(argc, argv, ":hVb:ru:vw:");
   char            opt;
-  int             verbose = 0;
   const char     *basedir = NULL;
-  uint32_t        arg_upsecs = 0;
   const char     *z;
-  const char     *svdir = NULL;
-  struct stat     st;
-  char            pathbuf[256];
   size_t          n;
-  int             fd_conn;
-  pkt_t           pkt = pkt_INIT(2, 'Q', 16);
-  uchar_t        *status = pkt_data(pkt);
-  pid_t           pid_main;
-  tain_t          when_main;
-  uint64_t        uptime_main;
-  uchar_t         flags;
-  tain_t          now;
+  pkt_t           pkt;
+  const uchar_t  *status;
+  size_t          len;
+  const char     *mesg;
+  int             fd_sub;
+  struct pollfd   pfd;
+  uint32_t        due;
+  uint64_t        msecs, m;
+  tain_t          now, deadline, diff;
 
   progname = nextopt_progname(&nopt);
   while((opt = nextopt(&nopt))){
@@ -87,6 +373,7 @@ main(int argc, char *argv[])
       case 'h': usage(); die(0); break;
       case 'V': version(); die(0); break;
       case 'b': basedir = nopt.opt_arg; break;
+      case 'r': ++opt_ready; break;
       case 'u':
           z = nuscan_uint32(&arg_upsecs, nopt.opt_arg);
           if(*z != '\0'){
@@ -94,6 +381,12 @@ main(int argc, char *argv[])
           }
           break;
       case 'v': ++verbose; break;
+      case 'w':
+          z = nuscan_uint32(&arg_waitsecs, nopt.opt_arg);
+          if(*z != '\0'){
+              fatal_usage("non-numeric argument found for option -", optc, " ", nopt.opt_arg);
+          }
+          break;
       case ':':
           fatal_usage("missing argument for option -", optc);
           break;
@@ -124,19 +417,7 @@ main(int argc, char *argv[])
       fatal_syserr("failure chdir() to ", basedir);
   }
 
-  if(stat(svdir, &st) == -1){
-      fatal_syserr("failure stat() on service directory ", svdir);
-  }
-
-  if(! S_ISDIR(st.st_mode)){
-      fatal_usage("argument not a directory: ", svdir);
-  }
-
-  if(!(S_ISVTX & st.st_mode)){
-      report_fail("service directory ", svdir, " not activated");
-  }
-
-  /* connect to control socket: */
+  /* control socket: */
   n = cstr_vlen(basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
   if(!(n < sizeof pathbuf)){
       errno = ENAMETOOLONG;
@@ -144,72 +425,71 @@ main(int argc, char *argv[])
                    basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
   }
   cstr_vcopy(pathbuf, basedir, "/", PERP_CONTROL, "/", PERPD_SOCKET);
-  fd_conn = domsock_connect(pathbuf);
-  if(fd_conn == -1){
-      if(errno == ECONNREFUSED){
-          fatal_syserr("perpd not running on control socket ", pathbuf);
-      } else {
-          fatal_syserr("failure connecting to perpd control socket ", pathbuf);
-      }
-  }
 
-  /* uptime compared to now: */
-  tain_now(&now);
-
-  /* status query packet: */ 
-  upak_pack(pkt_data(pkt), "LL", (uint64_t)st.st_dev, (uint64_t)st.st_ino);
-
-  if(pkt_write(fd_conn, pkt, 0) == -1){
-      fatal_syserr("failure pkt_write() to perpd control socket");
-  }
+  use_name = perp_svname_ok(svdir);
 
-  if(pkt_read(fd_conn, pkt, 0) == -1){
-      fatal_syserr("failure pkt_read() from perpd control socket");
+  /* status file (else query on the socket): */
+  if(statfile_open(&sf, basedir) == -1){
+      sf.map = NULL;
   }
 
-  /* done with connection: */
-  close(fd_conn);
-
-  if(pkt[0] != 2){
-      fatal(111, "unknown protocol found in reply from perpd control socket");
-  }
-  if(pkt[1] != 'S'){
-      if(pkt[1] == 'E'){
-          errno = (int)upak32_unpack(&pkt[3]);
-          fatal_syserr("error reported in reply from perpd control socket");
-      } else {
-          fatal(111, "unknown packet reply type from perpd control socket");
+  /* uptime compared to now: */
+  tain_now(&now);
+  status = query(pkt, &len);
+  mesg = check(status, len, &now, &due);
+
+  if((mesg != NULL) && (arg_waitsecs > 0)){
+      /* wait for service ok, woken by events of the service: */
+      tain_LOAD(&deadline, arg_waitsecs, 0);
+      tain_plus(&deadline, &now, &deadline);
+      fd_sub = subscribe();
+      for(;;){
+          /* (re)query after subscribing, missing no change: */
+          tain_now(&now);
+          status = query(pkt, &len);
+          mesg = check(status, len, &now, &due);
+          if(mesg == NULL){
+              break;
+          }
+          if(!tain_less(&now, &deadline)){
+              report_fail(mesg, " (wait timed out)");
+          }
+          tain_minus(&diff, &deadline, &now);
+          msecs = tain_to_msecs(&diff) + 1;
+          m = (uint64_t)due * 1000;
+          if((due > 0) && (m < msecs)) msecs = m;
+          /* perpd without subscriptions, check each second: */
+          if((fd_sub == -1) && (msecs > 1000)) msecs = 1000;
+
+          pfd.fd = fd_sub;
+          pfd.events = POLLIN;
+          if(poll(&pfd, (fd_sub == -1) ? 0 : 1, (int)msecs) == -1){
+              if(errno == EINTR) continue;
+              fatal_syserr("failure poll() on perpd control socket");
+          }
+          if((fd_sub != -1) && (pfd.revents != 0)){
+              /* event (contents unused), or perpd gone: */
+              if(pkt_read(fd_sub, pkt, 0) == -1){
+                  close(fd_sub);
+                  fd_sub = -1;
+                  /* status file of any new perpd: */
+                  statfile_close(&sf);
+                  if(statfile_open(&sf, basedir) == -1){
+                      sf.map = NULL;
+                  }
+              }
+          }
       }
   }
 
-  if(arg_upsecs == 0){
-  /* basic test complete: */
-      report_ok("service is activated/ok");
-  }
-
-  /* else continue extended testing... */
-
-  pid_main = upak32_unpack(&status[30]);
-  if(!(pid_main > 0)){
-      report_fail("service not running (pid is 0)");
-  }
-
-  flags = status[46];
-  if(flags & SUBSV_FLAG_ISRESET){
-      report_fail("service is resetting");
-  }
-  if(flags & SUBSV_FLAG_WANTDOWN){
-      report_fail("service wants down");
+  if(mesg != NULL){
+      report_fail(mesg);
   }
 
-  tain_unpack(&when_main, &status[34]);
-  uptime_main = tain_uptime(&now, &when_main);
-  if(uptime_main < (uint64_t)arg_upsecs){
-      report_fail("service uptime not met");
+  if((arg_upsecs == 0) && !opt_ready){
+      report_ok("service is activated/ok");
   }
-
-  /* okie dokie! */
-  report_ok("service uptime ok");
+  report_ok(opt_ready ? "service ready/ok" : "service uptime ok");
 
   /* not reached: */
   die(0);
@@ -3,7 +3,7 @@
 ** perp 2.0: single process scanner/supervisor/controller
 ** perpstat: query and report current service status
 ** (ipc client query to perpd server)
-** wcm, 2008.01.23 - 2011.01.27
+** wcm, 2008.01.23 - 2011.04.05
 ** ===
 */
 
@@ -58,17 +58,49 @@
 
 /* logging variables in scope: */
 static const char  *progname = NULL;
-static const char   prog_usage[] = "[-hV] [-b basedir]";
-
-
+static const char   prog_usage[] = "[-hV] [-b basedir] [-m] [sv ...]";
+
+/* maximum dev/ino per 'L' list request: */
+#define LISTREQ_MAX  15
+
+/* metrics records collected from 'M' replies: */
+struct metrics {
+  pkt_t   *v;
+  size_t   n;
+  size_t   slots;
+};
+
+static void report(const char *name, const uchar_t *status, size_t len,
+                   const uchar_t *usage, const tain_t *now);
+static void put_usage(const uchar_t *ru);
+static int query_list(int fd_conn, ioq_t *in, const uchar_t *devino, size_t n,
+                      pkt_t *replyv, pkt_t *usagev);
+static int query_one(int fd_conn, const uchar_t *devino, pkt_t pkt);
+static void print_reply(const char *name, pkt_t pkt, pkt_t usage, const tain_t *now);
+static int query_metrics(int fd_conn, ioq_t *in, const uchar_t *devino, size_t n,
+                         const char **namev, struct metrics *mv);
+static void put_labels(pkt_t rec, const char *le);
+static void put_msecs(uint64_t msecs);
+static void put_hist(struct metrics *mv, const char *family, int is_reset);
+static void print_metrics(struct metrics *mv);
+static void do_metrics(int fd_conn, ioq_t *in, char *argv[]);
+
+
+/* report()
+**   display status of service name, with resource usage (or NULL)
+*/
 static
 void
-report(const char *name, const uchar_t *status, const tain_t *now)
+report(const char *name, const uchar_t *status, size_t len,
+       const uchar_t *usage, const tain_t *now)
 {
   pid_t    pid;
   tain_t   when;
   uint64_t uptime;
+  uint32_t delay;
+  uint32_t nfail;
   uchar_t  flags;
+  uchar_t  ready;
   int      haslog;
   char     nbuf[NFMT_SIZE];
 
@@ -86,19 +118,35 @@ report(const char *name, const uchar_t *status, const tain_t *now)
   if(flags & SVDEF_FLAG_CYCLE){
       vputs(", flagged for reactivation");
   }
+  if(flags & SVDEF_FLAG_QUEUED){
+      vputs(", waiting in start queue");
+  }
+  if(flags & SVDEF_FLAG_STARTING){
+      vputs(", starting");
+  }
   vputs("\n");
 
   /* main: */
   pid = upak32_unpack(&status[30]); 
   tain_unpack(&when, &status[34]);
   flags = status[46];
+  nfail = status[47];
   uptime = tain_uptime(now, &when);
+  /* pending delay (msecs) in status from perp-2.05: */
+  delay = (len >= 74) ? upak32_unpack(&status[66]) : 0;
+  /* readiness in status from perp-2.05: */
+  ready = (len >= 92) ? status[29] : 0;
   vputs("  main: ");
   if(pid == 0){
       vputs("down ", nfmt_uint64(nbuf, uptime), " seconds");
       if(!(flags & SUBSV_FLAG_WANTDOWN)) vputs(", want up!");
+      if(flags & SUBSV_FLAG_DELAYED){
+          vputs(", respawn in ", nfmt_uint32(nbuf, (delay + 999) / 1000), " seconds");
+      }
+      if(flags & SUBSV_FLAG_QUARANTINE) vputs(", quarantined");
       if(flags & SUBSV_FLAG_ISONCE) vputs(", flagged once");
-  }else if((uptime < 1) && !(flags & SUBSV_FLAG_ISRESET)){
+  }else if((uptime < 1) && !(flags & SUBSV_FLAG_ISRESET) &&
+           !(ready & READY_FLAG_READY)){
       /* munge uptime < 1 second to want up: */
       vputs("down, want up!");
       if(flags & SUBSV_FLAG_ISONCE) vputs(", flagged once");
@@ -106,12 +154,48 @@ report(const char *name, const uchar_t *status, const tain_t *now)
       vputs((flags & SUBSV_FLAG_ISRESET) ? "resetting " : "up ");
       vputs(nfmt_uint64(nbuf, uptime), " seconds");
       vputs(" (pid ", nfmt_uint32(nbuf, (uint32_t)pid), ")");
+      if(!(flags & SUBSV_FLAG_ISRESET) && (ready & READY_FLAG_NOTIFY)){
+          if(ready & READY_FLAG_READY){
+              tain_unpack(&when, &status[74]);
+              vputs(", ready ", nfmt_uint64(nbuf, tain_uptime(now, &when)), " seconds");
+          }else{
+              vputs(", not ready");
+          }
+      }
       if(flags & SUBSV_FLAG_ISPAUSED) vputs(", paused");
       if(flags & SUBSV_FLAG_ISONCE) vputs(", flagged once");
   }
+  if(nfail > 0){
+      vputs(", ", nfmt_uint32(nbuf, nfail), " fast ", (nfail == 1) ? "failure" : "failures");
+  }
+  vputs("\n");
+  if(usage != NULL) put_usage(&usage[0]);
+
+  /* health check in status from perp-2.05: */
+  flags = (len >= 92) ? status[90] : 0;
+  if(flags & CHECK_FLAG_ENABLED){
+      vputs(" check: ");
+      if(!(flags & CHECK_FLAG_RESULT)){
+          vputs("no result");
+      }else{
+          if(flags & CHECK_FLAG_TIMEOUT){
+              vputs("timed out");
+          }else{
+              vputs((flags & CHECK_FLAG_FAILED) ? "failed" : "ok");
+          }
+          vputs(" (", nfmt_uint32(nbuf, upak32_unpack(&status[86])), " ms)");
+      }
+      nfail = status[91];
+      if(nfail > 0){
+          vputs(", ", nfmt_uint32(nbuf, nfail), " consecutive ",
+                (nfail == 1) ? "failure" : "failures");
+      }
+      if(flags & CHECK_FLAG_RUNNING) vputs(", running");
+      vputs("\n");
+  }
 
   /* log: */
-  vputs("\n   log: ");
+  vputs("   log: ");
   if(!haslog){
       vputs("(no log)\n");
       return;
@@ -121,10 +205,16 @@ report(const char *name, const uchar_t *status, const tain_t *now)
   pid = upak32_unpack(&status[48]);
   tain_unpack(&when, &status[52]);
   flags = status[64];
+  nfail = status[65];
   uptime = tain_uptime(now, &when);
+  delay = (len >= 74) ? upak32_unpack(&status[70]) : 0;
   if(pid == 0){
       vputs("down ", nfmt_uint64(nbuf, uptime), " seconds");
       if(!(flags & SUBSV_FLAG_WANTDOWN)) vputs(", want up!");
+      if(flags & SUBSV_FLAG_DELAYED){
+          vputs(", respawn in ", nfmt_uint32(nbuf, (delay + 999) / 1000), " seconds");
+      }
+      if(flags & SUBSV_FLAG_QUARANTINE) vputs(", quarantined");
       if(flags & SUBSV_FLAG_ISONCE) vputs(", flagged once");
   }else if((uptime < 1) && !(flags & SUBSV_FLAG_ISRESET)){
       /* munge uptime < 1 second to want up: */
@@ -137,7 +227,403 @@ report(const char *name, const uchar_t *status, const tain_t *now)
       if(flags & SUBSV_FLAG_ISPAUSED) vputs(", paused");
       if(flags & SUBSV_FLAG_ISONCE) vputs(", flagged once");
   }
+  if(nfail > 0){
+      vputs(", ", nfmt_uint32(nbuf, nfail), " fast ", (nfail == 1) ? "failure" : "failures");
+  }
   vputs("\n");
+  if(usage != NULL) put_usage(&usage[48]);
+
+  return;
+}
+
+
+/* put_usage()
+**   display resource usage ru of a subservice (48 bytes of 'U' record)
+*/
+static
+void
+put_usage(const uchar_t *ru)
+{
+  char  nbuf[NFMT_SIZE];
+
+  vputs("        usage: user ");
+  put_msecs(upak64_unpack(&ru[0]) / 1000);
+  vputs("s, system ");
+  put_msecs(upak64_unpack(&ru[8]) / 1000);
+  vputs("s, maxrss ", nfmt_uint64(nbuf, upak64_unpack(&ru[16])), " kB");
+  vputs(", majflt ", nfmt_uint64(nbuf, upak64_unpack(&ru[24])));
+  vputs(", nvcsw ", nfmt_uint64(nbuf, upak64_unpack(&ru[32])));
+  vputs(", nivcsw ", nfmt_uint64(nbuf, upak64_unpack(&ru[40])), "\n");
+
+  return;
+}
+
+
+/* query_list()
+**   query status of n services with one 'L' request
+**   devino[] holds n packed dev/ino, reply for each service in replyv[],
+**   and any 'U' record of resource usage following it in usagev[]
+**   return:
+**     0: success
+**    -1: failure, errno set (EPROTO if perpd without 'L' support)
+*/
+static
+int
+query_list(int fd_conn, ioq_t *in, const uchar_t *devino, size_t n,
+           pkt_t *replyv, pkt_t *usagev)
+{
+  pkt_t    pkt;
+  uchar_t *rec;
+  size_t   k;
+  ssize_t  r;
+
+  pkt_load(pkt, 2, 'L', (uchar_t *)devino, n * 16);
+  if(pkt_write(fd_conn, pkt, 0) == -1){
+      return -1;
+  }
+  for(k = 0; k < n; ++k){
+      usagev[k][1] = '\0';
+  }
+
+  /* n records (each 'R' with any 'U' following), then 'E' terminal: */
+  for(k = 0; k <= n; ){
+      rec = (k < n) ? replyv[k] : pkt;
+      r = pkt_ioqget(in, rec);
+      if(r <= 0){
+          if(r == 0) errno = EPROTO;
+          return -1;
+      }
+      if(rec[1] == 'U'){
+          if(k > 0){
+              buf_copy(usagev[k - 1], rec, PKT_HEADER + pkt_dlen(rec));
+          }
+          continue;
+      }
+      if((k < n) && (rec[1] == 'E')){
+          /* error in place of records: */
+          errno = (int)upak32_unpack(pkt_data(rec));
+          return -1;
+      }
+      ++k;
+  }
+
+  return 0;
+}
+
+
+/* query_one()
+**   query status of one service with 'Q' request, reply in pkt
+**   return:
+**     0: success
+**    -1: failure, errno set
+*/
+static
+int
+query_one(int fd_conn, const uchar_t *devino, pkt_t pkt)
+{
+  pkt_load(pkt, 2, 'Q', (uchar_t *)devino, 16);
+
+  if(pkt_write(fd_conn, pkt, 0) == -1){
+      return -1;
+  }
+  if(pkt_read(fd_conn, pkt, 0) == -1){
+      return -1;
+  }
+
+  return 0;
+}
+
+
+/* print_reply()
+**   display reply pkt for service name:
+**   'R' record (with any 'U' record in usage), 'S' status, or 'E' error
+*/
+static
+void
+print_reply(const char *name, pkt_t pkt, pkt_t usage, const tain_t *now)
+{
+  uchar_t  *data = pkt_data(pkt);
+  uchar_t  *ru = NULL;
+
+  if(pkt[0] != 2){
+      eputs("error: ", name, ": unknown packet protocol in reply");
+      return;
+  }
+
+  switch(pkt[1]){
+  case 'R':
+      if((pkt_dlen(pkt) < 17) || (pkt_dlen(pkt) < (size_t)(17 + data[16]))){
+          /* service not found by perpd: */
+          errno = ENOTDIR;
+          eputs_syserr("error: ", name, ": error reported in reply");
+          return;
+      }
+      /* resource usage in 'U' record from perp-2.05: */
+      if((usage != NULL) && (usage[1] == 'U') && (pkt_dlen(usage) >= 17 + 96) &&
+         (usage[PKT_HEADER + 16] >= 96)){
+          ru = &usage[PKT_HEADER + 17];
+      }
+      report(name, &data[17], data[16], ru, now);
+      break;
+  case 'S':
+      report(name, data, pkt_dlen(pkt), NULL, now);
+      break;
+  case 'E':
+      errno = (int)upak32_unpack(data);
+      eputs_syserr("error: ", name, ": error reported in reply");
+      break;
+  default:
+      eputs("error: ", name, ": unknown packet type in reply");
+  }
+
+  return;
+}
+
+
+/* query_metrics()
+**   query runtime metrics of n services with one 'M' request
+**   (of all services if n is 0), appending 'N' records to mv
+**   devino[] holds n packed dev/ino for the services named in namev[]
+**   return:
+**     0: success
+**    -1: failure, errno set (EPROTO if perpd without 'M' support)
+*/
+static
+int
+query_metrics(int fd_conn, ioq_t *in, const uchar_t *devino, size_t n,
+              const char **namev, struct metrics *mv)
+{
+  pkt_t    pkt;
+  uchar_t *rec;
+  size_t   k;
+  ssize_t  r;
+
+  pkt_load(pkt, 2, 'M', (uchar_t *)devino, n * 16);
+  if(pkt_write(fd_conn, pkt, 0) == -1){
+      return -1;
+  }
+
+  /* records, then 'E' terminal: */
+  for(;;){
+      if(mv->n == mv->slots){
+          size_t  slots = (mv->slots > 0) ? (mv->slots * 2) : 64;
+          pkt_t  *v = (pkt_t *)realloc(mv->v, slots * sizeof(pkt_t));
+          if(v == NULL){
+              errno = ENOMEM;
+              return -1;
+          }
+          mv->v = v;
+          mv->slots = slots;
+      }
+      rec = mv->v[mv->n];
+      r = pkt_ioqget(in, rec);
+      if(r <= 0){
+          if(r == 0) errno = EPROTO;
+          return -1;
+      }
+      if(rec[1] == 'E'){
+          errno = (int)upak32_unpack(pkt_data(rec));
+          return (errno == 0) ? 0 : -1;
+      }
+      if(rec[1] != 'N'){
+          errno = EPROTO;
+          return -1;
+      }
+      if((pkt_dlen(rec) < 18) ||
+         (pkt_dlen(rec) < (size_t)(18 + rec[PKT_HEADER + 17]))){
+          /* service not found by perpd: */
+          for(k = 0; k < n; ++k){
+              if(buf_cmp(&devino[k * 16], pkt_data(rec), 16) == 0){
+                  errno = ENOTDIR;
+                  eputs_syserr("error: ", namev[k], ": error reported in reply");
+                  break;
+              }
+          }
+          continue;
+      }
+      ++mv->n;
+  }
+
+  /* not reached: */
+  return 0;
+}
+
+
+/* put_labels()
+**   output labels of metrics record rec, with bucket le (or NULL)
+*/
+static
+void
+put_labels(pkt_t rec, const char *le)
+{
+  uchar_t  *data = pkt_data(rec);
+  size_t    i = 18 + data[17];
+  char      c[3] = {'\\', '\0', '\0'};
+
+  vputs("{service=\"");
+  for(; i < pkt_dlen(rec); ++i){
+      /* escape quote, backslash and newline: */
+      c[1] = (char)data[i];
+      if((c[1] == '"') || (c[1] == '\\')){
+          vputs(c);
+      }else if(c[1] == '\n'){
+          vputs("\\n");
+      }else{
+          vputs(&c[1]);
+      }
+  }
+  vputs("\",sub=\"", (data[16] == 0) ? "main" : "log", "\"");
+  if(le != NULL){
+      vputs(",le=\"", le, "\"");
+  }
+  vputs("}");
+
+  return;
+}
+
+
+/* put_msecs()
+**   output msecs in seconds, to 3 decimals
+*/
+static
+void
+put_msecs(uint64_t msecs)
+{
+  char  nbuf[NFMT_SIZE];
+
+  vputs(nfmt_uint64(nbuf, msecs / 1000), ".");
+  vputs(nfmt_uint32_pad0(nbuf, (uint32_t)(msecs % 1000), 3));
+
+  return;
+}
+
+
+/* put_hist()
+**   output histogram family of lifetime (or reset duration if is_reset)
+**   for all metrics records in mv
+**   bins are by decade of msecs, the first to 10 msecs, the last unbounded
+*/
+static
+void
+put_hist(struct metrics *mv, const char *family, int is_reset)
+{
+  uchar_t   *m;
+  size_t     k, nbins, i;
+  uint64_t   count;
+  char       le[NFMT_SIZE + 8];
+  char       nbuf[NFMT_SIZE];
+
+  vputs("# TYPE ", family, " histogram\n");
+  for(k = 0; k < mv->n; ++k){
+      m = &mv->v[k][PKT_HEADER + 18];
+      nbins = (mv->v[k][PKT_HEADER + 17] - 32) / 8;
+      count = 0;
+      for(i = 0; i < nbins; ++i){
+          count += upak32_unpack(&m[32 + ((is_reset ? nbins : 0) + i) * 4]);
+          /* le: 0.01, 0.1, 1, 10, ... +Inf: */
+          if(i == (nbins - 1)){
+              cstr_copy(le, "+Inf");
+          }else if(i < 2){
+              cstr_copy(le, (i == 0) ? "0.01" : "0.1");
+          }else{
+              cstr_copy(le, "1");
+              buf_fill(&le[1], i - 2, '0');
+              le[i - 1] = '\0';
+          }
+          vputs(family, "_bucket");
+          put_labels(mv->v[k], le);
+          vputs(" ", nfmt_uint64(nbuf, count), "\n");
+      }
+      vputs(family, "_sum");
+      put_labels(mv->v[k], NULL);
+      vputs(" ");
+      put_msecs(upak64_unpack(&m[is_reset ? 24 : 16]));
+      vputs("\n");
+      vputs(family, "_count");
+      put_labels(mv->v[k], NULL);
+      vputs(" ", nfmt_uint64(nbuf, count), "\n");
+  }
+
+  return;
+}
+
+
+/* print_metrics()
+**   output metrics records in mv, in Prometheus text format
+*/
+static
+void
+print_metrics(struct metrics *mv)
+{
+  static const char  *counters[] = {
+      "perp_starts_total",
+      "perp_exits_total",
+      "perp_exits_error_total",
+      "perp_exits_signal_total",
+  };
+  size_t   c, k;
+  char     nbuf[NFMT_SIZE];
+
+  for(c = 0; c < 4; ++c){
+      vputs("# TYPE ", counters[c], " counter\n");
+      for(k = 0; k < mv->n; ++k){
+          vputs(counters[c]);
+          put_labels(mv->v[k], NULL);
+          vputs(" ", nfmt_uint32(nbuf, upak32_unpack(&mv->v[k][PKT_HEADER + 18 + (c * 4)])), "\n");
+      }
+  }
+
+  put_hist(mv, "perp_lifetime_seconds", 0);
+  put_hist(mv, "perp_reset_seconds", 1);
+
+  return;
+}
+
+
+/* do_metrics()
+**   query and output runtime metrics for service directory arguments
+**   in argv (all active services if none)
+*/
+static
+void
+do_metrics(int fd_conn, ioq_t *in, char *argv[])
+{
+  struct metrics  mv = {NULL, 0, 0};
+
+  if(*argv == NULL){
+      if(query_metrics(fd_conn, in, NULL, 0, NULL, &mv) == -1){
+          fatal_syserr("failure during metrics query");
+      }
+  }
+
+  while(*argv != NULL){
+      const char  *namev[LISTREQ_MAX];
+      uchar_t      devino[LISTREQ_MAX * 16];
+      struct stat  st;
+      size_t       nreq = 0;
+
+      for(; (*argv != NULL) && (nreq < LISTREQ_MAX); ++argv){
+          if(stat(*argv, &st) == -1){
+              eputs(*argv, ": error: service directory not found");
+              continue;
+          }
+          if(! S_ISDIR(st.st_mode)){
+              eputs(*argv, ": error: not a directory");
+              continue;
+          }
+          upak_pack(&devino[nreq * 16], "LL", (uint64_t)st.st_dev, (uint64_t)st.st_ino);
+          namev[nreq++] = *argv;
+      }
+
+      if((nreq > 0) &&
+         (query_metrics(fd_conn, in, devino, nreq, namev, &mv) == -1)){
+          fatal_syserr("failure during metrics query");
+      }
+  }
+
+  print_metrics(&mv);
+  vputs_flush();
+  free(mv.v);
 
   return;
 }
@@ -146,13 +632,17 @@ report(const char *name, const uchar_t *status, const tain_t *now)
 int
 main(int argc, char *argv[])
 {
-  nextopt_t    nopt = nextopt_INIT(argc, argv, ":hVb:");
+  nextopt_t    nopt = nextopt_INIT(argc, argv, ":hVb:m");
   char         opt;
   const char  *basedir = NULL;
   char         pathbuf[256];
   tain_t       now;
   size_t       n;
   int          fd_conn;
+  uchar_t      ibuf[4096];
+  ioq_t        in;
+  int          use_list = 1;
+  int          opt_m = 0;
 
   progname = nextopt_progname(&nopt);
   while((opt = nextopt(&nopt))){
@@ -161,6 +651,7 @@ main(int argc, char *argv[])
       case 'h': usage(); die(0); break;
       case 'V': version(); die(0); break;
       case 'b': basedir = nopt.opt_arg; break;
+      case 'm': ++opt_m; break;
       case ':':
           fatal_usage("missing argument for option -", optc);
           break;
@@ -176,7 +667,7 @@ main(int argc, char *argv[])
   argc -= nopt.arg_ndx;
   argv += nopt.arg_ndx;
 
-  if(!*argv){
+  if(!*argv && !opt_m){
       fatal_usage("missing argument");
   }
 
@@ -206,56 +697,71 @@ main(int argc, char *argv[])
       }
   }
  
+  /* buffered input for reply streams: */
+  ioq_init(&in, fd_conn, ibuf, sizeof ibuf, &read);
+
+  /* runtime metrics: */
+  if(opt_m){
+      do_metrics(fd_conn, &in, argv);
+      die(0);
+  }
+
   /* uptimes compared to now: */
   tain_now(&now);
 
-  /* loop through service directory arguments and display report: */
-  for(; *argv != NULL; ++argv){
-      pkt_t        pkt = pkt_INIT(2, 'Q', 16);
+  /* loop through service directory arguments and display report:
+  **   active services are queried in batches with one 'L' request,
+  **   a batch ends at the next argument not an active service directory
+  */
+  while(*argv != NULL){
+      const char  *namev[LISTREQ_MAX];
+      uchar_t      devino[LISTREQ_MAX * 16];
+      pkt_t        replyv[LISTREQ_MAX];
+      pkt_t        usagev[LISTREQ_MAX];
       struct stat  st;
-
-      if(stat(*argv, &st) == -1){
-          eputs(*argv, ": error: service directory not found");
-          continue;
-      }
-
-      if(! S_ISDIR(st.st_mode)){
-          eputs(*argv, ": error: not a directory");
-          continue;
-      }
-
-      if(!(S_ISVTX & st.st_mode)){
-          vputs(*argv, ": not activated\n");
-          continue;
-      }
-
-      upak_pack(pkt_data(pkt), "LL", (uint64_t)st.st_dev, (uint64_t)st.st_ino);
-
-      if(pkt_write(fd_conn, pkt, 0) == -1){
-          eputs_syserr("error: ", *argv, ": error writing query");
-          continue;
+      const char  *errmsg = NULL;
+      int          is_info = 0;
+      size_t       nreq = 0, k;
+
+      for(; (*argv != NULL) && (nreq < LISTREQ_MAX); ++argv){
+          if(stat(*argv, &st) == -1){
+              errmsg = ": error: service directory not found";
+          }else if(! S_ISDIR(st.st_mode)){
+              errmsg = ": error: not a directory";
+          }else if(!(S_ISVTX & st.st_mode)){
+              errmsg = ": not activated\n";
+              is_info = 1;
+          }
+          if(errmsg != NULL) break;
+          upak_pack(&devino[nreq * 16], "LL", (uint64_t)st.st_dev, (uint64_t)st.st_ino);
+          namev[nreq++] = *argv;
       }
 
-      if(pkt_read(fd_conn, pkt, 0) == -1){
-          eputs_syserr("error: ", *argv, ": error reading response");
-          continue;
+      if(nreq > 0){
+          if(use_list && (query_list(fd_conn, &in, devino, nreq, replyv, usagev) == -1)){
+              if(errno != EPROTO){
+                  fatal_syserr("failure during status query");
+              }
+              /* perpd without 'L' support: */
+              use_list = 0;
+          }
+          for(k = 0; k < nreq; ++k){
+              if(!use_list && (query_one(fd_conn, &devino[k * 16], replyv[k]) == -1)){
+                  eputs_syserr("error: ", namev[k], ": error during query");
+                  continue;
+              }
+              print_reply(namev[k], replyv[k], use_list ? usagev[k] : NULL, &now);
+          }
       }
 
-      if(pkt[0] != 2){
-          eputs("error: ", *argv, ": unknown packet protocol in reply");
-          continue;
-      }
-      if(pkt[1] != 'S'){
-          if(pkt[1] == 'E'){
-              errno = (int)upak32_unpack(&pkt[3]);
-              eputs_syserr("error: ", *argv, ": error reported in reply");
-          } else {
-              eputs("error: ", *argv, ": unknown packet type in reply");
+      if(errmsg != NULL){
+          if(is_info){
+              vputs(*argv, errmsg);
+          }else{
+              eputs(*argv, errmsg);
           }
-          continue;
+          ++argv;
       }
-
-      report(*argv, pkt_data(pkt), &now);
   }
 
   vputs_flush();